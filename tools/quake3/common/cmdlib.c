@@ -34,9 +34,12 @@
 #include "inout.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #if GDEF_OS_WINDOWS
 #include <direct.h>
+#include <io.h>
+#include <process.h>
 #include <windows.h>
 #elif GDEF_OS_NEXT
 #include <libc.h>
@@ -44,6 +47,11 @@
 #include <unistd.h>
 #endif // OTHER OS
 
+#if GDEF_OS_POSIX
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
 #define BASEDIRNAME "quake" // assumed to have a 2 or 3 following
 #define PATHSEPERATOR '/'
 
@@ -307,6 +315,74 @@ double I_FloatTime( void ){
 #endif
 }
 
+/*
+   ================
+   Q_PeakMemory
+   returns the most memory the process has had resident since Q_ResetPeakMemory, or so far if
+   that can not be done, in bytes, 0 if unknown
+   ================
+ */
+size_t Q_PeakMemory( void ){
+#if GDEF_OS_POSIX
+	struct rusage usage;
+#if GDEF_OS_LINUX
+	FILE *f;
+	char line[ 256 ];
+	size_t peak = 0;
+
+	f = fopen( "/proc/self/status", "r" );
+	if ( f != NULL ) {
+		while ( fgets( line, sizeof( line ), f ) != NULL )
+		{
+			if ( !strncmp( line, "VmHWM:", 6 ) ) {
+				peak = (size_t) atol( line + 6 ) * 1024;
+				break;
+			}
+		}
+		fclose( f );
+		if ( peak > 0 ) {
+			return peak;
+		}
+	}
+#endif
+
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 ) {
+		return 0;
+	}
+#if GDEF_OS_MACOS
+	return usage.ru_maxrss;
+#else
+	return (size_t) usage.ru_maxrss * 1024;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/*
+   ================
+   Q_ResetPeakMemory
+   starts Q_PeakMemory over from the memory the process has resident now, qfalse if it can not
+   ================
+ */
+qboolean Q_ResetPeakMemory( void ){
+#if GDEF_OS_LINUX
+	FILE *f;
+
+	f = fopen( "/proc/self/clear_refs", "w" );
+	if ( f == NULL ) {
+		return qfalse;
+	}
+	if ( fputs( "5", f ) < 0 ) {
+		fclose( f );
+		return qfalse;
+	}
+	return fclose( f ) == 0;
+#else
+	return qfalse;
+#endif
+}
+
 void Q_getwd( char *out ){
 	int i = 0;
 
@@ -930,6 +1006,18 @@ float   BigFloat( float l ){
 	return l;
 }
 
+
+uint64_t LittleLong64( uint64_t l ){
+	int i;
+	uint64_t out;
+
+	out = 0;
+	for ( i = 0; i < 8; i++ )
+		out |= ( ( l >> ( i * 8 ) ) & 255 ) << ( ( 7 - i ) * 8 );
+
+	return out;
+}
+
 #else // !GDEF_ARCH_ENDIAN_BIG
 
 short   BigShort( short l ){
@@ -977,6 +1065,11 @@ float   LittleFloat( float l ){
 	return l;
 }
 
+
+uint64_t LittleLong64( uint64_t l ){
+	return l;
+}
+
 #endif // !GDEF_ARCH_ENDIAN_BIG
 
 
@@ -1106,3 +1199,123 @@ void Sys_Sleep( int n ){
 	usleep( n * 1000 );
 #endif // !GDEF_OS_WINDOWS
 }
+
+
+intptr_t Sys_StartProcess( char **argv, const char *logFile ){
+#if GDEF_OS_WINDOWS
+	static HANDLE job;
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+	intptr_t process;
+	int log, out, err;
+
+	/* the child inherits the output handles, so point ours at the log while starting it */
+	log = _open( logFile, _O_WRONLY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE );
+	if ( log < 0 ) {
+		return 0;
+	}
+	fflush( stdout );
+	fflush( stderr );
+	out = _dup( 1 );
+	err = _dup( 2 );
+	_dup2( log, 1 );
+	_dup2( log, 2 );
+	process = _spawnvp( _P_NOWAIT, argv[ 0 ], (const char * const *) argv );
+	_dup2( out, 1 );
+	_dup2( err, 2 );
+	_close( out );
+	_close( err );
+	_close( log );
+	if ( process == -1 ) {
+		return 0;
+	}
+
+	/* have it killed if this process is */
+	if ( job == NULL ) {
+		job = CreateJobObject( NULL, NULL );
+		memset( &limits, 0, sizeof( limits ) );
+		limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+		SetInformationJobObject( job, JobObjectExtendedLimitInformation, &limits, sizeof( limits ) );
+	}
+	if ( job != NULL ) {
+		AssignProcessToJobObject( job, (HANDLE) process );
+	}
+	return process;
+#else // !GDEF_OS_WINDOWS
+	pid_t pid;
+	int log;
+
+	fflush( stdout );
+	fflush( stderr );
+	pid = fork();
+	if ( pid < 0 ) {
+		return 0;
+	}
+	if ( pid == 0 ) {
+		log = open( logFile, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+		if ( log >= 0 ) {
+			dup2( log, 1 );
+			dup2( log, 2 );
+			close( log );
+		}
+		execvp( argv[ 0 ], argv );
+		_exit( 127 );
+	}
+	return pid;
+#endif // !GDEF_OS_WINDOWS
+}
+
+int Sys_CheckProcess( intptr_t process, qboolean wait ){
+#if GDEF_OS_WINDOWS
+	DWORD code;
+
+	if ( WaitForSingleObject( (HANDLE) process, wait ? INFINITE : 0 ) == WAIT_TIMEOUT ) {
+		return -1;
+	}
+	if ( !GetExitCodeProcess( (HANDLE) process, &code ) ) {
+		code = 1;
+	}
+	CloseHandle( (HANDLE) process );
+	return code;
+#else // !GDEF_OS_WINDOWS
+	int status;
+	pid_t pid;
+
+	do
+		pid = waitpid( (pid_t) process, &status, wait ? 0 : WNOHANG );
+	while ( pid < 0 && errno == EINTR );
+	if ( pid == 0 ) {
+		return -1;
+	}
+	if ( pid < 0 || !WIFEXITED( status ) ) {
+		return 1;
+	}
+	return WEXITSTATUS( status );
+#endif // !GDEF_OS_WINDOWS
+}
+
+int Sys_ParentProcess( void ){
+#if GDEF_OS_WINDOWS
+	return 0;
+#else // !GDEF_OS_WINDOWS
+	return getppid();
+#endif // !GDEF_OS_WINDOWS
+}
+
+qboolean Q_CreateExclusive( const char *path ){
+	int f;
+
+#if GDEF_OS_WINDOWS
+	f = _open( path, _O_WRONLY | _O_CREAT | _O_EXCL, _S_IREAD | _S_IWRITE );
+	if ( f < 0 ) {
+		return qfalse;
+	}
+	_close( f );
+#else // !GDEF_OS_WINDOWS
+	f = open( path, O_WRONLY | O_CREAT | O_EXCL, 0666 );
+	if ( f < 0 ) {
+		return qfalse;
+	}
+	close( f );
+#endif // !GDEF_OS_WINDOWS
+	return qtrue;
+}
@@ -46,6 +46,7 @@
 #include <ctype.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #if GDEF_COMPILER_MSVC
 
@@ -94,6 +95,8 @@ void ExpandWildcards( int *argc, char ***argv );
 
 
 double I_FloatTime( void );
+size_t Q_PeakMemory( void );
+qboolean Q_ResetPeakMemory( void );
 
 void    Error( const char *error, ... ) GDEF_ATTRIBUTE_NORETURN;
 int     CheckParm( const char *check );
@@ -126,6 +129,7 @@ int     BigLong( int l );
 int     LittleLong( int l );
 float   BigFloat( float l );
 float   LittleFloat( float l );
+uint64_t LittleLong64( uint64_t l );
 
 
 char *COM_Parse( char *data );
@@ -149,6 +153,19 @@ extern char archivedir[1024];
 // sleep for the given amount of milliseconds
 void Sys_Sleep( int n );
 
+// start a program in the background with its output going to logFile, 0 if it could not be started
+intptr_t Sys_StartProcess( char **argv, const char *logFile );
+
+// the exit code of a program started by Sys_StartProcess once it ended, -1 while it runs (unless wait is set)
+int Sys_CheckProcess( intptr_t process, qboolean wait );
+
+// the process that started this one, 0 if that is not known (on windows, where the children of
+// Sys_StartProcess are killed with it instead)
+int Sys_ParentProcess( void );
+
+// create a file only if it does not exist yet, qfalse if it did
+qboolean Q_CreateExclusive( const char *path );
+
 // for compression routines
 typedef struct
 {
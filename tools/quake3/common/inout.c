@@ -29,6 +29,7 @@
 #include "globaldefs.h"
 #include "cmdlib.h"
 #include "mathlib.h"
+#include "mempool.h"
 #include "polylib.h"
 #include "inout.h"
 #include <sys/types.h>
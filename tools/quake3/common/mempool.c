@@ -0,0 +1,247 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "cmdlib.h"
+#include "inout.h"
+#include "qthreads.h"
+#include "mempool.h"
+
+
+
+/*
+   size classes run in 16 byte steps up to 512 bytes and in 128 byte steps up to 4k,
+   chunks are never returned to the system, their blocks are reused instead
+ */
+
+#define MEM_SMALL_STEP      16
+#define MEM_SMALL_LIMIT     512
+#define MEM_LARGE_STEP      128
+#define MEM_LARGE_LIMIT     4096
+#define MEM_NUM_CLASSES     ( MEM_SMALL_LIMIT / MEM_SMALL_STEP + ( MEM_LARGE_LIMIT - MEM_SMALL_LIMIT ) / MEM_LARGE_STEP )
+#define MEM_CLASS_MALLOC    -1
+#define MEM_HEADER_SIZE     16                  /* keeps payloads 16 byte aligned */
+#define MEM_CHUNK_SIZE      ( 256 * 1024 )
+#define MAX_MEM_CACHES      1024
+
+/* the header in front of every block, the payload is left alone while the block is free */
+typedef struct memBlock_s
+{
+	struct memBlock_s   *next;
+	int size;                                   /* block payload bytes */
+	int sizeClass;
+}
+memBlock_t;
+
+/* one per worker thread number */
+typedef struct memCache_s
+{
+	memBlock_t          *free[ MEM_NUM_CLASSES ];
+	byte                *chunk;
+	size_t chunkLeft;
+}
+memCache_t;
+
+static memCache_t *memCaches[ MAX_MEM_CACHES ];
+static int numMemChunks;
+
+
+
+/*
+   MemSizeClass()
+   returns the size class for a small allocation
+ */
+
+static int MemSizeClass( size_t size ){
+	if ( size <= MEM_SMALL_LIMIT ) {
+		return ( size + MEM_SMALL_STEP - 1 ) / MEM_SMALL_STEP - 1;
+	}
+	return MEM_SMALL_LIMIT / MEM_SMALL_STEP + ( size - MEM_SMALL_LIMIT + MEM_LARGE_STEP - 1 ) / MEM_LARGE_STEP - 1;
+}
+
+
+
+/*
+   MemClassSize()
+   returns the payload size of the blocks in a size class
+ */
+
+static size_t MemClassSize( int sizeClass ){
+	if ( sizeClass < MEM_SMALL_LIMIT / MEM_SMALL_STEP ) {
+		return ( sizeClass + 1 ) * MEM_SMALL_STEP;
+	}
+	return MEM_SMALL_LIMIT + ( sizeClass + 1 - MEM_SMALL_LIMIT / MEM_SMALL_STEP ) * MEM_LARGE_STEP;
+}
+
+
+
+/*
+   MemCache()
+   returns the block cache of the calling thread; worker threads are numbered,
+   so a cache outlives its thread and is picked up again by the next worker
+   with the same number (the main thread shares the first one while it waits)
+ */
+
+static memCache_t *MemCache( void ){
+	int threadNum = ThreadNum();
+
+
+	if ( threadNum >= MAX_MEM_CACHES ) {
+		Error( "MAX_MEM_CACHES (%d) exceeded", MAX_MEM_CACHES );
+	}
+	if ( memCaches[ threadNum ] == NULL ) {
+		memCaches[ threadNum ] = safe_malloc0( sizeof( memCache_t ) );
+	}
+	return memCaches[ threadNum ];
+}
+
+
+
+/*
+   MemPoolCount()
+   updates the pool counters without locking
+ */
+
+static void MemPoolCount( memPool_t *pool, int count, int bytes ){
+	int active, peak;
+	size_t liveBytes, peakBytes;
+
+
+	if ( count < 0 ) {
+		__atomic_sub_fetch( &pool->active, 1, __ATOMIC_RELAXED );
+		__atomic_sub_fetch( &pool->bytes, (size_t) bytes, __ATOMIC_RELAXED );
+		return;
+	}
+
+	__atomic_add_fetch( &pool->allocs, 1, __ATOMIC_RELAXED );
+	active = __atomic_add_fetch( &pool->active, 1, __ATOMIC_RELAXED );
+	liveBytes = __atomic_add_fetch( &pool->bytes, (size_t) bytes, __ATOMIC_RELAXED );
+
+	/* raise the peaks unless another thread got there first */
+	peak = __atomic_load_n( &pool->peak, __ATOMIC_RELAXED );
+	while ( active > peak && !__atomic_compare_exchange_n( &pool->peak, &peak, active, qtrue, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+		;
+	peakBytes = __atomic_load_n( &pool->peakBytes, __ATOMIC_RELAXED );
+	while ( liveBytes > peakBytes && !__atomic_compare_exchange_n( &pool->peakBytes, &peakBytes, liveBytes, qtrue, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+		;
+}
+
+
+
+/*
+   MemPoolAlloc()
+   allocates a zeroed object from a pool
+ */
+
+void *MemPoolAlloc( memPool_t *pool, size_t size ){
+	int sizeClass;
+	size_t blockSize;
+	memCache_t      *cache;
+	memBlock_t      *block;
+
+
+	/* big objects are left to malloc */
+	if ( size > MEM_LARGE_LIMIT ) {
+		block = safe_malloc( MEM_HEADER_SIZE + size );
+		block->sizeClass = MEM_CLASS_MALLOC;
+		blockSize = size;
+	}
+	else
+	{
+		/* reuse a freed block */
+		cache = MemCache();
+		sizeClass = MemSizeClass( size > 0 ? size : 1 );
+		blockSize = MemClassSize( sizeClass );
+		block = cache->free[ sizeClass ];
+		if ( block != NULL ) {
+			cache->free[ sizeClass ] = block->next;
+		}
+
+		/* or carve a new one */
+		else
+		{
+			if ( cache->chunkLeft < MEM_HEADER_SIZE + blockSize ) {
+				cache->chunk = safe_malloc( MEM_CHUNK_SIZE );
+				cache->chunkLeft = MEM_CHUNK_SIZE;
+				__atomic_add_fetch( &numMemChunks, 1, __ATOMIC_RELAXED );
+			}
+			block = (memBlock_t*) cache->chunk;
+			block->sizeClass = sizeClass;
+			cache->chunk += MEM_HEADER_SIZE + blockSize;
+			cache->chunkLeft -= MEM_HEADER_SIZE + blockSize;
+		}
+	}
+
+	/* set it up */
+	block->next = NULL;
+	block->size = blockSize;
+	MemPoolCount( pool, 1, blockSize );
+	memset( (byte*) block + MEM_HEADER_SIZE, 0, size );
+	return (byte*) block + MEM_HEADER_SIZE;
+}
+
+
+
+/*
+   MemPoolFree()
+   returns an object to the calling thread's free list of its size class
+ */
+
+void MemPoolFree( memPool_t *pool, void *ptr ){
+	memCache_t      *cache;
+	memBlock_t      *block;
+
+
+	block = (memBlock_t*) ( (byte*) ptr - MEM_HEADER_SIZE );
+	MemPoolCount( pool, -1, block->size );
+
+	if ( block->sizeClass == MEM_CLASS_MALLOC ) {
+		free( block );
+		return;
+	}
+
+	cache = MemCache();
+	block->next = cache->free[ block->sizeClass ];
+	cache->free[ block->sizeClass ] = block;
+}
+
+
+
+/*
+   MemPoolPrintStats()
+   prints the counters of a pool
+ */
+
+void MemPoolPrintStats( const memPool_t *pool ){
+	Sys_Printf( "%9d %-12s live, %9d peak, %10d allocated, %8.2f MB peak\n",
+				pool->active, pool->name, pool->peak, pool->allocs, pool->peakBytes / ( 1024.0 * 1024.0 ) );
+}
+
+
+
+/*
+   MemPoolPrintTotals()
+   prints the memory held by all pools
+ */
+
+void MemPoolPrintTotals( void ){
+	Sys_Printf( "%9d pool chunks, %8.2f MB\n", numMemChunks, (double) numMemChunks * MEM_CHUNK_SIZE / ( 1024.0 * 1024.0 ) );
+}
@@ -0,0 +1,45 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+/*
+   object pools
+
+   small objects are carved out of per-thread chunks in size classes and go
+   back onto the freeing thread's free lists, so allocating and freeing never
+   takes a lock; larger objects fall back to malloc. the counters of each pool
+   are kept with atomic operations so they are valid with any number of threads
+ */
+
+typedef struct memPool_s
+{
+	const char      *name;
+	int allocs, active, peak;                           /* objects */
+	size_t bytes, peakBytes;                            /* live bytes, including size class rounding */
+}
+memPool_t;
+
+#define MEM_POOL( name )    { name, 0, 0, 0, 0, 0 }
+
+void    *MemPoolAlloc( memPool_t *pool, size_t size );
+void    MemPoolFree( memPool_t *pool, void *ptr );
+void    MemPoolPrintStats( const memPool_t *pool );
+void    MemPoolPrintTotals( void );
@@ -22,18 +22,14 @@
 #include "cmdlib.h"
 #include "mathlib.h"
 #include "inout.h"
+#include "mempool.h"
 #include "polylib.h"
 #include "qfiles.h"
 
 
 extern int numthreads;
 
-// counters are only bumped when running single threaded,
-// because they are an awefull coherence problem
-int c_active_windings;
-int c_peak_windings;
-int c_winding_allocs;
-int c_winding_points;
+memPool_t windingPool = MEM_POOL( "windings" );
 
 #define BOGUS_RANGE WORLD_SIZE
 
@@ -57,16 +53,8 @@ winding_t   *AllocWinding( int points ){
 		Error( "AllocWinding failed: MAX_POINTS_ON_WINDING exceeded" );
 	}
 
-	if ( numthreads == 1 ) {
-		c_winding_allocs++;
-		c_winding_points += points;
-		c_active_windings++;
-		if ( c_active_windings > c_peak_windings ) {
-			c_peak_windings = c_active_windings;
-		}
-	}
 	s = sizeof( *w ) + ( points ? sizeof( w->p[0] ) * ( points - 1 ) : 0 );
-	w = safe_malloc0( s );
+	w = MemPoolAlloc( &windingPool, s );
 	return w;
 }
 
@@ -83,17 +71,8 @@ winding_accu_t *AllocWindingAccu( int points ){
 		Error( "AllocWindingAccu failed: MAX_POINTS_ON_WINDING exceeded" );
 	}
 
-	if ( numthreads == 1 ) {
-		// At the time of this writing, these statistics were not used in any way.
-		c_winding_allocs++;
-		c_winding_points += points;
-		c_active_windings++;
-		if ( c_active_windings > c_peak_windings ) {
-			c_peak_windings = c_active_windings;
-		}
-	}
 	s = sizeof( *w ) + ( points ? sizeof( w->p[0] ) * ( points - 1 ) : 0 );
-	w = safe_malloc0( s );
+	w = MemPoolAlloc( &windingPool, s );
 	return w;
 }
 
@@ -112,10 +91,7 @@ void FreeWinding( winding_t *w ){
 	}
 	*(unsigned *)w = 0xdeaddead;
 
-	if ( numthreads == 1 ) {
-		c_active_windings--;
-	}
-	free( w );
+	MemPoolFree( &windingPool, w );
 }
 
 /*
@@ -133,10 +109,7 @@ void FreeWindingAccu( winding_accu_t *w ){
 	}
 	*( (unsigned *) w ) = 0xdeaddead;
 
-	if ( numthreads == 1 ) {
-		c_active_windings--;
-	}
-	free( w );
+	MemPoolFree( &windingPool, w );
 }
 
 /*
@@ -543,7 +516,7 @@ void    ClipWindingEpsilonStrict( winding_t *in, vec3_t normal, vec_t dist,
 	vec_t dists[MAX_POINTS_ON_WINDING + 4];
 	int sides[MAX_POINTS_ON_WINDING + 4];
 	int counts[3];
-	static vec_t dot;           // VC 4.2 optimizer bug if not static
+	vec_t dot;
 	int i, j;
 	vec_t   *p1, *p2;
 	vec3_t mid;
@@ -820,7 +793,7 @@ void ChopWindingInPlace( winding_t **inout, vec3_t normal, vec_t dist, vec_t eps
 	vec_t dists[MAX_POINTS_ON_WINDING + 4];
 	int sides[MAX_POINTS_ON_WINDING + 4];
 	int counts[3];
-	static vec_t dot;           // VC 4.2 optimizer bug if not static
+	vec_t dot;
 	int i, j;
 	vec_t   *p1, *p2;
 	vec3_t mid;
@@ -33,6 +33,8 @@ typedef struct
 #define ON_EPSILON  0.1
 #endif
 
+extern memPool_t windingPool;
+
 winding_t   *AllocWinding( int points );
 vec_t   WindingArea( winding_t *w );
 void    WindingCenter( winding_t *w, vec3_t center );
@@ -23,7 +23,8 @@
 extern int numthreads;
 
 void ThreadSetDefault( void );
-int GetThreadWork( void );
+int GetThreadWork( int threadnum );
+int ThreadNum( void );
 void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) );
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) );
 void ThreadLock( void );
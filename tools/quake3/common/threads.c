@@ -33,8 +33,6 @@
 #include "inout.h"
 #include "qthreads.h"
 
-#define MAX_THREADS 64
-
 int dispatch;
 int workcount;
 int oldf;
@@ -43,57 +41,256 @@ qboolean pacifier;
 qboolean threaded;
 
 /*
-   =============
-   GetThreadWork
+   work distribution
+
+   every worker thread owns a range of work items, packed as ( end << 32 ) | next
+   so that both the owner and other threads can update it with a single
+   compare-and-swap; the owner takes items from the front, an idle thread
+   steals the back half of the next non-empty range, and new ranges are
+   carved off the global dispatch cursor in chunks that shrink as the
+   remaining work shrinks (guided scheduling)
+ */
 
-   =============
+#define THREAD_CHUNK_DIVISOR    4
+#define THREAD_RANGE( next, end )   ( ( (uint64_t) (uint32_t) ( end ) << 32 ) | (uint32_t) ( next ) )
+#define THREAD_RANGE_NEXT( range )  ( (int) (uint32_t) ( range ) )
+#define THREAD_RANGE_END( range )   ( (int) (uint32_t) ( ( range ) >> 32 ) )
+
+typedef struct threadWork_s
+{
+	uint64_t range;
+	char pad[ 64 - sizeof( uint64_t ) ];    /* keep each range on its own cache line */
+}
+threadWork_t;
+
+static threadWork_t *threadWork;
+static int numThreadWork;
+static int workdispatched;
+static char pacifierBusy;
+static __thread int threadNum;            /* worker number of the calling thread */
+
+
+
+/*
+   ThreadProgress()
+   returns the pacifier position (0 - 39) of the last item handed out
  */
-int GetThreadWork( void ){
-	int r;
-	int f;
 
-	ThreadLock();
+static int ThreadProgress( void ){
+	int dispatched = __atomic_load_n( &workdispatched, __ATOMIC_RELAXED );
 
-	if ( dispatch == workcount ) {
-		ThreadUnlock();
+	if ( dispatched < 1 ) {
 		return -1;
 	}
+	return 40 * ( dispatched - 1 ) / workcount;
+}
+
+
+
+/*
+   ThreadPacifier()
+   prints the progress dots; threads that find the printer busy simply move on
+   unless they are told to wait, so the pacifier never serializes the workers
+ */
+
+static void ThreadPacifier( qboolean wait ){
+	int f, printed;
 
-	f = 40 * dispatch / workcount;
-	if ( f < oldf ) {
-		Sys_FPrintf( SYS_WRN, "WARNING: progress went backwards (should never happen)\n" );
-		oldf = f;
+	if ( !pacifier || workcount <= 0 ) {
+		return;
+	}
+
+	f = ThreadProgress();
+	if ( f <= __atomic_load_n( &oldf, __ATOMIC_RELAXED ) ) {
+		return;
 	}
-	while ( f > oldf )
+
+	while ( __atomic_test_and_set( &pacifierBusy, __ATOMIC_ACQUIRE ) )
 	{
-		++oldf;
-		if ( pacifier ) {
-			if ( oldf % 4 == 0 ) {
-				Sys_Printf( "%i", f / 4 );
+		if ( !wait ) {
+			return;
+		}
+	}
+
+	/* only the printer writes oldf, but the pre-check above reads it unlocked */
+	f = ThreadProgress();
+	printed = __atomic_load_n( &oldf, __ATOMIC_RELAXED );
+	while ( f > printed )
+	{
+		++printed;
+		if ( printed % 4 == 0 ) {
+			Sys_Printf( "%i", printed / 4 );
+		}
+		else{
+			Sys_Printf( "." );
+		}
+		fflush( stdout );   /* ydnar */
+		__atomic_store_n( &oldf, printed, __ATOMIC_RELAXED );
+	}
+
+	__atomic_clear( &pacifierBusy, __ATOMIC_RELEASE );
+}
+
+
+
+/*
+   ThreadSetupWork()
+   resets the per-thread work ranges before a new batch of work is dispatched
+ */
+
+static void ThreadSetupWork( void ){
+	if ( numThreadWork < numthreads ) {
+		free( threadWork );
+		numThreadWork = numthreads;
+		threadWork = safe_malloc( numThreadWork * sizeof( *threadWork ) );
+	}
+	memset( threadWork, 0, numThreadWork * sizeof( *threadWork ) );
+	workdispatched = 0;
+	pacifierBusy = 0;
+}
+
+
+
+/*
+   ThreadTakeWork()
+   tries to take the front item of a thread's own range
+ */
+
+static int ThreadTakeWork( threadWork_t *tw ){
+	uint64_t range;
+	int next, end;
+
+	range = __atomic_load_n( &tw->range, __ATOMIC_ACQUIRE );
+	for ( ;; )
+	{
+		next = THREAD_RANGE_NEXT( range );
+		end = THREAD_RANGE_END( range );
+		if ( next >= end ) {
+			return -1;
+		}
+		if ( __atomic_compare_exchange_n( &tw->range, &range, THREAD_RANGE( next + 1, end ), qfalse, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+			return next;
+		}
+	}
+}
+
+
+
+/*
+   ThreadClaimWork()
+   carves a new chunk off the global dispatch cursor
+ */
+
+static int ThreadClaimWork( threadWork_t *tw ){
+	int first, size;
+
+	first = __atomic_load_n( &dispatch, __ATOMIC_RELAXED );
+	for ( ;; )
+	{
+		if ( first >= workcount ) {
+			return -1;
+		}
+		size = ( workcount - first ) / ( numthreads * THREAD_CHUNK_DIVISOR );
+		if ( size < 1 ) {
+			size = 1;
+		}
+		if ( __atomic_compare_exchange_n( &dispatch, &first, first + size, qfalse, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+			break;
+		}
+	}
+
+	/* the first item is handed out right away, the rest is left for the owner (or thieves) */
+	__atomic_store_n( &tw->range, THREAD_RANGE( first + 1, first + size ), __ATOMIC_RELEASE );
+	return first;
+}
+
+
+
+/*
+   ThreadStealWork()
+   takes the back half of another thread's range
+ */
+
+static int ThreadStealWork( int threadnum ){
+	int i, victim, next, end, split;
+	uint64_t range;
+	threadWork_t *tw;
+
+	for ( i = 1; i < numthreads; i++ )
+	{
+		victim = ( threadnum + i ) % numthreads;
+		tw = &threadWork[ victim ];
+		range = __atomic_load_n( &tw->range, __ATOMIC_ACQUIRE );
+		for ( ;; )
+		{
+			next = THREAD_RANGE_NEXT( range );
+			end = THREAD_RANGE_END( range );
+			if ( next >= end ) {
+				break;
 			}
-			else{
-				Sys_Printf( "." );
+			split = end - ( end - next + 1 ) / 2;
+			if ( __atomic_compare_exchange_n( &tw->range, &range, THREAD_RANGE( next, split ), qfalse, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+				__atomic_store_n( &threadWork[ threadnum ].range, THREAD_RANGE( split + 1, end ), __ATOMIC_RELEASE );
+				return split;
 			}
-			fflush( stdout );   /* ydnar */
 		}
 	}
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock();
+	return -1;
+}
+
+
+
+/*
+   =============
+   GetThreadWork
+
+   =============
+ */
+int GetThreadWork( int threadnum ){
+	int r;
+	threadWork_t *tw = &threadWork[ threadnum ];
+
+	r = ThreadTakeWork( tw );
+	if ( r == -1 ) {
+		r = ThreadClaimWork( tw );
+	}
+	if ( r == -1 ) {
+		r = ThreadStealWork( threadnum );
+	}
+
+	if ( r == -1 ) {
+		/* make sure the last dots get printed before the threads are joined */
+		ThreadPacifier( qtrue );
+		return -1;
+	}
+
+	__atomic_add_fetch( &workdispatched, 1, __ATOMIC_RELAXED );
+	ThreadPacifier( qfalse );
 
 	return r;
 }
 
 
+/*
+   ThreadNum()
+   returns the worker number of the calling thread, 0 for the main thread
+ */
+
+int ThreadNum( void ){
+	return threadNum;
+}
+
+
 void ( *workfunction )( int );
 
 void ThreadWorkerFunction( int threadnum ){
 	int work;
 
+	threadNum = threadnum;
 	while ( 1 )
 	{
-		work = GetThreadWork();
+		work = GetThreadWork( threadnum );
 		if ( work == -1 ) {
 			break;
 		}
@@ -107,6 +304,7 @@ void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )(
 		ThreadSetDefault();
 	}
 	workfunction = func;
+	ThreadSetupWork();
 	RunThreadsOn( workcnt, showpacifier, ThreadWorkerFunction );
 }
 
@@ -133,7 +331,7 @@ void ThreadSetDefault( void ){
 	if ( numthreads == -1 ) { // not set manually
 		GetSystemInfo( &info );
 		numthreads = info.dwNumberOfProcessors;
-		if ( numthreads < 1 || numthreads > 32 ) {
+		if ( numthreads < 1 ) {
 			numthreads = 1;
 		}
 	}
@@ -170,8 +368,8 @@ void ThreadUnlock( void ){
    =============
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
-	int threadid[MAX_THREADS];
-	HANDLE threadhandle[MAX_THREADS];
+	int *threadid;
+	HANDLE *threadhandle;
 	int i;
 	int start, end;
 
@@ -192,6 +390,9 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	}
 	else
 	{
+		threadid = safe_malloc( numthreads * sizeof( *threadid ) );
+		threadhandle = safe_malloc( numthreads * sizeof( *threadhandle ) );
+
 		for ( i = 0 ; i < numthreads ; i++ )
 		{
 			threadhandle[i] = CreateThread(
@@ -209,6 +410,9 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
 		for ( i = 0 ; i < numthreads ; i++ )
 			WaitForSingleObject( threadhandle[i], INFINITE );
+
+		free( threadhandle );
+		free( threadid );
 	}
 	DeleteCriticalSection( &crit );
 
@@ -262,7 +466,7 @@ void ThreadUnlock( void ){
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	int i;
-	pthread_t work_threads[MAX_THREADS];
+	pthread_t *work_threads;
 	pthread_addr_t status;
 	pthread_attr_t attrib;
 	pthread_mutexattr_t mattrib;
@@ -299,6 +503,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		Error( "pthread_attr_setstacksize failed" );
 	}
 
+	work_threads = safe_malloc( numthreads * sizeof( *work_threads ) );
+
 	for ( i = 0 ; i < numthreads ; i++ )
 	{
 		if ( pthread_create( &work_threads[i], attrib
@@ -314,6 +520,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		}
 	}
 
+	free( work_threads );
 	threaded = qfalse;
 
 	end = I_FloatTime();
@@ -368,7 +575,7 @@ void ThreadUnlock( void ){
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	int i;
-	int pid[MAX_THREADS];
+	int *pid;
 	int start, end;
 
 	start = I_FloatTime();
@@ -384,6 +591,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
 	init_lock( &lck );
 
+	pid = safe_malloc( numthreads * sizeof( *pid ) );
+
 	for ( i = 0 ; i < numthreads - 1 ; i++ )
 	{
 		pid[i] = sprocsp( ( void ( * )( void *, size_t ) )func, PR_SALL, (void *)i
@@ -399,6 +608,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	for ( i = 0 ; i < numthreads - 1 ; i++ )
 		wait( NULL );
 
+	free( pid );
+
 	threaded = qfalse;
 
 	end = I_FloatTime();
@@ -525,7 +736,7 @@ void recursive_mutex_init( pthread_mutexattr_t attribs ){
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	pthread_mutexattr_t mattrib;
 	pthread_attr_t attr;
-	pthread_t work_threads[MAX_THREADS];
+	pthread_t *work_threads;
 	size_t stacksize;
 
 	int start, end;
@@ -564,6 +775,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		}
 		recursive_mutex_init( mattrib );
 
+		work_threads = safe_malloc( numthreads * sizeof( *work_threads ) );
+
 		for ( i = 0 ; i < numthreads ; i++ )
 		{
 			/* Default pthread attributes: joinable & non-realtime scheduling */
@@ -577,6 +790,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 				Error( "pthread_join failed" );
 			}
 		}
+		free( work_threads );
 		pthread_mutexattr_destroy( &mattrib );
 		threaded = qfalse;
 	}
@@ -99,10 +99,7 @@ brush_t *AllocBrush( int numSides ){
 	}
 	c = (size_t)&( ( (brush_t*) 0 )->sides[ numSides ] );*/
 	c = sizeof(*bb) + (numSides > 6 ? sizeof(side_t)*(numSides - 6) : 0);
-	bb = safe_malloc0( c );
-	if ( numthreads == 1 ) {
-		numActiveBrushes++;
-	}
+	bb = MemPoolAlloc( &brushPool, c );
 
 	/* return it */
 	return bb;
@@ -136,10 +133,7 @@ void FreeBrush( brush_t *b ){
 	*( (unsigned int*) b ) = 0xFEFEFEFE;
 
 	/* free it */
-	free( b );
-	if ( numthreads == 1 ) {
-		numActiveBrushes--;
-	}
+	MemPoolFree( &brushPool, b );
 }
 
 
@@ -857,11 +851,20 @@ tree_t *AllocTree( void ){
 node_t *AllocNode( void ){
 	node_t  *node;
 
-	node = safe_malloc0( sizeof( *node ) );
+	node = MemPoolAlloc( &nodePool, sizeof( *node ) );
 
 	return node;
 }
 
+/*
+   ================
+   FreeNode
+   ================
+ */
+void FreeNode( node_t *node ){
+	MemPoolFree( &nodePool, node );
+}
+
 
 /*
    ================
@@ -958,7 +958,7 @@ static void ConvertModel( FILE *f, bspModel_t *model, int modelNum, vec3_t origi
 	}
 
 	/* free the build brush */
-	free( buildBrush );
+	FreeBrush( buildBrush );
 
 	/* go through each drawsurf in the model */
 	for ( i = 0; i < model->numBSPSurfaces; i++ )
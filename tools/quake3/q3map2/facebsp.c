@@ -49,7 +49,7 @@ int c_faceLeafs;
 face_t  *AllocBspFace( void ) {
 	face_t  *f;
 
-	f = safe_malloc0( sizeof( *f ) );
+	f = MemPoolAlloc( &facePool, sizeof( *f ) );
 
 	return f;
 }
@@ -65,7 +65,265 @@ void    FreeBspFace( face_t *f ) {
 	if ( f->w ) {
 		FreeWinding( f->w );
 	}
-	free( f );
+	MemPoolFree( &facePool, f );
+}
+
+
+
+/*
+   split plane evaluation
+   faces on the same plane split the same way, so every plane in the list is tested
+   once; each face is first classified by its bounds and only the faces whose bounds
+   straddle the plane (or come too close to tell) get WindingOnPlaneSide()
+ */
+
+#define SPLIT_BLOCK_FACES       256         /* faces classified by bounds in one go */
+#define SPLIT_BOUNDS_ERROR      4e-6f       /* relative rounding margin of the bounds test */
+#define PARALLEL_SPLIT_FACES    1024        /* lists this big test their planes on all threads */
+#define FACE_TREE_TASKS         8           /* subtree tasks per thread */
+
+#define SPLIT_UNKNOWN           0
+#define SPLIT_FRONT             1
+#define SPLIT_BACK              2
+#define SPLIT_ON                4
+
+typedef struct splitFaces_s
+{
+	int numFaces;
+	face_t                  **faces;
+	int                     *slots;                         /* unique plane of each face */
+	float                   *mins[ 3 ], *maxs[ 3 ];
+	float                   *extents[ 3 ];                  /* largest absolute coordinate */
+
+	int numPlanes;
+	int                     *planeNums;                     /* unique plane numbers, sorted */
+	int                     *counts;                        /* facing, splits, front and back per unique plane */
+}
+splitFaces_t;
+
+typedef struct faceTreeTask_s
+{
+	node_t                  *node;
+	face_t                  *list;
+	int numFaces;
+}
+faceTreeTask_t;
+
+static splitFaces_t         *threadSplitFaces;
+static int numFaceTreeTasks, maxFaceTreeTasks;
+static faceTreeTask_t       *faceTreeTasks;
+static int maxTaskFaces;                                     /* lists up to this size are left to the tasks, 0 = build here */
+static qboolean parallelSplits;
+
+
+
+/*
+   CompareSplitPlaneNums()
+   sorts plane numbers
+ */
+
+static int CompareSplitPlaneNums( const void *a, const void *b ){
+	return *( (const int*) a ) - *( (const int*) b );
+}
+
+
+
+/*
+   SetupSplitFaces()
+   gathers the faces, their bounds and their distinct planes
+ */
+
+static void SetupSplitFaces( splitFaces_t *sf, face_t *list, int numFaces ){
+	int i, j, k;
+	face_t      *face;
+	float       *floats;
+	int         *planeNum;
+
+
+	/* allocate */
+	memset( sf, 0, sizeof( *sf ) );
+	sf->numFaces = numFaces;
+	sf->faces = safe_malloc( ( numFaces + 1 ) * sizeof( *sf->faces ) );
+	sf->slots = safe_malloc( ( numFaces + 1 ) * sizeof( *sf->slots ) );
+	sf->planeNums = safe_malloc( ( numFaces + 1 ) * sizeof( *sf->planeNums ) );
+	floats = safe_malloc( ( numFaces + 1 ) * 9 * sizeof( *floats ) );
+	for ( i = 0; i < 3; i++ )
+	{
+		sf->mins[ i ] = floats + ( 3 * i + 0 ) * ( numFaces + 1 );
+		sf->maxs[ i ] = floats + ( 3 * i + 1 ) * ( numFaces + 1 );
+		sf->extents[ i ] = floats + ( 3 * i + 2 ) * ( numFaces + 1 );
+	}
+
+	/* bound the faces */
+	for ( face = list, j = 0; face != NULL; face = face->next, j++ )
+	{
+		sf->faces[ j ] = face;
+		sf->planeNums[ j ] = face->planenum;
+		for ( i = 0; i < 3; i++ )
+		{
+			sf->mins[ i ][ j ] = sf->maxs[ i ][ j ] = face->w->p[ 0 ][ i ];
+			for ( k = 1; k < face->w->numpoints; k++ )
+			{
+				if ( face->w->p[ k ][ i ] < sf->mins[ i ][ j ] ) {
+					sf->mins[ i ][ j ] = face->w->p[ k ][ i ];
+				}
+				if ( face->w->p[ k ][ i ] > sf->maxs[ i ][ j ] ) {
+					sf->maxs[ i ][ j ] = face->w->p[ k ][ i ];
+				}
+			}
+			sf->extents[ i ][ j ] = fabs( sf->mins[ i ][ j ] ) > fabs( sf->maxs[ i ][ j ] ) ? fabs( sf->mins[ i ][ j ] ) : fabs( sf->maxs[ i ][ j ] );
+		}
+	}
+
+	/* find the distinct planes */
+	qsort( sf->planeNums, numFaces, sizeof( *sf->planeNums ), CompareSplitPlaneNums );
+	for ( j = 0; j < numFaces; j++ )
+	{
+		if ( sf->numPlanes == 0 || sf->planeNums[ j ] != sf->planeNums[ sf->numPlanes - 1 ] ) {
+			sf->planeNums[ sf->numPlanes++ ] = sf->planeNums[ j ];
+		}
+	}
+	for ( j = 0; j < numFaces; j++ )
+	{
+		planeNum = bsearch( &sf->faces[ j ]->planenum, sf->planeNums, sf->numPlanes, sizeof( *sf->planeNums ), CompareSplitPlaneNums );
+		sf->slots[ j ] = planeNum - sf->planeNums;
+	}
+	sf->counts = safe_malloc0( ( sf->numPlanes + 1 ) * 4 * sizeof( *sf->counts ) );
+}
+
+
+
+/*
+   FreeSplitFaces()
+   frees the evaluation data of a node
+ */
+
+static void FreeSplitFaces( splitFaces_t *sf ){
+	free( sf->faces );
+	free( sf->slots );
+	free( sf->planeNums );
+	free( sf->mins[ 0 ] );
+	free( sf->counts );
+}
+
+
+
+/*
+   CountSplitPlane()
+   counts the faces on, crossing, in front of and behind one of the distinct planes
+ */
+
+static void CountSplitPlane( splitFaces_t *sf, int slot ){
+	int i, j, first, numBlock, side;
+	int facing, splits, front, back;
+	plane_t     *plane;
+	const float *lo[ 3 ], *hi[ 3 ];
+	float normal[ 3 ], absNormal[ 3 ], dist, absDist, dLo, dHi, margin;
+	byte sides[ SPLIT_BLOCK_FACES ];
+
+
+	/* the bounds corners nearest to and farthest along the plane normal */
+	plane = &mapplanes[ sf->planeNums[ slot ] ];
+	for ( i = 0; i < 3; i++ )
+	{
+		normal[ i ] = plane->normal[ i ];
+		absNormal[ i ] = fabs( normal[ i ] );
+		lo[ i ] = normal[ i ] >= 0.0f ? sf->mins[ i ] : sf->maxs[ i ];
+		hi[ i ] = normal[ i ] >= 0.0f ? sf->maxs[ i ] : sf->mins[ i ];
+	}
+	dist = plane->dist;
+	absDist = fabs( dist );
+
+	facing = splits = front = back = 0;
+	for ( first = 0; first < sf->numFaces; first += SPLIT_BLOCK_FACES )
+	{
+		numBlock = sf->numFaces - first < SPLIT_BLOCK_FACES ? sf->numFaces - first : SPLIT_BLOCK_FACES;
+
+		/* classify the block by bounds, with enough slack to cover the rounding of WindingOnPlaneSide() */
+		for ( j = 0; j < numBlock; j++ )
+		{
+			dLo = normal[ 0 ] * lo[ 0 ][ first + j ] + normal[ 1 ] * lo[ 1 ][ first + j ] + normal[ 2 ] * lo[ 2 ][ first + j ] - dist;
+			dHi = normal[ 0 ] * hi[ 0 ][ first + j ] + normal[ 1 ] * hi[ 1 ][ first + j ] + normal[ 2 ] * hi[ 2 ][ first + j ] - dist;
+			margin = ( absNormal[ 0 ] * sf->extents[ 0 ][ first + j ] + absNormal[ 1 ] * sf->extents[ 1 ][ first + j ] +
+					   absNormal[ 2 ] * sf->extents[ 2 ][ first + j ] + absDist ) * SPLIT_BOUNDS_ERROR;
+			sides[ j ] = ( dLo - margin > ON_EPSILON ) * SPLIT_FRONT
+						 | ( dHi + margin < -ON_EPSILON ) * SPLIT_BACK
+						 | ( dLo - margin >= -ON_EPSILON && dHi + margin <= ON_EPSILON ) * SPLIT_ON;
+		}
+
+		/* count it */
+		for ( j = 0; j < numBlock; j++ )
+		{
+			if ( sf->slots[ first + j ] == slot ) {
+				facing++;
+				continue;
+			}
+			if ( sides[ j ] == SPLIT_FRONT ) {
+				front++;
+				continue;
+			}
+			if ( sides[ j ] == SPLIT_BACK ) {
+				back++;
+				continue;
+			}
+			if ( sides[ j ] == SPLIT_ON ) {
+				continue;
+			}
+
+			side = WindingOnPlaneSide( sf->faces[ first + j ]->w, plane->normal, plane->dist );
+			if ( side == SIDE_CROSS ) {
+				splits++;
+			}
+			else if ( side == SIDE_FRONT ) {
+				front++;
+			}
+			else if ( side == SIDE_BACK ) {
+				back++;
+			}
+		}
+	}
+
+	sf->counts[ slot * 4 + 0 ] = facing;
+	sf->counts[ slot * 4 + 1 ] = splits;
+	sf->counts[ slot * 4 + 2 ] = front;
+	sf->counts[ slot * 4 + 3 ] = back;
+}
+
+
+
+/*
+   CountSplitPlaneThread()
+   work function for counting the distinct planes of a big list on all threads
+ */
+
+static void CountSplitPlaneThread( int slot ){
+	CountSplitPlane( threadSplitFaces, slot );
+}
+
+
+
+/*
+   BlockSplitAxis()
+   returns the axis along which the node crosses a block boundary and the boundary, or -1
+ */
+
+static int BlockSplitAxis( node_t *node, float *dist ){
+	int i;
+
+
+	/* ydnar 2002-06-24: changed this to split on z-axis as well */
+	/* ydnar 2002-09-21: changed blocksize to be a vector, so mappers can specify a 3 element value */
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( blockSize[ i ] <= 0 ) {
+			continue;
+		}
+		*dist = blockSize[ i ] * ( floor( node->mins[ i ] / blockSize[ i ] ) + 1 );
+		if ( node->maxs[ i ] > *dist ) {
+			return i;
+		}
+	}
+	return -1;
 }
 
 
@@ -75,41 +333,48 @@ void    FreeBspFace( face_t *f ) {
    finds the best split plane for this node
  */
 
-static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum, int *compileFlags ){
+static void SelectSplitPlaneNum( node_t *node, face_t *list, int numFaces, int *splitPlaneNum, int *compileFlags ){
 	face_t *split;
-	face_t *check;
 	face_t *bestSplit;
 	int splits, facing, front, back;
-	int side;
 	plane_t *plane;
 	int value, bestValue;
-	int i;
+	int i, j;
 	vec3_t normal;
 	float dist;
 	int planenum;
 	float sizeBias;
+	splitFaces_t sf;
 
 	/* ydnar: set some defaults */
 	*splitPlaneNum = -1; /* leaf */
 	*compileFlags = 0;
 
-	/* ydnar 2002-06-24: changed this to split on z-axis as well */
-	/* ydnar 2002-09-21: changed blocksize to be a vector, so mappers can specify a 3 element value */
-
 	/* if it is crossing a block boundary, force a split */
-	for ( i = 0; i < 3; i++ )
+	i = BlockSplitAxis( node, &dist );
+	if ( i >= 0 ) {
+		VectorClear( normal );
+		normal[ i ] = 1;
+		planenum = FindFloatPlane( normal, dist, 0, NULL );
+		*splitPlaneNum = planenum;
+		return;
+	}
+
+	/* nothing, we have a leaf */
+	if ( list == NULL ) {
+		return;
+	}
+
+	/* count the faces on each side of each plane */
+	SetupSplitFaces( &sf, list, numFaces );
+	if ( parallelSplits && numFaces >= PARALLEL_SPLIT_FACES ) {
+		threadSplitFaces = &sf;
+		RunThreadsOnIndividual( sf.numPlanes, qfalse, CountSplitPlaneThread );
+	}
+	else
 	{
-		if ( blockSize[ i ] <= 0 ) {
-			continue;
-		}
-		dist = blockSize[ i ] * ( floor( node->mins[ i ] / blockSize[ i ] ) + 1 );
-		if ( node->maxs[ i ] > dist ) {
-			VectorClear( normal );
-			normal[ i ] = 1;
-			planenum = FindFloatPlane( normal, dist, 0, NULL );
-			*splitPlaneNum = planenum;
-			return;
-		}
+		for ( i = 0; i < sf.numPlanes; i++ )
+			CountSplitPlane( &sf, i );
 	}
 
 	/* pick one of the face planes */
@@ -121,33 +386,16 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 	//for( split = list; split; split = split->next )
 	//	split->checked = qfalse;
 
-	for ( split = list; split; split = split->next )
+	for ( split = list, j = 0; split; split = split->next, j++ )
 	{
 		//if ( split->checked )
 		//	continue;
 
 		plane = &mapplanes[ split->planenum ];
-		splits = 0;
-		facing = 0;
-		front = 0;
-		back = 0;
-		for ( check = list ; check ; check = check->next ) {
-			if ( check->planenum == split->planenum ) {
-				facing++;
-				//check->checked = qtrue;	// won't need to test this plane again
-				continue;
-			}
-			side = WindingOnPlaneSide( check->w, plane->normal, plane->dist );
-			if ( side == SIDE_CROSS ) {
-				splits++;
-			}
-			else if ( side == SIDE_FRONT ) {
-				front++;
-			}
-			else if ( side == SIDE_BACK ) {
-				back++;
-			}
-		}
+		facing = sf.counts[ sf.slots[ j ] * 4 + 0 ];
+		splits = sf.counts[ sf.slots[ j ] * 4 + 1 ];
+		front = sf.counts[ sf.slots[ j ] * 4 + 2 ];
+		back = sf.counts[ sf.slots[ j ] * 4 + 3 ];
 
 		if ( bspAlternateSplitWeights ) {
 			// from 27
@@ -177,6 +425,7 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 			bestSplit = split;
 		}
 	}
+	FreeSplitFaces( &sf );
 
 	/* nothing, we have a leaf */
 	if ( bestValue == -99999 ) {
@@ -188,7 +437,7 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 	*compileFlags = bestSplit->compileFlags;
 
 	if ( *splitPlaneNum > -1 ) {
-		mapplanes[ *splitPlaneNum ].counter++;
+		__atomic_add_fetch( &mapplanes[ *splitPlaneNum ].counter, 1, __ATOMIC_RELAXED );
 	}
 }
 
@@ -226,19 +475,30 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 	winding_t   *frontWinding, *backWinding;
 	int i;
 	int splitPlaneNum, compileFlags;
+	float dist;
 
 
 	/* count faces left */
 	i = CountFaceList( list );
 
+	/* leave small subtrees that can't hit a block boundary (and so never add planes) to the tasks */
+	if ( maxTaskFaces > 0 && i <= maxTaskFaces && BlockSplitAxis( node, &dist ) < 0 ) {
+		AUTOEXPAND_BY_REALLOC( faceTreeTasks, numFaceTreeTasks, maxFaceTreeTasks, 256 );
+		faceTreeTasks[ numFaceTreeTasks ].node = node;
+		faceTreeTasks[ numFaceTreeTasks ].list = list;
+		faceTreeTasks[ numFaceTreeTasks ].numFaces = i;
+		numFaceTreeTasks++;
+		return;
+	}
+
 	/* select the best split plane */
-	SelectSplitPlaneNum( node, list, &splitPlaneNum, &compileFlags );
+	SelectSplitPlaneNum( node, list, i, &splitPlaneNum, &compileFlags );
 
 	/* if we don't have any more faces, this is a node */
 	if ( splitPlaneNum == -1 ) {
 		node->planenum = PLANENUM_LEAF;
 		node->has_structural_children = qfalse;
-		c_faceLeafs++;
+		__atomic_add_fetch( &c_faceLeafs, 1, __ATOMIC_RELAXED );
 		return;
 	}
 
@@ -328,6 +588,48 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 }
 
 
+/*
+   BuildFaceTreeTask()
+   builds one of the subtrees left over by the serial top of the tree
+ */
+
+static void BuildFaceTreeTask( int taskNum ){
+	BuildFaceTree_r( faceTreeTasks[ taskNum ].node, faceTreeTasks[ taskNum ].list );
+}
+
+
+
+/*
+   CompareFaceTreeTasks()
+   sorts the subtree tasks biggest first
+ */
+
+static int CompareFaceTreeTasks( const void *a, const void *b ){
+	const faceTreeTask_t *ta = a, *tb = b;
+
+	if ( ta->numFaces != tb->numFaces ) {
+		return tb->numFaces - ta->numFaces;
+	}
+	return ta - tb;
+}
+
+
+
+/*
+   StructuralChildren_r()
+   redoes the has_structural_children flags of the nodes above the subtrees
+ */
+
+static qboolean StructuralChildren_r( node_t *node ){
+	if ( node->planenum != PLANENUM_LEAF ) {
+		node->has_structural_children |= StructuralChildren_r( node->children[ 0 ] );
+		node->has_structural_children |= StructuralChildren_r( node->children[ 1 ] );
+	}
+	return node->has_structural_children;
+}
+
+
+
 /*
    ================
    FaceBSP
@@ -366,8 +668,28 @@ tree_t *FaceBSP( face_t *list ) {
 	VectorCopy( tree->maxs, tree->headnode->maxs );
 	c_faceLeafs = 0;
 
+	/* the top of the tree is built here, testing the planes of big lists on all threads,
+	   and the subtrees below it are built in parallel; plane usage counts depend on the
+	   build order, so the alternate split weights keep to the serial build */
+	parallelSplits = ( numthreads > 1 );
+	maxTaskFaces = 0;
+	if ( numthreads > 1 && !bspAlternateSplitWeights ) {
+		maxTaskFaces = count / ( numthreads * FACE_TREE_TASKS );
+	}
+	numFaceTreeTasks = 0;
+
 	BuildFaceTree_r( tree->headnode, list );
 
+	/* build the subtrees */
+	if ( numFaceTreeTasks > 0 ) {
+		maxTaskFaces = 0;
+		parallelSplits = qfalse;
+		qsort( faceTreeTasks, numFaceTreeTasks, sizeof( *faceTreeTasks ), CompareFaceTreeTasks );
+		RunThreadsOnIndividual( numFaceTreeTasks, qfalse, BuildFaceTreeTask );
+		StructuralChildren_r( tree->headnode );
+	}
+	parallelSplits = qfalse;
+
 	Sys_FPrintf( SYS_VRB, "%9d leafs\n", c_faceLeafs );
 
 	return tree;
@@ -157,14 +157,19 @@ void HelpVis()
 {
 	struct HelpOption vis[] = {
 		{"-vis [options] <filename.map>", "Switch that enters this stage"},
+		{"-benchbits", "Time the portal bitset kernels on the map's portals and exit without writing the BSP"},
+		{"-bitkernels <scalar|sse2|avx2>", "Portal bitset kernels to use (default: the fastest the CPU supports)"},
+		{"-checkpoint", "Save every finished portal to <filename>.vcp, so a killed vis can be continued with `-resume`"},
 		{"-fast", "Very fast and crude vis calculation"},
 		{"-hint", "Merge all but hint portals"},
+		{"-incremental", "Reuse the vis of the portals whose neighbourhood did not change since the last `-incremental` run, kept in <filename>.viscache"},
 		{"-mergeportals", "The less crude half of `-merge`, makes vis sometimes much faster but doesn't hurt fps usually"},
 		{"-merge", "Faster but still okay vis calculation"},
 		{"-nopassage", "Just use PortalFlow vis (usually less fps)"},
 		{"-nosort", "Do not sort the portals before calculating vis (usually slower)"},
 		{"-passageOnly", "Just use PassageFlow vis (usually less fps)"},
 		{"-prtfile <filename.prt>", "Portal file to read"},
+		{"-resume", "Continue from the portals saved in <filename>.vcp by an earlier `-checkpoint` run with the same Portal file and options"},
 		{"-saveprt", "Keep the Portal file after running vis (so you can run vis again)"},
 		{"-tmpin", "Use /tmp folder for input"},
 		{"-tmpout", "Use /tmp folder for output"},
@@ -179,19 +184,26 @@ void HelpLight()
 	struct HelpOption light[] = {
 		{"-light [options] <filename.map>", "Switch that enters this stage"},
 		{"-vlight [options] <filename.map>", "Deprecated alias for `-light -fast` ... filename.map"},
+		{"-adaptivegrid", "Trace the light grid at every 4th point, refining only where the lighting varies and interpolating the points in between"},
+		{"-adaptivegridtolerance <F>", "Largest spread of grid color bytes `-adaptivegrid` interpolates over (default 4)"},
+		{"-adaptivesamples", "Supersample shadow edges by how uncertain each luxel still is, up to the `-samples` count (presets like `-randomsamples`)"},
 		{"-approx <N>", "Vertex light approximation tolerance (never use in conjunction with deluxemapping)"},
 		{"-areascale <F, `-area` F>", "Scaling factor for area lights (surfacelight)"},
 		{"-backsplash <Fscale Fdistance>", "scale area lights backsplash fraction + set distance globally; (distance < -900 to omit distance setting); default = 1 23; real area lights have no backsplash (scale = 0); q3map_backsplash shader keyword overrides this setting"},
 		{"-backsplashpoint", "Use point light as backsplash light (default)"},
 		{"-backsplasharea", "Use area light as backsplash light"},
 		{"-border", "Add a red border to lightmaps for debugging"},
+		{"-bouncecache <N>", "Sample radiosity every N luxels and interpolate in between where it is smooth"},
 		{"-bouncegrid", "Also compute radiosity on the light grid"},
 		{"-bounceonly", "Only compute radiosity"},
 		{"-bouncescale <F>", "Scaling factor for radiosity"},
 		{"-bounce <N>", "Number of bounces for radiosity"},
 		{"-bspfile <filename.bsp>", "BSP file to write"},
+		{"-bvh", "Trace shadows through a surface area heuristic bounding volume hierarchy (faster on maps with many triangles)"},
 		{"-cheapgrid", "Use `-cheap` style lighting for radiosity"},
 		{"-cheap", "Abort vertex light calculations when white is reached"},
+		{"-compactbatch <N>", "Megabytes of raw lightmaps a stage unpacks at once with `-compactlightmaps` (default 256)"},
+		{"-compactlightmaps", "Keep raw lightmaps packed (half floats and 16 bit normals) while no stage works on them, for a much lower peak memory use at a slight loss of precision"},
 		{"-compensate <F>", "Lightmap compensate (darkening factor applied after everything else)"},
 		{"-cpma", "CPMA vertex lighting mode"},
 		{"-custinfoparms", "Read scripts/custinfoparms.txt"},
@@ -207,6 +219,9 @@ void HelpLight()
 		{"-deluxemode 0", "Use modelspace deluxemaps (DarkPlaces)"},
 		{"-deluxemode 1", "Use tangentspace deluxemaps"},
 		{"-deluxe, -deluxemap", "Enable deluxemapping (light direction maps)"},
+		{"-denoise", "Edge-aware lightmap filtering that keeps shadow edges and surface boundaries, unlike `-filter`; smooths out the noise of `-randomsamples`, `-dirty` and `-bounce`"},
+		{"-denoisepasses <N>", "Number of `-denoise` passes, each reaching twice as far (default 2)"},
+		{"-denoisestrength <F>", "How large a brightness difference `-denoise` still smooths over (default 1)"},
 		{"-dirtdebug, -debugdirt", "Store the dirtmaps as lightmaps for debugging"},
 		{"-dirtdepth", "Dirtmapping depth"},
 		{"-dirtgain", "Dirtmapping exponent"},
@@ -237,8 +252,11 @@ void HelpLight()
 		{"-gridambientscale <F>", "Scaling factor for the light grid ambient components only"},
 		{"-griddirectionality <F>", "Directional lighting received (default: 1.0)"},
 		{"-gridscale <F>", "Scaling factor for the light grid only"},
+		{"-incremental", "Relight only what lights that changed since the last `-incremental` run reach (plus their bounces), reusing the rest from <filename>.lightcache"},
 		{"-lightanglehl 0", "Disable half lambert light angle attenuation"},
 		{"-lightanglehl 1", "Enable half lambert light angle attenuation"},
+		{"-lightcuts", "Cluster the lights reaching each block of luxels and sample whole clusters through one light where that is within the error"},
+		{"-lightcutserror <F>", "Largest part of the estimated light a `-lightcuts` cluster may be off by (default 0.02)"},
 		{"-lightmapdir <directory>", "Directory to store external lightmaps (default: same as map name without extension)"},
 		{"-lightmapsearchblocksize <N>", "Restrict lightmap search to block size <N>"},
 		{"-lightmapsearchpower <N>", "Optimize for lightmap merge power <N>"},
@@ -267,6 +285,7 @@ void HelpLight()
 		{"-q3", "Use nonlinear falloff curve by default (like Q3A)"},
 		{"-randomsamples", "Use random sampling for lightmaps"},
 		{"-rawlightmapsizelimit <N>", "Sets maximum lightmap resolution in luxels/qu (only affects patches if used -patchmeta in BSP stage)"},
+		{"-samplesbudget <F>", "Average samples per shadow edge luxel for `-adaptivesamples` (default a quarter of the `-samples` count, at least 8)"},
 		{"-samplescale <F>", "Scales all lightmap resolutions"},
 		{"-samplesize <N>", "Sets default lightmap resolution in luxels/qu"},
 		{"-samplessearchboxsize <N>", "Search box size (1 to 4) for lightmap adaptive supersampling"},
@@ -288,9 +307,13 @@ void HelpLight()
 		{"-sunonly", "Only compute sun light"},
 		{"-super <N, `-supersample` N>", "Ordered grid supersampling quality, much slower than `-samples`"},
 		{"-thresh <F>", "Triangle subdivision threshold"},
+		{"-tilesize <N>", "Split raw lightmaps into tiles of N x N luxels that are lit by separate threads, 0 to light them in one piece (default 64)"},
 		{"-trianglecheck", "Broken check that should ensure luxels apply to the right triangle"},
 		{"-trisoup", "Convert brush faces to triangle soup"},
 		{"-wolf", "Use linear falloff curve by default (like W:ET)"},
+		{"-worker <run>", "Help light run <run> of a `-workers` process, on any machine that sees the directory of the BSP"},
+		{"-workertimeout <N>", "With `-workers`, light the chunks of a worker again once it went quiet for N seconds (default 300), and stop waiting for it"},
+		{"-workers <N>", "Share the light grid, dirt and lightmap illumination out with N worker processes it starts (0 for only the ones joining with `-worker`), through <filename>.lightwork"},
 	};
 
 	HelpOptions("Light Stage", 0, terminalColumns, light, sizeof(light)/sizeof(struct HelpOption));
@@ -423,8 +446,9 @@ void HelpCommon()
 		{"-fs_nohomepath", "Do not load home path in VFS"},
 		{"-fs_pakpath <path>", "Specify a package directory (can be used more than once to look in multiple paths)"},
 		{"-game <gamename>", "Load settings for the given game (default: quake3)"},
+		{"-memstats", "Print live and peak counts of the pooled brushes, windings, portals, nodes and faces on exit"},
 		{"-subdivisions <F>", "Multiplier for patch subdivisions quality"},
-		{"-threads <N>", "Number of threads to use"},
+		{"-threads <N>", "Number of threads to use (default: number of online CPUs)"},
 		{"-v", "Verbose mode"},
 		{"-werror", "Make all warnings into errors"}
 	};
@@ -45,6 +45,11 @@
 
    ------------------------------------------------------------------------------- */
 
+static image_t              **images = NULL;                    /* image slots, images[ numImageSlots ] is a spare for ImageLoad() */
+static int numImageSlots = 0;
+static int maxImageSlots = 0;
+static nameIndex_t imageIndex;
+
 /*
    LoadDDSBuffer()
    loads a dxtc (1, 3, 5) dds buffer into a valid rgba image
@@ -279,25 +284,42 @@ static void LoadWEBPBuffer( byte *buffer, int size, byte **pixels, int *width, i
    implicitly called by every function to set up image list
  */
 
+static image_t *SpareImage( void ){
+	/* images are referenced by pointer, so only the list of them can move */
+	AUTOEXPAND_BY_REALLOC0( images, numImageSlots, maxImageSlots, 256 );
+	if ( images[ numImageSlots ] == NULL ) {
+		images[ numImageSlots ] = safe_malloc( sizeof( image_t ) );
+	}
+	memset( images[ numImageSlots ], 0, sizeof( image_t ) );
+	return images[ numImageSlots ];
+}
+
 static void ImageInit( void ){
 	int i;
+	image_t     *image;
 
 
 	if ( numImages <= 0 ) {
 		/* clear images (fixme: this could theoretically leak) */
-		memset( images, 0, sizeof( images ) );
+		for ( i = 0; i < numImageSlots; i++ )
+			memset( images[ i ], 0, sizeof( image_t ) );
+		numImageSlots = 0;
+		ClearNameIndex( &imageIndex );
 
 		/* generate *bogus image */
-		images[ 0 ].name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].name, DEFAULT_IMAGE );
-		images[ 0 ].filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].filename, DEFAULT_IMAGE );
-		images[ 0 ].width = 64;
-		images[ 0 ].height = 64;
-		images[ 0 ].refCount = 1;
-		images[ 0 ].pixels = safe_malloc( 64 * 64 * 4 );
+		image = SpareImage();
+		image->name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->name, DEFAULT_IMAGE );
+		image->filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->filename, DEFAULT_IMAGE );
+		image->width = 64;
+		image->height = 64;
+		image->refCount = 1;
+		image->pixels = safe_malloc( 64 * 64 * 4 );
 		for ( i = 0; i < ( 64 * 64 * 4 ); i++ )
-			images[ 0 ].pixels[ i ] = 255;
+			image->pixels[ i ] = 255;
+		AddNameIndexEntry( &imageIndex, numImageSlots, image->name );
+		numImageSlots++;
 	}
 }
 
@@ -309,6 +331,9 @@ static void ImageInit( void ){
  */
 
 void ImageFree( image_t *image ){
+	int i;
+
+
 	/* dummy check */
 	if ( image == NULL ) {
 		return;
@@ -320,6 +345,13 @@ void ImageFree( image_t *image ){
 	/* free? */
 	if ( image->refCount <= 0 ) {
 		if ( image->name != NULL ) {
+			for ( i = FirstNameIndexEntry( &imageIndex, image->name ); i >= 0; i = NextNameIndexEntry( &imageIndex, i ) )
+			{
+				if ( images[ i ] == image ) {
+					RemoveNameIndexEntry( &imageIndex, i );
+					break;
+				}
+			}
 			free( image->name );
 		}
 		image->name = NULL;
@@ -359,10 +391,10 @@ image_t *ImageFind( const char *filename ){
 	StripExtension( name );
 
 	/* search list */
-	for ( i = 0; i < MAX_IMAGES; i++ )
+	for ( i = FirstNameIndexEntry( &imageIndex, name ); i >= 0; i = NextNameIndexEntry( &imageIndex, i ) )
 	{
-		if ( images[ i ].name != NULL && !strcmp( name, images[ i ].name ) ) {
-			return &images[ i ];
+		if ( images[ i ]->name != NULL && !strcmp( name, images[ i ]->name ) ) {
+			return images[ i ];
 		}
 	}
 
@@ -415,20 +447,8 @@ image_t *ImageLoad( const char *filename ){
 			return image;
 		}
 
-		/* none found, so find first non-null image */
-		image = NULL;
-		for ( i = 0; i < MAX_IMAGES; i++ )
-		{
-			if ( images[ i ].name == NULL ) {
-				image = &images[ i ];
-				break;
-			}
-		}
-
-		/* too many images? */
-		if ( image == NULL ) {
-			Error( "MAX_IMAGES (%d) exceeded, there are too many image files referenced by the map.", MAX_IMAGES );
-		}
+		/* none found, so set up the spare image */
+		image = SpareImage();
 
 		/* set it up */
 		image->name = safe_malloc( strlen( name ) + 1 );
@@ -516,6 +536,9 @@ image_t *ImageLoad( const char *filename ){
 			LoadWEBPBuffer( buffer, size, &image->pixels, &image->width, &image->height );
 			break;
 		}
+
+		/* the image slot search used to reuse i and so ended the loop after the first pass, keep it that way */
+		break;
 	}
 
 	/* free file buffer */
@@ -542,6 +565,10 @@ image_t *ImageLoad( const char *filename ){
 	image->refCount = 1;
 	numImages++;
 
+	/* the spare is taken */
+	AddNameIndexEntry( &imageIndex, numImageSlots, image->name );
+	numImageSlots++;
+
 	if ( alphaHack ) {
 		StripExtension( name );
 		strcat( name, "_alpha.jpg" );
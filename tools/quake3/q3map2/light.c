@@ -765,11 +765,12 @@ float PointToPolygonFormFactor( const vec3_t point, const vec3_t normal, const w
 
 
 /*
-   LightContributionTosample()
-   determines the amount of light reaching a sample (luxel or vertex) from a given light
+   SetupLightContributionToSample()
+   does the work of LightContributionToSample() up to the shadow trace, returns LIGHT_TRACE_PENDING
+   if the sample still has to be traced and finished with FinishLightContributionToSample()
  */
 
-int LightContributionToSample( trace_t *trace ){
+int SetupLightContributionToSample( trace_t *trace ){
 	light_t         *light;
 	float angle;
 	float add;
@@ -1138,19 +1139,12 @@ int LightContributionToSample( trace_t *trace ){
 
 		/* setup trace */
 		trace->testAll = qtrue;
+		trace->add = add;
 		VectorScale( light->color, add, trace->color );
 
 		/* trace to point */
 		if ( trace->testOcclusion && !trace->forceSunlight ) {
-			/* trace */
-			TraceLine( trace );
-			trace->forceSubsampling *= add;
-			if ( !( trace->compileFlags & C_SKY ) || trace->opaque ) {
-				VectorClear( trace->color );
-				VectorClear( trace->directionContribution );
-
-				return -1;
-			}
+			return LIGHT_TRACE_PENDING;
 		}
 
 		/* return to sender */
@@ -1196,12 +1190,33 @@ int LightContributionToSample( trace_t *trace ){
 
 	/* setup trace */
 	trace->testAll = qfalse;
+	trace->add = add;
 	VectorScale( light->color, add, trace->color );
 
 	/* raytrace */
-	TraceLine( trace );
-	trace->forceSubsampling *= add;
-	if ( trace->passSolid || trace->opaque ) {
+	return LIGHT_TRACE_PENDING;
+}
+
+
+
+/*
+   FinishLightContributionToSample()
+   applies the shadow trace of a sample set up with SetupLightContributionToSample()
+ */
+
+int FinishLightContributionToSample( trace_t *trace ){
+	trace->forceSubsampling *= trace->add;
+
+	/* sunlight has to reach the sky, other lights just must not be blocked */
+	if ( trace->testAll ) {
+		if ( !( trace->compileFlags & C_SKY ) || trace->opaque ) {
+			VectorClear( trace->color );
+			VectorClear( trace->directionContribution );
+
+			return -1;
+		}
+	}
+	else if ( trace->passSolid || trace->opaque ) {
 		VectorClear( trace->color );
 		VectorClear( trace->directionContribution );
 
@@ -1214,6 +1229,25 @@ int LightContributionToSample( trace_t *trace ){
 
 
 
+/*
+   LightContributionToSample()
+   determines the amount of light reaching a sample (luxel or vertex) from a given light
+ */
+
+int LightContributionToSample( trace_t *trace ){
+	int contribution;
+
+
+	contribution = SetupLightContributionToSample( trace );
+	if ( contribution == LIGHT_TRACE_PENDING ) {
+		TraceLine( trace );
+		contribution = FinishLightContributionToSample( trace );
+	}
+	return contribution;
+}
+
+
+
 /*
    LightingAtSample()
    determines the amount of light reaching a sample (luxel or vertex)
@@ -1500,6 +1534,336 @@ int LightContributionToPoint( trace_t *trace ){
 
 
 
+/*
+   grid point flags
+   a point flagged solid has no place to be traced from anywhere in its cell; with -adaptivegrid
+   the others are either traced or interpolated from the coarser lattice around them
+ */
+
+#define GRID_POINT_SOLID        1
+#define GRID_POINT_TRACED       2
+#define GRID_POINT_INTERPOLATED 4
+
+#define GRID_CONTENTS_BLOCK     4       /* grid points along each side of the blocks tested for solid at once */
+#define ADAPTIVE_GRID_STEP      4       /* spacing of the coarsest lattice -adaptivegrid traces */
+
+static byte             *gridPointFlags;
+
+
+
+/*
+   GridPointCoords() / GridPointOrigin()
+   gets the lattice coordinates and the origin of a grid point
+ */
+
+static void GridPointCoords( int num, int coords[ 3 ] ){
+	coords[ 2 ] = num / ( gridBounds[ 0 ] * gridBounds[ 1 ] );
+	num -= coords[ 2 ] * ( gridBounds[ 0 ] * gridBounds[ 1 ] );
+	coords[ 1 ] = num / gridBounds[ 0 ];
+	coords[ 0 ] = num - coords[ 1 ] * gridBounds[ 0 ];
+}
+
+static void GridPointOrigin( int num, vec3_t origin ){
+	int coords[ 3 ];
+
+
+	GridPointCoords( num, coords );
+	origin[ 0 ] = gridMins[ 0 ] + coords[ 0 ] * gridSize[ 0 ];
+	origin[ 1 ] = gridMins[ 1 ] + coords[ 1 ] * gridSize[ 1 ];
+	origin[ 2 ] = gridMins[ 2 ] + coords[ 2 ] * gridSize[ 2 ];
+}
+
+
+
+/*
+   SetupGridContents()
+   flags the grid points whose whole cell is in solid, for them not to be nudged around in vain;
+   the nodes with only opaque leaves below are cached, so a box in the void outside the world
+   stops at the first of them
+ */
+
+static byte             *solidNodes;
+
+static qboolean SolidNode_r( int nodeNum ){
+	qboolean front, back;
+
+
+	if ( nodeNum < 0 ) {
+		return bspLeafs[ -nodeNum - 1 ].cluster < 0;
+	}
+	front = SolidNode_r( bspNodes[ nodeNum ].children[ 0 ] );
+	back = SolidNode_r( bspNodes[ nodeNum ].children[ 1 ] );
+	solidNodes[ nodeNum ] = front && back;
+	return solidNodes[ nodeNum ];
+}
+
+static qboolean BoxInSolid_r( int nodeNum, const vec3_t center, const vec3_t extents ){
+	int i, j, b;
+	float dist, radius;
+	qboolean inside;
+	bspNode_t       *node;
+	bspPlane_t      *plane;
+	bspLeaf_t       *leaf;
+	bspBrush_t      *brush;
+
+
+	/* go down the sides the points of the box go down in PointInLeafNum() */
+	while ( nodeNum >= 0 )
+	{
+		if ( solidNodes[ nodeNum ] ) {
+			return qtrue;
+		}
+		node = &bspNodes[ nodeNum ];
+		plane = &bspPlanes[ node->planeNum ];
+		dist = DotProduct( center, plane->normal ) - plane->dist;
+		radius = fabs( plane->normal[ 0 ] ) * extents[ 0 ] + fabs( plane->normal[ 1 ] ) * extents[ 1 ] + fabs( plane->normal[ 2 ] ) * extents[ 2 ];
+		if ( dist - radius > 0.1f ) {
+			nodeNum = node->children[ 0 ];
+		}
+		else if ( dist + radius < -0.1f ) {
+			nodeNum = node->children[ 1 ];
+		}
+		else
+		{
+			if ( !BoxInSolid_r( node->children[ 0 ], center, extents ) ) {
+				return qfalse;
+			}
+			nodeNum = node->children[ 1 ];
+		}
+	}
+
+	/* an opaque leaf */
+	leaf = &bspLeafs[ -nodeNum - 1 ];
+	if ( leaf->cluster < 0 ) {
+		return qtrue;
+	}
+
+	/* or one the box is buried in an opaque brush of, as ClusterForPointExt() finds points */
+	for ( i = 0; i < leaf->numBSPLeafBrushes; i++ )
+	{
+		b = bspLeafBrushes[ leaf->firstBSPLeafBrush + i ];
+		if ( b > maxOpaqueBrush || !( opaqueBrushes[ b >> 3 ] & ( 1 << ( b & 7 ) ) ) ) {
+			continue;
+		}
+		brush = &bspBrushes[ b ];
+		inside = qtrue;
+		for ( j = 0; j < brush->numSides && inside; j++ )
+		{
+			plane = &bspPlanes[ bspBrushSides[ brush->firstSide + j ].planeNum ];
+			dist = DotProduct( center, plane->normal ) - plane->dist;
+			radius = fabs( plane->normal[ 0 ] ) * extents[ 0 ] + fabs( plane->normal[ 1 ] ) * extents[ 1 ] + fabs( plane->normal[ 2 ] ) * extents[ 2 ];
+			if ( dist + radius > VERTEX_EPSILON ) {
+				inside = qfalse;
+			}
+		}
+		if ( inside ) {
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+static qboolean GridBoxInSolid( const int lo[ 3 ], const int hi[ 3 ] ){
+	int i;
+	vec3_t center, extents;
+
+
+	/* the cells of the points, a point is nudged up to half a cell around */
+	for ( i = 0; i < 3; i++ )
+	{
+		center[ i ] = gridMins[ i ] + ( lo[ i ] + hi[ i ] ) * 0.5f * gridSize[ i ];
+		extents[ i ] = ( hi[ i ] - lo[ i ] + 1 ) * 0.5f * gridSize[ i ] + 1.0f;
+	}
+	return BoxInSolid_r( 0, center, extents );
+}
+
+static void GridContentsBlock( int num ){
+	int i, x, y, z, blocks[ 3 ], lo[ 3 ], hi[ 3 ], c[ 3 ];
+
+
+	/* get block */
+	for ( i = 0; i < 3; i++ )
+		blocks[ i ] = ( gridBounds[ i ] + GRID_CONTENTS_BLOCK - 1 ) / GRID_CONTENTS_BLOCK;
+	lo[ 0 ] = ( num % blocks[ 0 ] ) * GRID_CONTENTS_BLOCK;
+	lo[ 1 ] = ( ( num / blocks[ 0 ] ) % blocks[ 1 ] ) * GRID_CONTENTS_BLOCK;
+	lo[ 2 ] = ( num / ( blocks[ 0 ] * blocks[ 1 ] ) ) * GRID_CONTENTS_BLOCK;
+	for ( i = 0; i < 3; i++ )
+	{
+		hi[ i ] = lo[ i ] + GRID_CONTENTS_BLOCK - 1;
+		if ( hi[ i ] > gridBounds[ i ] - 1 ) {
+			hi[ i ] = gridBounds[ i ] - 1;
+		}
+	}
+
+	/* the whole block at once, else point by point */
+	if ( GridBoxInSolid( lo, hi ) ) {
+		for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+			for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+				for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+					gridPointFlags[ x + gridBounds[ 0 ] * ( y + gridBounds[ 1 ] * z ) ] |= GRID_POINT_SOLID;
+		return;
+	}
+	for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+		for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+			for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+			{
+				c[ 0 ] = x;
+				c[ 1 ] = y;
+				c[ 2 ] = z;
+				if ( GridBoxInSolid( c, c ) ) {
+					gridPointFlags[ x + gridBounds[ 0 ] * ( y + gridBounds[ 1 ] * z ) ] |= GRID_POINT_SOLID;
+				}
+			}
+}
+
+static void SetupGridContents( void ){
+	int i, numBlocks, numSolid;
+
+
+	/* allocate */
+	if ( gridPointFlags != NULL ) {
+		free( gridPointFlags );
+	}
+	gridPointFlags = safe_malloc0( numRawGridPoints * sizeof( *gridPointFlags ) );
+	if ( numBSPNodes <= 0 ) {
+		return;
+	}
+
+	/* cache the solid nodes */
+	solidNodes = safe_malloc0( numBSPNodes * sizeof( *solidNodes ) );
+	SolidNode_r( 0 );
+
+	/* flag the points */
+	numBlocks = 1;
+	for ( i = 0; i < 3; i++ )
+		numBlocks *= ( gridBounds[ i ] + GRID_CONTENTS_BLOCK - 1 ) / GRID_CONTENTS_BLOCK;
+	RunThreadsOnIndividual( numBlocks, qfalse, GridContentsBlock );
+	free( solidNodes );
+	solidNodes = NULL;
+
+	/* note it */
+	numSolid = 0;
+	for ( i = 0; i < numRawGridPoints; i++ )
+	{
+		if ( gridPointFlags[ i ] & GRID_POINT_SOLID ) {
+			numSolid++;
+		}
+	}
+	Sys_Printf( "%9d grid points in solid\n", numSolid );
+}
+
+
+
+/*
+   FindGridPointOrigin()
+   finds the point a grid point is traced from, nudging it around at random (but the same in
+   every thread and process) if it is in solid; returns qfalse if there is none
+ */
+
+static vec3_t           *gridPointOrigins;
+static int              *gridPointClusters;
+
+static qboolean FindGridPointOrigin( int num, vec3_t origin, int *cluster ){
+	int i;
+	float step;
+	vec3_t baseOrigin;
+
+
+	/* every process sharing the grid out found them all up front */
+	if ( gridPointOrigins != NULL ) {
+		VectorCopy( gridPointOrigins[ num ], origin );
+		*cluster = gridPointClusters[ num ];
+		return *cluster >= 0;
+	}
+
+	/* a point in solid would be nudged around in vain */
+	if ( gridPointFlags != NULL && ( gridPointFlags[ num ] & GRID_POINT_SOLID ) ) {
+		return qfalse;
+	}
+
+	/* get grid origin */
+	GridPointOrigin( num, origin );
+
+	/* find point cluster */
+	*cluster = ClusterForPointExt( origin, GRID_EPSILON );
+	if ( *cluster < 0 ) {
+		/* try to nudge the origin around to find a valid point */
+		VectorCopy( origin, baseOrigin );
+		for ( i = 0, step = 0; ( step += 0.005 ) <= 1.0; i++ )
+		{
+			VectorCopy( baseOrigin, origin );
+			origin[ 0 ] += step * ( LuxelJitter( num, i, 0 ) - 0.5 ) * gridSize[0];
+			origin[ 1 ] += step * ( LuxelJitter( num, i, 1 ) - 0.5 ) * gridSize[1];
+			origin[ 2 ] += step * ( LuxelJitter( num, i, 2 ) - 0.5 ) * gridSize[2];
+
+			/* ydnar: changed to find cluster num */
+			*cluster = ClusterForPointExt( origin, VERTEX_EPSILON );
+			if ( *cluster >= 0 ) {
+				break;
+			}
+		}
+
+		/* can't find a valid point at all */
+		if ( step > 1.0 ) {
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+
+
+/*
+   StoreGridPoint()
+   copies a raw grid point off to the bsp one
+ */
+
+static void StoreGridPoint( rawGridPoint_t *gp, bspGridPoint_t *bgp ){
+	int i, j;
+	vec3_t color, thisdir;
+
+
+	/* the primary light direction */
+	VectorNormalize( gp->dir, thisdir );
+
+	/* store off sample */
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+#if 0
+		/* do some fudging to keep the ambient from being too low (2003-07-05: 0.25 -> 0.125) */
+		if ( !bouncing ) {
+			VectorMA( gp->ambient[ i ], 0.125f, gp->directed[ i ], gp->ambient[ i ] );
+		}
+#endif
+
+		/* set minimum light and copy off to bytes */
+		VectorCopy( gp->ambient[ i ], color );
+		for ( j = 0; j < 3; j++ )
+			if ( color[ j ] < minGridLight[ j ] ) {
+				color[ j ] = minGridLight[ j ];
+			}
+
+		/* vortex: apply gridscale and gridambientscale here */
+		if (gp->directed[i][0] || gp->directed[i][1] || gp->directed[i][2]) {
+			/*
+			 * HACK: if there's a non-zero directed component, this
+			 * lightgrid cell is useful. However, ioq3 skips grid
+			 * cells with zero ambient. So let's force ambient to be
+			 * nonzero unless directed is zero too.
+			 */
+			ColorToBytesNonZero(color, bgp->ambient[i], gridScale * gridAmbientScale);
+		} else {
+		ColorToBytes( color, bgp->ambient[ i ], gridScale * gridAmbientScale );
+		}
+		ColorToBytes( gp->directed[ i ], bgp->directed[ i ], gridScale );
+	}
+
+	/* store direction */
+	NormalToLatLong( thisdir, bgp->latLong );
+}
+
+
+
 /*
    TraceGrid()
    grid samples are for quickly determining the lighting
@@ -1518,9 +1882,9 @@ typedef struct
 contribution_t;
 
 void TraceGrid( int num ){
-	int i, j, x, y, z, mod, numCon, numStyles;
-	float d, step;
-	vec3_t baseOrigin, cheapColor, color, thisdir;
+	int i, j, numCon, numStyles;
+	float d;
+	vec3_t cheapColor, thisdir;
 	rawGridPoint_t          *gp;
 	bspGridPoint_t          *bgp;
 	contribution_t contributions[ MAX_CONTRIBUTIONS ];
@@ -1530,17 +1894,10 @@ void TraceGrid( int num ){
 	gp = &rawGridPoints[ num ];
 	bgp = &bspGridPoints[ num ];
 
-	/* get grid origin */
-	mod = num;
-	z = mod / ( gridBounds[ 0 ] * gridBounds[ 1 ] );
-	mod -= z * ( gridBounds[ 0 ] * gridBounds[ 1 ] );
-	y = mod / gridBounds[ 0 ];
-	mod -= y * gridBounds[ 0 ];
-	x = mod;
-
-	trace.origin[ 0 ] = gridMins[ 0 ] + x * gridSize[ 0 ];
-	trace.origin[ 1 ] = gridMins[ 1 ] + y * gridSize[ 1 ];
-	trace.origin[ 2 ] = gridMins[ 2 ] + z * gridSize[ 2 ];
+	/* get grid origin and point cluster */
+	if ( !FindGridPointOrigin( num, trace.origin, &trace.cluster ) ) {
+		return;
+	}
 
 	/* set inhibit sphere */
 	if ( gridSize[ 0 ] > gridSize[ 1 ] && gridSize[ 0 ] > gridSize[ 2 ] ) {
@@ -1553,39 +1910,21 @@ void TraceGrid( int num ){
 		trace.inhibitRadius = gridSize[ 2 ] * 0.5f;
 	}
 
-	/* find point cluster */
-	trace.cluster = ClusterForPointExt( trace.origin, GRID_EPSILON );
-	if ( trace.cluster < 0 ) {
-		/* try to nudge the origin around to find a valid point */
-		VectorCopy( trace.origin, baseOrigin );
-		for ( step = 0; ( step += 0.005 ) <= 1.0; )
-		{
-			VectorCopy( baseOrigin, trace.origin );
-			trace.origin[ 0 ] += step * ( Random() - 0.5 ) * gridSize[0];
-			trace.origin[ 1 ] += step * ( Random() - 0.5 ) * gridSize[1];
-			trace.origin[ 2 ] += step * ( Random() - 0.5 ) * gridSize[2];
-
-			/* ydnar: changed to find cluster num */
-			trace.cluster = ClusterForPointExt( trace.origin, VERTEX_EPSILON );
-			if ( trace.cluster >= 0 ) {
-				break;
-			}
-		}
-
-		/* can't find a valid point at all */
-		if ( step > 1.0 ) {
-			return;
-		}
-	}
-
 	/* setup trace */
 	trace.testOcclusion = !noTrace;
 	trace.forceSunlight = qfalse;
 	trace.recvShadows = WORLDSPAWN_RECV_SHADOWS;
 	trace.numSurfaces = 0;
 	trace.surfaces = NULL;
-	trace.numLights = 0;
-	trace.lights = NULL;
+
+	/* get the lights whose pvs bounds contain the point */
+	CreateTraceLightsForPoint( trace.origin, &trace );
+
+	/* take the point from the light cache if none of the lights reaching it changed */
+	if ( lightIncremental && ReadLightCacheGridPoint( num, &trace ) ) {
+		FreeTraceLights( &trace );
+		return;
+	}
 
 	/* clear */
 	numCon = 0;
@@ -1593,11 +1932,14 @@ void TraceGrid( int num ){
 
 	/* trace to all the lights, find the major light direction, and divide the
 	   total light between that along the direction and the remaining in the ambient */
-	for ( trace.light = lights; trace.light != NULL; trace.light = trace.light->next )
+	for ( i = 0; i < trace.numLights; i++ )
 	{
 		float addSize;
 
 
+		/* get light */
+		trace.light = trace.lights[ i ];
+
 		/* sample light */
 		if ( !LightContributionToPoint( &trace ) ) {
 			continue;
@@ -1631,6 +1973,11 @@ void TraceGrid( int num ){
 		}
 	}
 
+	/* free light list */
+	FreeTraceLights( &trace );
+	trace.numLights = 0;
+	trace.lights = NULL;
+
 	/////// Floodlighting for point //////////////////
 	//do our floodlight ambient occlusion loop, and add a single contribution based on the brightest dir
 	if ( floodlighty ) {
@@ -1665,137 +2012,572 @@ void TraceGrid( int num ){
 			contributions[ numCon ].color[1] = floodlightRGB[1] * floodlightIntensity * f * ( 1.0f - ambientFrac );
 			contributions[ numCon ].color[2] = floodlightRGB[2] * floodlightIntensity * f * ( 1.0f - ambientFrac );
 
-			contributions[ numCon ].ambient[0] = floodlightRGB[0] * floodlightIntensity * f * ambientFrac;
-			contributions[ numCon ].ambient[1] = floodlightRGB[1] * floodlightIntensity * f * ambientFrac;
-			contributions[ numCon ].ambient[2] = floodlightRGB[2] * floodlightIntensity * f * ambientFrac;
+			contributions[ numCon ].ambient[0] = floodlightRGB[0] * floodlightIntensity * f * ambientFrac;
+			contributions[ numCon ].ambient[1] = floodlightRGB[1] * floodlightIntensity * f * ambientFrac;
+			contributions[ numCon ].ambient[2] = floodlightRGB[2] * floodlightIntensity * f * ambientFrac;
+
+			contributions[ numCon ].dir[0] = dir[0];
+			contributions[ numCon ].dir[1] = dir[1];
+			contributions[ numCon ].dir[2] = dir[2];
+
+			contributions[ numCon ].style = 0;
+
+			/* push average direction around */
+			addSize = VectorLength( contributions[ numCon ].color );
+			VectorMA( gp->dir, addSize, dir, gp->dir );
+
+			numCon++;
+		}
+	}
+	/////////////////////
+
+	/* normalize to get primary light direction */
+	VectorNormalize( gp->dir, thisdir );
+
+	/* now that we have identified the primary light direction,
+	   go back and separate all the light into directed and ambient */
+
+	numStyles = 1;
+	for ( i = 0; i < numCon; i++ )
+	{
+		/* get relative directed strength */
+		d = DotProduct( contributions[ i ].dir, thisdir );
+		/* we map 1 to gridDirectionality, and 0 to gridAmbientDirectionality */
+		d = gridAmbientDirectionality + d * ( gridDirectionality - gridAmbientDirectionality );
+		if ( d < 0.0f ) {
+			d = 0.0f;
+		}
+
+		/* find appropriate style */
+		for ( j = 0; j < numStyles; j++ )
+		{
+			if ( gp->styles[ j ] == contributions[ i ].style ) {
+				break;
+			}
+		}
+
+		/* style not found? */
+		if ( j >= numStyles ) {
+			/* add a new style */
+			if ( numStyles < MAX_LIGHTMAPS ) {
+				gp->styles[ numStyles ] = contributions[ i ].style;
+				bgp->styles[ numStyles ] = contributions[ i ].style;
+				numStyles++;
+				//%	Sys_Printf( "(%d, %d) ", num, contributions[ i ].style );
+			}
+
+			/* fallback */
+			else{
+				j = 0;
+			}
+		}
+
+		/* add the directed color */
+		VectorMA( gp->directed[ j ], d, contributions[ i ].color, gp->directed[ j ] );
+
+		/* ambient light will be at 1/4 the value of directed light */
+		/* (ydnar: nuke this in favor of more dramatic lighting?) */
+		/* (PM: how about actually making it work? d=1 when it got here for single lights/sun :P */
+//		d = 0.25f;
+		/* (Hobbes: always setting it to .25 is hardly any better) */
+		d = 0.25f * ( 1.0f - d );
+		VectorMA( gp->ambient[ j ], d, contributions[ i ].color, gp->ambient[ j ] );
+
+		VectorAdd( gp->ambient[ j ], contributions[ i ].ambient, gp->ambient[ j ] );
+
+/*
+ * div0:
+ * the total light average = ambient value + 0.25 * sum of all directional values
+ * we can also get the total light average as 0.25 * the sum of all contributions
+ *
+ * 0.25 * sum(contribution_i) == ambient + 0.25 * sum(d_i contribution_i)
+ *
+ * THIS YIELDS:
+ * ambient == 0.25 * sum((1 - d_i) contribution_i)
+ *
+ * So, 0.25f * (1.0f - d) IS RIGHT. If you want to tune it, tune d BEFORE.
+ */
+	}
+
+
+	/* store off sample */
+	StoreGridPoint( gp, bgp );
+
+	/* debug code */
+	#if 0
+	//%	Sys_FPrintf( SYS_VRB, "%10d %10d %10d ", &gp->ambient[ 0 ][ 0 ], &gp->ambient[ 0 ][ 1 ], &gp->ambient[ 0 ][ 2 ] );
+	Sys_FPrintf( SYS_VRB, "%9d Amb: (%03.1f %03.1f %03.1f) Dir: (%03.1f %03.1f %03.1f)\n",
+				 num,
+				 gp->ambient[ 0 ][ 0 ], gp->ambient[ 0 ][ 1 ], gp->ambient[ 0 ][ 2 ],
+				 gp->directed[ 0 ][ 0 ], gp->directed[ 0 ][ 1 ], gp->directed[ 0 ][ 2 ] );
+	#endif
+}
+
+
+
+/*
+   TraceGridPoints()
+   traces the listed grid points, with light workers each process traces the chunks it claims
+   and reads the others
+ */
+
+static int              *traceGridPoints;       /* NULL for all of them */
+static int numTraceGridPoints, firstChunkGridPoint, numGridChunks;
+
+static int TraceGridPointNum( int num ){
+	return traceGridPoints != NULL ? traceGridPoints[ num ] : num;
+}
+
+static void TraceListGridPoint( int num ){
+	TraceGrid( traceGridPoints[ num ] );
+}
+
+static void TraceChunkGridPoint( int num ){
+	BeatLightWork();
+	TraceGrid( TraceGridPointNum( firstChunkGridPoint + num ) );
+}
+
+static int GridChunkPoints( int chunk, int *first ){
+	*first = (int) ( (double) chunk * numTraceGridPoints / numGridChunks );
+	return (int) ( (double) ( chunk + 1 ) * numTraceGridPoints / numGridChunks ) - *first;
+}
+
+static void TraceGridChunk( int chunk, FILE *file ){
+	int i, j, num;
+
+
+	num = GridChunkPoints( chunk, &firstChunkGridPoint );
+	RunThreadsOnIndividual( num, qfalse, TraceChunkGridPoint );
+
+	/* consecutive points go in one record */
+	for ( i = 0; i < num; i = j )
+	{
+		for ( j = i + 1; j < num && TraceGridPointNum( firstChunkGridPoint + j ) == TraceGridPointNum( firstChunkGridPoint + j - 1 ) + 1; j++ )
+			;
+		WriteLightWorkGrid( file, TraceGridPointNum( firstChunkGridPoint + i ), j - i );
+	}
+}
+
+static void ReadGridChunk( int chunk, FILE *file, const char *path ){
+	int i, j, first, num;
+
+
+	num = GridChunkPoints( chunk, &first );
+	for ( i = 0; i < num; i = j )
+	{
+		for ( j = i + 1; j < num && TraceGridPointNum( first + j ) == TraceGridPointNum( first + j - 1 ) + 1; j++ )
+			;
+		ReadLightWorkGrid( file, path, TraceGridPointNum( first + i ), j - i );
+	}
+}
+
+static void TraceGridPoints( void ){
+	if ( numTraceGridPoints <= 0 ) {
+		return;
+	}
+	if ( !lightWorkShared ) {
+		if ( traceGridPoints == NULL ) {
+			RunThreadsOnIndividual( numTraceGridPoints, qtrue, TraceGrid );
+		}
+		else{
+			RunThreadsOnIndividual( numTraceGridPoints, qtrue, TraceListGridPoint );
+		}
+		return;
+	}
+	numGridChunks = numTraceGridPoints < LIGHT_WORK_CHUNKS ? numTraceGridPoints : LIGHT_WORK_CHUNKS;
+	RunLightWork( numGridChunks, TraceGridChunk, ReadGridChunk );
+}
+
+
+
+/*
+   TraceAdaptiveGrid()
+   with -adaptivegrid, traces every ADAPTIVE_GRID_STEP-th point and halves the spacing from
+   there; a point between lattice points lit alike, with no light between them, is interpolated
+   from them instead of being traced. the first pass decides which points are traced, the
+   bounce passes adding to the grid follow it
+ */
+
+static int              *gridLightCounts;       /* lights nearest to the grid points, summed up over the lattice */
+static qboolean adaptiveGridDecided;
+
+static void CountGridLights( void ){
+	int i, x, y, z, c[ 3 ], sizes[ 3 ], strides[ 3 ];
+	light_t         *light;
+
+
+	/* one more along each side, for the sums to start at 0 */
+	for ( i = 0; i < 3; i++ )
+		sizes[ i ] = gridBounds[ i ] + 1;
+	strides[ 0 ] = 1;
+	strides[ 1 ] = sizes[ 0 ];
+	strides[ 2 ] = sizes[ 0 ] * sizes[ 1 ];
+	gridLightCounts = safe_malloc0( sizes[ 0 ] * sizes[ 1 ] * sizes[ 2 ] * sizeof( *gridLightCounts ) );
+
+	/* count the lights at the points nearest to them */
+	for ( light = lights; light != NULL; light = light->next )
+	{
+		if ( light->type == EMIT_SUN || !( light->flags & LIGHT_GRID ) ) {
+			continue;
+		}
+		for ( i = 0; i < 3; i++ )
+		{
+			c[ i ] = (int) floor( ( light->origin[ i ] - gridMins[ i ] ) / gridSize[ i ] + 0.5f );
+			if ( c[ i ] < 0 || c[ i ] >= gridBounds[ i ] ) {
+				break;
+			}
+		}
+		if ( i < 3 ) {
+			continue;
+		}
+		gridLightCounts[ ( c[ 0 ] + 1 ) * strides[ 0 ] + ( c[ 1 ] + 1 ) * strides[ 1 ] + ( c[ 2 ] + 1 ) * strides[ 2 ] ]++;
+	}
+
+	/* sum them up along each axis */
+	for ( i = 0; i < 3; i++ )
+	{
+		for ( z = ( i == 2 ); z < sizes[ 2 ]; z++ )
+			for ( y = ( i == 1 ); y < sizes[ 1 ]; y++ )
+				for ( x = ( i == 0 ); x < sizes[ 0 ]; x++ )
+					gridLightCounts[ x + y * strides[ 1 ] + z * strides[ 2 ] ] += gridLightCounts[ x + y * strides[ 1 ] + z * strides[ 2 ] - strides[ i ] ];
+	}
+}
+
+static int GridLightsInBox( const int lo[ 3 ], const int hi[ 3 ] ){
+	int i, j, num, count, strides[ 3 ];
+
+
+	strides[ 0 ] = 1;
+	strides[ 1 ] = gridBounds[ 0 ] + 1;
+	strides[ 2 ] = strides[ 1 ] * ( gridBounds[ 1 ] + 1 );
+
+	/* add and take away the sums at the corners */
+	count = 0;
+	for ( j = 0; j < 8; j++ )
+	{
+		num = 0;
+		for ( i = 0; i < 3; i++ )
+			num += ( ( j & ( 1 << i ) ) ? lo[ i ] : hi[ i ] + 1 ) * strides[ i ];
+		count += ( ( j & 1 ) ^ ( ( j >> 1 ) & 1 ) ^ ( ( j >> 2 ) & 1 ) ) ? -gridLightCounts[ num ] : gridLightCounts[ num ];
+	}
+	return count;
+}
+
+static int GridPointStep( int num ){
+	int i, step, coords[ 3 ];
+
+
+	/* the coarsest lattice the point is on, the last point along each side is on all of them */
+	GridPointCoords( num, coords );
+	for ( step = ADAPTIVE_GRID_STEP; step > 1; step >>= 1 )
+	{
+		for ( i = 0; i < 3; i++ )
+		{
+			if ( coords[ i ] % step != 0 && coords[ i ] != gridBounds[ i ] - 1 ) {
+				break;
+			}
+		}
+		if ( i == 3 ) {
+			break;
+		}
+	}
+	return step;
+}
+
+static int GridPointCorners( int num, int step, int lo[ 3 ], int hi[ 3 ], int corners[ 8 ], float weights[ 8 ] ){
+	int i, j, numCorners, coords[ 3 ], c[ 3 ];
+	float t[ 3 ], weight;
+
+
+	/* the points of the lattice twice as coarse around it */
+	GridPointCoords( num, coords );
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( coords[ i ] % ( step * 2 ) == 0 || coords[ i ] == gridBounds[ i ] - 1 ) {
+			lo[ i ] = hi[ i ] = coords[ i ];
+			t[ i ] = 0.0f;
+		}
+		else
+		{
+			lo[ i ] = coords[ i ] - step;
+			hi[ i ] = coords[ i ] + step;
+			if ( hi[ i ] > gridBounds[ i ] - 1 ) {
+				hi[ i ] = gridBounds[ i ] - 1;
+			}
+			t[ i ] = (float) ( coords[ i ] - lo[ i ] ) / ( hi[ i ] - lo[ i ] );
+		}
+	}
+
+	/* weigh them */
+	numCorners = 0;
+	for ( j = 0; j < 8; j++ )
+	{
+		weight = 1.0f;
+		for ( i = 0; i < 3 && weight > 0.0f; i++ )
+		{
+			if ( j & ( 1 << i ) ) {
+				c[ i ] = hi[ i ];
+				weight *= lo[ i ] != hi[ i ] ? t[ i ] : 0.0f;
+			}
+			else
+			{
+				c[ i ] = lo[ i ];
+				weight *= 1.0f - t[ i ];
+			}
+		}
+		if ( weight <= 0.0f ) {
+			continue;
+		}
+		corners[ numCorners ] = c[ 0 ] + gridBounds[ 0 ] * ( c[ 1 ] + gridBounds[ 1 ] * c[ 2 ] );
+		weights[ numCorners ] = weight;
+		numCorners++;
+	}
+	return numCorners;
+}
+
+static qboolean GridPointVaries( int num, int step ){
+	int i, j, k, lo[ 3 ], hi[ 3 ], corners[ 8 ], numCorners, mins[ MAX_LIGHTMAPS ][ 6 ], maxs[ MAX_LIGHTMAPS ][ 6 ], value;
+	float weights[ 8 ], directed;
+	vec3_t origin, dir, firstDir;
+	bspGridPoint_t  *bgp, *firstBgp;
+
+
+	/* a point nudged out of solid is next to a wall */
+	GridPointOrigin( num, origin );
+	if ( !VectorCompare( origin, gridPointOrigins[ num ] ) ) {
+		return qtrue;
+	}
+
+	/* a light between the points around it lights it unlike them */
+	numCorners = GridPointCorners( num, step, lo, hi, corners, weights );
+	if ( GridLightsInBox( lo, hi ) > 0 ) {
+		return qtrue;
+	}
+
+	/* so do points around it in solid, with other styles or lit unlike each other */
+	firstBgp = &bspGridPoints[ corners[ 0 ] ];
+	VectorClear( firstDir );
+	for ( k = 0; k < numCorners; k++ )
+	{
+		if ( gridPointClusters[ corners[ k ] ] < 0 ) {
+			return qtrue;
+		}
+		bgp = &bspGridPoints[ corners[ k ] ];
+		if ( memcmp( bgp->styles, firstBgp->styles, sizeof( bgp->styles ) ) ) {
+			return qtrue;
+		}
+
+		/* the colors */
+		directed = 0.0f;
+		for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+		{
+			if ( bgp->styles[ i ] == LS_NONE ) {
+				continue;
+			}
+			for ( j = 0; j < 6; j++ )
+			{
+				value = j < 3 ? bgp->ambient[ i ][ j ] : bgp->directed[ i ][ j - 3 ];
+				if ( k == 0 || value < mins[ i ][ j ] ) {
+					mins[ i ][ j ] = value;
+				}
+				if ( k == 0 || value > maxs[ i ][ j ] ) {
+					maxs[ i ][ j ] = value;
+				}
+				if ( maxs[ i ][ j ] - mins[ i ][ j ] > adaptiveGridTolerance ) {
+					return qtrue;
+				}
+				if ( j >= 3 && value > directed ) {
+					directed = value;
+				}
+			}
+		}
+
+		/* the direction, as far as the directed light shows it */
+		VectorNormalize( rawGridPoints[ corners[ k ] ].dir, dir );
+		VectorScale( dir, directed, dir );
+		if ( k == 0 ) {
+			VectorCopy( dir, firstDir );
+		}
+		VectorSubtract( dir, firstDir, dir );
+		if ( VectorLength( dir ) > adaptiveGridTolerance ) {
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+static void InterpolateGridPoint( int num, int step ){
+	int i, j, k, lo[ 3 ], hi[ 3 ], corners[ 8 ], numCorners, numStyles;
+	float weights[ 8 ];
+	rawGridPoint_t  *gp, *cgp;
+	bspGridPoint_t  *bgp;
 
-			contributions[ numCon ].dir[0] = dir[0];
-			contributions[ numCon ].dir[1] = dir[1];
-			contributions[ numCon ].dir[2] = dir[2];
 
-			contributions[ numCon ].style = 0;
+	/* get grid points */
+	gp = &rawGridPoints[ num ];
+	bgp = &bspGridPoints[ num ];
 
-			/* push average direction around */
-			addSize = VectorLength( contributions[ numCon ].color );
-			VectorMA( gp->dir, addSize, dir, gp->dir );
+	/* clear */
+	VectorClear( gp->dir );
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+		VectorClear( gp->ambient[ i ] );
+		VectorClear( gp->directed[ i ] );
+		gp->styles[ i ] = LS_NONE;
+	}
+	gp->styles[ 0 ] = LS_NORMAL;
+	numStyles = 1;
 
-			numCon++;
+	/* blend the points around it, style by style */
+	numCorners = GridPointCorners( num, step, lo, hi, corners, weights );
+	for ( k = 0; k < numCorners; k++ )
+	{
+		cgp = &rawGridPoints[ corners[ k ] ];
+		VectorMA( gp->dir, weights[ k ], cgp->dir, gp->dir );
+		for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+		{
+			if ( cgp->styles[ i ] == LS_NONE ) {
+				continue;
+			}
+			for ( j = 0; j < numStyles; j++ )
+			{
+				if ( gp->styles[ j ] == cgp->styles[ i ] ) {
+					break;
+				}
+			}
+			if ( j >= numStyles ) {
+				if ( numStyles < MAX_LIGHTMAPS ) {
+					gp->styles[ numStyles++ ] = cgp->styles[ i ];
+				}
+				else{
+					j = 0;
+				}
+			}
+			VectorMA( gp->ambient[ j ], weights[ k ], cgp->ambient[ i ], gp->ambient[ j ] );
+			VectorMA( gp->directed[ j ], weights[ k ], cgp->directed[ i ], gp->directed[ j ] );
 		}
 	}
-	/////////////////////
+	for ( i = numStyles; i < MAX_LIGHTMAPS; i++ )
+		VectorCopy( ambientColor, gp->ambient[ i ] );
 
-	/* normalize to get primary light direction */
-	VectorNormalize( gp->dir, thisdir );
+	/* store off sample */
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+		bgp->styles[ i ] = gp->styles[ i ];
+	StoreGridPoint( gp, bgp );
+}
 
-	/* now that we have identified the primary light direction,
-	   go back and separate all the light into directed and ambient */
+static void TraceAdaptiveGrid( void ){
+	int num, step, numInterpolated;
 
-	numStyles = 1;
-	for ( i = 0; i < numCon; i++ )
+
+	/* where the lights are */
+	if ( !adaptiveGridDecided ) {
+		CountGridLights();
+	}
+
+	/* from the coarsest lattice on */
+	traceGridPoints = safe_malloc( numRawGridPoints * sizeof( *traceGridPoints ) );
+	for ( step = ADAPTIVE_GRID_STEP; step >= 1; step >>= 1 )
 	{
-		/* get relative directed strength */
-		d = DotProduct( contributions[ i ].dir, thisdir );
-		/* we map 1 to gridDirectionality, and 0 to gridAmbientDirectionality */
-		d = gridAmbientDirectionality + d * ( gridDirectionality - gridAmbientDirectionality );
-		if ( d < 0.0f ) {
-			d = 0.0f;
+		/* the points to trace */
+		numTraceGridPoints = 0;
+		for ( num = 0; num < numRawGridPoints; num++ )
+		{
+			if ( gridPointClusters[ num ] < 0 || GridPointStep( num ) != step ) {
+				continue;
+			}
+			if ( !adaptiveGridDecided ) {
+				if ( step == ADAPTIVE_GRID_STEP || GridPointVaries( num, step ) ) {
+					gridPointFlags[ num ] |= GRID_POINT_TRACED;
+				}
+				else{
+					gridPointFlags[ num ] |= GRID_POINT_INTERPOLATED;
+				}
+			}
+			if ( gridPointFlags[ num ] & GRID_POINT_TRACED ) {
+				traceGridPoints[ numTraceGridPoints++ ] = num;
+			}
 		}
+		TraceGridPoints();
 
-		/* find appropriate style */
-		for ( j = 0; j < numStyles; j++ )
+		/* and the ones between them */
+		for ( num = 0; num < numRawGridPoints; num++ )
 		{
-			if ( gp->styles[ j ] == contributions[ i ].style ) {
-				break;
+			if ( ( gridPointFlags[ num ] & GRID_POINT_INTERPOLATED ) && GridPointStep( num ) == step ) {
+				InterpolateGridPoint( num, step );
 			}
 		}
+	}
+	free( traceGridPoints );
+	traceGridPoints = NULL;
 
-		/* style not found? */
-		if ( j >= numStyles ) {
-			/* add a new style */
-			if ( numStyles < MAX_LIGHTMAPS ) {
-				gp->styles[ numStyles ] = contributions[ i ].style;
-				bgp->styles[ numStyles ] = contributions[ i ].style;
-				numStyles++;
-				//%	Sys_Printf( "(%d, %d) ", num, contributions[ i ].style );
-			}
+	/* note it */
+	if ( !adaptiveGridDecided ) {
+		free( gridLightCounts );
+		gridLightCounts = NULL;
+		adaptiveGridDecided = qtrue;
 
-			/* fallback */
-			else{
-				j = 0;
+		numInterpolated = 0;
+		for ( num = 0; num < numRawGridPoints; num++ )
+		{
+			if ( gridPointFlags[ num ] & GRID_POINT_INTERPOLATED ) {
+				numInterpolated++;
 			}
 		}
-
-		/* add the directed color */
-		VectorMA( gp->directed[ j ], d, contributions[ i ].color, gp->directed[ j ] );
-
-		/* ambient light will be at 1/4 the value of directed light */
-		/* (ydnar: nuke this in favor of more dramatic lighting?) */
-		/* (PM: how about actually making it work? d=1 when it got here for single lights/sun :P */
-//		d = 0.25f;
-		/* (Hobbes: always setting it to .25 is hardly any better) */
-		d = 0.25f * ( 1.0f - d );
-		VectorMA( gp->ambient[ j ], d, contributions[ i ].color, gp->ambient[ j ] );
-
-		VectorAdd( gp->ambient[ j ], contributions[ i ].ambient, gp->ambient[ j ] );
+		Sys_Printf( "%9d grid points interpolated\n", numInterpolated );
+	}
+}
 
 /*
- * div0:
- * the total light average = ambient value + 0.25 * sum of all directional values
- * we can also get the total light average as 0.25 * the sum of all contributions
- *
- * 0.25 * sum(contribution_i) == ambient + 0.25 * sum(d_i contribution_i)
- *
- * THIS YIELDS:
- * ambient == 0.25 * sum((1 - d_i) contribution_i)
- *
- * So, 0.25f * (1.0f - d) IS RIGHT. If you want to tune it, tune d BEFORE.
+   RunTraceGrid()
+   traces the grid for a pass
  */
-	}
 
+static void RunTraceGrid( void ){
+	int i;
+	vec3_t              *origins;
 
-	/* store off sample */
-	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
-	{
-#if 0
-		/* do some fudging to keep the ambient from being too low (2003-07-05: 0.25 -> 0.125) */
-		if ( !bouncing ) {
-			VectorMA( gp->ambient[ i ], 0.125f, gp->directed[ i ], gp->ambient[ i ] );
-		}
-#endif
 
-		/* set minimum light and copy off to bytes */
-		VectorCopy( gp->ambient[ i ], color );
-		for ( j = 0; j < 3; j++ )
-			if ( color[ j ] < minGridLight[ j ] ) {
-				color[ j ] = minGridLight[ j ];
+	if ( lightIncremental ) {
+		BeginLightCacheGrid();
+	}
+	inGrid = qtrue;
+
+	/* points in solid are nudged out at random, so every process sharing the grid out finds them
+	   all in the order a single one would, to trace them from the same place whoever claims them;
+	   -adaptivegrid traces them out of order and does the same */
+	if ( lightWorkShared || adaptiveGrid ) {
+		origins = safe_malloc( numRawGridPoints * sizeof( *origins ) );
+		gridPointClusters = safe_malloc( numRawGridPoints * sizeof( *gridPointClusters ) );
+		for ( i = 0; i < numRawGridPoints; i++ )
+		{
+			if ( !FindGridPointOrigin( i, origins[ i ], &gridPointClusters[ i ] ) ) {
+				gridPointClusters[ i ] = -1;
 			}
-
-		/* vortex: apply gridscale and gridambientscale here */
-		if (gp->directed[i][0] || gp->directed[i][1] || gp->directed[i][2]) {
-			/*
-			 * HACK: if there's a non-zero directed component, this
-			 * lightgrid cell is useful. However, ioq3 skips grid
-			 * cells with zero ambient. So let's force ambient to be
-			 * nonzero unless directed is zero too.
-			 */
-			ColorToBytesNonZero(color, bgp->ambient[i], gridScale * gridAmbientScale);
-		} else {
-		ColorToBytes( color, bgp->ambient[ i ], gridScale * gridAmbientScale );
 		}
-		ColorToBytes( gp->directed[ i ], bgp->directed[ i ], gridScale );
+		gridPointOrigins = origins;
 	}
 
-	/* debug code */
-	#if 0
-	//%	Sys_FPrintf( SYS_VRB, "%10d %10d %10d ", &gp->ambient[ 0 ][ 0 ], &gp->ambient[ 0 ][ 1 ], &gp->ambient[ 0 ][ 2 ] );
-	Sys_FPrintf( SYS_VRB, "%9d Amb: (%03.1f %03.1f %03.1f) Dir: (%03.1f %03.1f %03.1f)\n",
-				 num,
-				 gp->ambient[ 0 ][ 0 ], gp->ambient[ 0 ][ 1 ], gp->ambient[ 0 ][ 2 ],
-				 gp->directed[ 0 ][ 0 ], gp->directed[ 0 ][ 1 ], gp->directed[ 0 ][ 2 ] );
-	#endif
+	if ( adaptiveGrid ) {
+		TraceAdaptiveGrid();
+	}
+	else
+	{
+		numTraceGridPoints = numRawGridPoints;
+		TraceGridPoints();
+	}
 
-	/* store direction */
-	NormalToLatLong( thisdir, bgp->latLong );
+	if ( gridPointOrigins != NULL ) {
+		free( gridPointOrigins );
+		gridPointOrigins = NULL;
+		free( gridPointClusters );
+		gridPointClusters = NULL;
+	}
+
+	inGrid = qfalse;
+	if ( lightIncremental ) {
+		EndLightCacheGrid();
+	}
 }
 
 
@@ -1887,6 +2669,48 @@ void SetupGrid( void ){
 
 	/* note it */
 	Sys_Printf( "%9d grid points\n", numRawGridPoints );
+
+	/* find the ones in solid */
+	SetupGridContents();
+	adaptiveGridDecided = qfalse;
+}
+
+
+
+/*
+   PrintLightCutStats()
+   emits how much the light cuts clustered the lights of the luxel blocks
+ */
+
+static void PrintLightCutStats( void ){
+	if ( !lightCuts || numLightCutBlocks <= 0 ) {
+		return;
+	}
+	Sys_Printf( "%9d luxel blocks lit through light cuts\n", numLightCutBlocks );
+	Sys_Printf( "%9.1f lights or clusters per block, of %.1f clustered lights\n",
+				numLightCutClusters / numLightCutBlocks, numLightCutLights / numLightCutBlocks );
+}
+
+
+
+/*
+   PrintPeakMemory()
+   emits the most memory the process held in the stage just done and how that compares to the
+   stage before; where the peak can not be started over per stage, it is the peak so far
+ */
+
+static void PrintPeakMemory( void ){
+	static size_t lastPeak;
+	static qboolean perStage;
+	size_t peak;
+
+	peak = Q_PeakMemory();
+	if ( peak > 0 ) {
+		Sys_Printf( "%9.1f MB peak memory %s (%+.1f MB)\n", peak / ( 1024.0 * 1024.0 ),
+					perStage ? "in this stage" : "so far", ( (double) peak - (double) lastPeak ) / ( 1024.0 * 1024.0 ) );
+	}
+	lastPeak = peak;
+	perStage = Q_ResetPeakMemory();
 }
 
 
@@ -1978,15 +2802,18 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 		SetupEnvelopes( qtrue, fastgrid );
 
 		Sys_Printf( "--- TraceGrid ---\n" );
-		inGrid = qtrue;
-		RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
-		inGrid = qfalse;
+		RunTraceGrid();
 		Sys_Printf( "%d x %d x %d = %d grid\n",
 					gridBounds[ 0 ], gridBounds[ 1 ], gridBounds[ 2 ], numBSPGridPoints );
+		if ( lightIncremental ) {
+			Sys_Printf( "%9d grid points from the light cache\n", numGridPointsCached );
+		}
 
 		/* ydnar: emit statistics on light culling */
 		Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
 		Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+		Sys_FPrintf( SYS_VRB, "%9d grid points index culled\n", gridIndexCulled );
+		PrintPeakMemory();
 	}
 
 	/* slight optimization to remove a sqrt */
@@ -1998,40 +2825,64 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 	Sys_Printf( "%9d luxels\n", numLuxels );
 	Sys_Printf( "%9d luxels mapped\n", numLuxelsMapped );
 	Sys_Printf( "%9d luxels occluded\n", numLuxelsOccluded );
+	PrintPeakMemory();
+
+	/* ydnar: set up light envelopes */
+	SetupEnvelopes( qfalse, fast );
+
+	/* the raw lightmaps the light cache has need no floodlight either */
+	if ( lightIncremental ) {
+		FindCachedRawLightmaps();
+	}
 
 	/* dirty them up */
 	if ( dirty ) {
-		Sys_Printf( "--- DirtyRawLightmap ---\n" );
-		RunThreadsOnIndividual( numRawLightmaps, qtrue, DirtyRawLightmap );
+		DirtyRawLightmaps();
+		PrintPeakMemory();
 	}
 
 	/* floodlight pass */
 	FloodlightRawLightmaps();
-
-	/* ydnar: set up light envelopes */
-	SetupEnvelopes( qfalse, fast );
+	PrintPeakMemory();
 
 	/* light up my world */
 	lightsPlaneCulled = 0;
 	lightsEnvelopeCulled = 0;
 	lightsBoundsCulled = 0;
 	lightsClusterCulled = 0;
+	lightsIndexCulled = 0;
+
+	numLightCutBlocks = 0;
+	numLightCutLights = 0;
+	numLightCutClusters = 0;
+	numLuxelSubsamples = 0;
+	numRawLightmapsCached = 0;
 
 	Sys_Printf( "--- IlluminateRawLightmap ---\n" );
-	RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
+	IlluminateRawLightmaps();
 	Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+	if ( lightIncremental ) {
+		Sys_Printf( "%9d raw lightmaps from the light cache\n", numRawLightmapsCached );
+	}
+	if ( lightSamples > 1 || lightRandomSamples ) {
+		Sys_Printf( "%9d luxel subsamples traced\n", numLuxelSubsamples );
+	}
+	PrintLightCutStats();
+	PrintPeakMemory();
 
 	StitchSurfaceLightmaps();
 
 	Sys_Printf( "--- IlluminateVertexes ---\n" );
 	RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
 	Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
+	PrintPeakMemory();
 
 	/* ydnar: emit statistics on light culling */
 	Sys_FPrintf( SYS_VRB, "%9d lights plane culled\n", lightsPlaneCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights envelope culled\n", lightsEnvelopeCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights bounds culled\n", lightsBoundsCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
+	Sys_FPrintf( SYS_VRB, "%9d lights index culled\n", lightsIndexCulled );
 
 	/* radiosity */
 	b = 1;
@@ -2039,10 +2890,11 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 
 	while ( bounce > 0 )
 	{
-		qboolean storeForReal = !noBounceStore;
+		qboolean storeForReal = !noBounceStore && !lightWorker;
 
 		/* store off the bsp between bounces */
-		StoreSurfaceLightmaps( fastAllocate, storeForReal );
+		StoreSurfaceLightmaps( fastAllocate, storeForReal, qfalse );
+		PrintPeakMemory();
 		UnparseEntities();
 
 		if ( storeForReal ) {
@@ -2055,6 +2907,7 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 
 		/* flag bouncing */
 		bouncing = qtrue;
+		bouncePass = b;
 		VectorClear( ambientColor );
 		floodlighty = qfalse;
 
@@ -2076,13 +2929,17 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 		if ( bouncegrid ) {
 			gridEnvelopeCulled = 0;
 			gridBoundsCulled = 0;
+			gridIndexCulled = 0;
 
 			Sys_Printf( "--- BounceGrid ---\n" );
-			inGrid = qtrue;
-			RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
-			inGrid = qfalse;
+			RunTraceGrid();
+			if ( lightIncremental ) {
+				Sys_Printf( "%9d grid points from the light cache\n", numGridPointsCached );
+			}
 			Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
 			Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+			Sys_FPrintf( SYS_VRB, "%9d grid points index culled\n", gridIndexCulled );
+			PrintPeakMemory();
 		}
 
 		/* light up my world */
@@ -2090,31 +2947,57 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate, qboolean noBoun
 		lightsEnvelopeCulled = 0;
 		lightsBoundsCulled = 0;
 		lightsClusterCulled = 0;
+		lightsIndexCulled = 0;
+
+		numBounceSamplesLit = 0;
+		numBounceSamplesCached = 0;
+		numLightCutBlocks = 0;
+		numLightCutLights = 0;
+		numLightCutClusters = 0;
+		numLuxelSubsamples = 0;
+		numRawLightmapsCached = 0;
 
 		Sys_Printf( "--- IlluminateRawLightmap ---\n" );
-		RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
+		IlluminateRawLightmaps();
 		Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
+		if ( lightIncremental ) {
+			Sys_Printf( "%9d raw lightmaps from the light cache\n", numRawLightmapsCached );
+		}
+		if ( bounceCacheSpacing > 0 ) {
+			Sys_Printf( "%9d luxel samples lit\n", numBounceSamplesLit );
+			Sys_Printf( "%9d luxel samples interpolated\n", numBounceSamplesCached );
+		}
+		if ( lightSamples > 1 || lightRandomSamples ) {
+			Sys_Printf( "%9d luxel subsamples traced\n", numLuxelSubsamples );
+		}
+		PrintLightCutStats();
+		PrintPeakMemory();
 
 		StitchSurfaceLightmaps();
 
 		Sys_Printf( "--- IlluminateVertexes ---\n" );
 		RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
+		PrintPeakMemory();
 
 		/* ydnar: emit statistics on light culling */
 		Sys_FPrintf( SYS_VRB, "%9d lights plane culled\n", lightsPlaneCulled );
 		Sys_FPrintf( SYS_VRB, "%9d lights envelope culled\n", lightsEnvelopeCulled );
 		Sys_FPrintf( SYS_VRB, "%9d lights bounds culled\n", lightsBoundsCulled );
 		Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
+		Sys_FPrintf( SYS_VRB, "%9d lights index culled\n", lightsIndexCulled );
 
 		/* interate */
 		bounce--;
 		b++;
 	}
 
-	/* ydnar: store off lightmaps */
-	StoreSurfaceLightmaps( fastAllocate, qtrue );
+	/* ydnar: store off lightmaps, a worker leaves that to the process it works for */
+	if ( !lightWorker ) {
+		StoreSurfaceLightmaps( fastAllocate, qtrue, qtrue );
+		PrintPeakMemory();
+	}
 }
 
 
@@ -2156,6 +3039,7 @@ int LightMain( int argc, char **argv ){
 	qboolean lightSamplesInsist = qfalse;
 	qboolean fastAllocate = qtrue;
 	qboolean noBounceStore = qfalse;
+	const char  *lightWorkRun = NULL;
 
 	/* note it */
 	Sys_Printf( "--- Light ---\n" );
@@ -2509,6 +3393,19 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Random sampling enabled\n", lightRandomSamples );
 		}
 
+		else if ( !strcmp( argv[ i ], "-adaptivesamples" ) ) {
+			lightAdaptiveSamples = qtrue;
+			Sys_Printf( "Variance driven sampling enabled\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-samplesbudget" ) ) {
+			lightSamplesBudget = atof( argv[ i + 1 ] );
+			if ( lightSamplesBudget < 0.0f ) {
+				lightSamplesBudget = 0.0f;
+			}
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-samples" ) ) {
 			if ( *argv[i + 1] == '+' ) {
 				lightSamplesInsist = qtrue;
@@ -2540,11 +3437,46 @@ int LightMain( int argc, char **argv ){
 			i++;
 		}
 
+		else if ( !strcmp( argv[ i ], "-tilesize" ) ) {
+			lightTileSize = atoi( argv[ i + 1 ] );
+			if ( lightTileSize <= 0 ) {
+				lightTileSize = 0;
+				Sys_Printf( "Illuminating raw lightmaps in one piece\n" );
+			}
+			else{
+				Sys_Printf( "Splitting raw lightmaps into tiles of %d x %d luxels\n", lightTileSize, lightTileSize );
+			}
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-filter" ) ) {
 			filter = qtrue;
 			Sys_Printf( "Lightmap filtering enabled\n" );
 		}
 
+		else if ( !strcmp( argv[ i ], "-denoise" ) ) {
+			denoise = qtrue;
+			Sys_Printf( "Edge-aware lightmap denoising enabled\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-denoisepasses" ) ) {
+			denoisePasses = atoi( argv[ i + 1 ] );
+			if ( denoisePasses < 1 ) {
+				denoisePasses = 1;
+			}
+			Sys_Printf( "Lightmap denoising with %d pass(es)\n", denoisePasses );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-denoisestrength" ) ) {
+			denoiseStrength = atof( argv[ i + 1 ] );
+			if ( denoiseStrength <= 0.0f ) {
+				denoiseStrength = 1.0f;
+			}
+			Sys_Printf( "Lightmap denoising strength set to %f\n", denoiseStrength );
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-dark" ) ) {
 			dark = qtrue;
 			Sys_Printf( "Dark lightmap seams enabled\n" );
@@ -2718,6 +3650,17 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Phong shading enabled\n" );
 		}
 
+		else if ( !strcmp( argv[ i ], "-bouncecache" ) ) {
+			bounceCacheSpacing = atoi( argv[ i + 1 ] );
+			if ( bounceCacheSpacing < 2 ) {
+				bounceCacheSpacing = 0;
+			}
+			else{
+				Sys_Printf( "Radiosity sampled every %d luxels\n", bounceCacheSpacing );
+			}
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-bouncegrid" ) ) {
 			bouncegrid = qtrue;
 			if ( bounce > 0 ) {
@@ -2792,6 +3735,20 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Cheap grid mode enabled\n" );
 		}
 
+		else if ( !strcmp( argv[ i ], "-adaptivegrid" ) ) {
+			adaptiveGrid = qtrue;
+			Sys_Printf( "Adaptive grid lighting enabled\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-adaptivegridtolerance" ) ) {
+			adaptiveGridTolerance = atof( argv[ i + 1 ] );
+			if ( adaptiveGridTolerance < 0.0f ) {
+				adaptiveGridTolerance = 0.0f;
+			}
+			Sys_Printf( "Adaptive grid lighting interpolates over color spreads up to %f\n", adaptiveGridTolerance );
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-normalmap" ) ) {
 			normalmap = qtrue;
 			Sys_Printf( "Storing normal map instead of lightmap\n" );
@@ -2908,6 +3865,10 @@ int LightMain( int argc, char **argv ){
 			noSurfaces = qtrue;
 			Sys_Printf( "Not tracing against surfaces\n" );
 		}
+		else if ( !strcmp( argv[ i ], "-bvh" ) ) {
+			traceBVH = qtrue;
+			Sys_Printf( "Tracing against surfaces through a bounding volume hierarchy\n" );
+		}
 		else if ( !strcmp( argv[ i ], "-dump" ) ) {
 			dump = qtrue;
 			Sys_Printf( "Dumping radiosity lights into numbered prefabs\n" );
@@ -2916,6 +3877,44 @@ int LightMain( int argc, char **argv ){
 			loMem = qtrue;
 			Sys_Printf( "Enabling low-memory (potentially slower) lighting mode\n" );
 		}
+		else if ( !strcmp( argv[ i ], "-compactlightmaps" ) ) {
+			compactLightmaps = qtrue;
+			Sys_Printf( "Keeping raw lightmaps packed between stages\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-incremental" ) ) {
+			lightIncremental = qtrue;
+			Sys_Printf( "Reusing what the lights that did not change lit in the last -incremental run\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-workers" ) ) {
+			lightWorkers = atoi( argv[ i + 1 ] );
+			if ( lightWorkers < 0 ) {
+				lightWorkers = 0;
+			}
+			Sys_Printf( "Sharing the light stage out with %d worker processes\n", lightWorkers );
+			i++;
+		}
+		else if ( !strcmp( argv[ i ], "-worker" ) ) {
+			lightWorker = qtrue;
+			lightWorkRun = argv[ i + 1 ];
+			Sys_Printf( "Working on light work %s\n", lightWorkRun );
+			i++;
+		}
+		else if ( !strcmp( argv[ i ], "-workertimeout" ) ) {
+			lightWorkTimeout = atoi( argv[ i + 1 ] );
+			if ( lightWorkTimeout < 1 ) {
+				lightWorkTimeout = 1;
+			}
+			Sys_Printf( "Lighting the chunks of workers quiet for %d seconds again\n", lightWorkTimeout );
+			i++;
+		}
+		else if ( !strcmp( argv[ i ], "-compactbatch" ) ) {
+			compactBatchSize = atoi( argv[ i + 1 ] );
+			if ( compactBatchSize < 1 ) {
+				compactBatchSize = 1;
+			}
+			Sys_Printf( "Unpacking up to %d MB of raw lightmaps at once\n", compactBatchSize );
+			i++;
+		}
 		else if ( !strcmp( argv[ i ], "-lightsubdiv" ) ) {
 			defaultLightSubdivide = atoi( argv[ i + 1 ] );
 			if ( defaultLightSubdivide < 1 ) {
@@ -2936,6 +3935,18 @@ int LightMain( int argc, char **argv ){
 				i++;
 			}
 		}
+		else if ( !strcmp( argv[ i ], "-lightcuts" ) ) {
+			lightCuts = qtrue;
+			Sys_Printf( "Clustering lights into light cuts\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-lightcutserror" ) ) {
+			lightCutsError = atof( argv[ i + 1 ] );
+			if ( lightCutsError < 0.0f ) {
+				lightCutsError = 0.0f;
+			}
+			Sys_Printf( "Light cut error threshold set to %f\n", lightCutsError );
+			i++;
+		}
 		else if ( !strcmp( argv[ i ], "-nostyle" ) || !strcmp( argv[ i ], "-nostyles" ) ) {
 			noStyles = qtrue;
 			Sys_Printf( "Disabling lightstyles\n" );
@@ -3064,7 +4075,10 @@ int LightMain( int argc, char **argv ){
 	}
 
 	/* fix up samples count */
-	if ( lightRandomSamples ) {
+	if ( lightAdaptiveSamples ) {
+		lightRandomSamples = qfalse;
+	}
+	if ( lightRandomSamples || lightAdaptiveSamples ) {
 		if ( !lightSamplesInsist ) {
 			/* approximately match -samples in quality */
 			switch ( lightSamples )
@@ -3093,6 +4107,17 @@ int LightMain( int argc, char **argv ){
 		}
 	}
 
+	/* by default, a quarter of what every shadow edge luxel could get, but no less than the pilot rounds */
+	if ( lightAdaptiveSamples ) {
+		if ( lightSamplesBudget <= 0.0f ) {
+			lightSamplesBudget = lightSamples * 0.25f;
+		}
+		if ( lightSamplesBudget < 8.0f ) {
+			lightSamplesBudget = 8.0f;
+		}
+		Sys_Printf( "Adaptive supersampling budget of %.1f sample(s) per shadow edge luxel\n", lightSamplesBudget );
+	}
+
 	/* fix up lightmap search power */
 	if ( lightmapMergeSize ) {
 		lightmapSearchBlockSize = ( lightmapMergeSize / lmCustomSize ) * ( lightmapMergeSize / lmCustomSize );
@@ -3103,6 +4128,12 @@ int LightMain( int argc, char **argv ){
 		Sys_Printf( "Restricted lightmap searching enabled - block size adjusted to %d\n", lightmapSearchBlockSize );
 	}
 
+	/* the light cache keeps what one process lit */
+	if ( lightIncremental && ( lightWorkers >= 0 || lightWorker ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: -incremental does not work with light workers, lighting everything\n" );
+		lightIncremental = qfalse;
+	}
+
 	/* arg checking */
 	if ( i != ( argc - 1 ) ) {
 		Error( "usage: q3map -light [options] <bspfile>" );
@@ -3163,9 +4194,30 @@ int LightMain( int argc, char **argv ){
 
 	/* initialize the surface facet tracing */
 	SetupTraceNodes();
+	PrintPeakMemory();
+
+	/* with -incremental, pick up what the last run lit */
+	if ( lightIncremental ) {
+		SetupLightCache( BSPFilePath, argc, argv );
+	}
+
+	/* with -workers or -worker, share the costly stages out between processes */
+	if ( lightWorkers >= 0 || lightWorker ) {
+		if ( !SetupLightWork( BSPFilePath, argc, argv, lightWorkers, lightWorkRun ) ) {
+			return 0;
+		}
+	}
 
 	/* light the world */
 	LightWorld( BSPFilePath, fastAllocate, noBounceStore );
+	if ( lightIncremental ) {
+		CloseLightCache();
+	}
+
+	/* a worker leaves the writing to the process it works for */
+	if ( lightWorker ) {
+		return 0;
+	}
 
 	/* write out the bsp */
 	UnparseEntities();
@@ -3176,6 +4228,7 @@ int LightMain( int argc, char **argv ){
 	if ( exportLightmaps && !externalLightmaps ) {
 		ExportLightmaps();
 	}
+	CloseLightWork();
 
 	/* return to sender */
 	return 0;
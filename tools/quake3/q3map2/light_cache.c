@@ -0,0 +1,940 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define LIGHT_CACHE_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+
+
+/*
+   with -incremental the light stage keeps what it lit in <map>.lightcache next to the bsp:
+   the final luxels of every raw lightmap per pass (the direct light, then each bounce), the
+   dirt of every raw lightmap and the light grid after each pass, each record keyed by the
+   lights that reached it; the file itself is keyed by the geometry, the worldspawn and the
+   light options, so a run only reuses a record when nothing but lights that did not reach it
+   changed, and lights everything else as usual; the light workers (see light_work.c) hand what
+   they lit to each other in the same records. the headers are little endian, but the records
+   hold luxels and grid points as they are in memory, so the byte order of the host goes into
+   the file key and a cache is only reused on hosts of the same byte order
+ */
+
+#define LIGHT_CACHE_IDENT       ( ( 'C' << 24 ) + ( 'L' << 16 ) + ( 'M' << 8 ) + 'Q' )
+#define LIGHT_CACHE_VERSION     1
+
+typedef enum
+{
+	LIGHT_CACHE_DIRT,
+	LIGHT_CACHE_LIGHTMAP,
+	LIGHT_CACHE_GRID
+}
+lightCacheType_t;
+
+typedef struct lightCacheHeader_s
+{
+	int ident, version;
+	uint64_t key;
+}
+lightCacheHeader_t;
+
+typedef struct lightCacheRecord_s
+{
+	int type, pass, num, size;
+	uint64_t key;
+}
+lightCacheRecord_t;
+
+typedef struct lightCacheEntry_s
+{
+	lightCacheRecord_t record;
+	long offset;
+}
+lightCacheEntry_t;
+
+typedef struct lightCacheReader_s
+{
+	FILE                *file;
+	const char          *path;
+	long offset;
+}
+lightCacheReader_t;
+
+static char lightCachePath[ 1024 ], newLightCachePath[ 1024 ];
+static uint64_t lightCacheKey;
+static FILE                 *oldLightCache, *newLightCache;
+static int numLightCacheEntries;
+static lightCacheEntry_t    *lightCacheEntries;
+
+static uint64_t             *gridChainKeys, *gridKeys, *oldGridKeys;
+static const lightCacheEntry_t  *gridEntry;
+
+
+
+/*
+   HashLightBytes() / MixLightHash()
+   fnv-1a, and a finalizer so hashes can be summed up in any order
+ */
+
+static uint64_t HashLightBytes( uint64_t hash, const void *data, int size ){
+	int i;
+
+
+	for ( i = 0; i < size; i++ )
+	{
+		hash ^= ( (const byte*) data )[ i ];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static uint64_t MixLightHash( uint64_t hash ){
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+#define HashLightValue( hash, value )   HashLightBytes( ( hash ), &( value ), sizeof( value ) )
+#define HashLightString( hash, s )      HashLightBytes( ( hash ), ( s ), strlen( s ) + 1 )
+
+
+
+/*
+   HashLightList()
+   sums up the keys of a list of lights, in whatever order the list has them
+ */
+
+static uint64_t HashLightList( uint64_t hash, light_t **lights, int numLights ){
+	int i;
+	uint64_t sum;
+
+
+	sum = 0;
+	for ( i = 0; i < numLights; i++ )
+		sum += MixLightHash( lights[ i ]->cacheKey );
+	hash = HashLightValue( hash, numLights );
+	return MixLightHash( MixLightHash( hash ) + sum );
+}
+
+
+
+/*
+   KeyLightCacheWorld()
+   hashes everything but the lights the light stage depends on: the command line, the
+   worldspawn, the bsp geometry and the lightmapped surfaces
+ */
+
+uint64_t KeyLightCacheWorld( int argc, char **argv ){
+	int i, version;
+	byte bigEndian;
+	uint64_t hash, sum;
+	epair_t             *ep;
+	bspDrawVert_t       *dv;
+	bspDrawSurface_t    *ds;
+	surfaceInfo_t       *info;
+
+
+	/* the version, and the byte order, as the cached records are stored in host order */
+	version = LIGHT_CACHE_VERSION;
+	hash = HashLightValue( 0xCBF29CE484222325ULL, version );
+	bigEndian = GDEF_ARCH_ENDIAN_BIG;
+	hash = HashLightValue( hash, bigEndian );
+
+	/* the options, but not the map name and the ones that only say how the work is done */
+	for ( i = 1; i < argc - 1; i++ )
+	{
+		if ( argv[ i ] == NULL || !strcmp( argv[ i ], "-incremental" ) ) {
+			continue;
+		}
+		if ( !strcmp( argv[ i ], "-workers" ) || !strcmp( argv[ i ], "-worker" ) || !strcmp( argv[ i ], "-workertimeout" ) ) {
+			i++;
+			continue;
+		}
+		hash = HashLightString( hash, argv[ i ] );
+	}
+
+	/* the worldspawn, in whatever order it is parsed in, without the keys compiling adds and the
+	   sun keys, which only make lights that are keyed like all others */
+	sum = 0;
+	for ( ep = entities[ 0 ].epairs; ep != NULL; ep = ep->next )
+	{
+		if ( !Q_strncasecmp( ep->key, "_q3map2_", 8 ) ||
+			 !Q_strncasecmp( ep->key, "_sun", 4 ) ||
+			 !Q_stricmp( ep->key, "_noshadersun" ) ||
+			 !Q_stricmp( ep->key, "_light" ) ) {
+			continue;
+		}
+		sum += MixLightHash( HashLightString( HashLightString( 0xCBF29CE484222325ULL, ep->key ), ep->value ) );
+	}
+	hash = HashLightValue( hash, sum );
+
+	/* the bsp, without what light writes into it */
+	hash = HashLightBytes( hash, bspShaders, numBSPShaders * sizeof( *bspShaders ) );
+	hash = HashLightBytes( hash, bspModels, numBSPModels * sizeof( *bspModels ) );
+	hash = HashLightBytes( hash, bspPlanes, numBSPPlanes * sizeof( *bspPlanes ) );
+	hash = HashLightBytes( hash, bspNodes, numBSPNodes * sizeof( *bspNodes ) );
+	hash = HashLightBytes( hash, bspLeafs, numBSPLeafs * sizeof( *bspLeafs ) );
+	hash = HashLightBytes( hash, bspLeafSurfaces, numBSPLeafSurfaces * sizeof( *bspLeafSurfaces ) );
+	hash = HashLightBytes( hash, bspLeafBrushes, numBSPLeafBrushes * sizeof( *bspLeafBrushes ) );
+	hash = HashLightBytes( hash, bspBrushes, numBSPBrushes * sizeof( *bspBrushes ) );
+	hash = HashLightBytes( hash, bspBrushSides, numBSPBrushSides * sizeof( *bspBrushSides ) );
+	hash = HashLightBytes( hash, bspVisBytes, numBSPVisBytes );
+	hash = HashLightBytes( hash, bspDrawIndexes, numBSPDrawIndexes * sizeof( *bspDrawIndexes ) );
+	for ( i = 0, dv = bspDrawVerts; i < numBSPDrawVerts; i++, dv++ )
+	{
+		hash = HashLightValue( hash, dv->xyz );
+		hash = HashLightValue( hash, dv->st );
+		hash = HashLightValue( hash, dv->normal );
+	}
+	for ( i = 0, ds = bspDrawSurfaces; i < numBSPDrawSurfaces; i++, ds++ )
+	{
+		hash = HashLightValue( hash, ds->shaderNum );
+		hash = HashLightValue( hash, ds->fogNum );
+		hash = HashLightValue( hash, ds->surfaceType );
+		hash = HashLightValue( hash, ds->firstVert );
+		hash = HashLightValue( hash, ds->numVerts );
+		hash = HashLightValue( hash, ds->firstIndex );
+		hash = HashLightValue( hash, ds->numIndexes );
+		hash = HashLightValue( hash, ds->patchWidth );
+		hash = HashLightValue( hash, ds->patchHeight );
+	}
+
+	/* the surfaces as the light stage sees them, with the .srf settings */
+	for ( i = 0, info = surfaceInfos; i < numBSPDrawSurfaces; i++, info++ )
+	{
+		hash = HashLightString( hash, info->si->shader );
+		hash = HashLightValue( hash, info->modelindex );
+		hash = HashLightValue( hash, info->parentSurfaceNum );
+		hash = HashLightValue( hash, info->childSurfaceNum );
+		hash = HashLightValue( hash, info->entityNum );
+		hash = HashLightValue( hash, info->castShadows );
+		hash = HashLightValue( hash, info->recvShadows );
+		hash = HashLightValue( hash, info->sampleSize );
+		hash = HashLightValue( hash, info->patchIterations );
+		hash = HashLightValue( hash, info->longestCurve );
+		hash = HashLightValue( hash, info->axis );
+		hash = HashLightValue( hash, info->mins );
+		hash = HashLightValue( hash, info->maxs );
+		hash = HashLightValue( hash, info->hasLightmap );
+		hash = HashLightValue( hash, info->approximated );
+		if ( info->plane != NULL ) {
+			hash = HashLightBytes( hash, info->plane, 4 * sizeof( float ) );
+		}
+	}
+	hash = HashLightValue( hash, numRawLightmaps );
+
+	return MixLightHash( hash );
+}
+
+
+
+/*
+   CompareLightCacheEntries()
+   sorts the records of the old light cache by type, pass and number
+ */
+
+static int CompareLightCacheEntries( const void *a, const void *b ){
+	const lightCacheRecord_t *ra = &( (const lightCacheEntry_t*) a )->record;
+	const lightCacheRecord_t *rb = &( (const lightCacheEntry_t*) b )->record;
+
+	if ( ra->type != rb->type ) {
+		return ra->type - rb->type;
+	}
+	if ( ra->pass != rb->pass ) {
+		return ra->pass - rb->pass;
+	}
+	return ra->num - rb->num;
+}
+
+
+
+/*
+   IndexLightCache()
+   reads the record headers of the old light cache, returns qfalse if it is broken
+ */
+
+static qboolean IndexLightCache( void ){
+	int maxEntries;
+	long offset, length;
+	lightCacheRecord_t record;
+	lightCacheEntry_t   *entry;
+
+
+	/* get the length */
+	if ( fseek( oldLightCache, 0, SEEK_END ) ) {
+		return qfalse;
+	}
+	length = ftell( oldLightCache );
+	offset = sizeof( lightCacheHeader_t );
+
+	/* walk the records */
+	maxEntries = 0;
+	while ( offset < length )
+	{
+		if ( fseek( oldLightCache, offset, SEEK_SET ) || fread( &record, sizeof( record ), 1, oldLightCache ) != 1 ) {
+			return qfalse;
+		}
+		record.type = LittleLong( record.type );
+		record.pass = LittleLong( record.pass );
+		record.num = LittleLong( record.num );
+		record.size = LittleLong( record.size );
+		record.key = LittleLong64( record.key );
+		offset += sizeof( record );
+		if ( record.size < 0 || offset + record.size > length ) {
+			return qfalse;
+		}
+
+		/* add it */
+		if ( numLightCacheEntries >= maxEntries ) {
+			maxEntries = maxEntries > 0 ? maxEntries * 2 : 1024;
+			entry = safe_malloc( maxEntries * sizeof( *entry ) );
+			if ( lightCacheEntries != NULL ) {
+				memcpy( entry, lightCacheEntries, numLightCacheEntries * sizeof( *entry ) );
+				free( lightCacheEntries );
+			}
+			lightCacheEntries = entry;
+		}
+		entry = &lightCacheEntries[ numLightCacheEntries++ ];
+		entry->record = record;
+		entry->offset = offset;
+		offset += record.size;
+	}
+
+	/* sort them for FindLightCacheEntry() */
+	qsort( lightCacheEntries, numLightCacheEntries, sizeof( *lightCacheEntries ), CompareLightCacheEntries );
+	return qtrue;
+}
+
+
+
+/*
+   SetupLightCache()
+   opens the light cache of the last -incremental run and starts the one of this run
+ */
+
+void SetupLightCache( const char *bspFilePath, int argc, char **argv ){
+	lightCacheHeader_t header;
+
+
+	/* note it */
+	Sys_Printf( "--- SetupLightCache ---\n" );
+
+	/* it is kept next to the bsp */
+	strcpy( lightCachePath, bspFilePath );
+	StripExtension( lightCachePath );
+	strcat( lightCachePath, ".lightcache" );
+	sprintf( newLightCachePath, "%s.tmp", lightCachePath );
+	lightCacheKey = KeyLightCacheWorld( argc, argv );
+
+	/* open the old one */
+	if ( !FileExists( lightCachePath ) ) {
+		Sys_Printf( "No light cache in %s, lighting everything\n", lightCachePath );
+	}
+	else
+	{
+		oldLightCache = fopen( lightCachePath, "rb" );
+		if ( oldLightCache == NULL ||
+			 fread( &header, sizeof( header ), 1, oldLightCache ) != 1 ||
+			 LittleLong( header.ident ) != LIGHT_CACHE_IDENT ||
+			 LittleLong( header.version ) != LIGHT_CACHE_VERSION ||
+			 LittleLong64( header.key ) != lightCacheKey ||
+			 !IndexLightCache() ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: %s is from other geometry or light options or broken, lighting everything\n", lightCachePath );
+			if ( oldLightCache != NULL ) {
+				fclose( oldLightCache );
+				oldLightCache = NULL;
+			}
+			free( lightCacheEntries );
+			lightCacheEntries = NULL;
+			numLightCacheEntries = 0;
+		}
+		else{
+			Sys_Printf( "%9d records in %s\n", numLightCacheEntries, lightCachePath );
+		}
+	}
+
+	/* start the new one, it replaces the old one once everything is lit */
+	newLightCache = fopen( newLightCachePath, "wb" );
+	if ( newLightCache == NULL ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Could not write %s\n", newLightCachePath );
+		return;
+	}
+	header.ident = LittleLong( LIGHT_CACHE_IDENT );
+	header.version = LittleLong( LIGHT_CACHE_VERSION );
+	header.key = LittleLong64( lightCacheKey );
+	fwrite( &header, sizeof( header ), 1, newLightCache );
+}
+
+
+
+/*
+   CloseLightCache()
+   closes the old light cache and puts the one of this run in its place
+ */
+
+void CloseLightCache( void ){
+	if ( oldLightCache != NULL ) {
+		fclose( oldLightCache );
+		oldLightCache = NULL;
+	}
+	free( lightCacheEntries );
+	lightCacheEntries = NULL;
+	numLightCacheEntries = 0;
+	free( gridChainKeys );
+	gridChainKeys = NULL;
+
+	if ( newLightCache == NULL ) {
+		return;
+	}
+	if ( fclose( newLightCache ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Could not write %s\n", newLightCachePath );
+		remove( newLightCachePath );
+	}
+	else
+	{
+		Sys_Printf( "Writing %s\n", lightCachePath );
+		remove( lightCachePath );
+		if ( rename( newLightCachePath, lightCachePath ) ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: Could not write %s\n", lightCachePath );
+		}
+	}
+	newLightCache = NULL;
+}
+
+
+
+/*
+   FindLightCacheEntry()
+   finds a record of the old light cache
+ */
+
+static const lightCacheEntry_t *FindLightCacheEntry( int type, int pass, int num ){
+	lightCacheEntry_t key;
+
+
+	if ( numLightCacheEntries <= 0 ) {
+		return NULL;
+	}
+	key.record.type = type;
+	key.record.pass = pass;
+	key.record.num = num;
+	return bsearch( &key, lightCacheEntries, numLightCacheEntries, sizeof( *lightCacheEntries ), CompareLightCacheEntries );
+}
+
+
+
+/*
+   ReadLightCacheBlock() / ReadLightCacheEntry() / WriteLightCacheRecord()
+   read the next block of a record, part of an old record, and write a whole new record, thread safe
+ */
+
+static void ReadLightCacheBlock( lightCacheReader_t *reader, void *data, int size ){
+	ThreadLock();
+	if ( fseek( reader->file, reader->offset, SEEK_SET ) || fread( data, 1, size, reader->file ) != (size_t) size ) {
+		Error( "Could not read %s", reader->path );
+	}
+	ThreadUnlock();
+	reader->offset += size;
+}
+
+static void ReadLightCacheEntry( const lightCacheEntry_t *entry, int offset, void *data, int size ){
+	lightCacheReader_t reader;
+
+
+	reader.file = oldLightCache;
+	reader.path = lightCachePath;
+	reader.offset = entry->offset + offset;
+	ReadLightCacheBlock( &reader, data, size );
+}
+
+static void WriteLightCacheRecord( FILE *file, int type, int pass, int num, uint64_t key, int numBlocks, const void **blocks, const int *sizes ){
+	int i;
+	lightCacheRecord_t record;
+
+
+	if ( file == NULL ) {
+		return;
+	}
+	record.type = LittleLong( type );
+	record.pass = LittleLong( pass );
+	record.num = LittleLong( num );
+	record.size = 0;
+	for ( i = 0; i < numBlocks; i++ )
+		record.size += sizes[ i ];
+	record.size = LittleLong( record.size );
+	record.key = LittleLong64( key );
+
+	ThreadLock();
+	fwrite( &record, sizeof( record ), 1, file );
+	for ( i = 0; i < numBlocks; i++ )
+		fwrite( blocks[ i ], 1, sizes[ i ], file );
+	ThreadUnlock();
+}
+
+
+
+/*
+   ReadLightCacheRecordHeader()
+   starts reading the next record of a light work file, which has to be the one expected
+ */
+
+static void ReadLightCacheRecordHeader( lightCacheReader_t *reader, int type, int pass, int num, int *size ){
+	lightCacheRecord_t record;
+
+
+	ReadLightCacheBlock( reader, &record, sizeof( record ) );
+	if ( LittleLong( record.type ) != type || LittleLong( record.pass ) != pass || LittleLong( record.num ) != num ) {
+		Error( "%s is broken", reader->path );
+	}
+	*size = LittleLong( record.size );
+}
+
+
+
+/*
+   KeyLightsForCache()
+   keys each light by everything that decides what it adds, called once its envelope is set up
+ */
+
+void KeyLightsForCache( void ){
+	uint64_t hash;
+	light_t     *light;
+
+
+	for ( light = lights; light != NULL; light = light->next )
+	{
+		hash = 0xCBF29CE484222325ULL;
+		hash = HashLightValue( hash, light->type );
+		hash = HashLightValue( hash, light->flags );
+		if ( light->si != NULL ) {
+			hash = HashLightString( hash, light->si->shader );
+		}
+		hash = HashLightValue( hash, light->origin );
+		hash = HashLightValue( hash, light->normal );
+		hash = HashLightValue( hash, light->dist );
+		hash = HashLightValue( hash, light->photons );
+		hash = HashLightValue( hash, light->style );
+		hash = HashLightValue( hash, light->color );
+		hash = HashLightValue( hash, light->radiusByDist );
+		hash = HashLightValue( hash, light->fade );
+		hash = HashLightValue( hash, light->angleScale );
+		hash = HashLightValue( hash, light->extraDist );
+		hash = HashLightValue( hash, light->add );
+		hash = HashLightValue( hash, light->envelope );
+		hash = HashLightValue( hash, light->mins );
+		hash = HashLightValue( hash, light->maxs );
+		hash = HashLightValue( hash, light->cluster );
+		hash = HashLightValue( hash, light->emitColor );
+		hash = HashLightValue( hash, light->falloffTolerance );
+		hash = HashLightValue( hash, light->filterRadius );
+		if ( light->w != NULL ) {
+			hash = HashLightValue( hash, light->w->numpoints );
+			hash = HashLightBytes( hash, light->w->p, light->w->numpoints * sizeof( light->w->p[ 0 ] ) );
+		}
+		light->cacheKey = MixLightHash( hash );
+	}
+}
+
+
+
+/*
+   FindLightCacheLightmap()
+   keys a raw lightmap by the pass, the lights reaching it and the styles and clusters it
+   starts the pass with, and returns whether the old light cache has it; needs lm->lights
+ */
+
+static int LightCacheLightmapSize( rawLightmap_t *lm, const byte *styles ){
+	int lightmapNum, size;
+
+
+	size = MAX_LIGHTMAPS + lm->sw * lm->sh * sizeof( *lm->superClusters );
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( styles[ lightmapNum ] != LS_NONE ) {
+			size += lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+		}
+	}
+	if ( lm->superDeluxels != NULL ) {
+		size += lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
+	}
+	return size;
+}
+
+qboolean FindLightCacheLightmap( rawLightmap_t *lm ){
+	uint64_t hash;
+	byte styles[ MAX_LIGHTMAPS ];
+	const lightCacheEntry_t *entry;
+
+
+	/* key it */
+	hash = HashLightValue( 0xCBF29CE484222325ULL, bouncePass );
+	hash = HashLightValue( hash, lm->sw );
+	hash = HashLightValue( hash, lm->sh );
+	hash = HashLightValue( hash, lm->styles );
+	hash = HashLightBytes( hash, lm->superClusters, lm->sw * lm->sh * sizeof( *lm->superClusters ) );
+	lm->lightCacheKey = HashLightList( hash, lm->lights, lm->numLights );
+
+	/* look it up */
+	lm->lightCached = qfalse;
+	entry = FindLightCacheEntry( LIGHT_CACHE_LIGHTMAP, bouncePass, lm - rawLightmaps );
+	if ( entry == NULL || entry->record.key != lm->lightCacheKey || entry->record.size < MAX_LIGHTMAPS ) {
+		return qfalse;
+	}
+	ReadLightCacheEntry( entry, 0, styles, MAX_LIGHTMAPS );
+	if ( entry->record.size != LightCacheLightmapSize( lm, styles ) ) {
+		return qfalse;
+	}
+	lm->lightCached = qtrue;
+	return qtrue;
+}
+
+
+
+/*
+   ReadLightmapBlocks() / LightmapBlocks()
+   the finished luxels of a raw lightmap as a record has them: its styles, its clusters, the
+   luxels of each style and the deluxels
+ */
+
+static void ReadLightmapBlocks( lightCacheReader_t *reader, rawLightmap_t *lm ){
+	int lightmapNum, size;
+
+
+	ReadLightCacheBlock( reader, lm->styles, MAX_LIGHTMAPS );
+	ReadLightCacheBlock( reader, lm->superClusters, lm->sw * lm->sh * sizeof( *lm->superClusters ) );
+
+	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->styles[ lightmapNum ] == LS_NONE ) {
+			continue;
+		}
+		if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			lm->superLuxels[ lightmapNum ] = safe_malloc( size );
+		}
+		ReadLightCacheBlock( reader, lm->superLuxels[ lightmapNum ], size );
+	}
+
+	if ( lm->superDeluxels != NULL ) {
+		ReadLightCacheBlock( reader, lm->superDeluxels, lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float ) );
+	}
+}
+
+static int LightmapBlocks( rawLightmap_t *lm, const void **blocks, int *sizes ){
+	int lightmapNum, numBlocks;
+
+
+	numBlocks = 0;
+	blocks[ numBlocks ] = lm->styles;
+	sizes[ numBlocks++ ] = MAX_LIGHTMAPS;
+	blocks[ numBlocks ] = lm->superClusters;
+	sizes[ numBlocks++ ] = lm->sw * lm->sh * sizeof( *lm->superClusters );
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->styles[ lightmapNum ] != LS_NONE ) {
+			blocks[ numBlocks ] = lm->superLuxels[ lightmapNum ];
+			sizes[ numBlocks++ ] = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+		}
+	}
+	if ( lm->superDeluxels != NULL ) {
+		blocks[ numBlocks ] = lm->superDeluxels;
+		sizes[ numBlocks++ ] = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
+	}
+	return numBlocks;
+}
+
+
+
+/*
+   ReadLightCacheLightmap() / WriteLightCacheLightmap()
+   restore the finished luxels of a raw lightmap found by FindLightCacheLightmap(), and store
+   them once it is finished
+ */
+
+void ReadLightCacheLightmap( rawLightmap_t *lm ){
+	lightCacheReader_t reader;
+
+
+	reader.file = oldLightCache;
+	reader.path = lightCachePath;
+	reader.offset = FindLightCacheEntry( LIGHT_CACHE_LIGHTMAP, bouncePass, lm - rawLightmaps )->offset;
+	ReadLightmapBlocks( &reader, lm );
+}
+
+void WriteLightCacheLightmap( rawLightmap_t *lm ){
+	int numBlocks, sizes[ MAX_LIGHTMAPS + 3 ];
+	const void  *blocks[ MAX_LIGHTMAPS + 3 ];
+
+
+	numBlocks = LightmapBlocks( lm, blocks, sizes );
+	WriteLightCacheRecord( newLightCache, LIGHT_CACHE_LIGHTMAP, bouncePass, lm - rawLightmaps, lm->lightCacheKey, numBlocks, blocks, sizes );
+}
+
+
+
+/*
+   ReadLightWorkLightmap() / WriteLightWorkLightmap()
+   hand the finished luxels of a raw lightmap from one light worker to the others
+ */
+
+void ReadLightWorkLightmap( FILE *file, const char *path, rawLightmap_t *lm ){
+	int size;
+	byte styles[ MAX_LIGHTMAPS ];
+	lightCacheReader_t reader;
+
+
+	reader.file = file;
+	reader.path = path;
+	reader.offset = ftell( file );
+	ReadLightCacheRecordHeader( &reader, LIGHT_CACHE_LIGHTMAP, bouncePass, lm - rawLightmaps, &size );
+	ReadLightCacheBlock( &reader, styles, MAX_LIGHTMAPS );
+	if ( size != LightCacheLightmapSize( lm, styles ) ) {
+		Error( "%s is broken", path );
+	}
+	reader.offset -= MAX_LIGHTMAPS;
+	ReadLightmapBlocks( &reader, lm );
+	fseek( file, reader.offset, SEEK_SET );
+}
+
+void WriteLightWorkLightmap( FILE *file, rawLightmap_t *lm ){
+	int numBlocks, sizes[ MAX_LIGHTMAPS + 3 ];
+	const void  *blocks[ MAX_LIGHTMAPS + 3 ];
+
+
+	numBlocks = LightmapBlocks( lm, blocks, sizes );
+	WriteLightCacheRecord( file, LIGHT_CACHE_LIGHTMAP, bouncePass, lm - rawLightmaps, 0, numBlocks, blocks, sizes );
+}
+
+
+
+/*
+   ReadLightCacheDirt() / WriteLightCacheDirt()
+   the dirt of a raw lightmap only depends on the geometry, so it is reused whenever the old
+   light cache has it
+ */
+
+static void ReadDirtBlock( lightCacheReader_t *reader, rawLightmap_t *lm ){
+	int x, y;
+	float       *dirt;
+
+
+	dirt = safe_malloc( lm->sw * lm->sh * sizeof( float ) );
+	ReadLightCacheBlock( reader, dirt, lm->sw * lm->sh * sizeof( float ) );
+	for ( y = 0; y < lm->sh; y++ )
+		for ( x = 0; x < lm->sw; x++ )
+			*SUPER_DIRT( x, y ) = dirt[ y * lm->sw + x ];
+	free( dirt );
+}
+
+static void WriteDirtRecord( FILE *file, rawLightmap_t *lm ){
+	int x, y, size;
+	float       *dirt;
+	const void  *blocks[ 1 ];
+
+
+	size = lm->sw * lm->sh * sizeof( float );
+	dirt = safe_malloc( size );
+	for ( y = 0; y < lm->sh; y++ )
+		for ( x = 0; x < lm->sw; x++ )
+			dirt[ y * lm->sw + x ] = *SUPER_DIRT( x, y );
+	blocks[ 0 ] = dirt;
+	WriteLightCacheRecord( file, LIGHT_CACHE_DIRT, 0, lm - rawLightmaps, 0, 1, blocks, &size );
+	free( dirt );
+}
+
+qboolean ReadLightCacheDirt( rawLightmap_t *lm ){
+	const lightCacheEntry_t *entry;
+	lightCacheReader_t reader;
+
+
+	entry = FindLightCacheEntry( LIGHT_CACHE_DIRT, 0, lm - rawLightmaps );
+	if ( entry == NULL || entry->record.size != (int) ( lm->sw * lm->sh * sizeof( float ) ) ) {
+		return qfalse;
+	}
+	reader.file = oldLightCache;
+	reader.path = lightCachePath;
+	reader.offset = entry->offset;
+	ReadDirtBlock( &reader, lm );
+	return qtrue;
+}
+
+void WriteLightCacheDirt( rawLightmap_t *lm ){
+	WriteDirtRecord( newLightCache, lm );
+}
+
+
+
+/*
+   ReadLightWorkDirt() / WriteLightWorkDirt()
+   hand the dirt of a raw lightmap from one light worker to the others
+ */
+
+void ReadLightWorkDirt( FILE *file, const char *path, rawLightmap_t *lm ){
+	int size;
+	lightCacheReader_t reader;
+
+
+	reader.file = file;
+	reader.path = path;
+	reader.offset = ftell( file );
+	ReadLightCacheRecordHeader( &reader, LIGHT_CACHE_DIRT, 0, lm - rawLightmaps, &size );
+	if ( size != (int) ( lm->sw * lm->sh * sizeof( float ) ) ) {
+		Error( "%s is broken", path );
+	}
+	ReadDirtBlock( &reader, lm );
+	fseek( file, reader.offset, SEEK_SET );
+}
+
+void WriteLightWorkDirt( FILE *file, rawLightmap_t *lm ){
+	WriteDirtRecord( file, lm );
+}
+
+
+
+/*
+   BeginLightCacheGrid() / ReadLightCacheGridPoint() / EndLightCacheGrid()
+   the light grid adds up over the passes, so a grid point is keyed by its key of the pass
+   before and the lights reaching it in this one; a point found in the old light cache takes
+   its values from there instead of being traced
+ */
+
+void BeginLightCacheGrid( void ){
+	int size;
+
+
+	/* the keys of the pass before */
+	if ( gridChainKeys == NULL ) {
+		gridChainKeys = safe_malloc0( numRawGridPoints * sizeof( *gridChainKeys ) );
+	}
+	gridKeys = safe_malloc0( numRawGridPoints * sizeof( *gridKeys ) );
+
+	/* the keys of the old light cache */
+	size = numRawGridPoints * ( sizeof( *oldGridKeys ) + sizeof( *rawGridPoints ) + sizeof( *bspGridPoints ) );
+	gridEntry = FindLightCacheEntry( LIGHT_CACHE_GRID, bouncePass, 0 );
+	if ( gridEntry != NULL && gridEntry->record.size != size ) {
+		gridEntry = NULL;
+	}
+	if ( gridEntry != NULL ) {
+		oldGridKeys = safe_malloc( numRawGridPoints * sizeof( *oldGridKeys ) );
+		ReadLightCacheEntry( gridEntry, 0, oldGridKeys, numRawGridPoints * sizeof( *oldGridKeys ) );
+	}
+	numGridPointsCached = 0;
+}
+
+qboolean ReadLightCacheGridPoint( int num, trace_t *trace ){
+	int offset;
+	uint64_t hash;
+
+
+	/* key it */
+	hash = HashLightValue( 0xCBF29CE484222325ULL, gridChainKeys[ num ] );
+	hash = HashLightValue( hash, bouncePass );
+	hash = HashLightValue( hash, trace->origin );
+	hash = HashLightValue( hash, trace->cluster );
+	gridKeys[ num ] = HashLightList( hash, trace->lights, trace->numLights );
+
+	/* look it up */
+	if ( gridEntry == NULL || oldGridKeys[ num ] != gridKeys[ num ] ) {
+		return qfalse;
+	}
+	offset = numRawGridPoints * sizeof( *oldGridKeys );
+	ReadLightCacheEntry( gridEntry, offset + num * sizeof( *rawGridPoints ), &rawGridPoints[ num ], sizeof( *rawGridPoints ) );
+	offset += numRawGridPoints * sizeof( *rawGridPoints );
+	ReadLightCacheEntry( gridEntry, offset + num * sizeof( *bspGridPoints ), &bspGridPoints[ num ], sizeof( *bspGridPoints ) );
+	ThreadLock();
+	numGridPointsCached++;
+	ThreadUnlock();
+	return qtrue;
+}
+
+void EndLightCacheGrid( void ){
+	int sizes[ 3 ];
+	const void  *blocks[ 3 ];
+
+
+	/* store it */
+	blocks[ 0 ] = gridKeys;
+	sizes[ 0 ] = numRawGridPoints * sizeof( *gridKeys );
+	blocks[ 1 ] = rawGridPoints;
+	sizes[ 1 ] = numRawGridPoints * sizeof( *rawGridPoints );
+	blocks[ 2 ] = bspGridPoints;
+	sizes[ 2 ] = numRawGridPoints * sizeof( *bspGridPoints );
+	WriteLightCacheRecord( newLightCache, LIGHT_CACHE_GRID, bouncePass, 0, 0, 3, blocks, sizes );
+
+	/* these keys chain into the next pass */
+	free( gridChainKeys );
+	gridChainKeys = gridKeys;
+	gridKeys = NULL;
+	free( oldGridKeys );
+	oldGridKeys = NULL;
+	gridEntry = NULL;
+}
+
+
+
+/*
+   ReadLightWorkGrid() / WriteLightWorkGrid()
+   hand a range of traced grid points from one light worker to the others
+ */
+
+void ReadLightWorkGrid( FILE *file, const char *path, int firstGridPoint, int numGridPoints ){
+	int size;
+	lightCacheReader_t reader;
+
+
+	reader.file = file;
+	reader.path = path;
+	reader.offset = ftell( file );
+	ReadLightCacheRecordHeader( &reader, LIGHT_CACHE_GRID, bouncePass, firstGridPoint, &size );
+	if ( size != (int) ( numGridPoints * ( sizeof( *rawGridPoints ) + sizeof( *bspGridPoints ) ) ) ) {
+		Error( "%s is broken", path );
+	}
+	ReadLightCacheBlock( &reader, &rawGridPoints[ firstGridPoint ], numGridPoints * sizeof( *rawGridPoints ) );
+	ReadLightCacheBlock( &reader, &bspGridPoints[ firstGridPoint ], numGridPoints * sizeof( *bspGridPoints ) );
+	fseek( file, reader.offset, SEEK_SET );
+}
+
+void WriteLightWorkGrid( FILE *file, int firstGridPoint, int numGridPoints ){
+	int sizes[ 2 ];
+	const void  *blocks[ 2 ];
+
+
+	blocks[ 0 ] = &rawGridPoints[ firstGridPoint ];
+	sizes[ 0 ] = numGridPoints * sizeof( *rawGridPoints );
+	blocks[ 1 ] = &bspGridPoints[ firstGridPoint ];
+	sizes[ 1 ] = numGridPoints * sizeof( *bspGridPoints );
+	WriteLightCacheRecord( file, LIGHT_CACHE_GRID, bouncePass, firstGridPoint, 0, 2, blocks, sizes );
+}
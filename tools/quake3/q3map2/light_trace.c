@@ -40,6 +40,17 @@
 /* dependencies */
 #include "q3map2.h"
 
+#if defined( __SSE__ )
+	#include <xmmintrin.h>
+#endif
+
+/* packet traversal has to round exactly like TraceLine_r(), so it needs sse float math, not x87 */
+#if defined( __SSE__ ) && defined( __SSE_MATH__ )
+	#define TRACE_PACKET_SIMD   1
+#else
+	#define TRACE_PACKET_SIMD   0
+#endif
+
 
 
 #define Vector2Copy( a, b )     ( ( b )[ 0 ] = ( a )[ 0 ], ( b )[ 1 ] = ( a )[ 1 ] )
@@ -63,6 +74,7 @@
 
 #define TRACE_LEAF              -1
 #define TRACE_LEAF_SOLID        -2
+#define TRACE_LEAF_BVH          -3          /* -bvh: stands in for a bsp leaf, its triangles are found through a bvh */
 
 typedef struct traceVert_s
 {
@@ -102,9 +114,53 @@ typedef struct traceNode_s
 	int children[ 2 ];
 	int numItems, maxItems;
 	int                         *items;
+	int bvhNodeNum, numLeafs;                               /* TRACE_LEAF_BVH: its bvh, and the leafs below children[ 0 ] with triangles */
 }
 traceNode_t;
 
+#define BVH_WIDTH               4           /* triangles per packet, one per simd lane */
+#define BVH_MAX_LEAF_PACKETS    2
+#define BVH_BINS                16
+#define BVH_MAX_DEPTH           64
+#define BVH_TRAVERSAL_COST      1.0f        /* relative to testing one packet */
+#define BVH_MIN_TRIANGLES       16          /* bsp leafs with fewer are walked like without -bvh */
+#define MAX_BVH_HITS            64
+
+#define GROW_BVH_NODES          16384
+#define GROW_BVH_PACKETS        16384
+
+typedef struct traceBVHNode_s
+{
+	float mins[ 3 ];
+	int first;                              /* interior: right child (left child follows the node), leaf: first packet */
+	float maxs[ 3 ];
+	int numPackets;                         /* 0 for interior nodes */
+}
+traceBVHNode_t;
+
+typedef struct traceBVHPacket_s
+{
+	float origin[ 3 ][ BVH_WIDTH ];
+	float edge1[ 3 ][ BVH_WIDTH ];
+	float edge2[ 3 ][ BVH_WIDTH ];
+	int triangles[ BVH_WIDTH ];             /* -1 for unused lanes */
+	int leafs[ BVH_WIDTH ], items[ BVH_WIDTH ];     /* the trace tree leaf each triangle is in, and where in its list */
+}
+traceBVHPacket_t;
+
+typedef struct traceBVHItem_s
+{
+	int triangleNum, leafNum, itemNum;
+	float mins[ 3 ], maxs[ 3 ], center[ 3 ];
+}
+traceBVHItem_t;
+
+typedef struct traceBVHHit_s
+{
+	int triangleNum, leafNum, itemNum, rank;
+}
+traceBVHHit_t;
+
 
 int noDrawContentFlags, noDrawSurfaceFlags, noDrawCompileFlags;
 
@@ -121,6 +177,14 @@ int headNodeNum = 0, skyboxNodeNum = 0, maxTraceDepth = 0, numTraceLeafNodes = 0
 int numTraceNodes = 0, maxTraceNodes = 0;
 traceNode_t                     *traceNodes = NULL;
 
+int numBVHLeafs = 0, maxBVHDepth = 0;
+int numBVHNodes = 0, maxBVHNodes = 0;
+traceBVHNode_t                  *bvhNodes = NULL;
+int numBVHPackets = 0, maxBVHPackets = 0;
+traceBVHPacket_t                *bvhPackets = NULL;
+int numBVHItems = 0, maxBVHItems = 0;
+traceBVHItem_t                  *bvhItems = NULL;
+
 
 
 /* -------------------------------------------------------------------------------
@@ -879,6 +943,373 @@ static int TriangulateTraceNode_r( int nodeNum ){
 
 
 
+/* -------------------------------------------------------------------------------
+
+   bounding volume hierarchy setup (-bvh)
+
+   ------------------------------------------------------------------------------- */
+
+/*
+   AllocBVHNode()
+   allocates a new bvh node
+ */
+
+static int AllocBVHNode( void ){
+	traceBVHNode_t  *temp;
+
+
+	/* enough space? */
+	if ( numBVHNodes >= maxBVHNodes ) {
+		/* reallocate more room */
+		maxBVHNodes += GROW_BVH_NODES;
+		temp = safe_malloc( maxBVHNodes * sizeof( *bvhNodes ) );
+		if ( bvhNodes != NULL ) {
+			memcpy( temp, bvhNodes, numBVHNodes * sizeof( *bvhNodes ) );
+			free( bvhNodes );
+		}
+		bvhNodes = temp;
+	}
+
+	/* add the node */
+	memset( &bvhNodes[ numBVHNodes ], 0, sizeof( *bvhNodes ) );
+	numBVHNodes++;
+
+	/* return the node number */
+	return ( numBVHNodes - 1 );
+}
+
+
+
+/*
+   AllocBVHPacket()
+   allocates a new, empty triangle packet
+ */
+
+static int AllocBVHPacket( void ){
+	int i;
+	traceBVHPacket_t    *temp;
+
+
+	/* enough space? */
+	if ( numBVHPackets >= maxBVHPackets ) {
+		/* reallocate more room */
+		maxBVHPackets += GROW_BVH_PACKETS;
+		temp = safe_malloc( maxBVHPackets * sizeof( *bvhPackets ) );
+		if ( bvhPackets != NULL ) {
+			memcpy( temp, bvhPackets, numBVHPackets * sizeof( *bvhPackets ) );
+			free( bvhPackets );
+		}
+		bvhPackets = temp;
+	}
+
+	/* add the packet (zero edges make unused lanes fail the determinant test) */
+	memset( &bvhPackets[ numBVHPackets ], 0, sizeof( *bvhPackets ) );
+	for ( i = 0; i < BVH_WIDTH; i++ )
+		bvhPackets[ numBVHPackets ].triangles[ i ] = -1;
+	numBVHPackets++;
+
+	/* return the packet number */
+	return ( numBVHPackets - 1 );
+}
+
+
+
+/*
+   CollectBVHItems_r()
+   adds the triangles of the trace tree leafs below a node to the bvh items, noting the leaf and
+   the place in its list of each, returns the number of leafs with triangles
+ */
+
+static int CollectBVHItems_r( int nodeNum ){
+	int i, j, k, numLeafs;
+	float pad;
+	traceNode_t     *node;
+	traceTriangle_t *tt;
+	traceBVHItem_t  *item, *temp;
+
+
+	/* get node */
+	node = &traceNodes[ nodeNum ];
+
+	/* is this a decision node? */
+	if ( node->type >= 0 ) {
+		numLeafs = CollectBVHItems_r( node->children[ 0 ] );
+		numLeafs += CollectBVHItems_r( node->children[ 1 ] );
+		return numLeafs;
+	}
+
+	/* walk the leaf's triangles */
+	for ( i = 0; i < node->numItems; i++ )
+	{
+		/* enough space? */
+		if ( numBVHItems >= maxBVHItems ) {
+			maxBVHItems += GROW_TRACE_TRIANGLES;
+			temp = safe_malloc( maxBVHItems * sizeof( *temp ) );
+			if ( bvhItems != NULL ) {
+				memcpy( temp, bvhItems, numBVHItems * sizeof( *temp ) );
+				free( bvhItems );
+			}
+			bvhItems = temp;
+		}
+
+		/* add the triangle */
+		item = &bvhItems[ numBVHItems++ ];
+		item->triangleNum = node->items[ i ];
+		item->leafNum = nodeNum;
+		item->itemNum = i;
+		tt = &traceTriangles[ item->triangleNum ];
+
+		/* bound it, padded for the barycentric epsilon of TraceTriangle() */
+		ClearBounds( item->mins, item->maxs );
+		for ( j = 0; j < 3; j++ )
+			AddPointToBounds( tt->v[ j ].xyz, item->mins, item->maxs );
+		pad = 0.025f * ( VectorLength( tt->edge1 ) + VectorLength( tt->edge2 ) ) + 0.125f;
+		for ( k = 0; k < 3; k++ )
+		{
+			item->mins[ k ] -= pad;
+			item->maxs[ k ] += pad;
+			item->center[ k ] = 0.5f * ( item->mins[ k ] + item->maxs[ k ] );
+		}
+	}
+
+	return node->numItems > 0 ? 1 : 0;
+}
+
+
+
+/*
+   BoxSurfaceArea()
+   half the surface area of a bounding box, which is all the sah needs
+ */
+
+static float BoxSurfaceArea( const vec3_t mins, const vec3_t maxs ){
+	vec3_t size;
+
+
+	if ( mins[ 0 ] > maxs[ 0 ] ) {
+		return 0.0f;
+	}
+	VectorSubtract( maxs, mins, size );
+	return size[ 0 ] * size[ 1 ] + size[ 1 ] * size[ 2 ] + size[ 2 ] * size[ 0 ];
+}
+
+
+
+/*
+   BuildBVH_r()
+   recursively builds a bvh over a list of triangles using binned surface area heuristic splits
+   the left child of an interior node always directly follows its parent
+ */
+
+#define BVH_PACKETS( n )    ( ( ( n ) + BVH_WIDTH - 1 ) / BVH_WIDTH )
+
+static int BuildBVH_r( traceBVHItem_t *items, int numItems, int depth ){
+	int i, j, k, nodeNum, packetNum, axis, bin, split, bestAxis, bestSplit, mid, numPackets;
+	int counts[ BVH_BINS ], leftCount;
+	vec3_t mins, maxs, centerMins, centerMaxs;
+	vec3_t binMins[ BVH_BINS ], binMaxs[ BVH_BINS ], leftMins, leftMaxs, rightMins, rightMaxs;
+	float area, scale, cost, bestCost, leftAreas[ BVH_BINS ];
+	traceBVHItem_t  temp;
+	traceBVHNode_t  *node;
+	traceBVHPacket_t *packet;
+	traceTriangle_t *tt;
+
+
+	/* allocate the node */
+	nodeNum = AllocBVHNode();
+	if ( depth > maxBVHDepth ) {
+		maxBVHDepth = depth;
+	}
+
+	/* bound the items and their centers */
+	ClearBounds( mins, maxs );
+	ClearBounds( centerMins, centerMaxs );
+	for ( i = 0; i < numItems; i++ )
+	{
+		AddPointToBounds( items[ i ].mins, mins, maxs );
+		AddPointToBounds( items[ i ].maxs, mins, maxs );
+		AddPointToBounds( items[ i ].center, centerMins, centerMaxs );
+	}
+	VectorCopy( mins, bvhNodes[ nodeNum ].mins );
+	VectorCopy( maxs, bvhNodes[ nodeNum ].maxs );
+
+	/* find the cheapest split */
+	numPackets = BVH_PACKETS( numItems );
+	area = BoxSurfaceArea( mins, maxs );
+	bestCost = 1e30f;
+	bestAxis = -1;
+	bestSplit = 0;
+	for ( axis = 0; axis < 3 && numPackets > 1 && area > 0.0f; axis++ )
+	{
+		/* can't split along a flat axis */
+		if ( centerMaxs[ axis ] - centerMins[ axis ] < 0.001f ) {
+			continue;
+		}
+
+		/* bin the items */
+		scale = BVH_BINS / ( centerMaxs[ axis ] - centerMins[ axis ] );
+		for ( bin = 0; bin < BVH_BINS; bin++ )
+		{
+			counts[ bin ] = 0;
+			ClearBounds( binMins[ bin ], binMaxs[ bin ] );
+		}
+		for ( i = 0; i < numItems; i++ )
+		{
+			bin = (int) ( ( items[ i ].center[ axis ] - centerMins[ axis ] ) * scale );
+			if ( bin >= BVH_BINS ) {
+				bin = BVH_BINS - 1;
+			}
+			counts[ bin ]++;
+			AddPointToBounds( items[ i ].mins, binMins[ bin ], binMaxs[ bin ] );
+			AddPointToBounds( items[ i ].maxs, binMins[ bin ], binMaxs[ bin ] );
+		}
+
+		/* sweep from the left, then evaluate each split sweeping from the right */
+		ClearBounds( leftMins, leftMaxs );
+		for ( bin = 0; bin < BVH_BINS - 1; bin++ )
+		{
+			AddPointToBounds( binMins[ bin ], leftMins, leftMaxs );
+			AddPointToBounds( binMaxs[ bin ], leftMins, leftMaxs );
+			leftAreas[ bin ] = BoxSurfaceArea( leftMins, leftMaxs );
+		}
+		ClearBounds( rightMins, rightMaxs );
+		leftCount = numItems;
+		for ( split = BVH_BINS - 1; split > 0; split-- )
+		{
+			AddPointToBounds( binMins[ split ], rightMins, rightMaxs );
+			AddPointToBounds( binMaxs[ split ], rightMins, rightMaxs );
+			leftCount -= counts[ split ];
+			if ( leftCount <= 0 || leftCount >= numItems ) {
+				continue;
+			}
+			cost = BVH_TRAVERSAL_COST +
+				   ( leftAreas[ split - 1 ] * BVH_PACKETS( leftCount ) +
+					 BoxSurfaceArea( rightMins, rightMaxs ) * BVH_PACKETS( numItems - leftCount ) ) / area;
+			if ( cost < bestCost ) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	/* make a leaf if splitting doesn't pay off */
+	if ( numPackets <= 1 || depth >= BVH_MAX_DEPTH - 1 ||
+		 ( bestCost >= numPackets && numPackets <= BVH_MAX_LEAF_PACKETS ) ) {
+		/* pack the triangles */
+		bvhNodes[ nodeNum ].first = numBVHPackets;
+		bvhNodes[ nodeNum ].numPackets = numPackets;
+		for ( i = 0; i < numPackets; i++ )
+		{
+			packetNum = AllocBVHPacket();
+			packet = &bvhPackets[ packetNum ];
+			for ( j = 0; j < BVH_WIDTH && i * BVH_WIDTH + j < numItems; j++ )
+			{
+				packet->triangles[ j ] = items[ i * BVH_WIDTH + j ].triangleNum;
+				packet->leafs[ j ] = items[ i * BVH_WIDTH + j ].leafNum;
+				packet->items[ j ] = items[ i * BVH_WIDTH + j ].itemNum;
+				tt = &traceTriangles[ packet->triangles[ j ] ];
+				for ( k = 0; k < 3; k++ )
+				{
+					packet->origin[ k ][ j ] = tt->v[ 0 ].xyz[ k ];
+					packet->edge1[ k ][ j ] = tt->edge1[ k ];
+					packet->edge2[ k ][ j ] = tt->edge2[ k ];
+				}
+			}
+		}
+		return nodeNum;
+	}
+
+	/* partition the items */
+	if ( bestAxis >= 0 ) {
+		scale = BVH_BINS / ( centerMaxs[ bestAxis ] - centerMins[ bestAxis ] );
+		mid = 0;
+		for ( i = 0; i < numItems; i++ )
+		{
+			bin = (int) ( ( items[ i ].center[ bestAxis ] - centerMins[ bestAxis ] ) * scale );
+			if ( bin >= BVH_BINS ) {
+				bin = BVH_BINS - 1;
+			}
+			if ( bin < bestSplit ) {
+				temp = items[ i ];
+				items[ i ] = items[ mid ];
+				items[ mid ] = temp;
+				mid++;
+			}
+		}
+	}
+	else
+	{
+		/* too many coincident triangles for a leaf, so just halve the list */
+		mid = numItems / 2;
+	}
+
+	/* build the children, the left one ends up at nodeNum + 1 */
+	BuildBVH_r( items, mid, depth + 1 );
+	split = BuildBVH_r( items + mid, numItems - mid, depth + 1 );
+
+	/* attach them */
+	node = &bvhNodes[ nodeNum ];
+	node->first = split;
+	node->numPackets = 0;
+	return nodeNum;
+}
+
+
+
+/*
+   SetupTraceBVH()
+   builds a bvh over the triangles below each bsp leaf of the trace tree that has enough of them,
+   the leaf is moved below a TRACE_LEAF_BVH node that stands in for it; the trace tree nodes made
+   from the bsp come before the ones subdivision adds, numbered depth first
+ */
+
+static void SetupTraceBVH( int numBSPTraceNodes ){
+	int i, nodeNum;
+	traceNode_t     *node;
+
+
+	/* walk the nodes made from the bsp, and the skybox node */
+	for ( i = 0; i < numBSPTraceNodes; i++ )
+	{
+		/* bsp leafs only, subdivided or not */
+		node = &traceNodes[ i ];
+		if ( node->type == TRACE_LEAF_SOLID || ( node->type >= 0 && node->children[ 0 ] < numBSPTraceNodes ) ||
+			 node->numItems < BVH_MIN_TRIANGLES ) {
+			continue;
+		}
+
+		/* move it below a stand-in */
+		nodeNum = AllocTraceNode();
+		traceNodes[ nodeNum ] = traceNodes[ i ];
+		node = &traceNodes[ i ];
+		node->type = TRACE_LEAF_BVH;
+		node->children[ 0 ] = nodeNum;
+		node->children[ 1 ] = 0;
+		node->maxItems = 0;
+		node->items = NULL;
+
+		/* build the bvh over its triangles */
+		numBVHItems = 0;
+		node->numLeafs = CollectBVHItems_r( nodeNum );
+		node->bvhNodeNum = BuildBVH_r( bvhItems, numBVHItems, 0 );
+		numBVHLeafs++;
+	}
+
+	/* the items are done with */
+	free( bvhItems );
+	bvhItems = NULL;
+	numBVHItems = maxBVHItems = 0;
+
+	/* emit some stats */
+	Sys_FPrintf( SYS_VRB, "%9d bvh leaf nodes\n", numBVHLeafs );
+	Sys_FPrintf( SYS_VRB, "%9d bvh nodes (%.2fMB)\n", numBVHNodes, (float) ( numBVHNodes * sizeof( *bvhNodes ) ) / ( 1024.0f * 1024.0f ) );
+	Sys_FPrintf( SYS_VRB, "%9d bvh packets (%.2fMB)\n", numBVHPackets, (float) ( numBVHPackets * sizeof( *bvhPackets ) ) / ( 1024.0f * 1024.0f ) );
+	Sys_FPrintf( SYS_VRB, "%9d max bvh depth\n", maxBVHDepth );
+}
+
+
+
 /* -------------------------------------------------------------------------------
 
    shadow casting item setup (triangles, patches, entities)
@@ -1300,6 +1731,9 @@ static void PopulateTraceNodes( void ){
  */
 
 void SetupTraceNodes( void ){
+	int numBSPTraceNodes;
+
+
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- SetupTraceNodes ---\n" );
 
@@ -1317,6 +1751,7 @@ void SetupTraceNodes( void ){
 	PopulateTraceNodes();
 
 	/* create the raytracing bsp */
+	numBSPTraceNodes = numTraceNodes;
 	if ( loMem == qfalse ) {
 		SubdivideTraceNode_r( headNodeNum, 0 );
 		SubdivideTraceNode_r( skyboxNodeNum, 0 );
@@ -1326,6 +1761,11 @@ void SetupTraceNodes( void ){
 	TriangulateTraceNode_r( headNodeNum );
 	TriangulateTraceNode_r( skyboxNodeNum );
 
+	/* optionally build the bvhs */
+	if ( traceBVH ) {
+		SetupTraceBVH( numBSPTraceNodes );
+	}
+
 	/* emit some stats */
 	//%	Sys_FPrintf( SYS_VRB, "%9d original triangles\n", numOriginalTriangles );
 	Sys_FPrintf( SYS_VRB, "%9d trace windings (%.2fMB)\n", numTraceWindings, (float) ( numTraceWindings * sizeof( *traceWindings ) ) / ( 1024.0f * 1024.0f ) );
@@ -1611,6 +2051,126 @@ qboolean TraceWinding( traceWinding_t *tw, trace_t *trace ){
 
 
 
+/*
+   TraceBVHPacket()
+   tests a ray against a packet of triangles at once with the same math as TraceTriangle(),
+   but with slightly wider tolerances; returns a lane mask of the triangles that may be hit
+   and have to be checked with TraceTriangle()
+ */
+
+#define BVH_BARY_MIN            ( -BARY_EPSILON - 0.001f )
+#define BVH_BARY_MAX            ( 1.0f + BARY_EPSILON + 0.001f )
+#define BVH_COPLANAR_EPSILON    ( COPLANAR_EPSILON * 0.99f )
+#define BVH_DEPTH_EPSILON       0.01f
+
+static int TraceBVHPacket( const traceBVHPacket_t *packet, const trace_t *trace ){
+#if defined( __SSE__ )
+	__m128 dx, dy, dz, e1x, e1y, e1z, e2x, e2y, e2z, tx, ty, tz;
+	__m128 px, py, pz, qx, qy, qz, det, invDet, u, v, depth, mask;
+
+
+	/* broadcast the ray */
+	dx = _mm_set1_ps( trace->direction[ 0 ] );
+	dy = _mm_set1_ps( trace->direction[ 1 ] );
+	dz = _mm_set1_ps( trace->direction[ 2 ] );
+
+	/* load the triangles */
+	e1x = _mm_loadu_ps( packet->edge1[ 0 ] );
+	e1y = _mm_loadu_ps( packet->edge1[ 1 ] );
+	e1z = _mm_loadu_ps( packet->edge1[ 2 ] );
+	e2x = _mm_loadu_ps( packet->edge2[ 0 ] );
+	e2y = _mm_loadu_ps( packet->edge2[ 1 ] );
+	e2z = _mm_loadu_ps( packet->edge2[ 2 ] );
+
+	/* determinant */
+	px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+	py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+	pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+	det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+	mask = _mm_cmpge_ps( _mm_andnot_ps( _mm_set1_ps( -0.0f ), det ), _mm_set1_ps( BVH_COPLANAR_EPSILON ) );
+	if ( !_mm_movemask_ps( mask ) ) {
+		return 0;
+	}
+	invDet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+
+	/* u parameter */
+	tx = _mm_sub_ps( _mm_set1_ps( trace->origin[ 0 ] ), _mm_loadu_ps( packet->origin[ 0 ] ) );
+	ty = _mm_sub_ps( _mm_set1_ps( trace->origin[ 1 ] ), _mm_loadu_ps( packet->origin[ 1 ] ) );
+	tz = _mm_sub_ps( _mm_set1_ps( trace->origin[ 2 ] ), _mm_loadu_ps( packet->origin[ 2 ] ) );
+	u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( u, _mm_set1_ps( BVH_BARY_MIN ) ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( u, _mm_set1_ps( BVH_BARY_MAX ) ) );
+
+	/* v parameter */
+	qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+	qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+	qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+	v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( v, _mm_set1_ps( BVH_BARY_MIN ) ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), _mm_set1_ps( BVH_BARY_MAX ) ) );
+
+	/* depth */
+	depth = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpgt_ps( depth, _mm_set1_ps( trace->inhibitRadius - BVH_DEPTH_EPSILON ) ) );
+	mask = _mm_and_ps( mask, _mm_cmplt_ps( depth, _mm_set1_ps( trace->distance + BVH_DEPTH_EPSILON ) ) );
+
+	return _mm_movemask_ps( mask );
+#else
+	int i, mask;
+	float tvec[ 3 ], pvec[ 3 ], qvec[ 3 ], edge1[ 3 ], edge2[ 3 ];
+	float det, invDet, u, v, depth;
+
+
+	mask = 0;
+	for ( i = 0; i < BVH_WIDTH; i++ )
+	{
+		/* gather the lane */
+		edge1[ 0 ] = packet->edge1[ 0 ][ i ];
+		edge1[ 1 ] = packet->edge1[ 1 ][ i ];
+		edge1[ 2 ] = packet->edge1[ 2 ][ i ];
+		edge2[ 0 ] = packet->edge2[ 0 ][ i ];
+		edge2[ 1 ] = packet->edge2[ 1 ][ i ];
+		edge2[ 2 ] = packet->edge2[ 2 ][ i ];
+
+		/* determinant */
+		CrossProduct( trace->direction, edge2, pvec );
+		det = DotProduct( edge1, pvec );
+		if ( fabs( det ) < BVH_COPLANAR_EPSILON ) {
+			continue;
+		}
+		invDet = 1.0f / det;
+
+		/* u parameter */
+		tvec[ 0 ] = trace->origin[ 0 ] - packet->origin[ 0 ][ i ];
+		tvec[ 1 ] = trace->origin[ 1 ] - packet->origin[ 1 ][ i ];
+		tvec[ 2 ] = trace->origin[ 2 ] - packet->origin[ 2 ][ i ];
+		u = DotProduct( tvec, pvec ) * invDet;
+		if ( u < BVH_BARY_MIN || u > BVH_BARY_MAX ) {
+			continue;
+		}
+
+		/* v parameter */
+		CrossProduct( tvec, edge1, qvec );
+		v = DotProduct( trace->direction, qvec ) * invDet;
+		if ( v < BVH_BARY_MIN || ( u + v ) > BVH_BARY_MAX ) {
+			continue;
+		}
+
+		/* depth */
+		depth = DotProduct( edge2, qvec ) * invDet;
+		if ( depth <= trace->inhibitRadius - BVH_DEPTH_EPSILON || depth >= trace->distance + BVH_DEPTH_EPSILON ) {
+			continue;
+		}
+
+		mask |= 1 << i;
+	}
+
+	return mask;
+#endif
+}
+
+
+
 /*
    TraceLine_r()
    returns qtrue if something is hit and tracing can stop
@@ -1744,6 +2304,261 @@ static qboolean TraceLine_r( int nodeNum, const vec3_t origin, const vec3_t end,
 
 
 
+/*
+   TraceBVH()
+   gathers the triangles of a bvh the ray may hit, the packets that pass the slab test
+   are tested in full, returns -1 when there are more than maxHits of them
+ */
+
+static int TraceBVH( int nodeNum, const trace_t *trace, traceBVHHit_t *hits, int maxHits ){
+	int i, j, mask, numHits, numStack, stack[ BVH_MAX_DEPTH + 1 ];
+	float invDir[ 3 ], t0, t1, temp, tNear, tFar;
+	traceBVHNode_t      *node;
+	traceBVHPacket_t    *packet;
+
+
+	/* setup slab test */
+	for ( i = 0; i < 3; i++ )
+		invDir[ i ] = trace->direction[ i ] != 0.0f ? 1.0f / trace->direction[ i ] : 1e30f;
+
+	/* walk the tree */
+	numHits = 0;
+	numStack = 0;
+	stack[ numStack++ ] = nodeNum;
+	while ( numStack > 0 )
+	{
+		node = &bvhNodes[ stack[ --numStack ] ];
+
+		/* does the part of the ray TraceTriangle() accepts hits on touch the node bounds? */
+		tNear = trace->inhibitRadius - BVH_DEPTH_EPSILON;
+		tFar = trace->distance + BVH_DEPTH_EPSILON;
+		for ( i = 0; i < 3; i++ )
+		{
+			t0 = ( node->mins[ i ] - trace->origin[ i ] ) * invDir[ i ];
+			t1 = ( node->maxs[ i ] - trace->origin[ i ] ) * invDir[ i ];
+			if ( t0 > t1 ) {
+				temp = t0;
+				t0 = t1;
+				t1 = temp;
+			}
+			if ( t0 > tNear ) {
+				tNear = t0;
+			}
+			if ( t1 < tFar ) {
+				tFar = t1;
+			}
+		}
+		if ( tNear > tFar ) {
+			continue;
+		}
+
+		/* interior node */
+		if ( node->numPackets == 0 ) {
+			stack[ numStack++ ] = node->first;
+			stack[ numStack++ ] = node - bvhNodes + 1;
+			continue;
+		}
+
+		/* leaf node: test the packets */
+		for ( i = 0; i < node->numPackets; i++ )
+		{
+			packet = &bvhPackets[ node->first + i ];
+			mask = TraceBVHPacket( packet, trace );
+			for ( j = 0; mask != 0; j++, mask >>= 1 )
+			{
+				if ( !( mask & 1 ) ) {
+					continue;
+				}
+				if ( numHits >= maxHits ) {
+					return -1;
+				}
+				hits[ numHits ].triangleNum = packet->triangles[ j ];
+				hits[ numHits ].leafNum = packet->leafs[ j ];
+				hits[ numHits ].itemNum = packet->items[ j ];
+				numHits++;
+			}
+		}
+	}
+
+	/* done */
+	return numHits;
+}
+
+
+
+/*
+   TraceBVHLeafs()
+   finds the leafs below a TRACE_LEAF_BVH node that TraceLine_r() would have gathered for a
+   trace, in the same order: the part of the trace that reached the node is found again
+   going down the same way from the top of its tree, then the node's subtree is walked
+   the leafs are added to the test nodes of walk, which has to start out like the trace
+ */
+
+static void TraceBVHLeafs( int nodeNum, const trace_t *trace, trace_t *walk ){
+	int num, side;
+	float front, back, frac;
+	vec3_t origin, end, mid;
+	traceNode_t     *node;
+
+
+	/* the bsp nodes are numbered depth first, the skybox node comes last */
+	num = nodeNum >= skyboxNodeNum ? skyboxNodeNum : headNodeNum;
+	VectorCopy( trace->origin, origin );
+	VectorCopy( trace->end, end );
+	while ( num != nodeNum )
+	{
+		/* get node */
+		node = &traceNodes[ num ];
+		if ( node->type < 0 ) {
+			return;
+		}
+
+		/* classify beginning and end points */
+		switch ( node->type )
+		{
+		case PLANE_X:
+			front = origin[ 0 ] - node->plane[ 3 ];
+			back = end[ 0 ] - node->plane[ 3 ];
+			break;
+
+		case PLANE_Y:
+			front = origin[ 1 ] - node->plane[ 3 ];
+			back = end[ 1 ] - node->plane[ 3 ];
+			break;
+
+		case PLANE_Z:
+			front = origin[ 2 ] - node->plane[ 3 ];
+			back = end[ 2 ] - node->plane[ 3 ];
+			break;
+
+		default:
+			front = DotProduct( origin, node->plane ) - node->plane[ 3 ];
+			back = DotProduct( end, node->plane ) - node->plane[ 3 ];
+			break;
+		}
+
+		/* entirely on one side? */
+		if ( front >= -TRACE_ON_EPSILON && back >= -TRACE_ON_EPSILON ) {
+			num = node->children[ 0 ];
+			continue;
+		}
+		if ( front < TRACE_ON_EPSILON && back < TRACE_ON_EPSILON ) {
+			num = node->children[ 1 ];
+			continue;
+		}
+
+		/* calculate intercept point */
+		side = front < 0;
+		frac = front / ( front - back );
+		mid[ 0 ] = origin[ 0 ] + ( end[ 0 ] - origin[ 0 ] ) * frac;
+		mid[ 1 ] = origin[ 1 ] + ( end[ 1 ] - origin[ 1 ] ) * frac;
+		mid[ 2 ] = origin[ 2 ] + ( end[ 2 ] - origin[ 2 ] ) * frac;
+
+		/* the node is on the first side up to the intercept, or on the other one past it */
+		if ( ( nodeNum >= node->children[ 1 ] ) == side ) {
+			num = node->children[ side ];
+			VectorCopy( mid, end );
+		}
+		else
+		{
+			num = node->children[ !side ];
+			VectorCopy( mid, origin );
+		}
+	}
+
+	/* walk the subtree */
+	TraceLine_r( traceNodes[ nodeNum ].children[ 0 ], origin, end, walk );
+}
+
+
+
+/*
+   TraceLineBVH()
+   tests the triangles of the leafs gathered for a trace exactly like TraceLine() does, in the
+   same order and stopping at the same opaque hit, but the triangles below a TRACE_LEAF_BVH
+   node that the ray may hit are found through its bvh; only when there are any is the node's
+   subtree walked, to put them in the order the leafs would have been tested in
+ */
+
+static void TraceLineBVH( trace_t *trace ){
+	int i, j, k, numLeafs, numHits, maxLeafs;
+	traceNode_t     *node;
+	traceBVHHit_t hits[ MAX_BVH_HITS ], hit;
+	trace_t walk;
+
+
+	/* when the leafs below the nodes may be too many for the list, they have to be walked
+	   one by one to find where it ends */
+	maxLeafs = 0;
+	for ( i = 0; i < trace->numTestNodes; i++ )
+	{
+		node = &traceNodes[ trace->testNodes[ i ] ];
+		maxLeafs += node->type == TRACE_LEAF_BVH ? node->numLeafs : 1;
+	}
+
+	/* walk node list, the walk of a subtree continues the list of the leafs before it */
+	walk.testAll = trace->testAll;
+	walk.numTestNodes = 0;
+	for ( i = 0; i < trace->numTestNodes && walk.numTestNodes < MAX_TRACE_TEST_NODES; i++ )
+	{
+		/* get node */
+		node = &traceNodes[ trace->testNodes[ i ] ];
+		numLeafs = walk.numTestNodes;
+
+		/* a leaf is tested like TraceLine() does */
+		if ( node->type != TRACE_LEAF_BVH ) {
+			walk.testNodes[ walk.numTestNodes++ ] = trace->testNodes[ i ];
+			numHits = -1;
+		}
+
+		/* a bvh leaf only needs its subtree walked when it has triangles the ray may hit */
+		else
+		{
+			numHits = -1;
+			if ( maxLeafs <= MAX_TRACE_TEST_NODES ) {
+				numHits = TraceBVH( node->bvhNodeNum, trace, hits, MAX_BVH_HITS );
+				if ( numHits == 0 ) {
+					continue;
+				}
+			}
+			TraceBVHLeafs( trace->testNodes[ i ], trace, &walk );
+		}
+
+		/* test all the triangles of the leafs */
+		if ( numHits < 0 ) {
+			for ( j = numLeafs; j < walk.numTestNodes; j++ )
+			{
+				node = &traceNodes[ walk.testNodes[ j ] ];
+				for ( k = 0; k < node->numItems; k++ )
+				{
+					if ( TraceTriangle( &traceInfos[ traceTriangles[ node->items[ k ] ].infoNum ], &traceTriangles[ node->items[ k ] ], trace ) ) {
+						return;
+					}
+				}
+			}
+			continue;
+		}
+
+		/* or just the ones found, by leaf and then in the order of each leaf's list */
+		for ( j = 0; j < numHits; j++ )
+		{
+			hit = hits[ j ];
+			for ( hit.rank = numLeafs; hit.rank < walk.numTestNodes && walk.testNodes[ hit.rank ] != hit.leafNum; hit.rank++ ) ;
+			for ( k = j; k > 0 && ( hits[ k - 1 ].rank > hit.rank || ( hits[ k - 1 ].rank == hit.rank && hits[ k - 1 ].itemNum > hit.itemNum ) ); k-- )
+				hits[ k ] = hits[ k - 1 ];
+			hits[ k ] = hit;
+		}
+		for ( j = 0; j < numHits && hits[ j ].rank < walk.numTestNodes; j++ )
+		{
+			if ( TraceTriangle( &traceInfos[ traceTriangles[ hits[ j ].triangleNum ].infoNum ], &traceTriangles[ hits[ j ].triangleNum ], trace ) ) {
+				return;
+			}
+		}
+	}
+}
+
+
+
 /*
    TraceLine() - ydnar
    rewrote this function a bit :)
@@ -1787,6 +2602,12 @@ void TraceLine( trace_t *trace ){
 		TraceLine_r( skyboxNodeNum, trace->origin, trace->end, trace );
 	}
 
+	/* test triangles through the bvhs? */
+	if ( traceBVH ) {
+		TraceLineBVH( trace );
+		return;
+	}
+
 	/* walk node list */
 	for ( i = 0; i < trace->numTestNodes; i++ )
 	{
@@ -1809,6 +2630,409 @@ void TraceLine( trace_t *trace ){
 
 
 
+/*
+   TraceLinePacket_r()
+   walks the trace tree with a packet of rays at once, gathering the same leafs in the same order
+   for each ray as TraceLine_r() would; each ray keeps its own lane in the segment arrays and the
+   plane tests are done four lanes at a time with exactly the same float math
+   returns the mask of lanes that hit solid, so tracing can stop for them
+ */
+
+#if TRACE_PACKET_SIMD
+static int TraceLinePacket_r( int nodeNum, trace_t **traces, int active, int testAll, float origins[ 3 ][ MAX_TRACE_PACKET ], float ends[ 3 ][ MAX_TRACE_PACKET ] ){
+	int i, k, frontMask, backMask, splitMask, sideMask, solidMask;
+	float mids[ 3 ][ MAX_TRACE_PACKET ], nearEnds[ 3 ][ MAX_TRACE_PACKET ];
+	vec3_t start, end;
+	__m128 dist, front, back, frac, o, e, epsilon, negEpsilon, fronts[ MAX_TRACE_PACKET / 4 ], backs[ MAX_TRACE_PACKET / 4 ];
+	traceNode_t     *node;
+	trace_t         *trace;
+
+
+	/* a lone ray is cheaper to trace on its own */
+	if ( !( active & ( active - 1 ) ) ) {
+		for ( i = 0; !( active & ( 1 << i ) ); i++ ) ;
+		VectorSet( start, origins[ 0 ][ i ], origins[ 1 ][ i ], origins[ 2 ][ i ] );
+		VectorSet( end, ends[ 0 ][ i ], ends[ 1 ][ i ], ends[ 2 ][ i ] );
+		return TraceLine_r( nodeNum, start, end, traces[ i ] ) ? active : 0;
+	}
+
+	epsilon = _mm_set1_ps( TRACE_ON_EPSILON );
+	negEpsilon = _mm_set1_ps( -TRACE_ON_EPSILON );
+	while ( 1 )
+	{
+		/* bogus node number means solid */
+		node = nodeNum >= 0 ? &traceNodes[ nodeNum ] : NULL;
+		if ( node == NULL || node->type == TRACE_LEAF_SOLID ) {
+			for ( i = 0; i < MAX_TRACE_PACKET; i++ )
+			{
+				if ( active & ( 1 << i ) ) {
+					traces[ i ]->hit[ 0 ] = origins[ 0 ][ i ];
+					traces[ i ]->hit[ 1 ] = origins[ 1 ][ i ];
+					traces[ i ]->hit[ 2 ] = origins[ 2 ][ i ];
+					traces[ i ]->passSolid = qtrue;
+				}
+			}
+			return active;
+		}
+
+		/* leafnode? */
+		if ( node->type < 0 ) {
+			for ( i = 0; i < MAX_TRACE_PACKET; i++ )
+			{
+				trace = traces[ i ];
+				if ( ( active & ( 1 << i ) ) && node->numItems > 0 && trace->numTestNodes < MAX_TRACE_TEST_NODES ) {
+					trace->testNodes[ trace->numTestNodes++ ] = nodeNum;
+				}
+			}
+			return 0;
+		}
+
+		/* ydnar 2003-09-07: don't test branches of the bsp with nothing in them when testall is enabled */
+		if ( node->numItems == 0 ) {
+			active &= ~testAll;
+			if ( active == 0 ) {
+				return 0;
+			}
+		}
+
+		/* classify beginning and end points */
+		frontMask = backMask = 0;
+		dist = _mm_set1_ps( node->plane[ 3 ] );
+		for ( i = 0; i < MAX_TRACE_PACKET; i += 4 )
+		{
+			if ( !( active & ( 15 << i ) ) ) {
+				continue;
+			}
+			if ( node->type <= PLANE_Z ) {
+				front = _mm_sub_ps( _mm_loadu_ps( &origins[ node->type ][ i ] ), dist );
+				back = _mm_sub_ps( _mm_loadu_ps( &ends[ node->type ][ i ] ), dist );
+			}
+			else
+			{
+				front = _mm_add_ps( _mm_add_ps(
+										_mm_mul_ps( _mm_loadu_ps( &origins[ 0 ][ i ] ), _mm_set1_ps( node->plane[ 0 ] ) ),
+										_mm_mul_ps( _mm_loadu_ps( &origins[ 1 ][ i ] ), _mm_set1_ps( node->plane[ 1 ] ) ) ),
+									_mm_mul_ps( _mm_loadu_ps( &origins[ 2 ][ i ] ), _mm_set1_ps( node->plane[ 2 ] ) ) );
+				front = _mm_sub_ps( front, dist );
+				back = _mm_add_ps( _mm_add_ps(
+									   _mm_mul_ps( _mm_loadu_ps( &ends[ 0 ][ i ] ), _mm_set1_ps( node->plane[ 0 ] ) ),
+									   _mm_mul_ps( _mm_loadu_ps( &ends[ 1 ][ i ] ), _mm_set1_ps( node->plane[ 1 ] ) ) ),
+								   _mm_mul_ps( _mm_loadu_ps( &ends[ 2 ][ i ] ), _mm_set1_ps( node->plane[ 2 ] ) ) );
+				back = _mm_sub_ps( back, dist );
+			}
+			frontMask |= _mm_movemask_ps( _mm_and_ps( _mm_cmpge_ps( front, negEpsilon ), _mm_cmpge_ps( back, negEpsilon ) ) ) << i;
+			backMask |= _mm_movemask_ps( _mm_and_ps( _mm_cmplt_ps( front, epsilon ), _mm_cmplt_ps( back, epsilon ) ) ) << i;
+			fronts[ i >> 2 ] = front;
+			backs[ i >> 2 ] = back;
+		}
+		frontMask &= active;
+		backMask &= active & ~frontMask;
+
+		/* the whole packet on one side? */
+		if ( frontMask == active ) {
+			nodeNum = node->children[ 0 ];
+			continue;
+		}
+		if ( backMask == active ) {
+			nodeNum = node->children[ 1 ];
+			continue;
+		}
+		break;
+	}
+
+	/* calculate intercept points for the lanes that cross the plane */
+	splitMask = active & ~frontMask & ~backMask;
+	sideMask = 0;
+	for ( i = 0; i < MAX_TRACE_PACKET; i += 4 )
+	{
+		if ( !( splitMask & ( 15 << i ) ) ) {
+			continue;
+		}
+		front = fronts[ i >> 2 ];
+		frac = _mm_div_ps( front, _mm_sub_ps( front, backs[ i >> 2 ] ) );
+		for ( k = 0; k < 3; k++ )
+		{
+			o = _mm_loadu_ps( &origins[ k ][ i ] );
+			e = _mm_loadu_ps( &ends[ k ][ i ] );
+			_mm_storeu_ps( &mids[ k ][ i ], _mm_add_ps( o, _mm_mul_ps( _mm_sub_ps( e, o ), frac ) ) );
+		}
+		sideMask |= _mm_movemask_ps( _mm_cmplt_ps( front, _mm_setzero_ps() ) ) << i;
+	}
+	sideMask &= splitMask;
+
+	/* split lanes end the first side at the intercept */
+	memcpy( nearEnds, ends, sizeof( nearEnds ) );
+	for ( i = 0; i < MAX_TRACE_PACKET; i++ )
+	{
+		if ( splitMask & ( 1 << i ) ) {
+			nearEnds[ 0 ][ i ] = mids[ 0 ][ i ];
+			nearEnds[ 1 ][ i ] = mids[ 1 ][ i ];
+			nearEnds[ 2 ][ i ] = mids[ 2 ][ i ];
+		}
+	}
+
+	/* trace the side each lane starts on, then the side the split lanes cross into */
+	solidMask = 0;
+	if ( frontMask | ( splitMask & ~sideMask ) ) {
+		solidMask |= TraceLinePacket_r( node->children[ 0 ], traces, frontMask | ( splitMask & ~sideMask ), testAll, origins, nearEnds );
+	}
+	if ( backMask | ( splitMask & sideMask ) ) {
+		solidMask |= TraceLinePacket_r( node->children[ 1 ], traces, backMask | ( splitMask & sideMask ), testAll, origins, nearEnds );
+	}
+	splitMask &= ~solidMask;
+	if ( splitMask & ~sideMask ) {
+		solidMask |= TraceLinePacket_r( node->children[ 1 ], traces, splitMask & ~sideMask, testAll, mids, ends );
+	}
+	if ( splitMask & sideMask ) {
+		solidMask |= TraceLinePacket_r( node->children[ 0 ], traces, splitMask & sideMask, testAll, mids, ends );
+	}
+	return solidMask;
+}
+#endif
+
+
+
+/*
+   TraceTrianglePacket()
+   tests a triangle against four rays at once with the same math as TraceTriangle(), but with
+   slightly wider tolerances; returns a mask of the rays that may hit it and have to be checked
+   with TraceTriangle()
+ */
+
+#define PACKET_ORIGIN           0           /* rows of the ray packet, one lane per ray */
+#define PACKET_DIRECTION        3
+#define PACKET_NEAR             6
+#define PACKET_FAR              7
+#define PACKET_ROWS             8
+
+#if defined( __SSE__ )
+static int TraceTrianglePacket( const traceTriangle_t *tt, float rays[ PACKET_ROWS ][ MAX_TRACE_PACKET ], int lane ){
+	__m128 dx, dy, dz, e1x, e1y, e1z, e2x, e2y, e2z, tx, ty, tz;
+	__m128 px, py, pz, qx, qy, qz, det, invDet, u, v, depth, mask;
+
+
+	/* load the rays */
+	dx = _mm_loadu_ps( &rays[ PACKET_DIRECTION + 0 ][ lane ] );
+	dy = _mm_loadu_ps( &rays[ PACKET_DIRECTION + 1 ][ lane ] );
+	dz = _mm_loadu_ps( &rays[ PACKET_DIRECTION + 2 ][ lane ] );
+
+	/* broadcast the triangle */
+	e1x = _mm_set1_ps( tt->edge1[ 0 ] );
+	e1y = _mm_set1_ps( tt->edge1[ 1 ] );
+	e1z = _mm_set1_ps( tt->edge1[ 2 ] );
+	e2x = _mm_set1_ps( tt->edge2[ 0 ] );
+	e2y = _mm_set1_ps( tt->edge2[ 1 ] );
+	e2z = _mm_set1_ps( tt->edge2[ 2 ] );
+
+	/* determinant */
+	px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+	py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+	pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+	det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+	mask = _mm_cmpge_ps( _mm_andnot_ps( _mm_set1_ps( -0.0f ), det ), _mm_set1_ps( BVH_COPLANAR_EPSILON ) );
+	if ( !_mm_movemask_ps( mask ) ) {
+		return 0;
+	}
+	invDet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+
+	/* u parameter */
+	tx = _mm_sub_ps( _mm_loadu_ps( &rays[ PACKET_ORIGIN + 0 ][ lane ] ), _mm_set1_ps( tt->v[ 0 ].xyz[ 0 ] ) );
+	ty = _mm_sub_ps( _mm_loadu_ps( &rays[ PACKET_ORIGIN + 1 ][ lane ] ), _mm_set1_ps( tt->v[ 0 ].xyz[ 1 ] ) );
+	tz = _mm_sub_ps( _mm_loadu_ps( &rays[ PACKET_ORIGIN + 2 ][ lane ] ), _mm_set1_ps( tt->v[ 0 ].xyz[ 2 ] ) );
+	u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( u, _mm_set1_ps( BVH_BARY_MIN ) ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( u, _mm_set1_ps( BVH_BARY_MAX ) ) );
+	if ( !_mm_movemask_ps( mask ) ) {
+		return 0;
+	}
+
+	/* v parameter */
+	qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+	qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+	qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+	v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpge_ps( v, _mm_set1_ps( BVH_BARY_MIN ) ) );
+	mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), _mm_set1_ps( BVH_BARY_MAX ) ) );
+
+	/* depth */
+	depth = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_cmpgt_ps( depth, _mm_loadu_ps( &rays[ PACKET_NEAR ][ lane ] ) ) );
+	mask = _mm_and_ps( mask, _mm_cmplt_ps( depth, _mm_loadu_ps( &rays[ PACKET_FAR ][ lane ] ) ) );
+
+	return _mm_movemask_ps( mask );
+}
+#endif
+
+
+
+/*
+   TraceLeafPacket()
+   tests the triangles of a trace tree leaf against a group of rays that all reached it,
+   in the same order TraceLine() would; returns the mask of rays that hit something opaque
+ */
+
+static int TraceLeafPacket( traceNode_t *node, trace_t **traces, float rays[ PACKET_ROWS ][ MAX_TRACE_PACKET ], int group ){
+	int i, j, k, mask, done;
+	traceTriangle_t *tt;
+
+
+	/* walk node item list */
+	done = 0;
+	for ( j = 0; j < node->numItems && group != 0; j++ )
+	{
+		tt = &traceTriangles[ node->items[ j ] ];
+		for ( i = 0; i < MAX_TRACE_PACKET; i += 4 )
+		{
+			/* a single ray is done the plain way */
+			mask = ( group >> i ) & 15;
+			if ( mask == 0 ) {
+				continue;
+			}
+#if defined( __SSE__ )
+			if ( mask & ( mask - 1 ) ) {
+				mask &= TraceTrianglePacket( tt, rays, i );
+			}
+#endif
+			for ( k = i; mask != 0; k++, mask >>= 1 )
+			{
+				if ( ( mask & 1 ) && TraceTriangle( &traceInfos[ tt->infoNum ], tt, traces[ k ] ) ) {
+					done |= 1 << k;
+					group &= ~( 1 << k );
+				}
+			}
+		}
+	}
+
+	return done;
+}
+
+
+
+/*
+   TraceLinePacket()
+   traces a packet of up to MAX_TRACE_PACKET similar rays (neighbouring samples towards the same light),
+   with exactly the same results as calling TraceLine() on each of them
+ */
+
+void TraceLinePacket( trace_t **traces, int numTraces ){
+	int i, j, k, numRays, rays[ MAX_TRACE_PACKET ], active, remaining, group, nodeNum;
+	float soa[ PACKET_ROWS ][ MAX_TRACE_PACKET ];
+	trace_t         *trace;
+#if TRACE_PACKET_SIMD
+	int testAll;
+	float origins[ 3 ][ MAX_TRACE_PACKET ], ends[ 3 ][ MAX_TRACE_PACKET ];
+#endif
+
+
+	/* setup output and early outs */
+	numRays = 0;
+	for ( i = 0; i < numTraces; i++ )
+	{
+		trace = traces[ i ];
+		trace->passSolid = qfalse;
+		trace->opaque = qfalse;
+		trace->compileFlags = 0;
+		trace->numTestNodes = 0;
+		if ( !trace->recvShadows || !trace->testOcclusion || trace->distance <= 0.00001f ) {
+			continue;
+		}
+		rays[ numRays++ ] = i;
+	}
+
+	/* trace through nodes */
+#if TRACE_PACKET_SIMD
+	memset( origins, 0, sizeof( origins ) );
+	memset( ends, 0, sizeof( ends ) );
+	active = testAll = 0;
+	for ( i = 0; i < numRays; i++ )
+	{
+		trace = traces[ rays[ i ] ];
+		for ( k = 0; k < 3; k++ )
+		{
+			origins[ k ][ rays[ i ] ] = trace->origin[ k ];
+			ends[ k ][ rays[ i ] ] = trace->end[ k ];
+		}
+		active |= 1 << rays[ i ];
+		if ( trace->testAll ) {
+			testAll |= 1 << rays[ i ];
+		}
+	}
+	if ( active ) {
+		TraceLinePacket_r( headNodeNum, traces, active, testAll, origins, ends );
+	}
+#else
+	for ( i = 0; i < numRays; i++ )
+		TraceLine_r( headNodeNum, traces[ rays[ i ] ]->origin, traces[ rays[ i ] ]->end, traces[ rays[ i ] ] );
+#endif
+
+	/* same as TraceLine() from here on */
+	memset( soa, 0, sizeof( soa ) );
+	active = 0;
+	for ( i = 0; i < numRays; i++ )
+	{
+		trace = traces[ rays[ i ] ];
+		if ( trace->passSolid && !trace->testAll ) {
+			trace->opaque = qtrue;
+			continue;
+		}
+		if ( noSurfaces ) {
+			continue;
+		}
+		if ( trace->testAll && trace->numTestNodes < MAX_TRACE_TEST_NODES &&
+			 trace->compileFlags & C_SKY &&
+			 ( trace->numSurfaces == 0 || surfaceInfos[ trace->surfaces[ 0 ] ].childSurfaceNum < 0 ) ) {
+			TraceLine_r( skyboxNodeNum, trace->origin, trace->end, trace );
+		}
+		if ( traceBVH ) {
+			TraceLineBVH( trace );
+			continue;
+		}
+		active |= 1 << rays[ i ];
+
+		/* setup the ray for the simd triangle tests */
+		for ( k = 0; k < 3; k++ )
+		{
+			soa[ PACKET_ORIGIN + k ][ rays[ i ] ] = trace->origin[ k ];
+			soa[ PACKET_DIRECTION + k ][ rays[ i ] ] = trace->direction[ k ];
+		}
+		soa[ PACKET_NEAR ][ rays[ i ] ] = trace->inhibitRadius - BVH_DEPTH_EPSILON;
+		soa[ PACKET_FAR ][ rays[ i ] ] = trace->distance + BVH_DEPTH_EPSILON;
+	}
+
+	/* walk the node lists in lockstep, testing rays that reached the same leaf together */
+	for ( j = 0; active != 0; j++ )
+	{
+		/* drop the rays whose list ended */
+		for ( i = 0; i < numTraces; i++ )
+		{
+			if ( ( active & ( 1 << i ) ) && j >= traces[ i ]->numTestNodes ) {
+				active &= ~( 1 << i );
+			}
+		}
+
+		/* group the rays by leaf */
+		remaining = active;
+		for ( i = 0; remaining != 0; i++ )
+		{
+			if ( !( remaining & ( 1 << i ) ) ) {
+				continue;
+			}
+			nodeNum = traces[ i ]->testNodes[ j ];
+			group = 0;
+			for ( k = i; k < numTraces; k++ )
+			{
+				if ( ( remaining & ( 1 << k ) ) && traces[ k ]->testNodes[ j ] == nodeNum ) {
+					group |= 1 << k;
+				}
+			}
+			remaining &= ~group;
+			active &= ~TraceLeafPacket( &traceNodes[ nodeNum ], traces, soa, group );
+		}
+	}
+}
+
+
+
 /*
    SetupTrace() - ydnar
    sets up certain trace values
@@ -0,0 +1,620 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define LIGHT_WORK_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+
+
+/*
+   with -workers the light stage is shared out between processes: the one started by hand
+   starts the workers, and every process loads the bsp and goes through the light stage in
+   step with the others, but the costly stages (the light grid, dirt and the illumination of
+   the raw lightmaps) are cut into chunks that go to whichever process claims them first
+
+   the processes talk through <map>.lightwork/ next to the bsp, so workers on other machines
+   seeing the same directory can join with -worker <run>:
+   <run>.key                the run, holding the key of the geometry and light options
+   <run>.worker<n>          a worker joined, holding a count it bumps while it works,
+                            <run>.worker<n>.done once it finished
+   <run>.<stage>.<chunk>    what a process lit of a chunk, <run>.<stage>.<chunk>.claim
+                            holding the worker lighting it
+   <run>.closed             the results are all in, workers still busy can stop
+
+   a worker that joined by hand can not be watched like a process, so the coordinating process
+   lights the chunks of a worker whose count did not change for -workertimeout seconds itself,
+   timed by its own clock as the machines may not agree on the time
+ */
+
+#define LIGHT_WORK_BEAT     5
+
+static char lightWorkDir[ 1024 ], lightWorkRun[ 64 ];
+static int lightWorkStage, lightWorkMaxChunks, lightWorkerNum = -1, lightWorkParent;
+static qboolean lightWorkDone;
+static int numLightWorkProcesses;
+static intptr_t             *lightWorkProcesses;
+static int lightWorkBeat, numLightWorkBeats;
+static double lightWorkBeatTime;
+static char lightWorkBeating;
+static int                  *lightWorkBeats;
+static double               *lightWorkBeatTimes;
+
+
+
+/*
+   LightWorkPath()
+   the path of a file of this run in the light work directory
+ */
+
+static void LightWorkPath( char *path, const char *format, ... ){
+	va_list argptr;
+
+
+	sprintf( path, "%s/%s.", lightWorkDir, lightWorkRun );
+	va_start( argptr, format );
+	vsprintf( path + strlen( path ), format, argptr );
+	va_end( argptr );
+}
+
+
+
+/*
+   BeatLightWork()
+   a worker bumps the count in its file every few seconds, to show it did not die; the threads
+   lighting a chunk call it too, so a long chunk does not look like a dead worker, and whichever
+   thread finds another one beating simply moves on
+ */
+
+void BeatLightWork( void ){
+	char path[ 1024 ];
+	FILE            *file;
+
+
+	if ( !lightWorker || lightWorkerNum < 0 ) {
+		return;
+	}
+	if ( __atomic_test_and_set( &lightWorkBeating, __ATOMIC_ACQUIRE ) ) {
+		return;
+	}
+	if ( I_FloatTime() - lightWorkBeatTime >= LIGHT_WORK_BEAT ) {
+		lightWorkBeatTime = I_FloatTime();
+		LightWorkPath( path, "worker%d", lightWorkerNum );
+		file = fopen( path, "wb" );
+		if ( file == NULL ) {
+			Error( "Could not write %s", path );
+		}
+		fprintf( file, "%d\n", ++lightWorkBeat );
+		fclose( file );
+	}
+	__atomic_clear( &lightWorkBeating, __ATOMIC_RELEASE );
+}
+
+
+
+/*
+   LightWorkerSeen()
+   how many seconds ago the count of a worker last changed, by the clock of this process; a
+   worker it hears of for the first time counts as just seen
+ */
+
+static double LightWorkerSeen( int worker ){
+	int i, beat;
+	char path[ 1024 ];
+	FILE            *file;
+
+
+	/* make room for it */
+	if ( worker >= numLightWorkBeats ) {
+		lightWorkBeats = realloc( lightWorkBeats, ( worker + 1 ) * sizeof( *lightWorkBeats ) );
+		lightWorkBeatTimes = realloc( lightWorkBeatTimes, ( worker + 1 ) * sizeof( *lightWorkBeatTimes ) );
+		if ( lightWorkBeats == NULL || lightWorkBeatTimes == NULL ) {
+			Error( "LightWorkerSeen: %d workers", worker + 1 );
+		}
+		for ( i = numLightWorkBeats; i <= worker; i++ )
+		{
+			lightWorkBeats[ i ] = -1;
+			lightWorkBeatTimes[ i ] = I_FloatTime();
+		}
+		numLightWorkBeats = worker + 1;
+	}
+
+	/* a file caught while it is rewritten says nothing */
+	LightWorkPath( path, "worker%d", worker );
+	file = fopen( path, "rb" );
+	if ( file != NULL ) {
+		if ( fscanf( file, "%d", &beat ) == 1 && beat != lightWorkBeats[ worker ] ) {
+			lightWorkBeats[ worker ] = beat;
+			lightWorkBeatTimes[ worker ] = I_FloatTime();
+		}
+		fclose( file );
+	}
+	return I_FloatTime() - lightWorkBeatTimes[ worker ];
+}
+
+
+
+/*
+   ExitLightWork()
+   a worker says it is done with the files of the run however it quits; if the coordinating
+   process quits before the run is done, removing the key tells the workers to quit too
+ */
+
+static void ExitLightWork( void ){
+	char path[ 1024 ];
+
+
+	if ( lightWorker ) {
+		LightWorkPath( path, "worker%d.done", lightWorkerNum );
+		Q_CreateExclusive( path );
+	}
+	else if ( !lightWorkDone ) {
+		LightWorkPath( path, "key" );
+		remove( path );
+	}
+}
+
+
+
+/*
+   StartLightWorkers()
+   starts the workers with the command line of this process, with -worker <run> for -workers
+ */
+
+static void StartLightWorkers( int numWorkers ){
+	int i, argc;
+	char            **argv, path[ 1024 ];
+
+
+	if ( numWorkers <= 0 ) {
+		return;
+	}
+
+	/* make their command line */
+	argv = safe_malloc( ( myargc + 3 ) * sizeof( *argv ) );
+	argc = 0;
+	for ( i = 0; i < myargc; i++ )
+	{
+		if ( !strcmp( myargv[ i ], "-workers" ) || !strcmp( myargv[ i ], "-connect" ) ) {
+			i++;
+			continue;
+		}
+		argv[ argc++ ] = myargv[ i ];
+		if ( !strcmp( myargv[ i ], "-light" ) ) {
+			argv[ argc++ ] = "-worker";
+			argv[ argc++ ] = lightWorkRun;
+		}
+	}
+	argv[ argc ] = NULL;
+
+	/* start them */
+	numLightWorkProcesses = numWorkers;
+	lightWorkProcesses = safe_malloc0( numWorkers * sizeof( *lightWorkProcesses ) );
+	for ( i = 0; i < numWorkers; i++ )
+	{
+		LightWorkPath( path, "log%d", i );
+		lightWorkProcesses[ i ] = Sys_StartProcess( argv, path );
+		if ( lightWorkProcesses[ i ] == 0 ) {
+			Error( "Could not start light worker %s", argv[ 0 ] );
+		}
+	}
+	free( argv );
+}
+
+
+
+/*
+   CheckLightWorkers()
+   makes sure the workers this process started did not quit, and that the process coordinating
+   a worker did not
+ */
+
+static void CheckLightWorkers( void ){
+	int i, code;
+	char path[ 1024 ];
+
+
+	/* a worker waiting for a chunk of a process that gave up would wait forever */
+	if ( lightWorker ) {
+		BeatLightWork();
+		LightWorkPath( path, "key" );
+		if ( !FileExists( path ) || Sys_ParentProcess() != lightWorkParent ) {
+			Error( "Light work %s was given up", lightWorkRun );
+		}
+		LightWorkPath( path, "closed" );
+		if ( FileExists( path ) ) {
+			Sys_Printf( "Light work %s is finished\n", lightWorkRun );
+			exit( 0 );
+		}
+		return;
+	}
+
+	/* so would the coordinating process waiting for a chunk of a worker that failed; one that
+	   went through all stages has written all it claimed and may quit before the run is closed */
+	for ( i = 0; i < numLightWorkProcesses; i++ )
+	{
+		if ( lightWorkProcesses[ i ] == 0 ) {
+			continue;
+		}
+		code = Sys_CheckProcess( lightWorkProcesses[ i ], qfalse );
+		if ( code < 0 ) {
+			continue;
+		}
+		lightWorkProcesses[ i ] = 0;
+		LightWorkPath( path, "log%d", i );
+		if ( code != 0 ) {
+			Error( "Light worker %d quit with code %d, see %s", i, code, path );
+		}
+		remove( path );
+	}
+}
+
+
+
+/*
+   SetupLightWork()
+   with -workers, starts a run and the workers for it; with -worker, joins the run, returns
+   qfalse if that is over already
+ */
+
+qboolean SetupLightWork( const char *bspFilePath, int argc, char **argv, int numWorkers, const char *run ){
+	int i;
+	uint64_t key, runKey;
+	char path[ 1024 ];
+	FILE            *file;
+
+
+	/* note it */
+	Sys_Printf( "--- SetupLightWork ---\n" );
+
+	/* the work directory is kept next to the bsp */
+	strcpy( lightWorkDir, bspFilePath );
+	StripExtension( lightWorkDir );
+	strcat( lightWorkDir, ".lightwork" );
+	key = KeyLightCacheWorld( argc, argv );
+
+	/* join a run, and quit if whatever started this process is killed */
+	if ( lightWorker ) {
+		lightWorkParent = Sys_ParentProcess();
+		strncpy( lightWorkRun, run, sizeof( lightWorkRun ) - 1 );
+		LightWorkPath( path, "key" );
+		file = fopen( path, "rb" );
+		if ( file == NULL || fread( &runKey, sizeof( runKey ), 1, file ) != 1 ) {
+			Error( "No light work %s in %s", lightWorkRun, lightWorkDir );
+		}
+		fclose( file );
+		if ( LittleLong64( runKey ) != key ) {
+			Error( "Light work %s is for other geometry or light options", lightWorkRun );
+		}
+
+		/* sign up */
+		for ( lightWorkerNum = 0; ; lightWorkerNum++ )
+		{
+			LightWorkPath( path, "worker%d", lightWorkerNum );
+			if ( Q_CreateExclusive( path ) ) {
+				break;
+			}
+			if ( !FileExists( path ) ) {
+				Error( "Could not write %s", path );
+			}
+		}
+		atexit( ExitLightWork );
+		LightWorkPath( path, "closed" );
+		if ( FileExists( path ) ) {
+			Sys_Printf( "Light work %s is finished\n", lightWorkRun );
+			return qfalse;
+		}
+		Sys_Printf( "Joined light work %s as worker %d\n", lightWorkRun, lightWorkerNum );
+		lightWorkShared = qtrue;
+		return qtrue;
+	}
+
+	/* start a run, named by the time so runs of crashed processes are not mistaken for it */
+	Q_mkdir( lightWorkDir );
+	for ( i = (int) time( NULL ); ; i++ )
+	{
+		sprintf( lightWorkRun, "%08x", (unsigned int) i );
+		LightWorkPath( path, "key" );
+		if ( Q_CreateExclusive( path ) ) {
+			break;
+		}
+		if ( !FileExists( path ) ) {
+			Error( "Could not write %s", path );
+		}
+	}
+	runKey = LittleLong64( key );
+	file = fopen( path, "wb" );
+	if ( file == NULL || fwrite( &runKey, sizeof( runKey ), 1, file ) != 1 || fclose( file ) ) {
+		Error( "Could not write %s", path );
+	}
+	atexit( ExitLightWork );
+
+	/* start the workers */
+	StartLightWorkers( numWorkers );
+	Sys_Printf( "%9d light workers started\n", numWorkers );
+	Sys_Printf( "More can join with -worker %s\n", lightWorkRun );
+	lightWorkShared = qtrue;
+	return qtrue;
+}
+
+
+
+/*
+   LightWorkChunk()
+   lights a chunk and writes what it lit into the work directory, through a file of its own
+   so a chunk lit again by the coordinating process does not get in the way of the worker
+ */
+
+static void LightWorkChunk( int chunk, void ( *runFunc )( int chunk, FILE *file ) ){
+	char path[ 1024 ], tempPath[ 1024 ];
+	FILE            *file;
+
+
+	LightWorkPath( path, "%d.%d", lightWorkStage, chunk );
+	LightWorkPath( tempPath, "%d.%d.tmp%d", lightWorkStage, chunk, lightWorkerNum + 1 );
+	file = fopen( tempPath, "wb" );
+	if ( file == NULL ) {
+		Error( "Could not write %s", tempPath );
+	}
+	runFunc( chunk, file );
+	if ( fclose( file ) || rename( tempPath, path ) ) {
+		Error( "Could not write %s", path );
+	}
+}
+
+
+
+/*
+   LightWorkChunkLost()
+   the coordinating process gives a chunk up when the worker that claimed it stopped counting,
+   or when nobody said who claimed it for as long
+ */
+
+static qboolean LightWorkChunkLost( int chunk, double waited ){
+	int worker;
+	char path[ 1024 ];
+	FILE            *file;
+
+
+	worker = -1;
+	LightWorkPath( path, "%d.%d.claim", lightWorkStage, chunk );
+	file = fopen( path, "rb" );
+	if ( file != NULL ) {
+		if ( fscanf( file, "%d", &worker ) != 1 ) {
+			worker = -1;
+		}
+		fclose( file );
+	}
+	if ( worker >= 0 ) {
+		return LightWorkerSeen( worker ) > lightWorkTimeout;
+	}
+	return waited > lightWorkTimeout;
+}
+
+
+
+/*
+   RunLightWork()
+   runs a stage cut into chunks: lights the chunks no other process claimed yet and writes
+   what it lit into the work directory, then reads what the others lit for the rest
+ */
+
+void RunLightWork( int numChunks, void ( *runFunc )( int chunk, FILE *file ), void ( *readFunc )( int chunk, FILE *file, const char *path ) ){
+	int chunk, numDone, numLit, f, fOld, start;
+	double waitStart, checked;
+	qboolean        *lit;
+	char path[ 1024 ], claimPath[ 1024 ];
+	FILE            *file;
+
+
+	/* every process counts the stages the same */
+	lightWorkStage++;
+	if ( numChunks > lightWorkMaxChunks ) {
+		lightWorkMaxChunks = numChunks;
+	}
+	CheckLightWorkers();
+	if ( numChunks <= 0 ) {
+		return;
+	}
+
+	lit = safe_malloc0( numChunks * sizeof( *lit ) );
+	numDone = 0;
+	numLit = 0;
+	fOld = -1;
+	start = I_FloatTime();
+
+	/* light what nobody claimed yet */
+	for ( chunk = 0; chunk < numChunks; chunk++ )
+	{
+		CheckLightWorkers();
+		LightWorkPath( claimPath, "%d.%d.claim", lightWorkStage, chunk );
+		if ( !Q_CreateExclusive( claimPath ) ) {
+			continue;
+		}
+		if ( lightWorker ) {
+			file = fopen( claimPath, "wb" );
+			if ( file == NULL ) {
+				Error( "Could not write %s", claimPath );
+			}
+			fprintf( file, "%d\n", lightWorkerNum );
+			fclose( file );
+		}
+		LightWorkChunk( chunk, runFunc );
+		lit[ chunk ] = qtrue;
+		numLit++;
+
+		/* print pacifier */
+		f = 10 * ++numDone / numChunks;
+		while ( fOld < f && fOld < 9 )
+			Sys_Printf( "%i...", ++fOld );
+	}
+
+	/* read what the others lit */
+	for ( chunk = 0; chunk < numChunks; chunk++ )
+	{
+		if ( lit[ chunk ] ) {
+			continue;
+		}
+		LightWorkPath( path, "%d.%d", lightWorkStage, chunk );
+		waitStart = checked = I_FloatTime();
+		while ( !FileExists( path ) )
+		{
+			CheckLightWorkers();
+			Sys_Sleep( 10 );
+
+			/* light the chunks of a worker that went quiet here */
+			if ( !lightWorker && I_FloatTime() - checked >= 1 ) {
+				checked = I_FloatTime();
+				if ( LightWorkChunkLost( chunk, checked - waitStart ) ) {
+					Sys_FPrintf( SYS_WRN, "WARNING: Light work chunk %d.%d was given up, lighting it here\n", lightWorkStage, chunk );
+					LightWorkChunk( chunk, runFunc );
+					lit[ chunk ] = qtrue;
+					numLit++;
+					break;
+				}
+			}
+		}
+		if ( lit[ chunk ] ) {
+			f = 10 * ++numDone / numChunks;
+			while ( fOld < f && fOld < 9 )
+				Sys_Printf( "%i...", ++fOld );
+			continue;
+		}
+		file = fopen( path, "rb" );
+		if ( file == NULL ) {
+			Error( "Could not read %s", path );
+		}
+		readFunc( chunk, file, path );
+		fclose( file );
+
+		/* print pacifier */
+		f = 10 * ++numDone / numChunks;
+		while ( fOld < f && fOld < 9 )
+			Sys_Printf( "%i...", ++fOld );
+	}
+	Sys_Printf( " (%i)\n", (int) ( I_FloatTime() - start ) );
+	Sys_FPrintf( SYS_VRB, "%9d of %d chunks lit by this process\n", numLit, numChunks );
+	free( lit );
+}
+
+
+
+/*
+   CloseLightWork()
+   the coordinating process waits for all workers to be done and removes the files of the run
+ */
+
+void CloseLightWork( void ){
+	int i, j, stage, chunk, code;
+	char path[ 1024 ], donePath[ 1024 ];
+
+
+	if ( !lightWorkShared || lightWorker ) {
+		return;
+	}
+
+	/* note it */
+	Sys_Printf( "--- CloseLightWork ---\n" );
+	LightWorkPath( path, "closed" );
+	Q_CreateExclusive( path );
+	lightWorkDone = qtrue;
+
+	/* wait for the workers started here */
+	for ( i = 0; i < numLightWorkProcesses; i++ )
+	{
+		if ( lightWorkProcesses[ i ] == 0 ) {
+			continue;
+		}
+		code = Sys_CheckProcess( lightWorkProcesses[ i ], qtrue );
+		LightWorkPath( path, "log%d", i );
+		if ( code != 0 ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: Light worker %d quit with code %d, see %s\n", i, code, path );
+		}
+		else{
+			remove( path );
+		}
+	}
+	free( lightWorkProcesses );
+	lightWorkProcesses = NULL;
+	numLightWorkProcesses = 0;
+
+	/* and for the ones that joined from elsewhere, they may still read the results */
+	for ( i = 0; ; i++ )
+	{
+		LightWorkPath( path, "worker%d", i );
+		if ( !FileExists( path ) ) {
+			break;
+		}
+		LightWorkPath( donePath, "worker%d.done", i );
+		while ( !FileExists( donePath ) )
+		{
+			if ( LightWorkerSeen( i ) > lightWorkTimeout ) {
+				Sys_FPrintf( SYS_WRN, "WARNING: Light worker %d stopped working, not waiting for it\n", i );
+				break;
+			}
+			Sys_Sleep( 100 );
+		}
+		remove( donePath );
+		remove( path );
+	}
+	Sys_Printf( "%9d light workers helped\n", i );
+	free( lightWorkBeats );
+	free( lightWorkBeatTimes );
+	lightWorkBeats = NULL;
+	lightWorkBeatTimes = NULL;
+	numLightWorkBeats = 0;
+
+	/* clean up */
+	for ( stage = 1; stage <= lightWorkStage; stage++ )
+	{
+		for ( chunk = 0; chunk < lightWorkMaxChunks; chunk++ )
+		{
+			LightWorkPath( path, "%d.%d", stage, chunk );
+			remove( path );
+			LightWorkPath( path, "%d.%d.claim", stage, chunk );
+			remove( path );
+			for ( j = 0; j <= i; j++ )
+			{
+				LightWorkPath( path, "%d.%d.tmp%d", stage, chunk, j );
+				remove( path );
+			}
+		}
+	}
+	LightWorkPath( path, "closed" );
+	remove( path );
+	LightWorkPath( path, "key" );
+	remove( path );
+	remove( lightWorkDir );
+	lightWorkShared = qfalse;
+}
@@ -1033,13 +1033,13 @@ static qboolean MapQuad( rawLightmap_t *lm, surfaceInfo_t *info, bspDrawVert_t *
 
 
 /*
-   MapRawLightmap()
+   MapRawLightmapLuxels()
    maps the locations, normals, and pvs clusters for a raw lightmap
  */
 
 #define VectorDivide( in, d, out )  VectorScale( in, ( 1.0f / ( d ) ), out )    //%	(out)[ 0 ] = (in)[ 0 ] / (d), (out)[ 1 ] = (in)[ 1 ] / (d), (out)[ 2 ] = (in)[ 2 ] / (d)
 
-void MapRawLightmap( int rawLightmapNum ){
+static void MapRawLightmapLuxels( int rawLightmapNum ){
 	int n, num, i, x, y, sx, sy, pw[ 5 ], r, *cluster, mapNonAxial;
 	float               *luxel, *origin, *normal, samples, radius, pass;
 	rawLightmap_t       *lm;
@@ -1049,11 +1049,6 @@ void MapRawLightmap( int rawLightmapNum ){
 	bspDrawVert_t       *verts, *dv[ 4 ], fake;
 
 
-	/* bail if this number exceeds the number of raw lightmaps */
-	if ( rawLightmapNum >= numRawLightmaps ) {
-		return;
-	}
-
 	/* get lightmap */
 	lm = &rawLightmaps[ rawLightmapNum ];
 
@@ -1417,6 +1412,29 @@ void MapRawLightmap( int rawLightmapNum ){
 
 
 
+/*
+   MapRawLightmap()
+   maps a raw lightmap, unpacking it for that with -compactlightmaps
+ */
+
+void MapRawLightmap( int rawLightmapNum ){
+	/* bail if this number exceeds the number of raw lightmaps */
+	if ( rawLightmapNum >= numRawLightmaps ) {
+		return;
+	}
+
+	/* map it */
+	if ( compactLightmaps ) {
+		UnpackRawLightmap( &rawLightmaps[ rawLightmapNum ] );
+	}
+	MapRawLightmapLuxels( rawLightmapNum );
+	if ( compactLightmaps ) {
+		PackRawLightmap( &rawLightmaps[ rawLightmapNum ] );
+	}
+}
+
+
+
 /*
    SetupDirt()
    sets up dirtmap (ambient occlusion)
@@ -1461,6 +1479,36 @@ void SetupDirt( void ){
 }
 
 
+
+/*
+   LuxelJitter() / PointJitter()
+   a repeatable jitter for a luxel (or a grid point), or for a sample point by its position, so
+   random samples don't depend on which thread or light worker takes the luxel, or in what order
+ */
+
+float LuxelJitter( int x, int y, int n ){
+	unsigned int h;
+
+
+	h = (unsigned int) x * 0x9e3779b1u;
+	h = ( h ^ ( h >> 16 ) ^ (unsigned int) y ) * 0x85ebca6bu;
+	h = ( h ^ ( h >> 13 ) ^ (unsigned int) n ) * 0xc2b2ae35u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return ( h & 0xFFFFFF ) * ( 1.0f / 16777216.0f );
+}
+
+static float PointJitter( const vec3_t point, int n ){
+	unsigned int bits[ 3 ];
+
+
+	memcpy( bits, point, sizeof( bits ) );
+	return LuxelJitter( (int) bits[ 0 ], (int) ( bits[ 1 ] ^ ( bits[ 2 ] * 0x27d4eb2du ) ), n );
+}
+
+
+
 /*
    DirtForSample()
    calculates dirt value for a given sample
@@ -1469,7 +1517,7 @@ void SetupDirt( void ){
 float DirtForSample( trace_t *trace ){
 	int i;
 	float gatherDirt, outDirt, angle, elevation, ooDepth;
-	vec3_t normal, worldUp, myUp, myRt, temp, direction, displacement;
+	vec3_t normal, worldUp, myUp, myRt, temp, direction, displacement, point;
 
 
 	/* dummy check */
@@ -1484,6 +1532,7 @@ float DirtForSample( trace_t *trace ){
 	gatherDirt = 0.0f;
 	ooDepth = 1.0f / dirtDepth;
 	VectorCopy( trace->normal, normal );
+	VectorCopy( trace->origin, point );
 
 	/* check if the normal is aligned to the world-up */
 	if ( normal[ 0 ] == 0.0f && normal[ 1 ] == 0.0f && ( normal[ 2 ] == 1.0f || normal[ 2 ] == -1.0f ) ) {
@@ -1511,8 +1560,8 @@ float DirtForSample( trace_t *trace ){
 		for ( i = 0; i < numDirtVectors; i++ )
 		{
 			/* get random vector */
-			angle = Random() * DEG2RAD( 360.0f );
-			elevation = Random() * DEG2RAD( DIRT_CONE_ANGLE );
+			angle = PointJitter( point, 2 * i ) * DEG2RAD( 360.0f );
+			elevation = PointJitter( point, 2 * i + 1 ) * DEG2RAD( DIRT_CONE_ANGLE );
 			temp[ 0 ] = cos( angle ) * sin( elevation );
 			temp[ 1 ] = sin( angle ) * sin( elevation );
 			temp[ 2 ] = cos( elevation );
@@ -1595,27 +1644,311 @@ float DirtForSample( trace_t *trace ){
 
 
 /*
-   DirtyRawLightmap()
-   calculates dirty fraction for each luxel
+   CreateRawLightmapTiles()
+   splits a range of raw lightmaps into tiles of at most lightTileSize x lightTileSize super luxels,
+   sorted so the most expensive tiles are handed out first and no single big lightmap is
+   left running on one thread at the end of a stage
+ */
+
+static rawLightmapTile_t    *rawLightmapTiles;
+static int numRawLightmapTiles;
+
+static int CompareRawLightmapTiles( const void *a, const void *b ){
+	const rawLightmapTile_t *ta = (const rawLightmapTile_t*) a;
+	const rawLightmapTile_t *tb = (const rawLightmapTile_t*) b;
+
+	if ( ta->cost != tb->cost ) {
+		return ta->cost < tb->cost ? 1 : -1;
+	}
+	if ( ta->rawLightmapNum != tb->rawLightmapNum ) {
+		return ta->rawLightmapNum - tb->rawLightmapNum;
+	}
+	if ( ta->y != tb->y ) {
+		return ta->y - tb->y;
+	}
+	return ta->x - tb->x;
+}
+
+static void CreateRawLightmapTiles( int firstRawLightmap, int numBatchLightmaps, qboolean weighLights ){
+	int i, x, y, sx, sy, tileWidth, tileHeight, mapped;
+	rawLightmap_t       *lm;
+	rawLightmapTile_t   *tile;
+
+
+	/* count the tiles */
+	numRawLightmapTiles = 0;
+	for ( i = firstRawLightmap; i < firstRawLightmap + numBatchLightmaps; i++ )
+	{
+		lm = &rawLightmaps[ i ];
+		if ( lightTileSize <= 0 || ( weighLights && lm->noTiles ) ) {
+			numRawLightmapTiles++;
+		}
+		else{
+			numRawLightmapTiles += ( ( lm->sw + lightTileSize - 1 ) / lightTileSize ) * ( ( lm->sh + lightTileSize - 1 ) / lightTileSize );
+		}
+	}
+	rawLightmapTiles = safe_malloc( numRawLightmapTiles * sizeof( *rawLightmapTiles ) );
+
+	/* cut them */
+	tile = rawLightmapTiles;
+	for ( i = firstRawLightmap; i < firstRawLightmap + numBatchLightmaps; i++ )
+	{
+		lm = &rawLightmaps[ i ];
+		if ( lightTileSize <= 0 || ( weighLights && lm->noTiles ) ) {
+			tileWidth = lm->sw;
+			tileHeight = lm->sh;
+		}
+		else
+		{
+			tileWidth = lightTileSize;
+			tileHeight = lightTileSize;
+		}
+
+		for ( y = 0; y < lm->sh; y += tileHeight )
+		{
+			for ( x = 0; x < lm->sw; x += tileWidth )
+			{
+				tile->rawLightmapNum = i;
+				tile->x = x;
+				tile->y = y;
+				tile->w = ( x + tileWidth < lm->sw ) ? tileWidth : lm->sw - x;
+				tile->h = ( y + tileHeight < lm->sh ) ? tileHeight : lm->sh - y;
+
+				/* the work is roughly proportional to the mapped luxels (times the lights reaching them) */
+				mapped = 0;
+				for ( sy = tile->y; sy < tile->y + tile->h; sy++ )
+					for ( sx = tile->x; sx < tile->x + tile->w; sx++ )
+						if ( *SUPER_CLUSTER( sx, sy ) >= 0 ) {
+							mapped++;
+						}
+				tile->cost = mapped;
+				if ( weighLights ) {
+					tile->cost *= lm->numLights + 1;
+				}
+				tile++;
+			}
+		}
+	}
+
+	/* largest first */
+	qsort( rawLightmapTiles, numRawLightmapTiles, sizeof( *rawLightmapTiles ), CompareRawLightmapTiles );
+}
+
+static void FreeRawLightmapTiles( void ){
+	free( rawLightmapTiles );
+	rawLightmapTiles = NULL;
+	numRawLightmapTiles = 0;
+}
+
+
+
+/*
+   RunRawLightmapStage()
+   runs a stage over the raw lightmaps: a function per raw lightmap, one per tile, then another one
+   per raw lightmap; with -compactlightmaps the raw lightmaps are unpacked for it a batch at a time
+   and packed again after, so no more than a batch is ever held at full precision; with light
+   workers, each process runs it on the chunks of raw lightmaps it claims and reads the others
+ */
+
+static int firstBatchLightmap;
+static void ( *batchLightmapFunc )( int );
+
+static int numWorkChunks, workChunks[ LIGHT_WORK_CHUNKS + 1 ];
+static FILE                 *workFile;
+static void ( *workBeginFunc )( int ), ( *workTileFunc )( int ), ( *workFinishFunc )( int );
+static qboolean workWeighLights;
+static void ( *workWriteFunc )( FILE *file, rawLightmap_t *lm );
+static void ( *workReadFunc )( FILE *file, const char *path, rawLightmap_t *lm );
+
+static void RunBatchLightmapFunc( int num ){
+	batchLightmapFunc( firstBatchLightmap + num );
+}
+
+static void UnpackBatchLightmap( int num ){
+	UnpackRawLightmap( &rawLightmaps[ firstBatchLightmap + num ] );
+}
+
+static void PackBatchLightmap( int num ){
+	PackRawLightmap( &rawLightmaps[ firstBatchLightmap + num ] );
+}
+
+static void WriteBatchLightmaps( int num ){
+	int i;
+
+
+	/* a light worker writes what it lit before it is packed again */
+	if ( workFile != NULL ) {
+		for ( i = firstBatchLightmap; i < firstBatchLightmap + num; i++ )
+			workWriteFunc( workFile, &rawLightmaps[ i ] );
+	}
+}
+
+static void RunRawLightmapRange( int firstRawLightmap, int numRangeLightmaps, void ( *beginFunc )( int ), void ( *tileFunc )( int ), void ( *finishFunc )( int ), qboolean weighLights, qboolean showpacifier ){
+	int num, lastRawLightmap, luxels, maxLuxels, doneLuxels, totalLuxels, f, fOld, start;
+
+
+	/* everything at once */
+	if ( !compactLightmaps ) {
+		firstBatchLightmap = firstRawLightmap;
+		if ( beginFunc != NULL ) {
+			batchLightmapFunc = beginFunc;
+			RunThreadsOnIndividual( numRangeLightmaps, qfalse, RunBatchLightmapFunc );
+		}
+		CreateRawLightmapTiles( firstRawLightmap, numRangeLightmaps, weighLights );
+		RunThreadsOnIndividual( numRawLightmapTiles, showpacifier, tileFunc );
+		FreeRawLightmapTiles();
+		if ( finishFunc != NULL ) {
+			batchLightmapFunc = finishFunc;
+			RunThreadsOnIndividual( numRangeLightmaps, qfalse, RunBatchLightmapFunc );
+		}
+		WriteBatchLightmaps( numRangeLightmaps );
+		return;
+	}
+
+	/* how many super luxels fit a batch at full precision */
+	maxLuxels = compactBatchSize * 1024 * 1024 /
+				( ( SUPER_LUXEL_SIZE + SUPER_ORIGIN_SIZE + SUPER_NORMAL_SIZE + SUPER_FLOODLIGHT_SIZE + SUPER_DELUXEL_SIZE ) * sizeof( float ) );
+	lastRawLightmap = firstRawLightmap + numRangeLightmaps;
+	totalLuxels = 0;
+	for ( num = firstRawLightmap; num < lastRawLightmap; num++ )
+		totalLuxels += rawLightmaps[ num ].sw * rawLightmaps[ num ].sh;
+
+	/* walk the batches */
+	fOld = -1;
+	start = I_FloatTime();
+	doneLuxels = 0;
+	for ( firstBatchLightmap = firstRawLightmap; firstBatchLightmap < lastRawLightmap; firstBatchLightmap += num )
+	{
+		/* print pacifier */
+		f = totalLuxels > 0 ? 10 * (double) doneLuxels / totalLuxels : 0;
+		while ( showpacifier && fOld < f )
+			Sys_Printf( "%i...", ++fOld );
+
+		/* gather raw lightmaps up to the budget, but at least one */
+		luxels = 0;
+		for ( num = 0; firstBatchLightmap + num < lastRawLightmap; num++ )
+		{
+			luxels += rawLightmaps[ firstBatchLightmap + num ].sw * rawLightmaps[ firstBatchLightmap + num ].sh;
+			if ( num > 0 && luxels > maxLuxels ) {
+				luxels -= rawLightmaps[ firstBatchLightmap + num ].sw * rawLightmaps[ firstBatchLightmap + num ].sh;
+				break;
+			}
+		}
+		doneLuxels += luxels;
+
+		/* run the stage on them */
+		RunThreadsOnIndividual( num, qfalse, UnpackBatchLightmap );
+		if ( beginFunc != NULL ) {
+			batchLightmapFunc = beginFunc;
+			RunThreadsOnIndividual( num, qfalse, RunBatchLightmapFunc );
+		}
+		CreateRawLightmapTiles( firstBatchLightmap, num, weighLights );
+		RunThreadsOnIndividual( numRawLightmapTiles, qfalse, tileFunc );
+		FreeRawLightmapTiles();
+		if ( finishFunc != NULL ) {
+			batchLightmapFunc = finishFunc;
+			RunThreadsOnIndividual( num, qfalse, RunBatchLightmapFunc );
+		}
+		WriteBatchLightmaps( num );
+		RunThreadsOnIndividual( num, qfalse, PackBatchLightmap );
+	}
+	if ( showpacifier ) {
+		while ( fOld < 9 )
+			Sys_Printf( "%i...", ++fOld );
+		Sys_Printf( " (%i)\n", (int) ( I_FloatTime() - start ) );
+	}
+}
+
+static void RunRawLightmapChunkTile( int tileNum ){
+	BeatLightWork();
+	workTileFunc( tileNum );
+}
+
+static void RunRawLightmapChunk( int chunk, FILE *file ){
+	workFile = file;
+	RunRawLightmapRange( workChunks[ chunk ], workChunks[ chunk + 1 ] - workChunks[ chunk ], workBeginFunc, RunRawLightmapChunkTile, workFinishFunc, workWeighLights, qfalse );
+	workFile = NULL;
+}
+
+static void ReadRawLightmapChunk( int chunk, FILE *file, const char *path ){
+	int i;
+
+
+	for ( i = workChunks[ chunk ]; i < workChunks[ chunk + 1 ]; i++ )
+	{
+		if ( compactLightmaps ) {
+			UnpackRawLightmap( &rawLightmaps[ i ] );
+		}
+		workReadFunc( file, path, &rawLightmaps[ i ] );
+		if ( compactLightmaps ) {
+			PackRawLightmap( &rawLightmaps[ i ] );
+		}
+	}
+}
+
+static void RunRawLightmapStage( void ( *beginFunc )( int ), void ( *tileFunc )( int ), void ( *finishFunc )( int ), qboolean weighLights,
+								 void ( *writeFunc )( FILE *file, rawLightmap_t *lm ), void ( *readFunc )( FILE *file, const char *path, rawLightmap_t *lm ) ){
+	int num, luxels, totalLuxels, chunk;
+
+
+	/* all of it here */
+	if ( !lightWorkShared || writeFunc == NULL ) {
+		RunRawLightmapRange( 0, numRawLightmaps, beginFunc, tileFunc, finishFunc, weighLights, qtrue );
+		return;
+	}
+
+	/* cut it into chunks of about the same number of luxels, the same in every process */
+	totalLuxels = 0;
+	for ( num = 0; num < numRawLightmaps; num++ )
+		totalLuxels += rawLightmaps[ num ].sw * rawLightmaps[ num ].sh;
+	numWorkChunks = 0;
+	luxels = 0;
+	for ( num = 0; num < numRawLightmaps; num++ )
+	{
+		chunk = (int) ( (double) luxels * LIGHT_WORK_CHUNKS / totalLuxels );
+		if ( num == 0 || chunk >= numWorkChunks ) {
+			workChunks[ numWorkChunks++ ] = num;
+		}
+		luxels += rawLightmaps[ num ].sw * rawLightmaps[ num ].sh;
+	}
+	workChunks[ numWorkChunks ] = numRawLightmaps;
+
+	/* share it out */
+	workBeginFunc = beginFunc;
+	workTileFunc = tileFunc;
+	workFinishFunc = finishFunc;
+	workWeighLights = weighLights;
+	workWriteFunc = writeFunc;
+	workReadFunc = readFunc;
+	RunLightWork( numWorkChunks, RunRawLightmapChunk, ReadRawLightmapChunk );
+}
+
+
+
+/*
+   DirtyRawLightmapTile()
+   calculates dirty fraction for each luxel of a raw lightmap tile
  */
 
-void DirtyRawLightmap( int rawLightmapNum ){
-	int i, x, y, sx, sy, *cluster;
-	float               *origin, *normal, *dirt, *dirt2, average, samples;
+static void DirtyRawLightmapTile( int tileNum ){
+	int i, x, y, *cluster;
+	float               *origin, *normal, *dirt;
+	rawLightmapTile_t   *tile;
 	rawLightmap_t       *lm;
 	surfaceInfo_t       *info;
 	trace_t trace;
 	qboolean noDirty;
 
 
-	/* bail if this number exceeds the number of raw lightmaps */
-	if ( rawLightmapNum >= numRawLightmaps ) {
+	/* get tile and lightmap */
+	tile = &rawLightmapTiles[ tileNum ];
+	lm = &rawLightmaps[ tile->rawLightmapNum ];
+
+	/* the light cache had it */
+	if ( lm->dirtCached ) {
 		return;
 	}
 
-	/* get lightmap */
-	lm = &rawLightmaps[ rawLightmapNum ];
-
 	/* setup trace */
 	trace.testOcclusion = qtrue;
 	trace.forceSunlight = qfalse;
@@ -1653,9 +1986,9 @@ void DirtyRawLightmap( int rawLightmapNum ){
 	}
 
 	/* gather dirt */
-	for ( y = 0; y < lm->sh; y++ )
+	for ( y = tile->y; y < tile->y + tile->h; y++ )
 	{
-		for ( x = 0; x < lm->sw; x++ )
+		for ( x = tile->x; x < tile->x + tile->w; x++ )
 		{
 			/* get luxel */
 			cluster = SUPER_CLUSTER( x, y );
@@ -1686,6 +2019,34 @@ void DirtyRawLightmap( int rawLightmapNum ){
 			*dirt = DirtForSample( &trace );
 		}
 	}
+}
+
+
+
+/*
+   FilterRawLightmapDirt()
+   filters the gathered dirt of a raw lightmap once all of its tiles are done
+ */
+
+static void FilterRawLightmapDirt( int rawLightmapNum ){
+	int x, y, sx, sy, *cluster;
+	float               *dirt, *dirt2, average, samples;
+	rawLightmap_t       *lm;
+
+
+	/* bail if this number exceeds the number of raw lightmaps */
+	if ( rawLightmapNum >= numRawLightmaps ) {
+		return;
+	}
+
+	/* get lightmap */
+	lm = &rawLightmaps[ rawLightmapNum ];
+
+	/* the light cache had it filtered */
+	if ( lm->dirtCached ) {
+		WriteLightCacheDirt( lm );
+		return;
+	}
 
 	/* testing no filtering */
 	//%	return;
@@ -1741,6 +2102,38 @@ void DirtyRawLightmap( int rawLightmapNum ){
 			*dirt = average / samples;
 		}
 	}
+
+	/* keep it for the next -incremental run */
+	if ( lightIncremental ) {
+		WriteLightCacheDirt( lm );
+	}
+}
+
+
+
+/*
+   BeginDirtyRawLightmap()
+   with -incremental, takes the dirt of a raw lightmap from the light cache if it has it
+ */
+
+static void BeginDirtyRawLightmap( int rawLightmapNum ){
+	rawLightmap_t       *lm;
+
+
+	lm = &rawLightmaps[ rawLightmapNum ];
+	lm->dirtCached = ReadLightCacheDirt( lm );
+}
+
+
+
+/*
+   DirtyRawLightmaps()
+   calculates dirty fraction for each luxel, tile by tile, then filters it per lightmap
+ */
+
+void DirtyRawLightmaps( void ){
+	Sys_Printf( "--- DirtyRawLightmap ---\n" );
+	RunRawLightmapStage( lightIncremental ? BeginDirtyRawLightmap : NULL, DirtyRawLightmapTile, FilterRawLightmapDirt, qfalse, WriteLightWorkDirt, ReadLightWorkDirt );
 }
 
 
@@ -1827,11 +2220,12 @@ static qboolean SubmapRawLuxel( rawLightmap_t *lm, int x, int y, float bx, float
 
 /*
    SubsampleRawLuxel_r()
-   recursively subsamples a luxel until its color gradient is low enough or subsampling limit is reached
+   recursively subsamples a luxel until its color gradient is low enough or subsampling limit is reached,
+   returns the number of samples traced
  */
 
-static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
-	int b, samples, mapped, lighted;
+static int SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
+	int b, samples, mapped, lighted, traced;
 	int cluster[ 4 ];
 	vec4_t luxel[ 4 ];
 	vec3_t deluxel[ 4 ];
@@ -1842,13 +2236,14 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 
 	/* limit check */
 	if ( lightLuxel[ 3 ] >= lightSamples ) {
-		return;
+		return 0;
 	}
 
 	/* setup */
 	VectorClear( total );
 	mapped = 0;
 	lighted = 0;
+	traced = 0;
 
 	/* make 2x2 subsample stamp */
 	for ( b = 0; b < 4; b++ )
@@ -1874,6 +2269,7 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 		/* sample light */
 
 		LightContributionToSample( trace );
+		traced++;
 		if ( trace->forceSubsampling > 1.0f ) {
 			/* alphashadow: we subsample as deep as we can */
 			++lighted;
@@ -1901,7 +2297,7 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 			if ( cluster[ b ] < 0 ) {
 				continue;
 			}
-			SubsampleRawLuxel_r( lm, trace, origin[ b ], x, y, ( bias * 0.5f ), luxel[ b ], lightDeluxel ? deluxel[ b ] : NULL );
+			traced += SubsampleRawLuxel_r( lm, trace, origin[ b ], x, y, ( bias * 0.5f ), luxel[ b ], lightDeluxel ? deluxel[ b ] : NULL );
 		}
 	}
 
@@ -1943,21 +2339,23 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 			VectorCopy( direction, lightDeluxel );
 		}
 	}
+
+	return traced;
 }
 
-/* A mostly Gaussian-like bounded random distribution (sigma is expected standard deviation) */
-static void GaussLikeRandom( float sigma, float *x, float *y ){
+/* A mostly Gaussian-like bounded random distribution (sigma is expected standard deviation), repeatable per luxel and sample */
+static void GaussLikeRandom( float sigma, int lx, int ly, int n, float *x, float *y ){
 	float r;
-	r = Random() * 2 * Q_PI;
+	r = LuxelJitter( lx, ly, 2 * n ) * 2 * Q_PI;
 	*x = sigma * 2.73861278752581783822 * cos( r );
 	*y = sigma * 2.73861278752581783822 * sin( r );
-	r = Random();
+	r = LuxelJitter( lx, ly, 2 * n + 1 );
 	r = 1 - sqrt( r );
 	r = 1 - sqrt( r );
 	*x *= r;
 	*y *= r;
 }
-static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
+static int RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
 	int b, mapped;
 	int cluster;
 	vec3_t origin, normal;
@@ -1971,7 +2369,7 @@ static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t s
 	{
 		/* set origin */
 		VectorCopy( sampleOrigin, origin );
-		GaussLikeRandom( bias, &dx, &dy );
+		GaussLikeRandom( bias, x, y, b, &dx, &dy );
 
 		/* calculate position */
 		if ( !SubmapRawLuxel( lm, x, y, dx, dy, &cluster, origin, normal ) ) {
@@ -2004,51 +2402,68 @@ static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t s
 			lightDeluxel[ 2 ] = totaldirection[ 2 ] / mapped;
 		}
 	}
+
+	return mapped;
 }
 
 
 
 /*
-   IlluminateRawLightmap()
-   illuminates the luxels
+   PushHeapItem(), PopHeapItem()
+   a max heap of item numbers, ordered by a key per item
  */
 
-#define STACK_LL_SIZE           ( SUPER_LUXEL_SIZE * 64 * 64 )
-#define LIGHT_LUXEL( x, y )     ( lightLuxels + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_LUXEL_SIZE ) )
-#define LIGHT_DELUXEL( x, y )       ( lightDeluxels + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_DELUXEL_SIZE ) )
+static void PushHeapItem( int *heap, int *numHeap, const float *keys, int item ){
+	int i, parent;
 
-void IlluminateRawLightmap( int rawLightmapNum ){
-	int i, t, x, y, sx, sy, size, luxelFilterRadius, lightmapNum;
-	int                 *cluster, *cluster2, mapped, lighted, totalLighted;
-	size_t llSize, ldSize;
-	rawLightmap_t       *lm;
-	surfaceInfo_t       *info;
-	qboolean filterColor, filterDir;
-	float brightness;
-	float               *origin, *normal, *dirt, *luxel, *luxel2, *deluxel, *deluxel2;
-	unsigned char           *flag;
-	float               *lightLuxels, *lightDeluxels, *lightLuxel, *lightDeluxel, samples, filterRadius, weight;
-	vec3_t color, direction, averageColor, averageDir, total, temp, temp2;
-	float tests[ 4 ][ 2 ] = { { 0.0f, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
-	trace_t trace;
-	float stackLightLuxels[ STACK_LL_SIZE ];
 
+	for ( i = ( *numHeap )++; i > 0; i = parent )
+	{
+		parent = ( i - 1 ) / 2;
+		if ( keys[ heap[ parent ] ] >= keys[ item ] ) {
+			break;
+		}
+		heap[ i ] = heap[ parent ];
+	}
+	heap[ i ] = item;
+}
+
+static int PopHeapItem( int *heap, int *numHeap, const float *keys ){
+	int i, child, item, last;
 
-	/* bail if this number exceeds the number of raw lightmaps */
-	if ( rawLightmapNum >= numRawLightmaps ) {
-		return;
+
+	item = heap[ 0 ];
+	last = heap[ --( *numHeap ) ];
+	for ( i = 0; ( child = 2 * i + 1 ) < *numHeap; i = child )
+	{
+		if ( child + 1 < *numHeap && keys[ heap[ child + 1 ] ] > keys[ heap[ child ] ] ) {
+			child++;
+		}
+		if ( keys[ last ] >= keys[ heap[ child ] ] ) {
+			break;
+		}
+		heap[ i ] = heap[ child ];
 	}
+	heap[ i ] = last;
+	return item;
+}
+
+
+
+/*
+   CreateRawLightmapLights()
+   creates the culled light list of a raw lightmap in lm->lights
+ */
+
+static void CreateRawLightmapLights( rawLightmap_t *lm ){
+	int i;
+	surfaceInfo_t       *info;
+	trace_t trace;
 
-	/* get lightmap */
-	lm = &rawLightmaps[ rawLightmapNum ];
 
 	/* setup trace */
-	trace.testOcclusion = !noTrace;
-	trace.forceSunlight = qfalse;
-	trace.recvShadows = lm->recvShadows;
 	trace.numSurfaces = lm->numLightSurfaces;
 	trace.surfaces = &lightSurfaces[ lm->firstLightSurface ];
-	trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
 
 	/* twosided lighting (may or may not be a good idea for lightmapped stuff) */
 	trace.twoSided = qfalse;
@@ -2067,29 +2482,119 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	/* create a culled light list for this raw lightmap */
 	CreateTraceLightsForBounds( lm->mins, lm->maxs, lm->plane, lm->numLightClusters, lm->lightClusters, LIGHT_SURFACES, &trace );
 
-	/* -----------------------------------------------------------------
-	   fill pass
-	   ----------------------------------------------------------------- */
+	/* keep a trimmed copy of it for the tiles */
+	lm->numLights = trace.numLights;
+	lm->lights = safe_malloc( ( trace.numLights + 1 ) * sizeof( *lm->lights ) );
+	memcpy( lm->lights, trace.lights, ( trace.numLights + 1 ) * sizeof( *lm->lights ) );
+	FreeTraceLights( &trace );
+}
 
-	/* set counts */
-	numLuxelsIlluminated += ( lm->sw * lm->sh );
 
-	/* test debugging state */
-	if ( debugSurfaces || debugAxis || debugCluster || debugOrigin || dirtDebug || normalmap ) {
-		/* debug fill the luxels */
-		for ( y = 0; y < lm->sh; y++ )
-		{
-			for ( x = 0; x < lm->sw; x++ )
-			{
-				/* get cluster */
-				cluster = SUPER_CLUSTER( x, y );
 
-				/* only fill mapped luxels */
-				if ( *cluster < 0 ) {
-					continue;
-				}
+/*
+   FindCachedRawLightmaps()
+   with -incremental, finds the raw lightmaps the light cache has the direct light of
+   up front, so the floodlight stage can skip them too
+ */
 
-				/* get particulars */
+static void FindCachedRawLightmap( int rawLightmapNum ){
+	rawLightmap_t       *lm;
+
+
+	lm = &rawLightmaps[ rawLightmapNum ];
+	CreateRawLightmapLights( lm );
+	FindLightCacheLightmap( lm );
+	free( lm->lights );
+	lm->lights = NULL;
+	lm->numLights = 0;
+}
+
+void FindCachedRawLightmaps( void ){
+	Sys_FPrintf( SYS_VRB, "--- FindCachedRawLightmaps ---\n" );
+	RunThreadsOnIndividual( numRawLightmaps, qfalse, FindCachedRawLightmap );
+}
+
+
+
+/*
+   BeginIlluminateRawLightmap()
+   creates the culled light list of a raw lightmap and fills its luxels with
+   ambient (or debug) color before the tiles are illuminated; with -incremental a
+   raw lightmap the light cache has is restored from it instead
+ */
+
+static void BeginIlluminateRawLightmap( int rawLightmapNum ){
+	int i, x, y, size, lightmapNum;
+	int                 *cluster;
+	rawLightmap_t       *lm;
+	float brightness;
+	float               *origin, *normal, *luxel, *deluxel;
+	vec3_t temp, temp2;
+
+
+	/* bail if this number exceeds the number of raw lightmaps */
+	if ( rawLightmapNum >= numRawLightmaps ) {
+		return;
+	}
+
+	/* get lightmap */
+	lm = &rawLightmaps[ rawLightmapNum ];
+
+	/* create its light list */
+	CreateRawLightmapLights( lm );
+
+	/* take it from the light cache if none of the lights reaching it changed */
+	if ( lightIncremental && FindLightCacheLightmap( lm ) ) {
+		ReadLightCacheLightmap( lm );
+		free( lm->lights );
+		lm->lights = NULL;
+		lm->numLights = 0;
+		lm->noTiles = qtrue;
+		ThreadLock();
+		numRawLightmapsCached++;
+		ThreadUnlock();
+		return;
+	}
+
+	/* tiles may only light the same lightmap at once if no light has to claim a new style slot */
+	lm->noTiles = qfalse;
+	for ( i = 0; i < lm->numLights && !lm->noTiles; i++ )
+	{
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			if ( lm->styles[ lightmapNum ] == lm->lights[ i ]->style ||
+				 lm->styles[ lightmapNum ] == LS_NONE ) {
+				break;
+			}
+		}
+		if ( lightmapNum >= MAX_LIGHTMAPS || lm->styles[ lightmapNum ] == LS_NONE ) {
+			lm->noTiles = qtrue;
+		}
+	}
+
+	/* -----------------------------------------------------------------
+	   fill pass
+	   ----------------------------------------------------------------- */
+
+	/* set counts */
+	numLuxelsIlluminated += ( lm->sw * lm->sh );
+
+	/* test debugging state */
+	if ( debugSurfaces || debugAxis || debugCluster || debugOrigin || dirtDebug || normalmap ) {
+		/* debug fill the luxels */
+		for ( y = 0; y < lm->sh; y++ )
+		{
+			for ( x = 0; x < lm->sw; x++ )
+			{
+				/* get cluster */
+				cluster = SUPER_CLUSTER( x, y );
+
+				/* only fill mapped luxels */
+				if ( *cluster < 0 ) {
+					continue;
+				}
+
+				/* get particulars */
 				luxel = SUPER_LUXEL( 0, x, y );
 				origin = SUPER_ORIGIN( x, y );
 				normal = SUPER_NORMAL( x, y );
@@ -2140,22 +2645,6 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	}
 	else
 	{
-		/* allocate temporary per-light luxel storage */
-		llSize = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
-		ldSize = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
-		if ( llSize <= ( STACK_LL_SIZE * sizeof( float ) ) ) {
-			lightLuxels = stackLightLuxels;
-		}
-		else{
-			lightLuxels = safe_malloc( llSize );
-		}
-		if ( deluxemap ) {
-			lightDeluxels = safe_malloc( ldSize );
-		}
-		else{
-			lightDeluxels = NULL;
-		}
-
 		/* clear luxels */
 		//%	memset( lm->superLuxels[ 0 ], 0, llSize );
 
@@ -2204,380 +2693,1694 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 		}
 
 		/* debugging code */
-		//%	if( trace.numLights <= 0 )
+		//%	if( lm->numLights <= 0 )
 		//%		Sys_Printf( "Lightmap %9d: 0 lights, axis: %.2f, %.2f, %.2f\n", rawLightmapNum, lm->axis[ 0 ], lm->axis[ 1 ], lm->axis[ 2 ] );
+	}
+}
 
-		/* walk light list */
-		for ( i = 0; i < trace.numLights; i++ )
-		{
-			/* setup trace */
-			trace.light = trace.lights[ i ];
 
-			/* style check */
-			for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
-			{
-				if ( lm->styles[ lightmapNum ] == trace.light->style ||
-					 lm->styles[ lightmapNum ] == LS_NONE ) {
-					break;
-				}
-			}
 
-			/* max of MAX_LIGHTMAPS (4) styles allowed to hit a surface/lightmap */
-			if ( lightmapNum >= MAX_LIGHTMAPS ) {
-				Sys_FPrintf( SYS_WRN, "WARNING: Hit per-surface style limit (%d)\n", MAX_LIGHTMAPS );
-				continue;
-			}
+/*
+   LuxelFilterRadius()
+   returns the radius in super luxels a light is filtered with on a raw lightmap
+ */
 
-			/* setup */
-			memset( lightLuxels, 0, llSize );
-			if ( deluxemap ) {
-				memset( lightDeluxels, 0, ldSize );
-			}
-			totalLighted = 0;
-
-			/* determine filter radius */
-			filterRadius = lm->filterRadius > trace.light->filterRadius
-						   ? lm->filterRadius
-						   : trace.light->filterRadius;
-			if ( filterRadius < 0.0f ) {
-				filterRadius = 0.0f;
-			}
+static int LuxelFilterRadius( rawLightmap_t *lm, light_t *light ){
+	int luxelFilterRadius;
+	float filterRadius;
 
-			/* set luxel filter radius */
-			luxelFilterRadius = lm->sampleSize != 0 ? superSample * filterRadius / lm->sampleSize : 0;
-			if ( luxelFilterRadius == 0 && ( filterRadius > 0.0f || filter ) ) {
-				luxelFilterRadius = 1;
-			}
 
-			/* allocate sampling flags storage */
-			if ( lightSamples > 1 || lightRandomSamples ) {
-				size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( unsigned char );
-				if ( lm->superFlags == NULL ) {
-					lm->superFlags = safe_malloc( size );
-				}
-				memset( (void *) lm->superFlags, 0, size );
+	/* determine filter radius */
+	filterRadius = lm->filterRadius > light->filterRadius
+				   ? lm->filterRadius
+				   : light->filterRadius;
+	if ( filterRadius < 0.0f ) {
+		filterRadius = 0.0f;
+	}
+
+	/* set luxel filter radius */
+	luxelFilterRadius = lm->sampleSize != 0 ? superSample * filterRadius / lm->sampleSize : 0;
+	if ( luxelFilterRadius == 0 && ( filterRadius > 0.0f || filter ) ) {
+		luxelFilterRadius = 1;
+	}
+
+	return luxelFilterRadius;
+}
+
+
+
+/*
+   light cuts
+   with -lightcuts, the lights of a raw lightmap that can stand in for each other (point or area
+   lights of the same style and flags) are clustered in a binary tree; every block of luxels of a
+   tile picks a cut through that tree, refining the clusters whose most possible light is more than
+   the error threshold of the estimated total, and a cluster left in the cut is sampled through one
+   of its lights, carrying the intensity of the whole cluster
+ */
+
+#define LIGHT_CUT_BLOCK_SIZE    8       /* super luxels, blocks may grow so a tile has no more than 8 x 8 */
+#define LIGHT_CUT_MAX_BLOCKS    8
+#define LIGHT_CUT_EVERYWHERE    0xFFFFFFFFFFFFFFFFULL
+
+typedef unsigned long long lightCutMask_t;
+
+typedef struct lightCutItem_s
+{
+	light_t             *light;
+	int num;                                                        /* in the raw lightmap light list */
+	float key;
+}
+lightCutItem_t;
+
+typedef struct lightCutNode_s
+{
+	vec3_t mins, maxs;                                              /* of the member origins and windings */
+	vec3_t color;                                                   /* power weighted sum of the member colors */
+	float power;                                                    /* summed power, what the representative is scaled to */
+	float intensity;                                                /* summed power times the brightest channel */
+	float cap;                                                      /* the most light all members can give a sample together */
+	float envelope;                                                 /* largest member envelope */
+	float reach;                                                    /* farthest any member reaches from the representative */
+	int light;                                                      /* representative, in the raw lightmap light list */
+	int children[ 2 ];                                              /* -1 for leaves */
+}
+lightCutNode_t;
+
+typedef struct lightCut_s
+{
+	int numLights;
+	light_t             **lights;                                   /* the lights that are not clustered, then the cut */
+	lightCutMask_t      *masks;                                     /* per light, the blocks it lights */
+	light_t             *clusters;                                  /* stand-ins for the clusters in the cut */
+	int blockSize, blocksWide, blocksHigh;
+}
+lightCut_t;
+
+static qboolean LightCutClusterable( const light_t *light ){
+	if ( light->type == EMIT_POINT ) {
+		return !( light->flags & LIGHT_ATTEN_LINEAR );
+	}
+	return light->type == EMIT_AREA && light->w != NULL;
+}
+
+static int CompareLightCutClasses( const light_t *a, const light_t *b ){
+	if ( a->type != b->type ) {
+		return a->type - b->type;
+	}
+	if ( a->style != b->style ) {
+		return a->style - b->style;
+	}
+	if ( a->flags != b->flags ) {
+		return a->flags - b->flags;
+	}
+	if ( a->filterRadius != b->filterRadius ) {
+		return a->filterRadius < b->filterRadius ? -1 : 1;
+	}
+	if ( a->angleScale != b->angleScale ) {
+		return a->angleScale < b->angleScale ? -1 : 1;
+	}
+	return 0;
+}
+
+static int CompareLightCutItems( const void *a, const void *b ){
+	const lightCutItem_t *ia = (const lightCutItem_t*) a;
+	const lightCutItem_t *ib = (const lightCutItem_t*) b;
+	int c;
+
+
+	c = CompareLightCutClasses( ia->light, ib->light );
+	if ( c != 0 ) {
+		return c;
+	}
+	if ( ia->key != ib->key ) {
+		return ia->key < ib->key ? -1 : 1;
+	}
+
+	/* threads may have listed the lights in any order */
+	for ( c = 0; c < 3; c++ )
+	{
+		if ( ia->light->origin[ c ] != ib->light->origin[ c ] ) {
+			return ia->light->origin[ c ] < ib->light->origin[ c ] ? -1 : 1;
+		}
+	}
+	return ia->num - ib->num;
+}
+
+/* what a light gives at a distance is under its power / dist^2; area lights have a form factor of about area / ( pi * dist^2 ) */
+static float LightCutPower( const light_t *light ){
+	if ( light->type == EMIT_AREA && !faster ) {
+		return light->add * WindingArea( light->w ) * ( 1.0f / Q_PI );
+	}
+	return light->photons;
+}
+
+/* a repeatable coin toss for picking representatives, seeded with where they are */
+static float LightCutRandom( const light_t *a, const light_t *b ){
+	int i;
+	unsigned int h, bits;
+
+
+	h = 0;
+	for ( i = 0; i < 3; i++ )
+	{
+		memcpy( &bits, &a->origin[ i ], sizeof( bits ) );
+		h = ( h ^ bits ) * 73856093u;
+		memcpy( &bits, &b->origin[ i ], sizeof( bits ) );
+		h = ( h ^ bits ) * 19349663u;
+	}
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+	return ( h & 0xFFFFFF ) * ( 1.0f / 16777216.0f );
+}
+
+static int BuildLightCutTree_r( light_t **lights, lightCutNode_t *nodes, int *numNodes, lightCutItem_t *items, int numItems ){
+	int i, j, axis, nodeNum;
+	float brightest, size, normalSize;
+	light_t             *light;
+	lightCutNode_t      *node, *child;
+	vec3_t mins, maxs, normalMins, normalMaxs, delta;
+
+
+	/* get a node */
+	nodeNum = ( *numNodes )++;
+	node = &nodes[ nodeNum ];
+
+	/* leaf */
+	if ( numItems == 1 ) {
+		light = items[ 0 ].light;
+		node->light = items[ 0 ].num;
+		node->children[ 0 ] = node->children[ 1 ] = -1;
+
+		/* area lights give at most their form factor (under 1), point lights are clamped to 16 units */
+		node->power = LightCutPower( light );
+		if ( light->type == EMIT_AREA && !faster ) {
+			node->cap = light->add;
+		}
+		else{
+			node->cap = node->power * ( 1.0f / 256.0f );
+		}
+		brightest = light->color[ 0 ] > light->color[ 1 ] ? light->color[ 0 ] : light->color[ 1 ];
+		brightest = brightest > light->color[ 2 ] ? brightest : light->color[ 2 ];
+		node->intensity = node->power * brightest;
+		node->cap *= brightest;
+		VectorScale( light->color, node->power, node->color );
+
+		/* bounds */
+		ClearBounds( node->mins, node->maxs );
+		AddPointToBounds( light->origin, node->mins, node->maxs );
+		if ( light->type == EMIT_AREA ) {
+			for ( i = 0; i < light->w->numpoints; i++ )
+				AddPointToBounds( light->w->p[ i ], node->mins, node->maxs );
+		}
+		node->envelope = light->envelope;
+		node->reach = light->envelope;
+		return nodeNum;
+	}
+
+	/* split along the widest spread of the origins, or of the normals of area lights facing apart */
+	ClearBounds( mins, maxs );
+	ClearBounds( normalMins, normalMaxs );
+	for ( i = 0; i < numItems; i++ )
+	{
+		AddPointToBounds( items[ i ].light->origin, mins, maxs );
+		AddPointToBounds( items[ i ].light->normal, normalMins, normalMaxs );
+	}
+	axis = 0;
+	size = normalSize = -1.0f;
+	for ( j = 0; j < 3; j++ )
+	{
+		if ( maxs[ j ] - mins[ j ] > size ) {
+			size = maxs[ j ] - mins[ j ];
+			axis = j;
+		}
+	}
+	if ( items[ 0 ].light->type == EMIT_AREA ) {
+		for ( j = 0; j < 3; j++ )
+		{
+			if ( normalMaxs[ j ] - normalMins[ j ] > 0.5f && normalMaxs[ j ] - normalMins[ j ] > normalSize ) {
+				normalSize = normalMaxs[ j ] - normalMins[ j ];
+				axis = 3 + j;
 			}
+		}
+	}
+	for ( i = 0; i < numItems; i++ )
+		items[ i ].key = axis < 3 ? items[ i ].light->origin[ axis ] : items[ i ].light->normal[ axis - 3 ];
+	qsort( items, numItems, sizeof( *items ), CompareLightCutItems );
+
+	/* build the children */
+	node->children[ 0 ] = BuildLightCutTree_r( lights, nodes, numNodes, items, numItems / 2 );
+	node->children[ 1 ] = BuildLightCutTree_r( lights, nodes, numNodes, items + numItems / 2, numItems - numItems / 2 );
+
+	/* sum them up */
+	child = &nodes[ node->children[ 0 ] ];
+	VectorCopy( child->mins, node->mins );
+	VectorCopy( child->maxs, node->maxs );
+	VectorCopy( child->color, node->color );
+	node->power = child->power;
+	node->intensity = child->intensity;
+	node->cap = child->cap;
+	node->envelope = child->envelope;
+	child = &nodes[ node->children[ 1 ] ];
+	AddPointToBounds( child->mins, node->mins, node->maxs );
+	AddPointToBounds( child->maxs, node->mins, node->maxs );
+	VectorAdd( node->color, child->color, node->color );
+	node->power += child->power;
+	node->intensity += child->intensity;
+	node->cap += child->cap;
+	node->envelope = child->envelope > node->envelope ? child->envelope : node->envelope;
+
+	/* pick the representative of either child, as likely as its share of the power */
+	if ( LightCutRandom( lights[ nodes[ node->children[ 0 ] ].light ], lights[ nodes[ node->children[ 1 ] ].light ] ) * node->power < nodes[ node->children[ 0 ] ].power ) {
+		node->light = nodes[ node->children[ 0 ] ].light;
+	}
+	else{
+		node->light = nodes[ node->children[ 1 ] ].light;
+	}
 
-			/* initial pass, one sample per luxel */
-			for ( y = 0; y < lm->sh; y++ )
-			{
-				for ( x = 0; x < lm->sw; x++ )
-				{
-					/* get cluster */
-					cluster = SUPER_CLUSTER( x, y );
-					if ( *cluster < 0 ) {
-						continue;
-					}
+	/* the representative has to reach as far as any member */
+	node->reach = 0.0f;
+	for ( i = 0; i < 2; i++ )
+	{
+		child = &nodes[ node->children[ i ] ];
+		size = child->reach;
+		if ( child->light != node->light ) {
+			VectorSubtract( lights[ child->light ]->origin, lights[ node->light ]->origin, delta );
+			size += VectorLength( delta );
+		}
+		if ( size > node->reach ) {
+			node->reach = size;
+		}
+	}
 
-					/* get particulars */
-					lightLuxel = LIGHT_LUXEL( x, y );
-					lightDeluxel = LIGHT_DELUXEL( x, y );
-					origin = SUPER_ORIGIN( x, y );
-					normal = SUPER_NORMAL( x, y );
-					flag = SUPER_FLAG( x, y );
+	return nodeNum;
+}
+
+/* the most light a cluster can give to anything in the bounds, 0 when all of it is out of reach */
+static float LightCutBound( const lightCutNode_t *node, const vec3_t mins, const vec3_t maxs ){
+	int i;
+	float d, dist2;
 
-					/* set contribution count */
-					lightLuxel[ 3 ] = 1.0f;
 
-					/* setup trace */
-					trace.cluster = *cluster;
-					VectorCopy( origin, trace.origin );
-					VectorCopy( normal, trace.normal );
+	dist2 = 0.0f;
+	for ( i = 0; i < 3; i++ )
+	{
+		d = node->mins[ i ] - maxs[ i ] > mins[ i ] - node->maxs[ i ] ? node->mins[ i ] - maxs[ i ] : mins[ i ] - node->maxs[ i ];
+		if ( d > 0.0f ) {
+			dist2 += d * d;
+		}
+	}
+	if ( dist2 >= node->envelope * node->envelope ) {
+		return 0.0f;
+	}
+	return node->intensity >= node->cap * dist2 ? node->cap : node->intensity / dist2;
+}
 
-					/* get light for this sample */
-					LightContributionToSample( &trace );
-					VectorCopy( trace.color, lightLuxel );
+/* the light of a cluster, unshadowed and all of it at the representative */
+static float LightCutEstimate( const lightCutNode_t *node, const light_t *light, const vec3_t center ){
+	vec3_t delta;
+	float dist2;
 
-					/* add the contribution to the deluxemap */
-					if ( deluxemap ) {
-						VectorCopy( trace.directionContribution, lightDeluxel );
-					}
 
-					/* check for evilness */
-					if ( trace.forceSubsampling > 1.0f && ( lightSamples > 1 || lightRandomSamples ) ) {
-						totalLighted++;
-						*flag |= FLAG_FORCE_SUBSAMPLING; /* force */
-					}
-					/* add to count */
-					else if ( trace.color[ 0 ] || trace.color[ 1 ] || trace.color[ 2 ] ) {
-						totalLighted++;
+	VectorSubtract( light->origin, center, delta );
+	dist2 = DotProduct( delta, delta );
+	return node->intensity >= node->cap * dist2 ? node->cap : node->intensity / dist2;
+}
+
+static int LightCutBlock( int offset, int blockSize, int numBlocks ){
+	if ( offset <= 0 ) {
+		return 0;
+	}
+	offset /= blockSize;
+	return offset < numBlocks ? offset : numBlocks - 1;
+}
+
+
+
+/*
+   CreateTileLightCut()
+   picks the light cuts for the blocks of a raw lightmap tile and lists the lights and cluster
+   stand-ins the tile is lit with, each with the blocks it lights
+ */
+
+static void CreateTileLightCut( rawLightmap_t *lm, rawLightmapTile_t *tile, lightCut_t *cut ){
+	int i, n, x, y, bx, by, first, numItems, numNodes, numRoots, numHeap, numPending, numClusters, numBlocks, numCut;
+	int                 *roots, *heap, *pending;
+	float total, scale, *bounds, *estimates;
+	lightCutItem_t      *items;
+	lightCutNode_t      *nodes, *node;
+	lightCutMask_t      *nodeMasks, bit, mappedBlocks;
+	light_t             *light;
+	vec3_t mins, maxs, center;
+
+
+	/* carve the tile into blocks, no more than fit a mask */
+	cut->blockSize = LIGHT_CUT_BLOCK_SIZE;
+	while ( ( tile->w + cut->blockSize - 1 ) / cut->blockSize > LIGHT_CUT_MAX_BLOCKS ||
+			( tile->h + cut->blockSize - 1 ) / cut->blockSize > LIGHT_CUT_MAX_BLOCKS )
+		cut->blockSize *= 2;
+	cut->blocksWide = ( tile->w + cut->blockSize - 1 ) / cut->blockSize;
+	cut->blocksHigh = ( tile->h + cut->blockSize - 1 ) / cut->blockSize;
+
+	/* the lights that can't be clustered light everything */
+	cut->lights = safe_malloc( ( 2 * lm->numLights + 1 ) * sizeof( *cut->lights ) );
+	cut->masks = safe_malloc( ( 2 * lm->numLights + 1 ) * sizeof( *cut->masks ) );
+	cut->numLights = 0;
+	items = safe_malloc( ( lm->numLights + 1 ) * sizeof( *items ) );
+	numItems = 0;
+	for ( i = 0; i < lm->numLights; i++ )
+	{
+		light = lm->lights[ i ];
+		if ( LightCutClusterable( light ) ) {
+			items[ numItems ].light = light;
+			items[ numItems ].num = i;
+			items[ numItems ].key = 0.0f;
+			numItems++;
+		}
+		else
+		{
+			cut->lights[ cut->numLights ] = light;
+			cut->masks[ cut->numLights++ ] = LIGHT_CUT_EVERYWHERE;
+		}
+	}
+
+	/* build a tree for each class of lights */
+	qsort( items, numItems, sizeof( *items ), CompareLightCutItems );
+	nodes = safe_malloc( ( 2 * numItems + 1 ) * sizeof( *nodes ) );
+	roots = safe_malloc( ( numItems + 1 ) * sizeof( *roots ) );
+	numNodes = 0;
+	numRoots = 0;
+	for ( first = 0; first < numItems; first = i )
+	{
+		for ( i = first + 1; i < numItems && CompareLightCutClasses( items[ first ].light, items[ i ].light ) == 0; i++ ) ;
+		roots[ numRoots++ ] = BuildLightCutTree_r( lm->lights, nodes, &numNodes, items + first, i - first );
+	}
+
+	/* pick a cut for each block */
+	nodeMasks = safe_malloc0( ( numNodes + 1 ) * sizeof( *nodeMasks ) );
+	heap = safe_malloc( ( numNodes + 1 ) * sizeof( *heap ) );
+	pending = safe_malloc( ( numNodes + 2 ) * sizeof( *pending ) );
+	bounds = safe_malloc( ( numNodes + 1 ) * sizeof( *bounds ) );
+	estimates = safe_malloc( ( numNodes + 1 ) * sizeof( *estimates ) );
+	mappedBlocks = 0;
+	numBlocks = 0;
+	numCut = 0;
+	for ( by = 0; by < cut->blocksHigh; by++ )
+	{
+		for ( bx = 0; bx < cut->blocksWide; bx++ )
+		{
+			/* bound the mapped luxels of the block */
+			ClearBounds( mins, maxs );
+			for ( y = tile->y + by * cut->blockSize; y < tile->y + tile->h && y < tile->y + ( by + 1 ) * cut->blockSize; y++ )
+			{
+				for ( x = tile->x + bx * cut->blockSize; x < tile->x + tile->w && x < tile->x + ( bx + 1 ) * cut->blockSize; x++ )
+				{
+					if ( *SUPER_CLUSTER( x, y ) >= 0 ) {
+						AddPointToBounds( SUPER_ORIGIN( x, y ), mins, maxs );
 					}
 				}
 			}
-
-			/* don't even bother with everything else if nothing was lit */
-			if ( totalLighted == 0 ) {
+			if ( mins[ 0 ] > maxs[ 0 ] ) {
 				continue;
 			}
-
-			/* secondary pass, adaptive supersampling (fixme: use a contrast function to determine if subsampling is necessary) */
-			/* 2003-09-27: changed it so filtering disamples supersampling, as it would waste time */
-			if ( lightSamples > 1 || lightRandomSamples ) {
-				/* walk luxels */
-				for ( y = 0; y < ( lm->sh - 1 ); y++ )
+			VectorAdd( mins, maxs, center );
+			VectorScale( center, 0.5f, center );
+			bit = 1ULL << ( by * cut->blocksWide + bx );
+			mappedBlocks |= bit;
+			numBlocks++;
+
+			/* start from the roots, refine the cluster that may be off the most until all are within the error */
+			total = 0.0f;
+			numHeap = 0;
+			numPending = 0;
+			for ( i = 0; i < numRoots; i++ )
+				pending[ numPending++ ] = roots[ i ];
+			while ( 1 )
+			{
+				while ( numPending > 0 )
 				{
-					for ( x = 0; x < ( lm->sw - 1 ); x++ )
+					n = pending[ --numPending ];
+					bounds[ n ] = LightCutBound( &nodes[ n ], mins, maxs );
+					if ( bounds[ n ] <= 0.0f ) {
+						continue;
+					}
+					estimates[ n ] = LightCutEstimate( &nodes[ n ], lm->lights[ nodes[ n ].light ], center );
+					total += estimates[ n ];
+					if ( nodes[ n ].children[ 0 ] >= 0 ) {
+						PushHeapItem( heap, &numHeap, bounds, n );
+					}
+					else
 					{
-						/* setup */
-						mapped = 0;
-						lighted = 0;
-						VectorClear( total );
+						nodeMasks[ n ] |= bit;
+						numCut++;
+					}
+				}
+				if ( numHeap == 0 || bounds[ heap[ 0 ] ] <= lightCutsError * total ) {
+					break;
+				}
+				n = PopHeapItem( heap, &numHeap, bounds );
+				total -= estimates[ n ];
+				pending[ numPending++ ] = nodes[ n ].children[ 0 ];
+				pending[ numPending++ ] = nodes[ n ].children[ 1 ];
+			}
 
-						/* test 2x2 stamp */
-						for ( t = 0; t < 4; t++ )
-						{
-							/* set sample coords */
-							sx = x + tests[ t ][ 0 ];
-							sy = y + tests[ t ][ 1 ];
+			/* the clusters left make the cut */
+			for ( i = 0; i < numHeap; i++ )
+				nodeMasks[ heap[ i ] ] |= bit;
+			numCut += numHeap;
+		}
+	}
 
-							/* get cluster */
-							cluster = SUPER_CLUSTER( sx, sy );
-							if ( *cluster < 0 ) {
-								continue;
-							}
-							mapped++;
+	/* list the lights and stand-ins for the clusters in any of the cuts */
+	numClusters = 0;
+	for ( n = 0; n < numNodes; n++ )
+	{
+		if ( nodeMasks[ n ] != 0 && nodes[ n ].children[ 0 ] >= 0 ) {
+			numClusters++;
+		}
+	}
+	cut->clusters = safe_malloc( ( numClusters + 1 ) * sizeof( *cut->clusters ) );
+	numClusters = 0;
+	for ( n = 0; n < numNodes; n++ )
+	{
+		if ( nodeMasks[ n ] == 0 ) {
+			continue;
+		}
+		node = &nodes[ n ];
+		light = lm->lights[ node->light ];
+
+		/* a cluster is its representative carrying the power and color of all of it */
+		if ( node->children[ 0 ] >= 0 ) {
+			memcpy( &cut->clusters[ numClusters ], light, sizeof( *light ) );
+			scale = LightCutPower( light );
+			scale = scale > 0.0f ? node->power / scale : 1.0f;
+			light = &cut->clusters[ numClusters++ ];
+			light->next = NULL;
+			light->photons *= scale;
+			light->add *= scale;
+			if ( node->power > 0.0f ) {
+				VectorScale( node->color, 1.0f / node->power, light->color );
+			}
+			light->envelope = node->reach;
+			light->envelope2 = node->reach * node->reach;
+		}
+
+		cut->lights[ cut->numLights ] = light;
+		cut->masks[ cut->numLights++ ] = nodeMasks[ n ] == mappedBlocks ? LIGHT_CUT_EVERYWHERE : nodeMasks[ n ];
+	}
+	cut->lights[ cut->numLights ] = NULL;
+
+	/* statistics */
+	ThreadLock();
+	numLightCutBlocks += numBlocks;
+	numLightCutLights += (double) numBlocks * numItems;
+	numLightCutClusters += numCut;
+	ThreadUnlock();
+
+	/* free the tree */
+	free( items );
+	free( nodes );
+	free( roots );
+	free( nodeMasks );
+	free( heap );
+	free( pending );
+	free( bounds );
+	free( estimates );
+}
+
+static void FreeTileLightCut( lightCut_t *cut ){
+	free( cut->lights );
+	free( cut->masks );
+	free( cut->clusters );
+	memset( cut, 0, sizeof( *cut ) );
+}
+
+
+
+/*
+   LuxelInLightCut()
+   tests if a light of a tile cut lights any block within radius of a luxel
+ */
+
+static qboolean LuxelInLightCut( const lightCut_t *cut, lightCutMask_t mask, const rawLightmapTile_t *tile, int x, int y, int radius ){
+	int bx, by, bx0, by0, bx1, by1;
+
+
+	if ( mask == LIGHT_CUT_EVERYWHERE ) {
+		return qtrue;
+	}
+	bx0 = LightCutBlock( x - radius - tile->x, cut->blockSize, cut->blocksWide );
+	bx1 = LightCutBlock( x + radius - tile->x, cut->blockSize, cut->blocksWide );
+	by0 = LightCutBlock( y - radius - tile->y, cut->blockSize, cut->blocksHigh );
+	by1 = LightCutBlock( y + radius - tile->y, cut->blockSize, cut->blocksHigh );
+	for ( by = by0; by <= by1; by++ )
+	{
+		for ( bx = bx0; bx <= bx1; bx++ )
+		{
+			if ( mask & ( 1ULL << ( by * cut->blocksWide + bx ) ) ) {
+				return qtrue;
+			}
+		}
+	}
+	return qfalse;
+}
+
+
+
+#define STACK_LL_SIZE           ( SUPER_LUXEL_SIZE * 64 * 64 )
+#define LIGHT_LUXEL( x, y )     ( lightLuxels + ( ( ( ( ( y ) - ay ) * aw ) + ( ( x ) - ax ) ) * SUPER_LUXEL_SIZE ) )
+#define LIGHT_DELUXEL( x, y )       ( lightDeluxels + ( ( ( ( ( y ) - ay ) * aw ) + ( ( x ) - ax ) ) * SUPER_DELUXEL_SIZE ) )
+#define LIGHT_FLAG( x, y )      ( lightFlags + ( ( ( ( ( y ) - ay ) * aw ) + ( ( x ) - ax ) ) * SUPER_FLAG_SIZE ) )
+
+
+
+/*
+   AdaptiveSubsampleRawLuxels()
+   supersamples the luxels found on shadow edges, four jittered samples (one per quadrant) at a
+   time, spread the way -randomsamples spreads them; every luxel gets a couple of rounds, then the
+   rest of the budget goes round by round to whichever luxel's mean is the least certain, until
+   that is close enough or the luxels are at lightSamples; the budget is pooled over the edge
+   luxels of a block of the lightmap, so tiles share it out the same as a whole lightmap
+ */
+
+#define ADAPTIVE_SAMPLES_BLOCK  8           /* luxels, square, lightmap aligned */
+#define ADAPTIVE_SAMPLES_ERROR  0.5f        /* standard error of a luxel mean that is good enough */
+#define ADAPTIVE_SAMPLES_PILOT  2           /* rounds before the error is trusted, four samples agree too easily */
+
+typedef struct adaptiveLuxel_s
+{
+	int x, y, numSamples, numRounds;
+	vec3_t color, direction;                /* sums */
+	float mean, m2;                         /* of the sample brightness, running */
+	qboolean forced;                        /* alphashadow, sample as much as possible */
+}
+adaptiveLuxel_t;
+
+static int AdaptiveSubsampleRound( rawLightmap_t *lm, trace_t *trace, adaptiveLuxel_t *al, qboolean deluxe ){
+	int i, s, traced, cluster;
+	float bias, angle, radius, brightness, delta;
+	vec3_t origin, normal;
+
+
+	bias = 0.5f * lightSamplesSearchBoxSize;
+	traced = 0;
+	for ( s = 0; s < 4; s++ )
+	{
+		/* a spot spread like GaussLikeRandom() does, one per quadrant around the luxel */
+		angle = ( s + LuxelJitter( al->x, al->y, 8 * al->numRounds + 2 * s ) ) * 0.5f * Q_PI;
+		radius = 1.0f - sqrt( 1.0f - sqrt( LuxelJitter( al->x, al->y, 8 * al->numRounds + 2 * s + 1 ) ) );
+		radius *= bias * 2.73861278752581783822;
+		VectorCopy( SUPER_ORIGIN( al->x, al->y ), origin );
+		if ( !SubmapRawLuxel( lm, al->x, al->y, radius * cos( angle ), radius * sin( angle ), &cluster, origin, normal ) ) {
+			continue;
+		}
+
+		/* sample light */
+		trace->cluster = cluster;
+		VectorCopy( origin, trace->origin );
+		VectorCopy( normal, trace->normal );
+		LightContributionToSample( trace );
+		traced++;
+		if ( trace->forceSubsampling > 1.0f ) {
+			al->forced = qtrue;
+		}
+
+		/* add it up */
+		VectorAdd( al->color, trace->color, al->color );
+		if ( deluxe ) {
+			VectorAdd( al->direction, trace->directionContribution, al->direction );
+		}
+		al->numSamples++;
+		/* past 255 it all ends up the same byte, don't chase noise there */
+		brightness = 0.0f;
+		for ( i = 0; i < 3; i++ )
+			brightness += trace->color[ i ] < 255.0f ? trace->color[ i ] : 255.0f;
+		delta = brightness - al->mean;
+		al->mean += delta / al->numSamples;
+		al->m2 += delta * ( brightness - al->mean );
+	}
+	al->numRounds++;
+
+	return traced;
+}
+
+static int AdaptiveSubsampleRawLuxels( rawLightmap_t *lm, trace_t *trace, adaptiveLuxel_t *luxels, int numLuxels,
+									   float *lightLuxels, float *lightDeluxels, int ax, int ay, int aw ){
+	int i, n, r, numHeap, budget, traced, *heap;
+	float               *errors, *lightLuxel, *lightDeluxel;
+	adaptiveLuxel_t     *al;
+
+
+	/* every luxel gets its pilot rounds */
+	heap = safe_malloc( ( numLuxels + 1 ) * sizeof( *heap ) );
+	errors = safe_malloc( ( numLuxels + 1 ) * sizeof( *errors ) );
+	numHeap = 0;
+	traced = 0;
+	budget = (int) ( lightSamplesBudget * numLuxels );
+	for ( i = 0; i < numLuxels; i++ )
+	{
+		al = &luxels[ i ];
+		VectorClear( al->color );
+		VectorClear( al->direction );
+		al->numSamples = al->numRounds = 0;
+		al->mean = al->m2 = 0.0f;
+		al->forced = qfalse;
+		for ( n = 0, r = 0; r < ADAPTIVE_SAMPLES_PILOT; r++ )
+			n += AdaptiveSubsampleRound( lm, trace, al, lightDeluxels != NULL );
+		traced += n;
+		if ( n == 0 ) {
+			continue;
+		}
+
+		/* the variance of its mean */
+		errors[ i ] = al->forced ? 1e30f : al->m2 / ( ( al->numSamples - 1 ) * al->numSamples + 1e-6f );
+		if ( n > 0 && al->numSamples + 4 <= lightSamples && errors[ i ] > ADAPTIVE_SAMPLES_ERROR * ADAPTIVE_SAMPLES_ERROR ) {
+			PushHeapItem( heap, &numHeap, errors, i );
+		}
+	}
+
+	/* spend the rest on the least certain */
+	while ( numHeap > 0 && traced < budget )
+	{
+		i = PopHeapItem( heap, &numHeap, errors );
+		al = &luxels[ i ];
+		n = AdaptiveSubsampleRound( lm, trace, al, lightDeluxels != NULL );
+		traced += n;
+		errors[ i ] = al->forced ? 1e30f : al->m2 / ( ( al->numSamples - 1 ) * al->numSamples + 1e-6f );
+
+		/* none of the spots mapped onto the surface, more rounds won't either */
+		if ( n > 0 && al->numSamples + 4 <= lightSamples && errors[ i ] > ADAPTIVE_SAMPLES_ERROR * ADAPTIVE_SAMPLES_ERROR ) {
+			PushHeapItem( heap, &numHeap, errors, i );
+		}
+	}
+
+	/* average, luxels that never mapped keep the sample from their center */
+	for ( i = 0; i < numLuxels; i++ )
+	{
+		al = &luxels[ i ];
+		if ( al->numSamples == 0 ) {
+			continue;
+		}
+		lightLuxel = LIGHT_LUXEL( al->x, al->y );
+		VectorScale( al->color, 1.0f / al->numSamples, lightLuxel );
+		if ( lightDeluxels != NULL ) {
+			lightDeluxel = LIGHT_DELUXEL( al->x, al->y );
+			VectorScale( al->direction, 1.0f / al->numSamples, lightDeluxel );
+		}
+	}
+
+	free( heap );
+	free( errors );
+	return traced;
+}
+
+
+
+/*
+   InterpolateBounceLuxel()
+   bounce cache: interpolates the light of a luxel from the samples on the cache lattice
+   around it, returns qfalse where the surface or the light is not smooth enough for that
+ */
+
+#define BOUNCE_CACHE_NORMAL_EPSILON     0.95f   /* cosine between the luxel normal and the sample normals */
+#define BOUNCE_CACHE_ORIGIN_EPSILON     0.25f   /* of the sample spacing, off the interpolated origin */
+#define BOUNCE_CACHE_CONTRAST           0.25f   /* largest spread of the sample brightnesses, of the brightest */
+#define BOUNCE_CACHE_DARK               1.0f    /* brightness under which any spread will do */
+
+static qboolean InterpolateBounceLuxel( rawLightmap_t *lm, int x, int y, int spacing, int x0, int y0, int x1, int y1,
+										float *lightLuxels, float *lightDeluxels, unsigned char *lightFlags, int ax, int ay, int aw ){
+	int i, sx, sy, cx[ 2 ], cy[ 2 ];
+	float fx, fy, weight, brightness, minBrightness, maxBrightness;
+	float               *normal, *lightLuxel, *lightDeluxel, *sampleLuxel;
+	vec3_t origin;
+
+
+	/* the samples around the luxel, on the lattice lines when it is on one */
+	cx[ 0 ] = x - ( x % spacing );
+	cx[ 1 ] = ( x % spacing ) ? cx[ 0 ] + spacing : cx[ 0 ];
+	cy[ 0 ] = y - ( y % spacing );
+	cy[ 1 ] = ( y % spacing ) ? cy[ 0 ] + spacing : cy[ 0 ];
+	if ( cx[ 0 ] < x0 || cx[ 1 ] >= x1 || cy[ 0 ] < y0 || cy[ 1 ] >= y1 ) {
+		return qfalse;
+	}
+	fx = (float) ( x - cx[ 0 ] ) / spacing;
+	fy = (float) ( y - cy[ 0 ] ) / spacing;
+
+	/* check them */
+	normal = SUPER_NORMAL( x, y );
+	VectorClear( origin );
+	minBrightness = maxBrightness = 0.0f;
+	for ( i = 0; i < 4; i++ )
+	{
+		sx = cx[ i & 1 ];
+		sy = cy[ i >> 1 ];
+		if ( *SUPER_CLUSTER( sx, sy ) < 0 ) {
+			return qfalse;
+		}
+		if ( lightFlags != NULL && ( *LIGHT_FLAG( sx, sy ) & FLAG_FORCE_SUBSAMPLING ) ) {
+			return qfalse;
+		}
+
+		/* the surface has to be smooth */
+		if ( DotProduct( normal, SUPER_NORMAL( sx, sy ) ) < BOUNCE_CACHE_NORMAL_EPSILON ) {
+			return qfalse;
+		}
+		weight = ( ( i & 1 ) ? fx : 1.0f - fx ) * ( ( i >> 1 ) ? fy : 1.0f - fy );
+		VectorMA( origin, weight, SUPER_ORIGIN( sx, sy ), origin );
+
+		/* and so has the light */
+		sampleLuxel = LIGHT_LUXEL( sx, sy );
+		brightness = sampleLuxel[ 0 ] + sampleLuxel[ 1 ] + sampleLuxel[ 2 ];
+		if ( i == 0 || brightness < minBrightness ) {
+			minBrightness = brightness;
+		}
+		if ( i == 0 || brightness > maxBrightness ) {
+			maxBrightness = brightness;
+		}
+	}
+	if ( maxBrightness > BOUNCE_CACHE_DARK && maxBrightness - minBrightness > BOUNCE_CACHE_CONTRAST * maxBrightness ) {
+		return qfalse;
+	}
+
+	/* and continuous, not folded or cut between the samples */
+	VectorSubtract( origin, SUPER_ORIGIN( x, y ), origin );
+	if ( VectorLength( origin ) > BOUNCE_CACHE_ORIGIN_EPSILON * spacing * lm->actualSampleSize / superSample ) {
+		return qfalse;
+	}
+
+	/* interpolate */
+	lightLuxel = LIGHT_LUXEL( x, y );
+	lightDeluxel = LIGHT_DELUXEL( x, y );
+	VectorClear( lightLuxel );
+	if ( lightDeluxels != NULL ) {
+		VectorClear( lightDeluxel );
+	}
+	for ( i = 0; i < 4; i++ )
+	{
+		sx = cx[ i & 1 ];
+		sy = cy[ i >> 1 ];
+		weight = ( ( i & 1 ) ? fx : 1.0f - fx ) * ( ( i >> 1 ) ? fy : 1.0f - fy );
+		VectorMA( lightLuxel, weight, LIGHT_LUXEL( sx, sy ), lightLuxel );
+		if ( lightDeluxels != NULL ) {
+			VectorMA( lightDeluxel, weight, LIGHT_DELUXEL( sx, sy ), lightDeluxel );
+		}
+	}
+	lightLuxel[ 3 ] = 1.0f;
+
+	return qtrue;
+}
+
+
+
+/*
+   IlluminateRawLightmapTile()
+   illuminates the luxels of a raw lightmap tile; each light is sampled over the tile plus an
+   apron as wide as its filter radius, so the luxels on the tile edges are filtered against the
+   same neighbors as in a whole lightmap; when supersampling, the apron also covers the stamps
+   (and the -adaptivesamples blocks) that decide which of those luxels get subsampled
+ */
+
+static void IlluminateRawLightmapTile( int tileNum ){
+	int i, t, x, y, sx, sy, size, luxelFilterRadius, lightmapNum;
+	int ax, ay, aw, ah, apron, superApron, x0, y0, x1, y1, rx0, ry0, rx1, ry1, bx, by;
+	int n, numPacket, numTraced, packetX[ MAX_TRACE_PACKET ];
+	int cacheSpacing, cachePass, anchor, numCached, numSampled, cutRadius, numAdaptive, numSubsamples;
+	int                 *cluster, mapped, lighted, totalLighted;
+	size_t llSize, ldSize;
+	rawLightmapTile_t   *tile;
+	rawLightmap_t       *lm;
+	surfaceInfo_t       *info;
+	float               *origin, *dirt, *luxel, *deluxel;
+	unsigned char           *flag, *lightFlags;
+	float               *lightLuxels, *lightDeluxels, *lightLuxel, *lightDeluxel, samples, weight;
+	vec3_t color, direction, averageColor, averageDir, total;
+	float tests[ 4 ][ 2 ] = { { 0.0f, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
+	trace_t trace, packet[ MAX_TRACE_PACKET ], *traced[ MAX_TRACE_PACKET ];
+	lightCut_t cut;
+	lightCutMask_t cutMask;
+	adaptiveLuxel_t     *adaptiveLuxels;
+	float stackLightLuxels[ STACK_LL_SIZE ];
+
+
+	/* debug colors were filled in up front */
+	if ( debugSurfaces || debugAxis || debugCluster || debugOrigin || dirtDebug || normalmap ) {
+		return;
+	}
+
+	/* get tile and lightmap */
+	tile = &rawLightmapTiles[ tileNum ];
+	lm = &rawLightmaps[ tile->rawLightmapNum ];
+
+	/* the light cache had it */
+	if ( lm->lightCached ) {
+		return;
+	}
+
+	/* setup trace */
+	trace.testOcclusion = !noTrace;
+	trace.forceSunlight = qfalse;
+	trace.recvShadows = lm->recvShadows;
+	trace.numSurfaces = lm->numLightSurfaces;
+	trace.surfaces = &lightSurfaces[ lm->firstLightSurface ];
+	trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
+	trace.numLights = lm->numLights;
+	trace.lights = lm->lights;
+
+	/* light cuts: light the blocks of the tile with clusters of lights where that is close enough */
+	memset( &cut, 0, sizeof( cut ) );
+	if ( lightCuts && lm->numLights > 0 ) {
+		CreateTileLightCut( lm, tile, &cut );
+		trace.numLights = cut.numLights;
+		trace.lights = cut.lights;
+	}
+
+	/* twosided lighting (may or may not be a good idea for lightmapped stuff) */
+	trace.twoSided = qfalse;
+	for ( i = 0; i < trace.numSurfaces; i++ )
+	{
+		/* get surface */
+		info = &surfaceInfos[ trace.surfaces[ i ] ];
+
+		/* check twosidedness */
+		if ( info->si->twoSided ) {
+			trace.twoSided = qtrue;
+			break;
+		}
+	}
+
+	/* neighbouring luxels are traced together, each with its own copy of the trace */
+	for ( i = 0; i < MAX_TRACE_PACKET; i++ )
+		packet[ i ] = trace;
+	numCached = 0;
+	numSampled = 0;
+	numSubsamples = 0;
+
+	/* supersampling tests the stamps one luxel around the ones it may subsample,
+	   -adaptivesamples rounds those out to whole blocks first */
+	superApron = 0;
+	if ( lightSamples > 1 || lightRandomSamples ) {
+		superApron = lightAdaptiveSamples ? ADAPTIVE_SAMPLES_BLOCK : 1;
+	}
+
+	/* the widest apron any of the lights needs */
+	apron = 0;
+	for ( i = 0; i < trace.numLights; i++ )
+	{
+		luxelFilterRadius = LuxelFilterRadius( lm, trace.lights[ i ] );
+		if ( luxelFilterRadius > apron ) {
+			apron = luxelFilterRadius;
+		}
+	}
+	apron += superApron;
+	ax = tile->x - apron > 0 ? tile->x - apron : 0;
+	ay = tile->y - apron > 0 ? tile->y - apron : 0;
+	aw = ( tile->x + tile->w + apron < lm->sw ? tile->x + tile->w + apron : lm->sw ) - ax;
+	ah = ( tile->y + tile->h + apron < lm->sh ? tile->y + tile->h + apron : lm->sh ) - ay;
+
+	/* allocate temporary per-light luxel storage */
+	llSize = aw * ah * SUPER_LUXEL_SIZE * sizeof( float );
+	ldSize = aw * ah * SUPER_DELUXEL_SIZE * sizeof( float );
+	if ( llSize <= ( STACK_LL_SIZE * sizeof( float ) ) ) {
+		lightLuxels = stackLightLuxels;
+	}
+	else{
+		lightLuxels = safe_malloc( llSize );
+	}
+	if ( deluxemap ) {
+		lightDeluxels = safe_malloc( ldSize );
+	}
+	else{
+		lightDeluxels = NULL;
+	}
+
+	/* allocate sampling flags storage */
+	if ( lightSamples > 1 || lightRandomSamples ) {
+		lightFlags = safe_malloc( aw * ah * SUPER_FLAG_SIZE * sizeof( unsigned char ) );
+	}
+	else{
+		lightFlags = NULL;
+	}
+	adaptiveLuxels = lightAdaptiveSamples ? safe_malloc( aw * ah * sizeof( *adaptiveLuxels ) ) : NULL;
+
+	/* walk light list */
+	for ( i = 0; i < trace.numLights; i++ )
+	{
+		/* setup trace */
+		trace.light = trace.lights[ i ];
+
+		/* style check */
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			if ( lm->styles[ lightmapNum ] == trace.light->style ||
+				 lm->styles[ lightmapNum ] == LS_NONE ) {
+				break;
+			}
+		}
+
+		/* max of MAX_LIGHTMAPS (4) styles allowed to hit a surface/lightmap */
+		if ( lightmapNum >= MAX_LIGHTMAPS ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: Hit per-surface style limit (%d)\n", MAX_LIGHTMAPS );
+			continue;
+		}
+
+		/* setup */
+		memset( lightLuxels, 0, llSize );
+		if ( deluxemap ) {
+			memset( lightDeluxels, 0, ldSize );
+		}
+		totalLighted = 0;
+
+		/* set luxel filter radius */
+		luxelFilterRadius = LuxelFilterRadius( lm, trace.light );
+
+		/* sample as much around the tile as this light's filtering and supersampling look at */
+		apron = luxelFilterRadius + superApron;
+		x0 = tile->x - apron > ax ? tile->x - apron : ax;
+		y0 = tile->y - apron > ay ? tile->y - apron : ay;
+		x1 = tile->x + tile->w + apron < ax + aw ? tile->x + tile->w + apron : ax + aw;
+		y1 = tile->y + tile->h + apron < ay + ah ? tile->y + tile->h + apron : ay + ah;
+
+		/* the luxels filtering reads are the ones that may get subsampled */
+		rx0 = tile->x - luxelFilterRadius > 0 ? tile->x - luxelFilterRadius : 0;
+		ry0 = tile->y - luxelFilterRadius > 0 ? tile->y - luxelFilterRadius : 0;
+		rx1 = tile->x + tile->w + luxelFilterRadius < lm->sw ? tile->x + tile->w + luxelFilterRadius : lm->sw;
+		ry1 = tile->y + tile->h + luxelFilterRadius < lm->sh ? tile->y + tile->h + luxelFilterRadius : lm->sh;
+		if ( lightAdaptiveSamples ) {
+			rx0 -= rx0 % ADAPTIVE_SAMPLES_BLOCK;
+			ry0 -= ry0 % ADAPTIVE_SAMPLES_BLOCK;
+			rx1 = rx1 + ADAPTIVE_SAMPLES_BLOCK - 1 - ( ( rx1 + ADAPTIVE_SAMPLES_BLOCK - 1 ) % ADAPTIVE_SAMPLES_BLOCK );
+			ry1 = ry1 + ADAPTIVE_SAMPLES_BLOCK - 1 - ( ( ry1 + ADAPTIVE_SAMPLES_BLOCK - 1 ) % ADAPTIVE_SAMPLES_BLOCK );
+			rx1 = rx1 < lm->sw ? rx1 : lm->sw;
+			ry1 = ry1 < lm->sh ? ry1 : lm->sh;
+		}
+
+		/* clear sampling flags */
+		if ( lightFlags != NULL ) {
+			memset( lightFlags, 0, aw * ah * SUPER_FLAG_SIZE * sizeof( unsigned char ) );
+		}
+
+		/* setup packet traces */
+		for ( n = 0; n < MAX_TRACE_PACKET; n++ )
+			packet[ n ].light = trace.light;
+
+		/* with the bounce cache, bounced light is sampled on a lattice of luxels first, and
+		   the luxels in between are interpolated from it where the light is smooth enough */
+		cacheSpacing = bouncing ? bounceCacheSpacing : 0;
+
+		/* a light of a cut is sampled on the blocks it lights and as far around as filtering, supersampling and the bounce cache look */
+		cutMask = cut.masks != NULL ? cut.masks[ i ] : LIGHT_CUT_EVERYWHERE;
+		cutRadius = apron + cacheSpacing;
+		for ( cachePass = ( cacheSpacing > 1 ? 0 : 1 ); cachePass < 2; cachePass++ )
+		{
+			/* initial pass, one sample per luxel, traced in packets of neighbouring luxels */
+			for ( y = y0; y < y1; y++ )
+			{
+				for ( x = x0; x < x1; )
+				{
+					/* gather the next few mapped luxels of the row */
+					numPacket = 0;
+					numTraced = 0;
+					for ( ; x < x1 && numPacket < MAX_TRACE_PACKET; x++ )
+					{
+						/* get cluster */
+						cluster = SUPER_CLUSTER( x, y );
+						if ( *cluster < 0 || !LuxelInLightCut( &cut, cutMask, tile, x, y, cutRadius ) ) {
+							continue;
+						}
+
+						/* bounce cache */
+						if ( cacheSpacing > 1 ) {
+							anchor = ( x % cacheSpacing ) == 0 && ( y % cacheSpacing ) == 0;
+							if ( cachePass == 0 && !anchor ) {
+								continue;
+							}
+							if ( cachePass == 1 && anchor ) {
+								continue;
+							}
+							if ( cachePass == 1 && InterpolateBounceLuxel( lm, x, y, cacheSpacing, x0, y0, x1, y1, lightLuxels, lightDeluxels, lightFlags, ax, ay, aw ) ) {
+								lightLuxel = LIGHT_LUXEL( x, y );
+								if ( lightLuxel[ 0 ] || lightLuxel[ 1 ] || lightLuxel[ 2 ] ) {
+									totalLighted++;
+								}
+								numCached++;
+								continue;
+							}
+						}
+
+						/* setup trace */
+						packetX[ numPacket ] = x;
+						packet[ numPacket ].cluster = *cluster;
+						VectorCopy( SUPER_ORIGIN( x, y ), packet[ numPacket ].origin );
+						VectorCopy( SUPER_NORMAL( x, y ), packet[ numPacket ].normal );
+
+						/* get light for this sample, deferring the shadow trace */
+						if ( SetupLightContributionToSample( &packet[ numPacket ] ) == LIGHT_TRACE_PENDING ) {
+							traced[ numTraced++ ] = &packet[ numPacket ];
+						}
+						numPacket++;
+					}
+
+					/* trace the shadows together */
+					numSampled += numPacket;
+					if ( numTraced > 0 ) {
+						TraceLinePacket( traced, numTraced );
+						for ( n = 0; n < numTraced; n++ )
+							FinishLightContributionToSample( traced[ n ] );
+					}
+
+					/* store the samples */
+					for ( n = 0; n < numPacket; n++ )
+					{
+						/* get particulars */
+						sx = packetX[ n ];
+						lightLuxel = LIGHT_LUXEL( sx, y );
+						lightDeluxel = LIGHT_DELUXEL( sx, y );
+						flag = LIGHT_FLAG( sx, y );
+
+						/* set contribution count */
+						lightLuxel[ 3 ] = 1.0f;
+						VectorCopy( packet[ n ].color, lightLuxel );
+
+						/* add the contribution to the deluxemap */
+						if ( deluxemap ) {
+							VectorCopy( packet[ n ].directionContribution, lightDeluxel );
+						}
+
+						/* check for evilness */
+						if ( packet[ n ].forceSubsampling > 1.0f && ( lightSamples > 1 || lightRandomSamples ) ) {
+							totalLighted++;
+							*flag |= FLAG_FORCE_SUBSAMPLING; /* force */
+						}
+						/* add to count */
+						else if ( packet[ n ].color[ 0 ] || packet[ n ].color[ 1 ] || packet[ n ].color[ 2 ] ) {
+							totalLighted++;
+						}
+					}
+				}
+			}
+		}
+
+		/* don't even bother with everything else if nothing was lit */
+		if ( totalLighted == 0 ) {
+			continue;
+		}
+
+		/* secondary pass, adaptive supersampling (fixme: use a contrast function to determine if subsampling is necessary) */
+		/* 2003-09-27: changed it so filtering disamples supersampling, as it would waste time */
+		if ( lightSamples > 1 || lightRandomSamples ) {
+			/* pick the luxels to subsample from the stamps over them, all tested before any
+			   subsample is stored, so the picks don't depend on where the tile starts */
+			for ( y = ( ry0 > y0 ? ry0 - 1 : y0 ); y < ry1 && y < ( y1 - 1 ); y++ )
+			{
+				for ( x = ( rx0 > x0 ? rx0 - 1 : x0 ); x < rx1 && x < ( x1 - 1 ); x++ )
+				{
+					/* setup */
+					mapped = 0;
+					lighted = 0;
+					VectorClear( total );
+
+					/* test 2x2 stamp */
+					for ( t = 0; t < 4; t++ )
+					{
+						/* set sample coords */
+						sx = x + tests[ t ][ 0 ];
+						sy = y + tests[ t ][ 1 ];
+
+						/* get cluster */
+						cluster = SUPER_CLUSTER( sx, sy );
+						if ( *cluster < 0 || !LuxelInLightCut( &cut, cutMask, tile, sx, sy, cutRadius ) ) {
+							continue;
+						}
+						mapped++;
+
+						/* get luxel */
+						flag = LIGHT_FLAG( sx, sy );
+						if ( *flag & FLAG_FORCE_SUBSAMPLING ) {
+							/* force a lighted/mapped discrepancy so we subsample */
+							++lighted;
+							++mapped;
+							++mapped;
+						}
+						lightLuxel = LIGHT_LUXEL( sx, sy );
+						VectorAdd( total, lightLuxel, total );
+						if ( ( lightLuxel[ 0 ] + lightLuxel[ 1 ] + lightLuxel[ 2 ] ) > 0.0f ) {
+							lighted++;
+						}
+					}
+
+					/* if total color is under a certain amount, then don't bother subsampling */
+					if ( total[ 0 ] <= 4.0f && total[ 1 ] <= 4.0f && total[ 2 ] <= 4.0f ) {
+						continue;
+					}
+
+					/* if all 4 pixels are either in shadow or light, then don't subsample */
+					if ( lighted != 0 && lighted != mapped ) {
+						for ( t = 0; t < 4; t++ )
+						{
+							/* set sample coords */
+							sx = x + tests[ t ][ 0 ];
+							sy = y + tests[ t ][ 1 ];
+							if ( sx < rx0 || sx >= rx1 || sy < ry0 || sy >= ry1 ) {
+								continue;
+							}
+
+							/* get luxel */
+							cluster = SUPER_CLUSTER( sx, sy );
+							if ( *cluster < 0 || !LuxelInLightCut( &cut, cutMask, tile, sx, sy, cutRadius ) ) {
+								continue;
+							}
+							flag = LIGHT_FLAG( sx, sy );
+							*flag |= FLAG_SUBSAMPLE;
+						}
+					}
+				}
+			}
+
+			/* subsample them, adaptively a block at a time, sharing the budget out among its edge luxels */
+			for ( by = ry0; by < ry1; by += ( lightAdaptiveSamples ? ADAPTIVE_SAMPLES_BLOCK : ry1 - ry0 ) )
+			{
+				for ( bx = rx0; bx < rx1; bx += ( lightAdaptiveSamples ? ADAPTIVE_SAMPLES_BLOCK : rx1 - rx0 ) )
+				{
+					numAdaptive = 0;
+					for ( y = by; y < ry1 && ( !lightAdaptiveSamples || y < by + ADAPTIVE_SAMPLES_BLOCK ); y++ )
+					{
+						for ( x = bx; x < rx1 && ( !lightAdaptiveSamples || x < bx + ADAPTIVE_SAMPLES_BLOCK ); x++ )
+						{
+							flag = LIGHT_FLAG( x, y );
+							if ( !( *flag & FLAG_SUBSAMPLE ) ) {
+								continue;
+							}
+							lightLuxel = LIGHT_LUXEL( x, y );
+							lightDeluxel = LIGHT_DELUXEL( x, y );
+							origin = SUPER_ORIGIN( x, y );
+
+							/* only subsample shadowed luxels */
+							//%	if( (lightLuxel[ 0 ] + lightLuxel[ 1 ] + lightLuxel[ 2 ]) <= 0.0f )
+							//%		continue;
+
+							/* subsample it (adaptively, once all the edge luxels of the block are known) */
+							if ( lightAdaptiveSamples ) {
+								adaptiveLuxels[ numAdaptive ].x = x;
+								adaptiveLuxels[ numAdaptive ].y = y;
+								numAdaptive++;
+							}
+							else if ( lightRandomSamples ) {
+								numSubsamples += RandomSubsampleRawLuxel( lm, &trace, origin, x, y, 0.5f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
+							}
+							else{
+								numSubsamples += SubsampleRawLuxel_r( lm, &trace, origin, x, y, 0.25f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
+							}
+
+							/* debug code to colorize subsampled areas to yellow */
+							//%	luxel = SUPER_LUXEL( lightmapNum, x, y );
+							//%	VectorSet( luxel, 255, 204, 0 );
+						}
+					}
+					if ( numAdaptive > 0 ) {
+						numSubsamples += AdaptiveSubsampleRawLuxels( lm, &trace, adaptiveLuxels, numAdaptive, lightLuxels, deluxemap ? lightDeluxels : NULL, ax, ay, aw );
+					}
+				}
+			}
+		}
+
+		/* tertiary pass, apply dirt map (ambient occlusion) */
+		if ( 0 && dirty ) {
+			/* walk luxels */
+			for ( y = y0; y < y1; y++ )
+			{
+				for ( x = x0; x < x1; x++ )
+				{
+					/* get cluster  */
+					cluster = SUPER_CLUSTER( x, y );
+					if ( *cluster < 0 ) {
+						continue;
+					}
+
+					/* get particulars */
+					lightLuxel = LIGHT_LUXEL( x, y );
+					dirt = SUPER_DIRT( x, y );
+
+					/* scale light value */
+					VectorScale( lightLuxel, *dirt, lightLuxel );
+				}
+			}
+		}
+
+		/* allocate sampling lightmap storage (only ever happens to lightmaps illuminated in one piece) */
+		if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			/* allocate sampling lightmap storage */
+			size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+			lm->superLuxels[ lightmapNum ] = safe_malloc0( size );
+		}
+
+		/* set style */
+		if ( lightmapNum > 0 ) {
+			lm->styles[ lightmapNum ] = trace.light->style;
+			//%	Sys_Printf( "Surface %6d has lightstyle %d\n", rawLightmapNum, trace.light->style );
+		}
+
+		/* copy the tile to permanent luxels */
+		for ( y = tile->y; y < tile->y + tile->h; y++ )
+		{
+			for ( x = tile->x; x < tile->x + tile->w; x++ )
+			{
+				/* get cluster and origin */
+				cluster = SUPER_CLUSTER( x, y );
+				if ( *cluster < 0 || !LuxelInLightCut( &cut, cutMask, tile, x, y, 0 ) ) {
+					continue;
+				}
+				origin = SUPER_ORIGIN( x, y );
+
+				/* filter? */
+				if ( luxelFilterRadius ) {
+					/* setup */
+					VectorClear( averageColor );
+					VectorClear( averageDir );
+					samples = 0.0f;
+
+					/* cheaper distance-based filtering */
+					for ( sy = ( y - luxelFilterRadius ); sy <= ( y + luxelFilterRadius ); sy++ )
+					{
+						if ( sy < 0 || sy >= lm->sh ) {
+							continue;
+						}
+
+						for ( sx = ( x - luxelFilterRadius ); sx <= ( x + luxelFilterRadius ); sx++ )
+						{
+							if ( sx < 0 || sx >= lm->sw ) {
+								continue;
+							}
+
+							/* get particulars */
+							cluster = SUPER_CLUSTER( sx, sy );
+							if ( *cluster < 0 ) {
+								continue;
+							}
+							lightLuxel = LIGHT_LUXEL( sx, sy );
+							lightDeluxel = LIGHT_DELUXEL( sx, sy );
+
+							/* create weight */
+							weight = ( abs( sx - x ) == luxelFilterRadius ? 0.5f : 1.0f );
+							weight *= ( abs( sy - y ) == luxelFilterRadius ? 0.5f : 1.0f );
+
+							/* scale luxel by filter weight */
+							VectorScale( lightLuxel, weight, color );
+							VectorAdd( averageColor, color, averageColor );
+							if ( deluxemap ) {
+								VectorScale( lightDeluxel, weight, direction );
+								VectorAdd( averageDir, direction, averageDir );
+							}
+							samples += weight;
+						}
+					}
+
+					/* any samples? */
+					if ( samples <= 0.0f ) {
+						continue;
+					}
+
+					/* scale into luxel */
+					luxel = SUPER_LUXEL( lightmapNum, x, y );
+					luxel[ 3 ] = 1.0f;
+
+					/* handle negative light */
+					if ( trace.light->flags & LIGHT_NEGATIVE ) {
+						luxel[ 0 ] -= averageColor[ 0 ] / samples;
+						luxel[ 1 ] -= averageColor[ 1 ] / samples;
+						luxel[ 2 ] -= averageColor[ 2 ] / samples;
+					}
+
+					/* handle normal light */
+					else
+					{
+						luxel[ 0 ] += averageColor[ 0 ] / samples;
+						luxel[ 1 ] += averageColor[ 1 ] / samples;
+						luxel[ 2 ] += averageColor[ 2 ] / samples;
+					}
+
+					if ( deluxemap ) {
+						/* scale into luxel */
+						deluxel = SUPER_DELUXEL( x, y );
+						deluxel[ 0 ] += averageDir[ 0 ] / samples;
+						deluxel[ 1 ] += averageDir[ 1 ] / samples;
+						deluxel[ 2 ] += averageDir[ 2 ] / samples;
+					}
+				}
+
+				/* single sample */
+				else
+				{
+					/* get particulars */
+					lightLuxel = LIGHT_LUXEL( x, y );
+					lightDeluxel = LIGHT_DELUXEL( x, y );
+					luxel = SUPER_LUXEL( lightmapNum, x, y );
+					deluxel = SUPER_DELUXEL( x, y );
+
+					/* handle negative light */
+					if ( trace.light->flags & LIGHT_NEGATIVE ) {
+						VectorScale( averageColor, -1.0f, averageColor );
+					}
+
+					/* add color */
+					luxel[ 3 ] = 1.0f;
+
+					/* handle negative light */
+					if ( trace.light->flags & LIGHT_NEGATIVE ) {
+						VectorSubtract( luxel, lightLuxel, luxel );
+					}
+
+					/* handle normal light */
+					else{
+						VectorAdd( luxel, lightLuxel, luxel );
+					}
+
+					if ( deluxemap ) {
+						VectorAdd( deluxel, lightDeluxel, deluxel );
+					}
+				}
+			}
+		}
+	}
+
+	/* free temporary luxels */
+	if ( lightLuxels != stackLightLuxels ) {
+		free( lightLuxels );
+	}
+
+	if ( deluxemap ) {
+		free( lightDeluxels );
+	}
+
+	free( lightFlags );
+	free( adaptiveLuxels );
+	FreeTileLightCut( &cut );
+
+	/* supersampling statistics */
+	__atomic_add_fetch( &numLuxelSubsamples, numSubsamples, __ATOMIC_RELAXED );
+
+	/* bounce cache statistics */
+	if ( bouncing ) {
+		__atomic_add_fetch( &numBounceSamplesCached, numCached, __ATOMIC_RELAXED );
+		__atomic_add_fetch( &numBounceSamplesLit, numSampled, __ATOMIC_RELAXED );
+	}
+}
+
+
+
+/*
+   EstimateLuxelNoise()
+   estimates the noise of every mapped luxel of a lightmap from how far the brightness of the
+   luxels around it strays from the median of their neighborhood: a smooth gradient or a clean
+   shadow edge follows its median closely, noise does not
+ */
+
+#define DENOISE_NEIGHBORS       9
+
+static int CompareLuxelGray( const void *a, const void *b ){
+	float ga = *( (const float*) a ), gb = *( (const float*) b );
+
+	if ( ga != gb ) {
+		return ga < gb ? -1 : 1;
+	}
+	return 0;
+}
+
+static void EstimateLuxelNoise( rawLightmap_t *lm, const float *luxels, float *residuals, float *noise ){
+	int x, y, sx, sy, numGrays, numResiduals;
+	int                 *cluster, *cluster2;
+	float grays[ DENOISE_NEIGHBORS ], sum;
+
+
+	/* residual from the median of the 3x3 neighborhood */
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( x = 0; x < lm->sw; x++ )
+		{
+			cluster = SUPER_CLUSTER( x, y );
+			residuals[ y * lm->sw + x ] = 0.0f;
+			if ( *cluster < 0 ) {
+				continue;
+			}
+
+			numGrays = 0;
+			for ( sy = y - 1; sy <= y + 1; sy++ )
+			{
+				for ( sx = x - 1; sx <= x + 1; sx++ )
+				{
+					if ( sx < 0 || sy < 0 || sx >= lm->sw || sy >= lm->sh ) {
+						continue;
+					}
+					cluster2 = SUPER_CLUSTER( sx, sy );
+					if ( *cluster2 == *cluster ) {
+						grays[ numGrays++ ] = RGBTOGRAY( luxels + ( sy * lm->sw + sx ) * SUPER_LUXEL_SIZE );
+					}
+				}
+			}
+			qsort( grays, numGrays, sizeof( *grays ), CompareLuxelGray );
+			residuals[ y * lm->sw + x ] = RGBTOGRAY( luxels + ( y * lm->sw + x ) * SUPER_LUXEL_SIZE ) - grays[ numGrays / 2 ];
+		}
+	}
+
+	/* rms of the residuals around each luxel */
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( x = 0; x < lm->sw; x++ )
+		{
+			cluster = SUPER_CLUSTER( x, y );
+			noise[ y * lm->sw + x ] = 0.0f;
+			if ( *cluster < 0 ) {
+				continue;
+			}
 
-							/* get luxel */
-							flag = SUPER_FLAG( sx, sy );
-							if ( *flag & FLAG_FORCE_SUBSAMPLING ) {
-								/* force a lighted/mapped discrepancy so we subsample */
-								++lighted;
-								++mapped;
-								++mapped;
-							}
-							lightLuxel = LIGHT_LUXEL( sx, sy );
-							VectorAdd( total, lightLuxel, total );
-							if ( ( lightLuxel[ 0 ] + lightLuxel[ 1 ] + lightLuxel[ 2 ] ) > 0.0f ) {
-								lighted++;
-							}
-						}
+			sum = 0.0f;
+			numResiduals = 0;
+			for ( sy = y - 1; sy <= y + 1; sy++ )
+			{
+				for ( sx = x - 1; sx <= x + 1; sx++ )
+				{
+					if ( sx < 0 || sy < 0 || sx >= lm->sw || sy >= lm->sh ) {
+						continue;
+					}
+					cluster2 = SUPER_CLUSTER( sx, sy );
+					if ( *cluster2 == *cluster ) {
+						sum += residuals[ sy * lm->sw + sx ] * residuals[ sy * lm->sw + sx ];
+						numResiduals++;
+					}
+				}
+			}
+			noise[ y * lm->sw + x ] = sqrt( sum / numResiduals );
+		}
+	}
+}
 
-						/* if total color is under a certain amount, then don't bother subsampling */
-						if ( total[ 0 ] <= 4.0f && total[ 1 ] <= 4.0f && total[ 2 ] <= 4.0f ) {
-							continue;
-						}
 
-						/* if all 4 pixels are either in shadow or light, then don't subsample */
-						if ( lighted != 0 && lighted != mapped ) {
-							for ( t = 0; t < 4; t++ )
-							{
-								/* set sample coords */
-								sx = x + tests[ t ][ 0 ];
-								sy = y + tests[ t ][ 1 ];
 
-								/* get luxel */
-								cluster = SUPER_CLUSTER( sx, sy );
-								if ( *cluster < 0 ) {
-									continue;
-								}
-								flag = SUPER_FLAG( sx, sy );
-								if ( *flag & FLAG_ALREADY_SUBSAMPLED ) { // already subsampled
-									continue;
-								}
-								lightLuxel = LIGHT_LUXEL( sx, sy );
-								lightDeluxel = LIGHT_DELUXEL( sx, sy );
-								origin = SUPER_ORIGIN( sx, sy );
+/*
+   DenoiseRawLightmap()
+   -denoise: edge-aware a-trous filtering of the luxels of a raw lightmap, five by five taps spread
+   further apart on every pass; a neighbor counts for less the further it is off the luxel's plane,
+   the more its normal differs and the more its brightness differs from the luxel's, measured
+   against the noise estimated around the luxel (and less so on later passes, as the noise is gone
+   by then), and not at all when unmapped or in another cluster, so shadow edges, gradients and
+   surface boundaries stay put while the noise of random samples, dirt and bounce is smoothed out
+ */
 
-								/* only subsample shadowed luxels */
-								//%	if( (lightLuxel[ 0 ] + lightLuxel[ 1 ] + lightLuxel[ 2 ]) <= 0.0f )
-								//%		continue;
+#define DENOISE_NORMAL_POWER    32.0f
+#define DENOISE_MIN_SIGMA       0.5f
+#define DENOISE_SATURATION      255.0f
 
-								/* subsample it */
-								if ( lightRandomSamples ) {
-									RandomSubsampleRawLuxel( lm, &trace, origin, sx, sy, 0.5f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
-								}
-								else{
-									SubsampleRawLuxel_r( lm, &trace, origin, sx, sy, 0.25f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
-								}
+static void DenoiseRawLightmap( rawLightmap_t *lm ){
+	static const float kernel[ 5 ] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	int i, x, y, sx, sy, tx, ty, pass, step, lightmapNum, size;
+	int                 *cluster, *cluster2;
+	float               *luxel, *luxel2, *deluxel, *deluxel2, *origin, *origin2, *normal, *normal2;
+	float               *luxels, *deluxels, *residuals, *noise;
+	float max, weight, samples, gray, gray2, sigma, dist, dot, planeScale;
+	vec3_t delta, averageColor, averageDir;
 
-								*flag |= FLAG_ALREADY_SUBSAMPLED;
 
-								/* debug code to colorize subsampled areas to yellow */
-								//%	luxel = SUPER_LUXEL( lightmapNum, sx, sy );
-								//%	VectorSet( luxel, 255, 204, 0 );
-							}
-						}
-					}
-				}
-			}
+	/* distances off the plane are measured in luxels */
+	planeScale = lm->actualSampleSize > 0 ? (float) superSample / lm->actualSampleSize : 1.0f;
 
-			/* tertiary pass, apply dirt map (ambient occlusion) */
-			if ( 0 && dirty ) {
-				/* walk luxels */
-				for ( y = 0; y < lm->sh; y++ )
-				{
-					for ( x = 0; x < lm->sw; x++ )
-					{
-						/* get cluster  */
-						cluster = SUPER_CLUSTER( x, y );
-						if ( *cluster < 0 ) {
-							continue;
-						}
+	/* scratch space */
+	size = lm->sw * lm->sh;
+	luxels = safe_malloc( size * SUPER_LUXEL_SIZE * sizeof( float ) );
+	deluxels = deluxemap ? safe_malloc( size * SUPER_DELUXEL_SIZE * sizeof( float ) ) : NULL;
+	residuals = safe_malloc( size * sizeof( float ) );
+	noise = safe_malloc( size * sizeof( float ) );
 
-						/* get particulars */
-						lightLuxel = LIGHT_LUXEL( x, y );
-						dirt = SUPER_DIRT( x, y );
+	/* walk lightmaps */
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		/* early out */
+		if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			continue;
+		}
 
-						/* scale light value */
-						VectorScale( lightLuxel, *dirt, lightLuxel );
-					}
-				}
+		for ( pass = 0, step = 1; pass < denoisePasses; pass++, step *= 2 )
+		{
+			memcpy( luxels, lm->superLuxels[ lightmapNum ], size * SUPER_LUXEL_SIZE * sizeof( float ) );
+			if ( deluxels != NULL && lightmapNum == 0 ) {
+				memcpy( deluxels, lm->superDeluxels, size * SUPER_DELUXEL_SIZE * sizeof( float ) );
 			}
 
-			/* allocate sampling lightmap storage */
-			if ( lm->superLuxels[ lightmapNum ] == NULL ) {
-				/* allocate sampling lightmap storage */
-				size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
-				lm->superLuxels[ lightmapNum ] = safe_malloc0( size );
+			/* clamp the way ColorToBytes() will, so the light around a hot spot does not leak out */
+			for ( i = 0; i < size; i++ )
+			{
+				luxel = luxels + i * SUPER_LUXEL_SIZE;
+				max = luxel[ 0 ] > luxel[ 1 ] ? luxel[ 0 ] : luxel[ 1 ];
+				if ( luxel[ 2 ] > max ) {
+					max = luxel[ 2 ];
+				}
+				if ( max > DENOISE_SATURATION ) {
+					VectorScale( luxel, DENOISE_SATURATION / max, luxel );
+				}
 			}
 
-			/* set style */
-			if ( lightmapNum > 0 ) {
-				lm->styles[ lightmapNum ] = trace.light->style;
-				//%	Sys_Printf( "Surface %6d has lightstyle %d\n", rawLightmapNum, trace.light->style );
+			/* the noise is measured on the unfiltered luxels only */
+			if ( pass == 0 ) {
+				EstimateLuxelNoise( lm, luxels, residuals, noise );
 			}
 
-			/* copy to permanent luxels */
 			for ( y = 0; y < lm->sh; y++ )
 			{
 				for ( x = 0; x < lm->sw; x++ )
 				{
-					/* get cluster and origin */
+					/* get particulars, saturated luxels are left as they are */
 					cluster = SUPER_CLUSTER( x, y );
 					if ( *cluster < 0 ) {
 						continue;
 					}
+					luxel = luxels + ( y * lm->sw + x ) * SUPER_LUXEL_SIZE;
+					if ( luxel[ 0 ] >= DENOISE_SATURATION || luxel[ 1 ] >= DENOISE_SATURATION || luxel[ 2 ] >= DENOISE_SATURATION ) {
+						continue;
+					}
 					origin = SUPER_ORIGIN( x, y );
+					normal = SUPER_NORMAL( x, y );
+					gray = RGBTOGRAY( luxel );
 
-					/* filter? */
-					if ( luxelFilterRadius ) {
-						/* setup */
-						VectorClear( averageColor );
-						VectorClear( averageDir );
-						samples = 0.0f;
+					/* what passes for noise here */
+					sigma = ( denoiseStrength * noise[ y * lm->sw + x ] + DENOISE_MIN_SIGMA ) / ( 1 << pass );
 
-						/* cheaper distance-based filtering */
-						for ( sy = ( y - luxelFilterRadius ); sy <= ( y + luxelFilterRadius ); sy++ )
+					/* walk the taps */
+					VectorClear( averageColor );
+					VectorClear( averageDir );
+					samples = 0.0f;
+					for ( ty = 0; ty < 5; ty++ )
+					{
+						sy = y + ( ty - 2 ) * step;
+						if ( sy < 0 || sy >= lm->sh ) {
+							continue;
+						}
+
+						for ( tx = 0; tx < 5; tx++ )
 						{
-							if ( sy < 0 || sy >= lm->sh ) {
+							sx = x + ( tx - 2 ) * step;
+							if ( sx < 0 || sx >= lm->sw ) {
 								continue;
 							}
 
-							for ( sx = ( x - luxelFilterRadius ); sx <= ( x + luxelFilterRadius ); sx++ )
-							{
-								if ( sx < 0 || sx >= lm->sw ) {
-									continue;
-								}
-
-								/* get particulars */
-								cluster = SUPER_CLUSTER( sx, sy );
-								if ( *cluster < 0 ) {
-									continue;
-								}
-								lightLuxel = LIGHT_LUXEL( sx, sy );
-								lightDeluxel = LIGHT_DELUXEL( sx, sy );
-
-								/* create weight */
-								weight = ( abs( sx - x ) == luxelFilterRadius ? 0.5f : 1.0f );
-								weight *= ( abs( sy - y ) == luxelFilterRadius ? 0.5f : 1.0f );
-
-								/* scale luxel by filter weight */
-								VectorScale( lightLuxel, weight, color );
-								VectorAdd( averageColor, color, averageColor );
-								if ( deluxemap ) {
-									VectorScale( lightDeluxel, weight, direction );
-									VectorAdd( averageDir, direction, averageDir );
-								}
-								samples += weight;
+							/* stay on this side of cluster boundaries */
+							cluster2 = SUPER_CLUSTER( sx, sy );
+							if ( *cluster2 != *cluster ) {
+								continue;
 							}
-						}
-
-						/* any samples? */
-						if ( samples <= 0.0f ) {
-							continue;
-						}
-
-						/* scale into luxel */
-						luxel = SUPER_LUXEL( lightmapNum, x, y );
-						luxel[ 3 ] = 1.0f;
-
-						/* handle negative light */
-						if ( trace.light->flags & LIGHT_NEGATIVE ) {
-							luxel[ 0 ] -= averageColor[ 0 ] / samples;
-							luxel[ 1 ] -= averageColor[ 1 ] / samples;
-							luxel[ 2 ] -= averageColor[ 2 ] / samples;
-						}
-
-						/* handle normal light */
-						else
-						{
-							luxel[ 0 ] += averageColor[ 0 ] / samples;
-							luxel[ 1 ] += averageColor[ 1 ] / samples;
-							luxel[ 2 ] += averageColor[ 2 ] / samples;
-						}
+							luxel2 = luxels + ( sy * lm->sw + sx ) * SUPER_LUXEL_SIZE;
+							origin2 = SUPER_ORIGIN( sx, sy );
+							normal2 = SUPER_NORMAL( sx, sy );
 
-						if ( deluxemap ) {
-							/* scale into luxel */
-							deluxel = SUPER_DELUXEL( x, y );
-							deluxel[ 0 ] += averageDir[ 0 ] / samples;
-							deluxel[ 1 ] += averageDir[ 1 ] / samples;
-							deluxel[ 2 ] += averageDir[ 2 ] / samples;
+							/* stay on this surface */
+							dot = DotProduct( normal, normal2 );
+							if ( dot <= 0.0f ) {
+								continue;
+							}
+							VectorSubtract( origin2, origin, delta );
+							dist = DotProduct( delta, normal ) * planeScale;
+
+							/* weigh it */
+							gray2 = RGBTOGRAY( luxel2 ) - gray;
+							weight = kernel[ tx ] * kernel[ ty ] * pow( dot, DENOISE_NORMAL_POWER ) *
+									 exp( -dist * dist - gray2 * gray2 / ( sigma * sigma ) );
+							VectorMA( averageColor, weight, luxel2, averageColor );
+							if ( deluxels != NULL && lightmapNum == 0 ) {
+								deluxel2 = deluxels + ( sy * lm->sw + sx ) * SUPER_DELUXEL_SIZE;
+								VectorMA( averageDir, weight, deluxel2, averageDir );
+							}
+							samples += weight;
 						}
 					}
 
-					/* single sample */
-					else
-					{
-						/* get particulars */
-						lightLuxel = LIGHT_LUXEL( x, y );
-						lightDeluxel = LIGHT_DELUXEL( x, y );
-						luxel = SUPER_LUXEL( lightmapNum, x, y );
+					/* the luxel itself always counts, so this can't be zero */
+					if ( samples <= 0.0f ) {
+						continue;
+					}
+					luxel2 = SUPER_LUXEL( lightmapNum, x, y );
+					VectorScale( averageColor, 1.0f / samples, luxel2 );
+					if ( deluxels != NULL && lightmapNum == 0 ) {
 						deluxel = SUPER_DELUXEL( x, y );
+						VectorScale( averageDir, 1.0f / samples, deluxel );
+					}
+				}
+			}
+		}
+	}
 
-						/* handle negative light */
-						if ( trace.light->flags & LIGHT_NEGATIVE ) {
-							VectorScale( averageColor, -1.0f, averageColor );
-						}
+	/* free scratch space */
+	free( luxels );
+	free( deluxels );
+	free( residuals );
+	free( noise );
+}
 
-						/* add color */
-						luxel[ 3 ] = 1.0f;
 
-						/* handle negative light */
-						if ( trace.light->flags & LIGHT_NEGATIVE ) {
-							VectorSubtract( luxel, lightLuxel, luxel );
-						}
 
-						/* handle normal light */
-						else{
-							VectorAdd( luxel, lightLuxel, luxel );
-						}
+/*
+   FinishIlluminateRawLightmap()
+   applies floodlight and dirt to a raw lightmap once all of its tiles are lit, denoises it
+   and fills in unmapped luxels from their neighbors
+ */
 
-						if ( deluxemap ) {
-							VectorAdd( deluxel, lightDeluxel, deluxel );
-						}
-					}
-				}
-			}
-		}
+static void FinishIlluminateRawLightmap( int rawLightmapNum ){
+	int x, y, sx, sy, lightmapNum;
+	int                 *cluster, *cluster2;
+	rawLightmap_t       *lm;
+	qboolean filterColor, filterDir;
+	float               *normal, *dirt, *luxel, *luxel2, *deluxel, *deluxel2, samples;
+	vec3_t averageColor, averageDir;
 
-		/* free temporary luxels */
-		if ( lightLuxels != stackLightLuxels ) {
-			free( lightLuxels );
-		}
 
-		if ( deluxemap ) {
-			free( lightDeluxels );
-		}
+	/* bail if this number exceeds the number of raw lightmaps */
+	if ( rawLightmapNum >= numRawLightmaps ) {
+		return;
 	}
 
+	/* get lightmap */
+	lm = &rawLightmaps[ rawLightmapNum ];
+
 	/* free light list */
-	FreeTraceLights( &trace );
+	free( lm->lights );
+	lm->lights = NULL;
+	lm->numLights = 0;
 
 	/* floodlight pass */
 	if ( floodlighty ) {
 		FloodlightIlluminateLightmap( lm );
 	}
 
+	/* packed raw lightmaps drop the floodlight once it is in, the bounces don't add it again */
+	if ( compactLightmaps && lm->superFloodLight != NULL ) {
+		free( lm->superFloodLight );
+		lm->superFloodLight = NULL;
+		free( lm->compactFloodLight );
+		lm->compactFloodLight = NULL;
+	}
+
+	/* the light cache had it finished, keep it for the next run */
+	if ( lm->lightCached ) {
+		WriteLightCacheLightmap( lm );
+		return;
+	}
+
 	if ( debugnormals ) {
 		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 		{
@@ -2648,6 +4451,11 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	   filter pass
 	   ----------------------------------------------------------------- */
 
+	/* edge-aware denoising */
+	if ( denoise ) {
+		DenoiseRawLightmap( lm );
+	}
+
 	/* walk lightmaps */
 	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 	{
@@ -2750,6 +4558,22 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 			}
 		}
 	}
+
+	/* keep it for the next -incremental run */
+	if ( lightIncremental ) {
+		WriteLightCacheLightmap( lm );
+	}
+}
+
+
+
+/*
+   IlluminateRawLightmaps()
+   illuminates the luxels of all raw lightmaps, splitting the big ones into tiles
+ */
+
+void IlluminateRawLightmaps( void ){
+	RunRawLightmapStage( BeginIlluminateRawLightmap, IlluminateRawLightmapTile, FinishIlluminateRawLightmap, qtrue, WriteLightWorkLightmap, ReadLightWorkLightmap );
 }
 
 
@@ -2766,6 +4590,7 @@ void IlluminateVertexes( int num ){
 	int lightmapNum, numAvg;
 	float samples, *vertLuxel, *radVertLuxel, *luxel, dirt;
 	vec3_t temp, temp2, colors[ MAX_LIGHTMAPS ], avgColors[ MAX_LIGHTMAPS ];
+	vec4_t unpacked;
 	bspDrawSurface_t    *ds;
 	surfaceInfo_t       *info;
 	rawLightmap_t       *lm;
@@ -3054,7 +4879,7 @@ void IlluminateVertexes( int num ){
 		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 		{
 			/* early out */
-			if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			if ( lm->superLuxels[ lightmapNum ] == NULL && lm->compactLuxels[ lightmapNum ] == NULL ) {
 				continue;
 			}
 
@@ -3120,11 +4945,11 @@ void IlluminateVertexes( int num ){
 							}
 
 							/* get luxel particulars */
-							luxel = SUPER_LUXEL( lightmapNum, sx, sy );
 							cluster = SUPER_CLUSTER( sx, sy );
 							if ( *cluster < 0 ) {
 								continue;
 							}
+							luxel = GetSuperLuxel( lm, lightmapNum, sx, sy, unpacked );
 
 							/* testing: must be brigher than ambient color */
 							//%	if( luxel[ 0 ] <= ambientColor[ 0 ] || luxel[ 1 ] <= ambientColor[ 1 ] || luxel[ 2 ] <= ambientColor[ 2 ] )
@@ -3565,6 +5390,286 @@ qboolean ChopBounds( vec3_t mins, vec3_t maxs, vec3_t origin, vec3_t normal ){
 
 
 
+/*
+   light index
+   bounding volume hierarchies over the lights, rebuilt whenever SetupEnvelopes() changes the
+   light list, so CreateTraceLightsForBounds() and CreateTraceLightsForPoint() only look at the
+   lights whose envelope (or pvs bounds) can reach them instead of walking every light
+ */
+
+#define LIGHT_INDEX_LEAF_SIZE   4
+#define LIGHT_INDEX_EPSILON     1.0f
+#define MAX_LIGHT_INDEX_DEPTH   64
+
+typedef struct lightIndexNode_s
+{
+	vec3_t mins, maxs;
+	int children[ 2 ];
+	int first, numItems;                                            /* numItems is 0 for inner nodes */
+}
+lightIndexNode_t;
+
+typedef struct lightIndex_s
+{
+	vec3_t                  *mins, *maxs;                           /* per light number */
+	int                     *items;                                 /* bounded light numbers in tree order */
+	int numNodes;
+	lightIndexNode_t        *nodes;
+	int numUnbounded, *unbounded;                                   /* lights reaching the whole world (suns, unattenuated lights) */
+}
+lightIndex_t;
+
+static int numIndexLights;
+static light_t              **indexLights;                          /* light numbers, in light list order */
+static lightIndex_t envelopeIndex;                                  /* envelope spheres, for lightmaps and vertexes */
+static lightIndex_t boundsIndex;                                    /* pvs bounds, for the light grid */
+
+static const lightIndex_t   *sortIndex;
+static int sortAxis;
+
+#define MAX_LIGHT_INDEX_SCRATCH 1024
+
+/* the light numbers a query found, one buffer per thread */
+typedef struct lightIndexScratch_s
+{
+	int maxLightNums;
+	int                     *lightNums;
+}
+lightIndexScratch_t;
+
+static lightIndexScratch_t lightIndexScratch[ MAX_LIGHT_INDEX_SCRATCH ];
+
+static int CompareLightIndexItems( const void *a, const void *b ){
+	int na = *( (const int*) a ), nb = *( (const int*) b );
+	float ca = sortIndex->mins[ na ][ sortAxis ] + sortIndex->maxs[ na ][ sortAxis ];
+	float cb = sortIndex->mins[ nb ][ sortAxis ] + sortIndex->maxs[ nb ][ sortAxis ];
+
+	if ( ca != cb ) {
+		return ca < cb ? -1 : 1;
+	}
+	return na - nb;
+}
+
+static int CompareLightNums( const void *a, const void *b ){
+	return *( (const int*) a ) - *( (const int*) b );
+}
+
+static int BuildLightIndex_r( lightIndex_t *index, int first, int numItems, int depth ){
+	int i, nodeNum, half;
+	lightIndexNode_t    *node;
+	vec3_t centerMins, centerMaxs, center, size;
+
+
+	/* get a node */
+	nodeNum = index->numNodes++;
+	node = &index->nodes[ nodeNum ];
+
+	/* bound the items and their centers */
+	ClearBounds( node->mins, node->maxs );
+	ClearBounds( centerMins, centerMaxs );
+	for ( i = first; i < first + numItems; i++ )
+	{
+		AddPointToBounds( index->mins[ index->items[ i ] ], node->mins, node->maxs );
+		AddPointToBounds( index->maxs[ index->items[ i ] ], node->mins, node->maxs );
+		VectorAdd( index->mins[ index->items[ i ] ], index->maxs[ index->items[ i ] ], center );
+		AddPointToBounds( center, centerMins, centerMaxs );
+	}
+
+	/* small enough for a leaf? */
+	if ( numItems <= LIGHT_INDEX_LEAF_SIZE || depth >= MAX_LIGHT_INDEX_DEPTH - 1 ) {
+		node->first = first;
+		node->numItems = numItems;
+		return nodeNum;
+	}
+
+	/* split at the median along the axis the centers spread most */
+	VectorSubtract( centerMaxs, centerMins, size );
+	sortAxis = ( size[ 0 ] >= size[ 1 ] && size[ 0 ] >= size[ 2 ] ) ? 0 : ( size[ 1 ] >= size[ 2 ] ? 1 : 2 );
+	sortIndex = index;
+	qsort( index->items + first, numItems, sizeof( *index->items ), CompareLightIndexItems );
+	half = numItems / 2;
+
+	node->first = 0;
+	node->numItems = 0;
+	node->children[ 0 ] = BuildLightIndex_r( index, first, half, depth + 1 );
+	node->children[ 1 ] = BuildLightIndex_r( index, first + half, numItems - half, depth + 1 );
+	return nodeNum;
+}
+
+static void BuildLightIndex( lightIndex_t *index ){
+	int i, numItems;
+
+
+	/* sort out the lights that reach everywhere anyway */
+	index->items = safe_malloc( ( numIndexLights + 1 ) * sizeof( *index->items ) );
+	index->unbounded = safe_malloc( ( numIndexLights + 1 ) * sizeof( *index->unbounded ) );
+	index->numUnbounded = 0;
+	numItems = 0;
+	for ( i = 0; i < numIndexLights; i++ )
+	{
+		if ( index->maxs[ i ][ 0 ] - index->mins[ i ][ 0 ] > WORLD_SIZE ||
+			 index->maxs[ i ][ 1 ] - index->mins[ i ][ 1 ] > WORLD_SIZE ||
+			 index->maxs[ i ][ 2 ] - index->mins[ i ][ 2 ] > WORLD_SIZE ) {
+			index->unbounded[ index->numUnbounded++ ] = i;
+		}
+		else if ( index->mins[ i ][ 0 ] <= index->maxs[ i ][ 0 ] ) {
+			index->items[ numItems++ ] = i;
+		}
+	}
+
+	/* a binary tree with at least one item per leaf has fewer than twice as many nodes as items */
+	index->nodes = safe_malloc( ( 2 * numItems + 1 ) * sizeof( *index->nodes ) );
+	index->numNodes = 0;
+	if ( numItems > 0 ) {
+		BuildLightIndex_r( index, 0, numItems, 0 );
+	}
+}
+
+static void FreeLightIndex( lightIndex_t *index ){
+	free( index->mins );
+	free( index->maxs );
+	free( index->items );
+	free( index->nodes );
+	free( index->unbounded );
+	memset( index, 0, sizeof( *index ) );
+}
+
+static void SetupLightIndex( void ){
+	int i;
+	light_t     *light;
+	float size;
+
+
+	/* clear out the old index */
+	FreeLightIndex( &envelopeIndex );
+	FreeLightIndex( &boundsIndex );
+	free( indexLights );
+
+	/* number the lights in list order */
+	numIndexLights = 0;
+	for ( light = lights; light != NULL; light = light->next )
+		numIndexLights++;
+	indexLights = safe_malloc( ( numIndexLights + 1 ) * sizeof( *indexLights ) );
+	envelopeIndex.mins = safe_malloc( ( numIndexLights + 1 ) * sizeof( vec3_t ) );
+	envelopeIndex.maxs = safe_malloc( ( numIndexLights + 1 ) * sizeof( vec3_t ) );
+	boundsIndex.mins = safe_malloc( ( numIndexLights + 1 ) * sizeof( vec3_t ) );
+	boundsIndex.maxs = safe_malloc( ( numIndexLights + 1 ) * sizeof( vec3_t ) );
+	for ( i = 0, light = lights; light != NULL; i++, light = light->next )
+	{
+		indexLights[ i ] = light;
+
+		/* zero sized envelopes never reach anything */
+		if ( light->envelope <= 0.0f ) {
+			ClearBounds( envelopeIndex.mins[ i ], envelopeIndex.maxs[ i ] );
+			ClearBounds( boundsIndex.mins[ i ], boundsIndex.maxs[ i ] );
+			continue;
+		}
+
+		/* the envelope sphere, padded against rounding in the distance test */
+		if ( light->type == EMIT_SUN ) {
+			size = WORLD_SIZE * 2.0f;
+		}
+		else{
+			size = light->envelope * 1.001f + LIGHT_INDEX_EPSILON;
+		}
+		VectorSet( envelopeIndex.mins[ i ], light->origin[ 0 ] - size, light->origin[ 1 ] - size, light->origin[ 2 ] - size );
+		VectorSet( envelopeIndex.maxs[ i ], light->origin[ 0 ] + size, light->origin[ 1 ] + size, light->origin[ 2 ] + size );
+
+		/* the pvs bounds are tested exactly */
+		VectorCopy( light->mins, boundsIndex.mins[ i ] );
+		VectorCopy( light->maxs, boundsIndex.maxs[ i ] );
+	}
+
+	/* build the trees */
+	BuildLightIndex( &envelopeIndex );
+	BuildLightIndex( &boundsIndex );
+}
+
+/*
+   LightIndexScratch()
+   returns the light number buffer of the calling thread, with room for all lights
+ */
+
+static int *LightIndexScratch( void ){
+	int threadNum;
+	lightIndexScratch_t *scratch;
+
+
+	threadNum = ThreadNum();
+	if ( threadNum >= MAX_LIGHT_INDEX_SCRATCH ) {
+		Error( "MAX_LIGHT_INDEX_SCRATCH (%d) exceeded", MAX_LIGHT_INDEX_SCRATCH );
+	}
+	scratch = &lightIndexScratch[ threadNum ];
+
+	/* the light list may have grown since the last query */
+	if ( scratch->maxLightNums < numIndexLights + 1 ) {
+		free( scratch->lightNums );
+		scratch->maxLightNums = numIndexLights + 1;
+		scratch->lightNums = safe_malloc( scratch->maxLightNums * sizeof( *scratch->lightNums ) );
+	}
+
+	return scratch->lightNums;
+}
+
+
+
+/*
+   QueryLightIndex()
+   stores the numbers of the lights whose index bounds touch the given bounds in
+   lightNums (which must have room for all lights), in light list order
+ */
+
+static int QueryLightIndex( const lightIndex_t *index, const vec3_t mins, const vec3_t maxs, int *lightNums ){
+	int i, n, lightNum, stack[ MAX_LIGHT_INDEX_DEPTH * 2 ], stackSize;
+	const lightIndexNode_t  *node;
+
+
+	/* the unbounded lights always make it */
+	n = 0;
+	for ( i = 0; i < index->numUnbounded; i++ )
+		lightNums[ n++ ] = index->unbounded[ i ];
+
+	/* walk the tree */
+	stackSize = 0;
+	if ( index->numNodes > 0 ) {
+		stack[ stackSize++ ] = 0;
+	}
+	while ( stackSize > 0 )
+	{
+		node = &index->nodes[ stack[ --stackSize ] ];
+		if ( mins[ 0 ] > node->maxs[ 0 ] || maxs[ 0 ] < node->mins[ 0 ] ||
+			 mins[ 1 ] > node->maxs[ 1 ] || maxs[ 1 ] < node->mins[ 1 ] ||
+			 mins[ 2 ] > node->maxs[ 2 ] || maxs[ 2 ] < node->mins[ 2 ] ) {
+			continue;
+		}
+
+		/* inner node */
+		if ( node->numItems == 0 ) {
+			stack[ stackSize++ ] = node->children[ 1 ];
+			stack[ stackSize++ ] = node->children[ 0 ];
+			continue;
+		}
+
+		/* leaf */
+		for ( i = node->first; i < node->first + node->numItems; i++ )
+		{
+			lightNum = index->items[ i ];
+			if ( mins[ 0 ] > index->maxs[ lightNum ][ 0 ] || maxs[ 0 ] < index->mins[ lightNum ][ 0 ] ||
+				 mins[ 1 ] > index->maxs[ lightNum ][ 1 ] || maxs[ 1 ] < index->mins[ lightNum ][ 1 ] ||
+				 mins[ 2 ] > index->maxs[ lightNum ][ 2 ] || maxs[ 2 ] < index->mins[ lightNum ][ 2 ] ) {
+				continue;
+			}
+			lightNums[ n++ ] = lightNum;
+		}
+	}
+
+	/* lights are summed up in list order, keep it that way */
+	qsort( lightNums, n, sizeof( *lightNums ), CompareLightNums );
+	return n;
+}
+
+
+
 /*
    SetupEnvelopes()
    calculates each light's effective envelope,
@@ -3585,6 +5690,7 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 
 	/* early out for weird cases where there are no lights */
 	if ( lights == NULL ) {
+		SetupLightIndex();
 		return;
 	}
 
@@ -3852,7 +5958,7 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 				numCulledLights++;
 				*owner = light->next;
 				if ( light->w != NULL ) {
-					free( light->w );
+					FreeWinding( light->w );
 				}
 				free( light );
 				continue;
@@ -3900,6 +6006,14 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 		}
 	}
 
+	/* index the final list */
+	SetupLightIndex();
+
+	/* key the lights for the light cache */
+	if ( lightIncremental ) {
+		KeyLightsForCache();
+	}
+
 	/* emit some statistics */
 	Sys_Printf( "%9d total lights\n", numLights );
 	Sys_Printf( "%9d culled lights\n", numCulledLights );
@@ -3913,9 +6027,9 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
  */
 
 void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace ){
-	int i;
+	int i, j, numLightNums, *lightNums;
 	light_t     *light;
-	vec3_t origin, dir, nullVector = { 0.0f, 0.0f, 0.0f };
+	vec3_t origin, dir, sphereMins, sphereMaxs, nullVector = { 0.0f, 0.0f, 0.0f };
 	float radius, dist, length;
 
 
@@ -3947,10 +6061,20 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 		length = 0;
 	}
 
+	/* only the lights whose envelope touches the (padded) sphere bounds can reach it */
+	dist = radius * 1.001f + LIGHT_INDEX_EPSILON;
+	VectorSet( sphereMins, origin[ 0 ] - dist, origin[ 1 ] - dist, origin[ 2 ] - dist );
+	VectorSet( sphereMaxs, origin[ 0 ] + dist, origin[ 1 ] + dist, origin[ 2 ] + dist );
+	lightNums = LightIndexScratch();
+	numLightNums = QueryLightIndex( &envelopeIndex, sphereMins, sphereMaxs, lightNums );
+	__atomic_add_fetch( &lightsIndexCulled, numIndexLights - numLightNums, __ATOMIC_RELAXED );
+
 	/* test each light and see if it reaches the sphere */
 	/* note: the attenuation code MUST match LightingAtSample() */
-	for ( light = lights; light; light = light->next )
+	for ( j = 0; j < numLightNums; j++ )
 	{
+		light = indexLights[ lightNums[ j ] ];
+
 		/* check zero sized envelope */
 		if ( light->envelope <= 0 ) {
 			lightsEnvelopeCulled++;
@@ -4036,6 +6160,32 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 
 
 
+/*
+   CreateTraceLightsForPoint()
+   creates a list of the lights whose pvs bounds contain the given point (light grid)
+ */
+
+void CreateTraceLightsForPoint( vec3_t point, trace_t *trace ){
+	int i, numLightNums, *lightNums;
+
+
+	/* find the lights */
+	lightNums = LightIndexScratch();
+	numLightNums = QueryLightIndex( &boundsIndex, point, point, lightNums );
+	__atomic_add_fetch( &gridIndexCulled, numIndexLights - numLightNums, __ATOMIC_RELAXED );
+
+	/* allocate the light list */
+	trace->lights = safe_malloc( sizeof( light_t* ) * ( numLightNums + 1 ) );
+	trace->numLights = numLightNums;
+	for ( i = 0; i < numLightNums; i++ )
+		trace->lights[ i ] = indexLights[ lightNums[ i ] ];
+
+	/* make last light null */
+	trace->lights[ trace->numLights ] = NULL;
+}
+
+
+
 void FreeTraceLights( trace_t *trace ){
 	if ( trace->lights != NULL ) {
 		free( trace->lights );
@@ -4300,15 +6450,18 @@ float FloodLightForSample( trace_t *trace, float floodLightDistance, qboolean fl
    VorteX: fixed problems with deluxemapping
  */
 
-// floodlight pass on a lightmap
-void FloodLightRawLightmapPass( rawLightmap_t *lm, vec3_t lmFloodLightRGB, float lmFloodLightIntensity, float lmFloodLightDistance, qboolean lmFloodLightLowQuality, float floodlightDirectionScale ){
+// floodlight pass on a lightmap tile
+static void FloodLightRawLightmapPass( rawLightmapTile_t *tile, vec3_t lmFloodLightRGB, float lmFloodLightIntensity, float lmFloodLightDistance, qboolean lmFloodLightLowQuality, float floodlightDirectionScale ){
 	int i, x, y, *cluster;
 	float               *origin, *normal, *floodlight, floodLightAmount;
+	rawLightmap_t       *lm;
 	surfaceInfo_t       *info;
 	trace_t trace;
 	// int sx, sy;
 	// float samples, average, *floodlight2;
 
+	lm = &rawLightmaps[ tile->rawLightmapNum ];
+
 	memset( &trace,0,sizeof( trace_t ) );
 
 	/* setup trace */
@@ -4337,9 +6490,9 @@ void FloodLightRawLightmapPass( rawLightmap_t *lm, vec3_t lmFloodLightRGB, float
 	}
 
 	/* gather floodlight */
-	for ( y = 0; y < lm->sh; y++ )
+	for ( y = tile->y; y < tile->y + tile->h; y++ )
 	{
-		for ( x = 0; x < lm->sw; x++ )
+		for ( x = tile->x; x < tile->x + tile->w; x++ )
 		{
 			/* get luxel */
 			cluster = SUPER_CLUSTER( x, y );
@@ -4430,32 +6583,39 @@ void FloodLightRawLightmapPass( rawLightmap_t *lm, vec3_t lmFloodLightRGB, float
 #endif
 }
 
-void FloodLightRawLightmap( int rawLightmapNum ){
+static void FloodLightRawLightmapTile( int tileNum ){
+	rawLightmapTile_t   *tile;
 	rawLightmap_t       *lm;
 
-	/* bail if this number exceeds the number of raw lightmaps */
-	if ( rawLightmapNum >= numRawLightmaps ) {
+	/* get tile and lightmap */
+	tile = &rawLightmapTiles[ tileNum ];
+	lm = &rawLightmaps[ tile->rawLightmapNum ];
+
+	/* the light cache has the floodlight in already */
+	if ( lm->lightCached ) {
 		return;
 	}
-	/* get lightmap */
-	lm = &rawLightmaps[ rawLightmapNum ];
 
 	/* global pass */
 	if ( floodlighty && floodlightIntensity ) {
-		FloodLightRawLightmapPass( lm, floodlightRGB, floodlightIntensity, floodlightDistance, floodlight_lowquality, floodlightDirectionScale );
+		FloodLightRawLightmapPass( tile, floodlightRGB, floodlightIntensity, floodlightDistance, floodlight_lowquality, floodlightDirectionScale );
 	}
 
 	/* custom pass */
 	if ( lm->floodlightIntensity ) {
-		FloodLightRawLightmapPass( lm, lm->floodlightRGB, lm->floodlightIntensity, lm->floodlightDistance, qfalse, lm->floodlightDirectionScale );
-		numSurfacesFloodlighten += 1;
+		FloodLightRawLightmapPass( tile, lm->floodlightRGB, lm->floodlightIntensity, lm->floodlightDistance, qfalse, lm->floodlightDirectionScale );
+
+		/* count each lightmap once */
+		if ( tile->x == 0 && tile->y == 0 ) {
+			numSurfacesFloodlighten += 1;
+		}
 	}
 }
 
 void FloodlightRawLightmaps(){
 	Sys_Printf( "--- FloodlightRawLightmap ---\n" );
 	numSurfacesFloodlighten = 0;
-	RunThreadsOnIndividual( numRawLightmaps, qtrue, FloodLightRawLightmap );
+	RunRawLightmapStage( NULL, FloodLightRawLightmapTile, NULL, qfalse, NULL, NULL );
 	Sys_Printf( "%9d custom lightmaps floodlighted\n", numSurfacesFloodlighten );
 }
 
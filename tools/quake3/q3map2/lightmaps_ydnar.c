@@ -303,6 +303,57 @@ static int CompareLightSurface( const void *a, const void *b ){
 
 
 
+/*
+   AllocateSuperLuxels()
+   allocates a raw lightmap's supersampled buffers, cleared
+ */
+
+static void AllocateSuperLuxels( rawLightmap_t *lm ){
+	int size;
+
+
+	/* allocate sampling lightmap storage */
+	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+	if ( lm->superLuxels[ 0 ] == NULL ) {
+		lm->superLuxels[ 0 ] = safe_malloc( size );
+	}
+	memset( lm->superLuxels[ 0 ], 0, size );
+
+	/* allocate origin map storage */
+	size = lm->sw * lm->sh * SUPER_ORIGIN_SIZE * sizeof( float );
+	if ( lm->superOrigins == NULL ) {
+		lm->superOrigins = safe_malloc( size );
+	}
+	memset( lm->superOrigins, 0, size );
+
+	/* allocate normal map storage */
+	size = lm->sw * lm->sh * SUPER_NORMAL_SIZE * sizeof( float );
+	if ( lm->superNormals == NULL ) {
+		lm->superNormals = safe_malloc( size );
+	}
+	memset( lm->superNormals, 0, size );
+
+	/* allocate floodlight map storage (packed raw lightmaps only need it if they are floodlit) */
+	if ( !compactLightmaps || floodlighty || lm->floodlightIntensity ) {
+		size = lm->sw * lm->sh * SUPER_FLOODLIGHT_SIZE * sizeof( float );
+		if ( lm->superFloodLight == NULL ) {
+			lm->superFloodLight = safe_malloc( size );
+		}
+		memset( lm->superFloodLight, 0, size );
+	}
+
+	/* allocate sampling deluxel storage */
+	if ( deluxemap ) {
+		size = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
+		if ( lm->superDeluxels == NULL ) {
+			lm->superDeluxels = safe_malloc( size );
+		}
+		memset( lm->superDeluxels, 0, size );
+	}
+}
+
+
+
 /*
    FinishRawLightmap()
    allocates a raw lightmap's necessary buffers
@@ -392,33 +443,10 @@ void FinishRawLightmap( rawLightmap_t *lm ){
 		memset( lm->radLuxels[ 0 ], 0, size );
 	}
 
-	/* allocate sampling lightmap storage */
-	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
-	if ( lm->superLuxels[ 0 ] == NULL ) {
-		lm->superLuxels[ 0 ] = safe_malloc( size );
+	/* allocate the super luxels (packed raw lightmaps get them when first unpacked) */
+	if ( !compactLightmaps ) {
+		AllocateSuperLuxels( lm );
 	}
-	memset( lm->superLuxels[ 0 ], 0, size );
-
-	/* allocate origin map storage */
-	size = lm->sw * lm->sh * SUPER_ORIGIN_SIZE * sizeof( float );
-	if ( lm->superOrigins == NULL ) {
-		lm->superOrigins = safe_malloc( size );
-	}
-	memset( lm->superOrigins, 0, size );
-
-	/* allocate normal map storage */
-	size = lm->sw * lm->sh * SUPER_NORMAL_SIZE * sizeof( float );
-	if ( lm->superNormals == NULL ) {
-		lm->superNormals = safe_malloc( size );
-	}
-	memset( lm->superNormals, 0, size );
-
-	/* allocate floodlight map storage */
-	size = lm->sw * lm->sh * SUPER_FLOODLIGHT_SIZE * sizeof( float );
-	if ( lm->superFloodLight == NULL ) {
-		lm->superFloodLight = safe_malloc( size );
-	}
-	memset( lm->superFloodLight, 0, size );
 
 	/* allocate cluster map storage */
 	size = lm->sw * lm->sh * sizeof( int );
@@ -432,13 +460,6 @@ void FinishRawLightmap( rawLightmap_t *lm ){
 
 	/* deluxemap allocation */
 	if ( deluxemap ) {
-		/* allocate sampling deluxel storage */
-		size = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
-		if ( lm->superDeluxels == NULL ) {
-			lm->superDeluxels = safe_malloc( size );
-		}
-		memset( lm->superDeluxels, 0, size );
-
 		/* allocate bsp deluxel storage */
 		size = lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float );
 		if ( lm->bspDeluxels == NULL ) {
@@ -453,6 +474,340 @@ void FinishRawLightmap( rawLightmap_t *lm ){
 
 
 
+/*
+   FloatToHalf() / HalfToFloat()
+   convert between floats and 16 bit half floats, rounding to nearest even; values too big for a
+   half are clamped to the largest one instead of becoming infinite
+ */
+
+static unsigned short FloatToHalf( float f ){
+	union { float f; unsigned int u; } v;
+	unsigned int sign, mantissa, rest, halfway, h;
+	int exponent, shift;
+
+
+	v.f = f;
+	sign = ( v.u >> 16 ) & 0x8000;
+	exponent = (int) ( ( v.u >> 23 ) & 0xFF ) - 127 + 15;
+	mantissa = v.u & 0x7FFFFF;
+
+	/* nan stays nan, inf and overflow become the largest half */
+	if ( exponent >= 31 ) {
+		if ( ( ( v.u >> 23 ) & 0xFF ) == 0xFF && mantissa != 0 ) {
+			return sign | 0x7E00;
+		}
+		return sign | 0x7BFF;
+	}
+
+	/* subnormal or zero */
+	if ( exponent <= 0 ) {
+		if ( exponent < -10 ) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		h = mantissa >> shift;
+		rest = mantissa & ( ( 1u << shift ) - 1 );
+		halfway = 1u << ( shift - 1 );
+		if ( rest > halfway || ( rest == halfway && ( h & 1 ) ) ) {
+			h++;
+		}
+		return sign | h;
+	}
+
+	/* normal */
+	h = ( exponent << 10 ) | ( mantissa >> 13 );
+	rest = mantissa & 0x1FFF;
+	if ( rest > 0x1000 || ( rest == 0x1000 && ( h & 1 ) ) ) {
+		h++;
+	}
+	if ( h >= 0x7C00 ) {
+		h = 0x7BFF;
+	}
+	return sign | h;
+}
+
+static float HalfToFloat( unsigned short h ){
+	union { float f; unsigned int u; } v;
+	unsigned int exponent, mantissa;
+
+
+	exponent = ( h >> 10 ) & 0x1F;
+	mantissa = h & 0x3FF;
+
+	/* subnormal or zero */
+	if ( exponent == 0 ) {
+		v.f = mantissa * ( 1.0f / 16777216.0f );
+		return ( h & 0x8000 ) ? -v.f : v.f;
+	}
+
+	/* inf or nan, or normal */
+	if ( exponent == 31 ) {
+		v.u = 0x7F800000 | ( mantissa << 13 );
+	}
+	else{
+		v.u = ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+	}
+	v.u |= ( h & 0x8000 ) << 16;
+	return v.f;
+}
+
+
+
+/*
+   PackHalfs() / UnpackHalfs()
+   convert runs of floats to half floats and back
+ */
+
+static void PackHalfs( const float *in, unsigned short *out, int count ){
+	int i;
+
+	for ( i = 0; i < count; i++ )
+		out[ i ] = FloatToHalf( in[ i ] );
+}
+
+static void UnpackHalfs( const unsigned short *in, float *out, int count ){
+	int i;
+
+	for ( i = 0; i < count; i++ )
+		out[ i ] = HalfToFloat( in[ i ] );
+}
+
+
+
+/*
+   PackOctNormal() / UnpackOctNormal()
+   stores a unit normal as two 16 bit coordinates on the octahedron folded into a square,
+   the otherwise unused code 0xFFFF keeps a zero normal zero
+ */
+
+#define OCT_NORMAL_ZERO         0xFFFF
+#define OCT_NORMAL_SCALE        65534.0f
+
+static void PackOctNormal( const float *normal, unsigned short *out ){
+	float l1, u, v, t;
+
+
+	l1 = fabs( normal[ 0 ] ) + fabs( normal[ 1 ] ) + fabs( normal[ 2 ] );
+	if ( l1 <= 0.0f ) {
+		out[ 0 ] = out[ 1 ] = OCT_NORMAL_ZERO;
+		return;
+	}
+	u = normal[ 0 ] / l1;
+	v = normal[ 1 ] / l1;
+
+	/* fold the lower half over the diagonals */
+	if ( normal[ 2 ] < 0.0f ) {
+		t = ( 1.0f - fabs( v ) ) * ( u >= 0.0f ? 1.0f : -1.0f );
+		v = ( 1.0f - fabs( u ) ) * ( v >= 0.0f ? 1.0f : -1.0f );
+		u = t;
+	}
+	out[ 0 ] = (unsigned short) ( ( u * 0.5f + 0.5f ) * OCT_NORMAL_SCALE + 0.5f );
+	out[ 1 ] = (unsigned short) ( ( v * 0.5f + 0.5f ) * OCT_NORMAL_SCALE + 0.5f );
+}
+
+static void UnpackOctNormal( const unsigned short *in, float *normal ){
+	float u, v, t;
+
+
+	if ( in[ 0 ] == OCT_NORMAL_ZERO && in[ 1 ] == OCT_NORMAL_ZERO ) {
+		VectorClear( normal );
+		return;
+	}
+	u = in[ 0 ] * ( 2.0f / OCT_NORMAL_SCALE ) - 1.0f;
+	v = in[ 1 ] * ( 2.0f / OCT_NORMAL_SCALE ) - 1.0f;
+	normal[ 2 ] = 1.0f - fabs( u ) - fabs( v );
+
+	/* unfold the lower half */
+	if ( normal[ 2 ] < 0.0f ) {
+		t = ( 1.0f - fabs( v ) ) * ( u >= 0.0f ? 1.0f : -1.0f );
+		v = ( 1.0f - fabs( u ) ) * ( v >= 0.0f ? 1.0f : -1.0f );
+		u = t;
+	}
+	normal[ 0 ] = u;
+	normal[ 1 ] = v;
+	VectorNormalize( normal, normal );
+}
+
+
+
+/*
+   PackRawLightmap()
+   with -compactlightmaps, packs the super luxels of a raw lightmap no stage is working on:
+   half float luxels, deluxels and floodlight, and octahedral normals with half float dirt
+   (the origins stay as they are, the dirt and light traces start on the surface); the packed
+   buffers are kept for good once made, so only the unpacked ones come and go on the heap
+ */
+
+static unsigned short *PackedBuffer( unsigned short *packed, int count ){
+	return packed != NULL ? packed : safe_malloc( count * sizeof( unsigned short ) );
+}
+
+void PackRawLightmap( rawLightmap_t *lm ){
+	int i, size;
+	float               *normal;
+	unsigned short      *packed;
+
+
+	/* already packed? */
+	if ( lm->superNormals == NULL ) {
+		return;
+	}
+	size = lm->sw * lm->sh;
+
+	/* luxels */
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+		if ( lm->superLuxels[ i ] == NULL ) {
+			continue;
+		}
+		lm->compactLuxels[ i ] = PackedBuffer( lm->compactLuxels[ i ], size * SUPER_LUXEL_SIZE );
+		PackHalfs( lm->superLuxels[ i ], lm->compactLuxels[ i ], size * SUPER_LUXEL_SIZE );
+		free( lm->superLuxels[ i ] );
+		lm->superLuxels[ i ] = NULL;
+	}
+
+	/* deluxels and floodlight */
+	if ( lm->superDeluxels != NULL ) {
+		lm->compactDeluxels = PackedBuffer( lm->compactDeluxels, size * SUPER_DELUXEL_SIZE );
+		PackHalfs( lm->superDeluxels, lm->compactDeluxels, size * SUPER_DELUXEL_SIZE );
+		free( lm->superDeluxels );
+		lm->superDeluxels = NULL;
+	}
+	if ( lm->superFloodLight != NULL ) {
+		lm->compactFloodLight = PackedBuffer( lm->compactFloodLight, size * SUPER_FLOODLIGHT_SIZE );
+		PackHalfs( lm->superFloodLight, lm->compactFloodLight, size * SUPER_FLOODLIGHT_SIZE );
+		free( lm->superFloodLight );
+		lm->superFloodLight = NULL;
+	}
+
+	/* normals, with the dirt stashed in them */
+	lm->compactNormals = PackedBuffer( lm->compactNormals, size * 3 );
+	for ( i = 0; i < size; i++ )
+	{
+		normal = lm->superNormals + i * SUPER_NORMAL_SIZE;
+		packed = lm->compactNormals + i * 3;
+		PackOctNormal( normal, packed );
+		packed[ 2 ] = FloatToHalf( normal[ 3 ] );
+	}
+	free( lm->superNormals );
+	lm->superNormals = NULL;
+}
+
+
+
+/*
+   UnpackRawLightmap()
+   with -compactlightmaps, brings back the super luxels of a raw lightmap at full precision
+   before a stage works on it, allocating them on first use
+ */
+
+void UnpackRawLightmap( rawLightmap_t *lm ){
+	int i, size;
+	float               *normal;
+	unsigned short      *packed;
+
+
+	/* already unpacked? */
+	if ( lm->superNormals != NULL ) {
+		return;
+	}
+
+	/* first use */
+	if ( lm->compactNormals == NULL ) {
+		AllocateSuperLuxels( lm );
+		return;
+	}
+	size = lm->sw * lm->sh;
+
+	/* luxels */
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+		if ( lm->compactLuxels[ i ] == NULL ) {
+			continue;
+		}
+		lm->superLuxels[ i ] = safe_malloc( size * SUPER_LUXEL_SIZE * sizeof( float ) );
+		UnpackHalfs( lm->compactLuxels[ i ], lm->superLuxels[ i ], size * SUPER_LUXEL_SIZE );
+	}
+
+	/* deluxels and floodlight */
+	if ( lm->compactDeluxels != NULL ) {
+		lm->superDeluxels = safe_malloc( size * SUPER_DELUXEL_SIZE * sizeof( float ) );
+		UnpackHalfs( lm->compactDeluxels, lm->superDeluxels, size * SUPER_DELUXEL_SIZE );
+	}
+	if ( lm->compactFloodLight != NULL ) {
+		lm->superFloodLight = safe_malloc( size * SUPER_FLOODLIGHT_SIZE * sizeof( float ) );
+		UnpackHalfs( lm->compactFloodLight, lm->superFloodLight, size * SUPER_FLOODLIGHT_SIZE );
+	}
+
+	/* normals */
+	lm->superNormals = safe_malloc( size * SUPER_NORMAL_SIZE * sizeof( float ) );
+	for ( i = 0; i < size; i++ )
+	{
+		normal = lm->superNormals + i * SUPER_NORMAL_SIZE;
+		packed = lm->compactNormals + i * 3;
+		UnpackOctNormal( packed, normal );
+		normal[ 3 ] = HalfToFloat( packed[ 2 ] );
+	}
+}
+
+
+
+/*
+   FreeSuperLuxels()
+   drops the super luxels of a raw lightmap after the last store filled its bsp luxels, packed
+   or not, but for the normals if they are still to be read
+ */
+
+static void FreeSuperLuxels( rawLightmap_t *lm, qboolean keepNormals ){
+	int i;
+
+
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+		free( lm->superLuxels[ i ] );
+		lm->superLuxels[ i ] = NULL;
+		free( lm->compactLuxels[ i ] );
+		lm->compactLuxels[ i ] = NULL;
+	}
+	free( lm->superOrigins );
+	lm->superOrigins = NULL;
+	free( lm->superClusters );
+	lm->superClusters = NULL;
+	free( lm->superDeluxels );
+	lm->superDeluxels = NULL;
+	free( lm->compactDeluxels );
+	lm->compactDeluxels = NULL;
+	free( lm->superFloodLight );
+	lm->superFloodLight = NULL;
+	free( lm->compactFloodLight );
+	lm->compactFloodLight = NULL;
+	if ( !keepNormals ) {
+		free( lm->superNormals );
+		lm->superNormals = NULL;
+		free( lm->compactNormals );
+		lm->compactNormals = NULL;
+	}
+}
+
+
+
+/*
+   GetSuperLuxel()
+   returns a super luxel of a raw lightmap, unpacking it into the given scratch space if the
+   raw lightmap is packed
+ */
+
+float *GetSuperLuxel( rawLightmap_t *lm, int lightmapNum, int x, int y, float *scratch ){
+	if ( lm->superLuxels[ lightmapNum ] == NULL && lm->compactLuxels[ lightmapNum ] != NULL ) {
+		UnpackHalfs( lm->compactLuxels[ lightmapNum ] + ( y * lm->sw + x ) * SUPER_LUXEL_SIZE, scratch, SUPER_LUXEL_SIZE );
+		return scratch;
+	}
+	return SUPER_LUXEL( lightmapNum, x, y );
+}
+
+
+
 /*
    AddPatchToRawLightmap()
    projects a lightmap for a patch surface
@@ -1974,6 +2329,9 @@ static void SetupOutLightmap( rawLightmap_t *lm, outLightmap_t *olm ){
 
 	/* allocate buffers */
 	olm->lightBits = safe_malloc0( ( olm->customWidth * olm->customHeight / 8 ) + 8 );
+	olm->skyline = safe_malloc0( olm->customWidth * sizeof( *olm->skyline ) );
+	olm->minSkyline = 0;
+	olm->firstFreeLuxel = 0;
 	olm->bspLightBytes = safe_malloc0( olm->customWidth * olm->customHeight * 3 );
 	if ( deluxemap ) {
 		olm->bspDirBytes = safe_malloc0( olm->customWidth * olm->customHeight * 3 );
@@ -1982,6 +2340,111 @@ static void SetupOutLightmap( rawLightmap_t *lm, outLightmap_t *olm ){
 
 
 
+/*
+   FindSkylinePosition()
+   finds the lowest spot (leftmost of those) above the skyline of an output lightmap that fits a
+   w by h rectangle, keeping the running maximum of the skyline over a window of w columns
+ */
+
+static qboolean FindSkylinePosition( outLightmap_t *olm, int w, int h, int *x, int *y ){
+	int i, head, tail, top, bestX, bestY, *window;
+
+
+	/* quick rejects */
+	if ( w > olm->customWidth || olm->minSkyline + h > olm->customHeight ) {
+		return qfalse;
+	}
+
+	/* window holds the columns that can still be the highest, highest first */
+	window = safe_malloc( olm->customWidth * sizeof( *window ) );
+	head = tail = 0;
+	bestX = -1;
+	bestY = olm->customHeight;
+	for ( i = 0; i < olm->customWidth; i++ )
+	{
+		while ( tail > head && olm->skyline[ window[ tail - 1 ] ] <= olm->skyline[ i ] )
+			tail--;
+		window[ tail++ ] = i;
+		if ( window[ head ] <= i - w ) {
+			head++;
+		}
+
+		/* a full window */
+		if ( i >= w - 1 ) {
+			top = olm->skyline[ window[ head ] ];
+			if ( top < bestY ) {
+				bestX = i - w + 1;
+				bestY = top;
+			}
+		}
+	}
+	free( window );
+
+	/* does it fit? */
+	if ( bestX < 0 || bestY + h > olm->customHeight ) {
+		return qfalse;
+	}
+	*x = bestX;
+	*y = bestY;
+	return qtrue;
+}
+
+
+
+/*
+   FindSolidPosition()
+   finds the first free luxel of an output lightmap for a solid lightmap, as the exhaustive search
+   would, but from where the last search left off
+ */
+
+static qboolean FindSolidPosition( outLightmap_t *olm, int *x, int *y ){
+	int offset, size;
+
+
+	size = olm->customWidth * olm->customHeight;
+	for ( offset = olm->firstFreeLuxel; offset < size; offset++ )
+	{
+		if ( !( olm->lightBits[ offset >> 3 ] & ( 1 << ( offset & 7 ) ) ) ) {
+			break;
+		}
+	}
+	olm->firstFreeLuxel = offset;
+	if ( offset >= size ) {
+		return qfalse;
+	}
+	*x = offset % olm->customWidth;
+	*y = offset / olm->customWidth;
+	return qtrue;
+}
+
+
+
+/*
+   RaiseSkyline()
+   raises the skyline of an output lightmap over a rectangle placed on it
+ */
+
+static void RaiseSkyline( outLightmap_t *olm, int x, int y, int w, int h ){
+	int i;
+
+
+	for ( i = x; i < x + w && i < olm->customWidth; i++ )
+	{
+		if ( i >= 0 && olm->skyline[ i ] < y + h ) {
+			olm->skyline[ i ] = y + h;
+		}
+	}
+	olm->minSkyline = olm->customHeight;
+	for ( i = 0; i < olm->customWidth; i++ )
+	{
+		if ( olm->skyline[ i ] < olm->minSkyline ) {
+			olm->minSkyline = olm->skyline[ i ];
+		}
+	}
+}
+
+
+
 /*
    FindOutLightmaps()
    for a given surface lightmap, find output lightmap pages and positions for it
@@ -1996,7 +2459,6 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 	vec3_t color, direction;
 	byte                *pixel;
 	qboolean ok;
-	int xIncrement, yIncrement;
 
 	/* set default lightmap number (-3 = LIGHTMAP_BY_VERTEX) */
 	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
@@ -2119,43 +2581,12 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 					continue;
 				}
 
-				/* set maxs */
+				/* solid lightmaps take the first free luxel, the others go on top of the skyline */
 				if ( lm->solid[ lightmapNum ] ) {
-					xMax = olm->customWidth;
-					yMax = olm->customHeight;
+					ok = FindSolidPosition( olm, &x, &y );
 				}
-				else
-				{
-					xMax = ( olm->customWidth - lm->w ) + 1;
-					yMax = ( olm->customHeight - lm->h ) + 1;
-				}
-
-				/* if fast allocation, do not test allocation on every pixels, especially for large lightmaps */
-				if ( fastAllocate == qtrue ) {
-					xIncrement = MAX(1, lm->w / 15);
-					yIncrement = MAX(1, lm->h / 15);
-				}
-				else {
-					xIncrement = 1;
-					yIncrement = 1;
-				}
-
-				/* walk the origin around the lightmap */
-				for ( y = 0; y < yMax; y += yIncrement )
-				{
-					for ( x = 0; x < xMax; x += xIncrement )
-					{
-						/* find a fine tract of lauhnd */
-						ok = TestOutLightmapStamp( lm, lightmapNum, olm, x, y );
-
-						if ( ok ) {
-							break;
-						}
-					}
-
-					if ( ok ) {
-						break;
-					}
+				else{
+					ok = FindSkylinePosition( olm, lm->w, lm->h, &x, &y );
 				}
 
 				if ( ok ) {
@@ -2209,6 +2640,16 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 		lm->lightmapY[ lightmapNum ] = y;
 		olm->numLightmaps++;
 
+		/* keep the skyline above it (solid lightmaps mostly fill holes below it) */
+		if ( lm->solid[ lightmapNum ] ) {
+			if ( y >= olm->skyline[ x ] ) {
+				RaiseSkyline( olm, x, y, 1, 1 );
+			}
+		}
+		else{
+			RaiseSkyline( olm, x, y, lm->w, lm->h );
+		}
+
 		/* add shaders */
 		for ( i = 0; i < lm->numLightSurfaces; i++ )
 		{
@@ -2486,15 +2927,15 @@ void FillOutLightmap( outLightmap_t *olm ){
    stores the surface lightmaps into the bsp as byte rgb triplets
  */
 
-void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
+void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal, qboolean lastStore ){
 	int i, j, k, x, y, lx, ly, sx, sy, *cluster, mappedSamples, timer_start;
 	int style, size, lightmapNum, lightmapNum2;
 	float               *normal, *luxel, *bspLuxel, *bspLuxel2, *radLuxel, samples, occludedSamples;
 	vec3_t sample, occludedSample, dirSample, colorMins, colorMaxs;
 	float               *deluxel, *bspDeluxel, *bspDeluxel2;
 	byte                *lb;
-	int numUsed, numTwins, numTwinLuxels, numStored;
-	float lmx, lmy, efficiency;
+	int numUsed, numTwins, numTwinLuxels, numStored, numPacked, numPageLuxels;
+	float lmx, lmy, efficiency, packing;
 	vec3_t color;
 	bspDrawSurface_t    *ds, *parent, dsTemp;
 	surfaceInfo_t       *info;
@@ -2506,10 +2947,12 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 	char lightmapName[ 128 ];
 	const char          *rgbGenValues[ 256 ];
 	const char          *alphaGenValues[ 256 ];
+	qboolean tangentSpace;
 
 
 	/* note it */
 	Sys_Printf( "--- StoreSurfaceLightmaps ---\n" );
+	tangentSpace = !bouncing && deluxemap && deluxemode == 1;
 
 	/* setup */
 	if ( lmCustomDir ) {
@@ -2541,6 +2984,9 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 	{
 		/* get lightmap */
 		lm = &rawLightmaps[ i ];
+		if ( compactLightmaps ) {
+			UnpackRawLightmap( lm );
+		}
 
 		/* walk individual lightmaps */
 		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
@@ -2863,6 +3309,15 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 				}
 			}
 		}
+
+		/* the super luxels are done with until the next bounce, or for good after the last
+		   store but for the normals the tangentspace deluxemaps are made with */
+		if ( lastStore ) {
+			FreeSuperLuxels( lm, tangentSpace );
+		}
+		if ( compactLightmaps ) {
+			PackRawLightmap( lm );
+		}
 	}
 
 	Sys_FPrintf( SYS_VRB, "%d.", (int) ( I_FloatTime() - timer_start ) );
@@ -2884,28 +3339,30 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 			{
 				/* get lightmap */
 				lm = &rawLightmaps[ i ];
+				if ( compactLightmaps ) {
+					UnpackRawLightmap( lm );
+				}
 
-				/* walk lightmap samples */
-				for ( y = 0; y < lm->sh; y++ )
+				/* walk bsp luxels, with the normal of the first super sample of each */
+				for ( y = 0; y < lm->h; y++ )
 				{
-					for ( x = 0; x < lm->sw; x++ )
+					for ( x = 0; x < lm->w; x++ )
 					{
 						/* get normal and deluxel */
-						normal = SUPER_NORMAL( x, y );
-						cluster = SUPER_CLUSTER( x, y );
+						normal = SUPER_NORMAL( x * superSample, y * superSample );
 						bspDeluxel = BSP_DELUXEL( x, y );
-						deluxel = SUPER_DELUXEL( x, y );
 
 						/* get normal */
 						VectorSet( myNormal, normal[0], normal[1], normal[2] );
 
-						/* get tangent vectors */
+						/* get tangent vectors (the unmapped luxels have no normal at all) */
 						if ( myNormal[ 0 ] == 0.0f && myNormal[ 1 ] == 0.0f ) {
-							if ( myNormal[ 2 ] == 1.0f ) {
+							if ( myNormal[ 2 ] >= 0.0f ) {
 								VectorSet( myTangent, 1.0f, 0.0f, 0.0f );
 								VectorSet( myBinormal, 0.0f, 1.0f, 0.0f );
 							}
-							else if ( myNormal[ 2 ] == -1.0f ) {
+							else
+							{
 								VectorSet( myTangent, -1.0f, 0.0f, 0.0f );
 								VectorSet( myBinormal,  0.0f, 1.0f, 0.0f );
 							}
@@ -2946,6 +3403,12 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 						bspDeluxel[2] = DotProduct( dirSample, myNormal );
 					}
 				}
+				if ( lastStore ) {
+					FreeSuperLuxels( lm, qfalse );
+				}
+				else if ( compactLightmaps ) {
+					PackRawLightmap( lm );
+				}
 			}
 
 			Sys_FPrintf( SYS_VRB, "%d.", (int) ( I_FloatTime() - timer_start ) );
@@ -3107,6 +3570,7 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 			for ( i = 0; i < numOutLightmaps; i++ )
 			{
 				free( outLightmaps[ i ].lightBits );
+				free( outLightmaps[ i ].skyline );
 				free( outLightmaps[ i ].bspLightBytes );
 			}
 			free( outLightmaps );
@@ -3546,6 +4010,18 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 				 ? 0
 				 : (float) numUsed / (float) numStored;
 
+	/* calc how tightly the output lightmaps are packed */
+	numPacked = 0;
+	numPageLuxels = 0;
+	for ( i = 0; i < numOutLightmaps; i++ )
+	{
+		numPageLuxels += outLightmaps[ i ].customWidth * outLightmaps[ i ].customHeight;
+		numPacked += outLightmaps[ i ].customWidth * outLightmaps[ i ].customHeight - outLightmaps[ i ].freeLuxels;
+	}
+	packing = ( numPageLuxels <= 0 )
+			  ? 0
+			  : (float) numPacked / (float) numPageLuxels;
+
 	if ( storeForReal ) {
 		/* print stats */
 		Sys_Printf( "%9d luxels used\n", numUsed );
@@ -3556,6 +4032,7 @@ void StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal ){
 		Sys_Printf( "%9d vertex approximated surfaces\n", numSurfsVertexApproximated );
 		Sys_Printf( "%9d BSP lightmaps\n", numBSPLightmaps );
 		Sys_Printf( "%9d total lightmaps\n", numOutLightmaps );
+		Sys_Printf( "%9d luxels in output lightmaps (%3.2f percent used)\n", numPageLuxels, packing * 100.0f );
 		Sys_Printf( "%9d unique lightmap/shader combinations\n", numLightmapShaders );
 
 		/* write map shader file */
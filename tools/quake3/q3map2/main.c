@@ -90,6 +90,17 @@ static void ExitQ3Map( void ){
 	if ( mapDrawSurfs != NULL ) {
 		free( mapDrawSurfs );
 	}
+
+	/* print the pool counters */
+	if ( memStats ) {
+		Sys_Printf( "--- MemStats ---\n" );
+		MemPoolPrintStats( &brushPool );
+		MemPoolPrintStats( &windingPool );
+		MemPoolPrintStats( &portalPool );
+		MemPoolPrintStats( &nodePool );
+		MemPoolPrintStats( &facePool );
+		MemPoolPrintTotals();
+	}
 }
 
 
@@ -2094,6 +2105,11 @@ int main( int argc, char **argv ){
 	/* we want consistent 'randomness' */
 	srand( 0 );
 
+	/* keep the command line as given, light workers are started with it */
+	myargc = argc;
+	myargv = safe_malloc( ( argc + 1 ) * sizeof( *myargv ) );
+	memcpy( myargv, argv, ( argc + 1 ) * sizeof( *myargv ) );
+
 	/* start timer */
 	start = I_FloatTime();
 
@@ -2137,6 +2153,12 @@ int main( int argc, char **argv ){
 			argv[ i ] = NULL;
 		}
 
+		/* print pool allocator statistics on exit */
+		else if ( !strcmp( argv[ i ], "-memstats" ) ) {
+			memStats = qtrue;
+			argv[ i ] = NULL;
+		}
+
 		/* make all warnings into errors */
 		else if ( !strcmp( argv[ i ], "-werror" ) ) {
 			werror = qtrue;
@@ -1144,7 +1144,7 @@ static void ParseRawBrush( qboolean onlyLights ){
 		/* set default flags and values */
 		sprintf( shader, "textures/%s", name );
 		if ( onlyLights ) {
-			si = &shaderInfo[ 0 ];
+			si = shaderInfo[ 0 ];
 		}
 		else{
 			si = ShaderInfoForShader( shader );
@@ -84,6 +84,12 @@ void PicoLoadFileFunc( const char *name, byte **buffer, int *bufSize ){
 
 
 
+static picoModel_t          **picoModels = NULL;
+static int maxPicoModels = 0;
+static nameIndex_t picoModelIndex;
+
+
+
 /*
    FindModel() - ydnar
    finds an existing picoModel and returns a pointer to the picoModel_t struct or NULL if not found
@@ -93,18 +99,13 @@ picoModel_t *FindModel( const char *name, int frame ){
 	int i;
 
 
-	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
-
 	/* dummy check */
 	if ( name == NULL || name[ 0 ] == '\0' ) {
 		return NULL;
 	}
 
 	/* search list */
-	for ( i = 0; i < MAX_MODELS; i++ )
+	for ( i = FirstNameIndexEntry( &picoModelIndex, name ); i >= 0; i = NextNameIndexEntry( &picoModelIndex, i ) )
 	{
 		if ( picoModels[ i ] != NULL &&
 			 !strcmp( PicoGetModelName( picoModels[ i ] ), name ) &&
@@ -125,15 +126,9 @@ picoModel_t *FindModel( const char *name, int frame ){
  */
 
 picoModel_t *LoadModel( const char *name, int frame ){
-	int i;
 	picoModel_t     *model, **pm;
 
 
-	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
-
 	/* dummy check */
 	if ( name == NULL || name[ 0 ] == '\0' ) {
 		return NULL;
@@ -145,20 +140,9 @@ picoModel_t *LoadModel( const char *name, int frame ){
 		return model;
 	}
 
-	/* none found, so find first non-null picoModel */
-	pm = NULL;
-	for ( i = 0; i < MAX_MODELS; i++ )
-	{
-		if ( picoModels[ i ] == NULL ) {
-			pm = &picoModels[ i ];
-			break;
-		}
-	}
-
-	/* too many picoModels? */
-	if ( pm == NULL ) {
-		Error( "MAX_MODELS (%d) exceeded, there are too many model files referenced by the map.", MAX_MODELS );
-	}
+	/* none found, so add a new picoModel */
+	AUTOEXPAND_BY_REALLOC0( picoModels, numPicoModels, maxPicoModels, 256 );
+	pm = &picoModels[ numPicoModels ];
 
 	/* attempt to parse model */
 	*pm = PicoLoadModel( name, frame );
@@ -179,7 +163,7 @@ picoModel_t *LoadModel( const char *name, int frame ){
 	/* debug code */
 	#if 0
 	{
-		int numSurfaces, numVertexes;
+		int i, numSurfaces, numVertexes;
 		picoSurface_t   *ps;
 
 
@@ -196,6 +180,7 @@ picoModel_t *LoadModel( const char *name, int frame ){
 
 	/* set count */
 	if ( *pm != NULL ) {
+		AddNameIndexEntry( &picoModelIndex, numPicoModels, PicoGetModelName( *pm ) );
 		numPicoModels++;
 	}
 
@@ -1239,7 +1224,7 @@ void InsertModel( const char *name, int skin, int frame, m4x4_t transform, remap
 						else
 						{
 							Sys_Printf( "WARNING: triangle (%6.0f %6.0f %6.0f) (%6.0f %6.0f %6.0f) (%6.0f %6.0f %6.0f) of %s was not autoclipped\n", points[0][0], points[0][1], points[0][2], points[1][0], points[1][1], points[1][2], points[2][0], points[2][1], points[2][2], name );
-							free( buildBrush );
+							FreeBrush( buildBrush );
 							continue;
 						}
 					}
@@ -1316,7 +1301,7 @@ void InsertModel( const char *name, int skin, int frame, m4x4_t transform, remap
 					}
 					else{
 						Sys_Printf( "WARNING: triangle (%6.0f %6.0f %6.0f) (%6.0f %6.0f %6.0f) (%6.0f %6.0f %6.0f) of %s was not autoclipped\n", points[0][0], points[0][1], points[0][2], points[1][0], points[1][1], points[1][2], points[2][0], points[2][1], points[2][2], name );
-						free( buildBrush );
+						FreeBrush( buildBrush );
 					}
 				}
 			}
@@ -0,0 +1,260 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define NAMEINDEX_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+
+
+/*
+   name index
+   a case insensitive hash from names to entry numbers, shared by the shader,
+   image and model lists so that looking a name up doesn't scan the whole list;
+   lookups only narrow things down to entries with the same hash, the owner of
+   the list still compares the names the way it always did
+ */
+
+#define MIN_NAME_INDEX_BUCKETS  256
+
+
+
+/*
+   HashName()
+   returns a case insensitive hash of a name
+ */
+
+unsigned int HashName( const char *name ){
+	unsigned int hash, c;
+
+
+	/* fnv-1a, folding case the way Q_stricmp() does */
+	hash = 2166136261u;
+	for ( ; *name != '\0'; name++ )
+	{
+		c = (unsigned char) *name;
+		if ( c >= 'A' && c <= 'Z' ) {
+			c += 'a' - 'A';
+		}
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+
+/*
+   LinkNameIndexEntry()
+   appends an entry to the end of its bucket's chain, so chains stay in entry order
+ */
+
+static void LinkNameIndexEntry( nameIndex_t *index, int entry ){
+	int bucket;
+
+
+	bucket = index->entries[ entry ].hash & ( index->numBuckets - 1 );
+	index->entries[ entry ].next = 0;
+	if ( index->tails[ bucket ] > 0 ) {
+		index->entries[ index->tails[ bucket ] - 1 ].next = entry + 1;
+	}
+	else{
+		index->buckets[ bucket ] = entry + 1;
+	}
+	index->tails[ bucket ] = entry + 1;
+}
+
+
+
+/*
+   ResizeNameIndex()
+   grows the bucket table and relinks every entry in ascending order
+ */
+
+static void ResizeNameIndex( nameIndex_t *index, int numBuckets ){
+	int i;
+
+
+	free( index->buckets );
+	free( index->tails );
+	index->numBuckets = numBuckets;
+	index->buckets = safe_malloc0( numBuckets * sizeof( *index->buckets ) );
+	index->tails = safe_malloc0( numBuckets * sizeof( *index->tails ) );
+	for ( i = 0; i < index->maxEntries; i++ )
+	{
+		if ( index->entries[ i ].used ) {
+			LinkNameIndexEntry( index, i );
+		}
+	}
+}
+
+
+
+/*
+   AddNameIndexEntry()
+   adds an entry under a name; entries that should win a lookup must be added
+   first or have lower entry numbers than those added before them
+ */
+
+void AddNameIndexEntry( nameIndex_t *index, int entry, const char *name ){
+	int bucket, prev, next;
+
+
+	/* make room for the entry number */
+	AUTOEXPAND_BY_REALLOC0( index->entries, entry, index->maxEntries, MIN_NAME_INDEX_BUCKETS );
+
+	/* keep the chains short */
+	if ( index->numEntries >= index->numBuckets ) {
+		ResizeNameIndex( index, index->numBuckets > 0 ? index->numBuckets * 2 : MIN_NAME_INDEX_BUCKETS );
+	}
+
+	/* re-adding an entry replaces it */
+	if ( index->entries[ entry ].used ) {
+		RemoveNameIndexEntry( index, entry );
+	}
+	index->entries[ entry ].hash = HashName( name );
+	index->entries[ entry ].used = qtrue;
+	index->numEntries++;
+
+	/* common case: entries come in ascending order */
+	bucket = index->entries[ entry ].hash & ( index->numBuckets - 1 );
+	if ( index->tails[ bucket ] <= entry ) {
+		LinkNameIndexEntry( index, entry );
+		return;
+	}
+
+	/* otherwise insert it in order */
+	prev = -1;
+	for ( next = index->buckets[ bucket ] - 1; next >= 0 && next < entry; next = index->entries[ next ].next - 1 )
+		prev = next;
+	index->entries[ entry ].next = next + 1;
+	if ( prev >= 0 ) {
+		index->entries[ prev ].next = entry + 1;
+	}
+	else{
+		index->buckets[ bucket ] = entry + 1;
+	}
+}
+
+
+
+/*
+   RemoveNameIndexEntry()
+   takes an entry out of the index
+ */
+
+void RemoveNameIndexEntry( nameIndex_t *index, int entry ){
+	int bucket, prev, i;
+
+
+	/* dummy check */
+	if ( entry < 0 || entry >= index->maxEntries || !index->entries[ entry ].used ) {
+		return;
+	}
+
+	/* unlink it */
+	bucket = index->entries[ entry ].hash & ( index->numBuckets - 1 );
+	prev = -1;
+	for ( i = index->buckets[ bucket ] - 1; i >= 0 && i != entry; i = index->entries[ i ].next - 1 )
+		prev = i;
+	if ( prev >= 0 ) {
+		index->entries[ prev ].next = index->entries[ entry ].next;
+	}
+	else{
+		index->buckets[ bucket ] = index->entries[ entry ].next;
+	}
+	if ( index->tails[ bucket ] == entry + 1 ) {
+		index->tails[ bucket ] = prev + 1;
+	}
+
+	index->entries[ entry ].used = qfalse;
+	index->numEntries--;
+}
+
+
+
+/*
+   ClearNameIndex()
+   empties an index, keeping its memory around
+ */
+
+void ClearNameIndex( nameIndex_t *index ){
+	if ( index->numBuckets > 0 ) {
+		memset( index->buckets, 0, index->numBuckets * sizeof( *index->buckets ) );
+		memset( index->tails, 0, index->numBuckets * sizeof( *index->tails ) );
+	}
+	if ( index->maxEntries > 0 ) {
+		memset( index->entries, 0, index->maxEntries * sizeof( *index->entries ) );
+	}
+	index->numEntries = 0;
+}
+
+
+
+/*
+   FirstNameIndexEntry() / NextNameIndexEntry()
+   walk the entries that may have the given name, lowest entry number first;
+   return -1 when there are no more
+ */
+
+int FirstNameIndexEntry( const nameIndex_t *index, const char *name ){
+	int i;
+	unsigned int hash;
+
+
+	if ( index->numEntries <= 0 ) {
+		return -1;
+	}
+	hash = HashName( name );
+	for ( i = index->buckets[ hash & ( index->numBuckets - 1 ) ] - 1; i >= 0; i = index->entries[ i ].next - 1 )
+	{
+		if ( index->entries[ i ].hash == hash ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int NextNameIndexEntry( const nameIndex_t *index, int entry ){
+	int i;
+
+
+	for ( i = index->entries[ entry ].next - 1; i >= 0; i = index->entries[ i ].next - 1 )
+	{
+		if ( index->entries[ i ].hash == index->entries[ entry ].hash ) {
+			return i;
+		}
+	}
+	return -1;
+}
@@ -42,8 +42,6 @@
 extern qboolean FixWinding( winding_t *w );
 
 
-int c_active_portals;
-int c_peak_portals;
 int c_boundary;
 int c_boundary_sides;
 
@@ -55,14 +53,7 @@ int c_boundary_sides;
 portal_t *AllocPortal( void ){
 	portal_t    *p;
 
-	if ( numthreads == 1 ) {
-		c_active_portals++;
-	}
-	if ( c_active_portals > c_peak_portals ) {
-		c_peak_portals = c_active_portals;
-	}
-
-	p = safe_malloc0( sizeof( portal_t ) );
+	p = MemPoolAlloc( &portalPool, sizeof( portal_t ) );
 
 	return p;
 }
@@ -71,10 +62,7 @@ void FreePortal( portal_t *p ){
 	if ( p->winding ) {
 		FreeWinding( p->winding );
 	}
-	if ( numthreads == 1 ) {
-		c_active_portals--;
-	}
-	free( p );
+	MemPoolFree( &portalPool, p );
 }
 
 
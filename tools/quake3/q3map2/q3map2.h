@@ -71,6 +71,7 @@
 #include "picomodel.h"
 
 #include "scriplib.h"
+#include "mempool.h"
 #include "polylib.h"
 #include "imagelib.h"
 #include "qthreads.h"
@@ -124,17 +125,13 @@
 /* general */
 #define MAX_QPATH               64
 
-#define MAX_IMAGES              2048
 #define DEFAULT_IMAGE           "*default"
 
-#define MAX_MODELS              2048
-
 #define DEF_BACKSPLASH_FRACTION 0.05f   /* 5% backsplash by default */
 #define DEF_BACKSPLASH_DISTANCE 23
 
 #define DEF_RADIOSITY_BOUNCE    1.0f    /* ydnar: default to 100% re-emitted light */
 
-#define MAX_SHADER_INFO         8192
 #define MAX_CUST_SURFACEPARMS   256
 
 #define SHADER_MAX_VERTEXES     1000
@@ -261,7 +258,10 @@
 #define LIGHT_WOLF_DEFAULT      ( LIGHT_ATTEN_LINEAR | LIGHT_ATTEN_DISTANCE | LIGHT_GRID | LIGHT_SURFACES | LIGHT_FAST )
 
 #define MAX_TRACE_TEST_NODES    256
+#define MAX_TRACE_PACKET        8
+#define LIGHT_TRACE_PENDING     2       /* SetupLightContributionToSample() result */
 #define DEFAULT_INHIBIT_RADIUS  1.5f
+#define LIGHT_WORK_CHUNKS       64      /* chunks a stage shared out between light workers is cut into */
 
 #define LUXEL_EPSILON           0.125f
 #define VERTEX_EPSILON          -0.125f
@@ -285,7 +285,7 @@
 #define SUPER_LUXEL_SIZE        4
 #define SUPER_FLAG_SIZE         4
 #define FLAG_FORCE_SUBSAMPLING 1
-#define FLAG_ALREADY_SUBSAMPLED 2
+#define FLAG_SUBSAMPLE          2
 #define SUPER_ORIGIN_SIZE       3
 #define SUPER_NORMAL_SIZE       4
 #define SUPER_DELUXEL_SIZE      3
@@ -297,7 +297,6 @@
 #define BSP_LUXEL( s, x, y )    ( lm->bspLuxels[ s ] + ( ( ( ( y ) * lm->w ) + ( x ) ) * BSP_LUXEL_SIZE ) )
 #define RAD_LUXEL( s, x, y )    ( lm->radLuxels[ s ] + ( ( ( ( y ) * lm->w ) + ( x ) ) * RAD_LUXEL_SIZE ) )
 #define SUPER_LUXEL( s, x, y )  ( lm->superLuxels[ s ] + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_LUXEL_SIZE ) )
-#define SUPER_FLAG( x, y )  ( lm->superFlags + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_FLAG_SIZE ) )
 #define SUPER_DELUXEL( x, y )   ( lm->superDeluxels + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_DELUXEL_SIZE ) )
 #define BSP_DELUXEL( x, y )     ( lm->bspDeluxels + ( ( ( ( y ) * lm->w ) + ( x ) ) * BSP_DELUXEL_SIZE ) )
 #define SUPER_CLUSTER( x, y )   ( lm->superClusters + ( ( ( y ) * lm->sw ) + ( x ) ) )
@@ -611,6 +610,25 @@ typedef struct game_s
 game_t;
 
 
+typedef struct nameIndexEntry_s
+{
+	unsigned int hash;
+	int next;                                           /* next entry + 1 in the same bucket */
+	qboolean used;
+}
+nameIndexEntry_t;
+
+
+typedef struct nameIndex_s
+{
+	int numBuckets;
+	int                 *buckets, *tails;               /* first and last entry + 1 per bucket */
+	int numEntries, maxEntries;
+	nameIndexEntry_t    *entries;
+}
+nameIndex_t;
+
+
 typedef struct image_s
 {
 	char                *name, *filename;
@@ -1237,6 +1255,18 @@ typedef struct
 fixedWinding_t;
 
 
+/* seperating planes kept as separate arrays of normal components and dists, so a
+   winding can be measured against four of them at once; padded so four can be
+   loaded starting at any of them */
+typedef struct
+{
+	int numSeperators;
+	vec_t normals[ 3 ][ MAX_SEPERATORS + 3 ];
+	vec_t dists[ MAX_SEPERATORS + 3 ];
+}
+visSeperators_t;
+
+
 typedef struct passage_s
 {
 	struct passage_s    *next;
@@ -1272,6 +1302,11 @@ typedef struct
 	byte                *portalvis;     /* [portals], final */
 
 	int nummightsee;                    /* bit count on portalflood for sort */
+	float cost;                         /* estimated flow cost, see EstimatePortalCosts() */
+	int chains;                         /* flow statistics, fed back into the cost */
+	int clips;                          /* windings clipped to a plane while flowing */
+	int maxDepth;
+	int branchesLeft;                   /* flow tasks still running on this portal */
 	passage_t           *passages;      /* there are just as many passages as there */
 	                                    /* are portals in the leaf this portal leads */
 }
@@ -1287,9 +1322,24 @@ typedef struct leaf_s
 leaf_t;
 
 
+/* a mightsee bitset is listed when few enough of its 64 bit words are set, so it can be
+   and-ed word by word instead of in full; the bitset itself is always kept whole */
+#define MIGHTSEE_UNLISTED       -1      /* not looked at yet */
+#define MIGHTSEE_DENSE          -2      /* too many words set to be worth listing */
+#define MIGHTSEE_LIST_FRACTION  8       /* listed when at most 1 / this of the words are set */
+
+typedef struct mightsee_s
+{
+	byte                *bits;          /* portalbytes */
+	unsigned short      *words;         /* the nonzero words of bits, when numWords >= 0 */
+	int numWords;
+}
+mightsee_t;
+
+
 typedef struct pstack_s
 {
-	byte mightsee[ MAX_PORTALS / 8 ];
+	mightsee_t          *mightsee;      /* per thread and depth, see MightseeForDepth() */
 	struct pstack_s     *next;
 	leaf_t              *leaf;
 	vportal_t           *portal;        /* portal exiting */
@@ -1301,9 +1351,9 @@ typedef struct pstack_s
 
 	visPlane_t portalplane;
 	int depth;
+	int                 *c_clips;       /* the clips of the flow, counted by VisChopWinding() */
 #ifdef SEPERATORCACHE
-	visPlane_t seperators[ 2 ][ MAX_SEPERATORS ];
-	int numseperators[ 2 ];
+	visSeperators_t seperators[ 2 ];
 #endif
 }
 pstack_t;
@@ -1312,7 +1362,11 @@ pstack_t;
 typedef struct
 {
 	vportal_t           *base;
+	byte                *portalvis;     /* base->portalvis, or a private copy when flowing one branch */
+	int branch;                         /* top level portal to flow, -1 for all */
 	int c_chains;
+	int c_clips;
+	int maxDepth;
 	pstack_t pstack_head;
 }
 threaddata_t;
@@ -1357,6 +1411,8 @@ typedef struct light_s
 
 	float falloffTolerance;                 /* ydnar: minimum attenuation threshold */
 	float filterRadius;                 /* ydnar: lightmap filter radius in world units, 0 == default */
+
+	uint64_t cacheKey;                  /* -incremental: hash of the above, see KeyLightsForCache() */
 }
 light_t;
 
@@ -1399,6 +1455,7 @@ typedef struct
 	qboolean passSolid;
 	qboolean opaque;
 	vec_t forceSubsampling;           /* needs subsampling (alphashadow), value = max color contribution possible from it */
+	vec_t add;                          /* light reaching the sample before shadowing */
 
 	/* working data */
 	int numTestNodes;
@@ -1447,6 +1504,8 @@ typedef struct outLightmap_s
 	int numShaders;
 	shaderInfo_t        *shaders[ MAX_LIGHTMAP_SHADERS ];
 	byte                *lightBits;
+	int                 *skyline;                       /* per column, the row from which on it is all free */
+	int minSkyline, firstFreeLuxel;                     /* everything before firstFreeLuxel is used */
 	byte                *bspLightBytes;
 	byte                *bspDirBytes;
 }
@@ -1490,7 +1549,6 @@ typedef struct rawLightmap_s
 	float                   *bspLuxels[ MAX_LIGHTMAPS ];
 	float                   *radLuxels[ MAX_LIGHTMAPS ];
 	float                   *superLuxels[ MAX_LIGHTMAPS ];
-	unsigned char               *superFlags;
 	float                   *superOrigins;
 	float                   *superNormals;
 	int                     *superClusters;
@@ -1498,10 +1556,34 @@ typedef struct rawLightmap_s
 	float                   *superDeluxels; /* average light direction */
 	float                   *bspDeluxels;
 	float                   *superFloodLight;
+
+	/* -compactlightmaps: the super luxels above, packed while no stage works on them */
+	unsigned short          *compactLuxels[ MAX_LIGHTMAPS ];        /* half floats */
+	unsigned short          *compactNormals;                        /* octahedral normal and half float dirt */
+	unsigned short          *compactDeluxels;
+	unsigned short          *compactFloodLight;
+
+	qboolean noTiles;                                               /* styles still need a lightmap slot, illuminate in one piece */
+	int numLights;                                                  /* culled lights while illuminating */
+	light_t                 **lights;
+
+	/* -incremental */
+	qboolean lightCached, dirtCached;                               /* this pass is lit, the dirt is gathered from the light cache */
+	uint64_t lightCacheKey;
 }
 rawLightmap_t;
 
 
+/* a rectangle of super luxels of a raw lightmap, handed to a thread as one piece of work */
+typedef struct rawLightmapTile_s
+{
+	int rawLightmapNum;
+	int x, y, w, h;
+	float cost;
+}
+rawLightmapTile_t;
+
+
 typedef struct rawGridPoint_s
 {
 	vec3_t ambient[ MAX_LIGHTMAPS ];
@@ -1610,6 +1692,7 @@ void                        SplitBrush( brush_t *brush, int planenum, brush_t **
 
 tree_t                      *AllocTree( void );
 node_t                      *AllocNode( void );
+void                        FreeNode( node_t *node );
 
 
 /* mesh.c */
@@ -1804,31 +1887,74 @@ void                        ComputeAxisBase( vec3_t normal, vec3_t texX, vec3_t
 
 /* vis.c */
 fixedWinding_t              *NewFixedWinding( int points );
+void                        CheckpointPortal( vportal_t *p );
 int                         VisMain( int argc, char **argv );
 
 /* visflow.c */
-int                         CountBits( byte *bits, int numbits );
-void                        PassageFlow( int portalnum );
+void                        PassageFlow( int tasknum );
 void                        CreatePassages( int portalnum );
 void                        PassageMemory( void );
 void                        BasePortalVis( int portalnum );
 void                        BetterPortalVis( int portalnum );
-void                        PortalFlow( int portalnum );
-void                        PassagePortalFlow( int portalnum );
+void                        PortalFlow( int tasknum );
+void                        PassagePortalFlow( int tasknum );
+int                         SchedulePortalFlow( void );
+
+/* visbits.c */
+void                        SetupPortalBits( const char *name );
+qboolean                    PortalBitsAnd( byte *out, const byte *a, const byte *b, const byte *seen );
+qboolean                    PortalBitsAnd3( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen );
+void                        PortalBitsOr( byte *out, const byte *a );
+int                         CountBits( byte *bits, int numbits );
+void                        BenchPortalBits( void );
+mightsee_t                  *MightseeForDepth( int depth );
+void                        MightseeCopy( mightsee_t *out, const byte *bits );
+qboolean                    MightseeAnd( mightsee_t *out, mightsee_t *in, const byte *a, const byte *b, const byte *seen );
 
 
 
 /* light.c  */
 float                       PointToPolygonFormFactor( const vec3_t point, const vec3_t normal, const winding_t *w );
+int                         SetupLightContributionToSample( trace_t *trace );
+int                         FinishLightContributionToSample( trace_t *trace );
 int                         LightContributionToSample( trace_t *trace );
 void LightingAtSample( trace_t * trace, byte styles[ MAX_LIGHTMAPS ], vec3_t colors[ MAX_LIGHTMAPS ] );
 int                         LightContributionToPoint( trace_t *trace );
 int                         LightMain( int argc, char **argv );
 
 
+/* light_cache.c */
+uint64_t                    KeyLightCacheWorld( int argc, char **argv );
+void                        SetupLightCache( const char *bspFilePath, int argc, char **argv );
+void                        CloseLightCache( void );
+void                        KeyLightsForCache( void );
+qboolean                    FindLightCacheLightmap( rawLightmap_t *lm );
+void                        ReadLightCacheLightmap( rawLightmap_t *lm );
+void                        WriteLightCacheLightmap( rawLightmap_t *lm );
+qboolean                    ReadLightCacheDirt( rawLightmap_t *lm );
+void                        WriteLightCacheDirt( rawLightmap_t *lm );
+void                        BeginLightCacheGrid( void );
+qboolean                    ReadLightCacheGridPoint( int num, trace_t *trace );
+void                        EndLightCacheGrid( void );
+void                        ReadLightWorkLightmap( FILE *file, const char *path, rawLightmap_t *lm );
+void                        WriteLightWorkLightmap( FILE *file, rawLightmap_t *lm );
+void                        ReadLightWorkDirt( FILE *file, const char *path, rawLightmap_t *lm );
+void                        WriteLightWorkDirt( FILE *file, rawLightmap_t *lm );
+void                        ReadLightWorkGrid( FILE *file, const char *path, int firstGridPoint, int numGridPoints );
+void                        WriteLightWorkGrid( FILE *file, int firstGridPoint, int numGridPoints );
+
+
+/* light_work.c */
+qboolean                    SetupLightWork( const char *bspFilePath, int argc, char **argv, int numWorkers, const char *run );
+void                        RunLightWork( int numChunks, void ( *runFunc )( int chunk, FILE *file ), void ( *readFunc )( int chunk, FILE *file, const char *path ) );
+void                        BeatLightWork( void );
+void                        CloseLightWork( void );
+
+
 /* light_trace.c */
 void                        SetupTraceNodes( void );
 void                        TraceLine( trace_t *trace );
+void                        TraceLinePacket( trace_t **traces, int numTraces );
 float                       SetupTrace( trace_t *trace );
 
 
@@ -1848,16 +1974,17 @@ void                        SmoothNormals( void );
 void                        MapRawLightmap( int num );
 
 void                        SetupDirt();
+float                       LuxelJitter( int x, int y, int n );
 float                       DirtForSample( trace_t *trace );
-void                        DirtyRawLightmap( int num );
+void                        DirtyRawLightmaps( void );
 
 void                        SetupFloodLight();
 void                        FloodlightRawLightmaps();
 void                        FloodlightIlluminateLightmap( rawLightmap_t *lm );
 float                       FloodLightForSample( trace_t *trace, float floodLightDistance, qboolean floodLightLowQuality );
-void                        FloodLightRawLightmap( int num );
 
-void                        IlluminateRawLightmap( int num );
+void                        FindCachedRawLightmaps( void );
+void                        IlluminateRawLightmaps( void );
 void                        IlluminateVertexes( int num );
 
 void                        SetupBrushesFlags( unsigned int mask_any, unsigned int test_any, unsigned int mask_all, unsigned int test_all );
@@ -1872,6 +1999,7 @@ int                         ShaderForPointInLeaf( vec3_t point, int leafNum, flo
 void                        SetupEnvelopes( qboolean forGrid, qboolean fastFlag );
 void                        FreeTraceLights( trace_t *trace );
 void                        CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace );
+void                        CreateTraceLightsForPoint( vec3_t point, trace_t *trace );
 void                        CreateTraceLightsForSurface( int num, trace_t *trace );
 
 
@@ -1881,9 +2009,13 @@ void                        ExportLightmaps( void );
 int                         ExportLightmapsMain( int argc, char **argv );
 int                         ImportLightmapsMain( int argc, char **argv );
 
+void                        PackRawLightmap( rawLightmap_t *lm );
+void                        UnpackRawLightmap( rawLightmap_t *lm );
+float                       *GetSuperLuxel( rawLightmap_t *lm, int lightmapNum, int x, int y, float *scratch );
+
 void                        SetupSurfaceLightmaps( void );
 void                        StitchSurfaceLightmaps( void );
-void                        StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal );
+void                        StoreSurfaceLightmaps( qboolean fastAllocate, qboolean storeForReal, qboolean lastStore );
 
 
 /* exportents.c */
@@ -1891,6 +2023,15 @@ void                        ExportEntities( void );
 int                         ExportEntitiesMain( int argc, char **argv );
 
 
+/* nameindex.c */
+unsigned int                HashName( const char *name );
+void                        AddNameIndexEntry( nameIndex_t *index, int entry, const char *name );
+void                        RemoveNameIndexEntry( nameIndex_t *index, int entry );
+void                        ClearNameIndex( nameIndex_t *index );
+int                         FirstNameIndexEntry( const nameIndex_t *index, const char *name );
+int                         NextNameIndexEntry( const nameIndex_t *index, int entry );
+
+
 /* image.c */
 void                        ImageFree( image_t *image );
 image_t                     *ImageFind( const char *filename );
@@ -2045,12 +2186,10 @@ Q_EXTERN game_t             *game Q_ASSIGN( &games[ 0 ] );
 
 /* general */
 Q_EXTERN int numImages Q_ASSIGN( 0 );
-Q_EXTERN image_t images[ MAX_IMAGES ];
 
 Q_EXTERN int numPicoModels Q_ASSIGN( 0 );
-Q_EXTERN picoModel_t        *picoModels[ MAX_MODELS ];
 
-Q_EXTERN shaderInfo_t       *shaderInfo Q_ASSIGN( NULL );
+Q_EXTERN shaderInfo_t       **shaderInfo Q_ASSIGN( NULL );
 Q_EXTERN int numShaderInfo Q_ASSIGN( 0 );
 Q_EXTERN int numVertexRemaps Q_ASSIGN( 0 );
 
@@ -2070,6 +2209,7 @@ Q_EXTERN qboolean doingBSP Q_ASSIGN( qfalse );
 /* commandline arguments */
 Q_EXTERN qboolean verboseEntities Q_ASSIGN( qfalse );
 Q_EXTERN qboolean force Q_ASSIGN( qfalse );
+Q_EXTERN qboolean memStats Q_ASSIGN( qfalse );
 Q_EXTERN qboolean infoMode Q_ASSIGN( qfalse );
 Q_EXTERN qboolean useCustomInfoParms Q_ASSIGN( qfalse );
 Q_EXTERN qboolean noprune Q_ASSIGN( qfalse );
@@ -2179,7 +2319,10 @@ Q_EXTERN fog_t mapFogs[ MAX_MAP_FOGS ];
 
 Q_EXTERN entity_t           *mapEnt;
 Q_EXTERN brush_t            *buildBrush;
-Q_EXTERN int numActiveBrushes;
+Q_EXTERN memPool_t brushPool Q_ASSIGN( MEM_POOL( "brushes" ) );
+Q_EXTERN memPool_t nodePool Q_ASSIGN( MEM_POOL( "nodes" ) );
+Q_EXTERN memPool_t portalPool Q_ASSIGN( MEM_POOL( "portals" ) );
+Q_EXTERN memPool_t facePool Q_ASSIGN( MEM_POOL( "faces" ) );
 Q_EXTERN int g_bBrushPrimit;
 
 Q_EXTERN int numStrippedLights Q_ASSIGN( 0 );
@@ -2243,6 +2386,11 @@ Q_EXTERN qboolean mergevisportals;
 Q_EXTERN qboolean nosort;
 Q_EXTERN qboolean saveprt;
 Q_EXTERN qboolean hint;             /* ydnar */
+Q_EXTERN qboolean benchPortalBits;
+Q_EXTERN qboolean visCheckpoint;
+Q_EXTERN qboolean visResume;
+Q_EXTERN qboolean visIncremental;
+Q_EXTERN char                       *portalBitKernels Q_ASSIGN( NULL );
 Q_EXTERN char inbase[ MAX_QPATH ];
 Q_EXTERN char globalCelShader[ MAX_QPATH ];
 
@@ -2288,6 +2436,13 @@ Q_EXTERN vportal_t          *sorted_portals[ MAX_MAP_PORTALS * 2 ];
 Q_EXTERN qboolean wolfLight Q_ASSIGN( qfalse );
 Q_EXTERN float extraDist Q_ASSIGN( 0.0f );
 Q_EXTERN qboolean loMem Q_ASSIGN( qfalse );
+Q_EXTERN qboolean compactLightmaps Q_ASSIGN( qfalse );
+Q_EXTERN int compactBatchSize Q_ASSIGN( 256 );                  /* megabytes of raw lightmaps a stage unpacks at once with -compactlightmaps */
+Q_EXTERN qboolean lightIncremental Q_ASSIGN( qfalse );
+Q_EXTERN int lightWorkers Q_ASSIGN( -1 );               /* worker processes -workers starts, -1 without it */
+Q_EXTERN qboolean lightWorker Q_ASSIGN( qfalse );       /* this process was started with -worker */
+Q_EXTERN int lightWorkTimeout Q_ASSIGN( 300 );          /* seconds a worker may go quiet before its chunks are lit again */
+Q_EXTERN qboolean lightWorkShared Q_ASSIGN( qfalse );   /* the costly light stages are shared out between processes */
 Q_EXTERN qboolean noStyles Q_ASSIGN( qfalse );
 Q_EXTERN qboolean keepLights Q_ASSIGN( qfalse );
 
@@ -2299,6 +2454,7 @@ Q_EXTERN qboolean noGridLighting Q_ASSIGN( qfalse );
 
 Q_EXTERN qboolean noTrace Q_ASSIGN( qfalse );
 Q_EXTERN qboolean noSurfaces Q_ASSIGN( qfalse );
+Q_EXTERN qboolean traceBVH Q_ASSIGN( qfalse );
 Q_EXTERN qboolean patchShadows Q_ASSIGN( qfalse );
 Q_EXTERN qboolean cpmaHack Q_ASSIGN( qfalse );
 
@@ -2313,10 +2469,16 @@ Q_EXTERN qboolean fastgrid Q_ASSIGN( qfalse );
 Q_EXTERN qboolean fastbounce Q_ASSIGN( qfalse );
 Q_EXTERN qboolean cheap Q_ASSIGN( qfalse );
 Q_EXTERN qboolean cheapgrid Q_ASSIGN( qfalse );
+Q_EXTERN qboolean adaptiveGrid Q_ASSIGN( qfalse );
+Q_EXTERN float adaptiveGridTolerance Q_ASSIGN( 4.0f );          /* largest spread of grid color bytes -adaptivegrid interpolates over */
 Q_EXTERN int bounce Q_ASSIGN( 0 );
 Q_EXTERN qboolean bounceOnly Q_ASSIGN( qfalse );
 Q_EXTERN qboolean bouncing Q_ASSIGN( qfalse );
+Q_EXTERN int bouncePass Q_ASSIGN( 0 );                  /* 0 while lighting directly, then the bounce */
 Q_EXTERN qboolean bouncegrid Q_ASSIGN( qfalse );
+Q_EXTERN int bounceCacheSpacing Q_ASSIGN( 0 );          /* super luxels between the bounced light samples interpolated over, 0 for none */
+Q_EXTERN qboolean lightCuts Q_ASSIGN( qfalse );
+Q_EXTERN float lightCutsError Q_ASSIGN( 0.02f );                /* largest light a cluster may add or miss, of the estimated total */
 Q_EXTERN qboolean normalmap Q_ASSIGN( qfalse );
 Q_EXTERN qboolean trisoup Q_ASSIGN( qfalse );
 Q_EXTERN qboolean shade Q_ASSIGN( qfalse );
@@ -2324,13 +2486,19 @@ Q_EXTERN float shadeAngleDegrees Q_ASSIGN( 0.0f );
 Q_EXTERN int superSample Q_ASSIGN( 0 );
 Q_EXTERN int lightSamples Q_ASSIGN( 1 );
 Q_EXTERN qboolean lightRandomSamples Q_ASSIGN( qfalse );
+Q_EXTERN qboolean lightAdaptiveSamples Q_ASSIGN( qfalse );
+Q_EXTERN float lightSamplesBudget Q_ASSIGN( 0.0f );             /* average samples per shadow edge luxel with -adaptivesamples, 0 for the default */
 Q_EXTERN int lightSamplesSearchBoxSize Q_ASSIGN( 1 );
 Q_EXTERN qboolean filter Q_ASSIGN( qfalse );
+Q_EXTERN qboolean denoise Q_ASSIGN( qfalse );
+Q_EXTERN int denoisePasses Q_ASSIGN( 2 );
+Q_EXTERN float denoiseStrength Q_ASSIGN( 1.0f );
 Q_EXTERN qboolean dark Q_ASSIGN( qfalse );
 Q_EXTERN qboolean sunOnly Q_ASSIGN( qfalse );
 Q_EXTERN int approximateTolerance Q_ASSIGN( 0 );
 Q_EXTERN qboolean noCollapse Q_ASSIGN( qfalse );
 Q_EXTERN int lightmapSearchBlockSize Q_ASSIGN( 0 );
+Q_EXTERN int lightTileSize Q_ASSIGN( 64 );                  /* super luxels, raw lightmaps are split into tiles this big for threading */
 Q_EXTERN qboolean exportLightmaps Q_ASSIGN( qfalse );
 Q_EXTERN qboolean externalLightmaps Q_ASSIGN( qfalse );
 Q_EXTERN qboolean externalLightmapNames Q_ASSIGN( qfalse );
@@ -2465,11 +2633,13 @@ Q_EXTERN int numCulledLights;
 
 Q_EXTERN int gridBoundsCulled;
 Q_EXTERN int gridEnvelopeCulled;
+Q_EXTERN int gridIndexCulled;
 
 Q_EXTERN int lightsBoundsCulled;
 Q_EXTERN int lightsEnvelopeCulled;
 Q_EXTERN int lightsPlaneCulled;
 Q_EXTERN int lightsClusterCulled;
+Q_EXTERN int lightsIndexCulled;
 
 /* ydnar: radiosity */
 Q_EXTERN float diffuseSubdivide Q_ASSIGN( 256.0f );
@@ -2524,6 +2694,14 @@ Q_EXTERN int numLuxels Q_ASSIGN( 0 );
 Q_EXTERN int numLuxelsMapped Q_ASSIGN( 0 );
 Q_EXTERN int numLuxelsOccluded Q_ASSIGN( 0 );
 Q_EXTERN int numLuxelsIlluminated Q_ASSIGN( 0 );
+Q_EXTERN int numLuxelSubsamples Q_ASSIGN( 0 );
+Q_EXTERN int numBounceSamplesLit Q_ASSIGN( 0 );
+Q_EXTERN int numBounceSamplesCached Q_ASSIGN( 0 );
+Q_EXTERN int numRawLightmapsCached Q_ASSIGN( 0 );
+Q_EXTERN int numGridPointsCached Q_ASSIGN( 0 );
+Q_EXTERN int numLightCutBlocks Q_ASSIGN( 0 );
+Q_EXTERN double numLightCutLights Q_ASSIGN( 0 );
+Q_EXTERN double numLightCutClusters Q_ASSIGN( 0 );
 Q_EXTERN int numVertsIlluminated Q_ASSIGN( 0 );
 
 /* lightgrid */
@@ -368,7 +368,7 @@ void WriteMapShaderFile( void ){
 	/* are there any custom shaders? */
 	for ( i = 0, num = 0; i < numShaderInfo; i++ )
 	{
-		if ( shaderInfo[ i ].custom ) {
+		if ( shaderInfo[ i ]->custom ) {
 			break;
 		}
 	}
@@ -398,7 +398,7 @@ void WriteMapShaderFile( void ){
 	for ( i = 0, num = 0; i < numShaderInfo; i++ )
 	{
 		/* get the shader and print it */
-		si = &shaderInfo[ i ];
+		si = shaderInfo[ i ];
 		if ( si->custom == qfalse || si->shaderText == NULL || si->shaderText[ 0 ] == '\0' ) {
 			continue;
 		}
@@ -617,6 +617,20 @@ void EmitVertexRemapShader( char *from, char *to ){
 
 
 
+static int maxShaderInfo = 0;
+static nameIndex_t shaderInfoIndex;
+
+/*
+   IndexShaderInfo()
+   makes the most recently allocated shader findable under its name
+ */
+
+static void IndexShaderInfo( void ){
+	AddNameIndexEntry( &shaderInfoIndex, numShaderInfo - 1, shaderInfo[ numShaderInfo - 1 ]->shader );
+}
+
+
+
 /*
    AllocShaderInfo()
    allocates and initializes a new shader
@@ -626,17 +640,10 @@ static shaderInfo_t *AllocShaderInfo( void ){
 	shaderInfo_t    *si;
 
 
-	/* allocate? */
-	if ( shaderInfo == NULL ) {
-		shaderInfo = safe_malloc( sizeof( shaderInfo_t ) * MAX_SHADER_INFO );
-		numShaderInfo = 0;
-	}
-
-	/* bounds check */
-	if ( numShaderInfo == MAX_SHADER_INFO ) {
-		Error( "MAX_SHADER_INFO exceeded. Remove some PK3 files or shader scripts from shaderlist.txt and try again." );
-	}
-	si = &shaderInfo[ numShaderInfo ];
+	/* allocate (shaders are referenced by pointer, so only the list of them can move) */
+	AUTOEXPAND_BY_REALLOC( shaderInfo, numShaderInfo, maxShaderInfo, 1024 );
+	si = safe_malloc( sizeof( shaderInfo_t ) );
+	shaderInfo[ numShaderInfo ] = si;
 	numShaderInfo++;
 
 	/* ydnar: clear to 0 first */
@@ -854,9 +861,10 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName ){
 
 	/* search for it */
 	deprecationDepth = 0;
-	for ( i = 0; i < numShaderInfo; i++ )
+	i = FirstNameIndexEntry( &shaderInfoIndex, shader );
+	while ( i >= 0 )
 	{
-		si = &shaderInfo[ i ];
+		si = shaderInfo[ i ];
 		if ( !Q_stricmp( shader, si->shader ) ) {
 			/* check if shader is deprecated */
 			if ( deprecationDepth < MAX_SHADER_DEPRECATION_DEPTH && si->deprecateShader && si->deprecateShader[ 0 ] ) {
@@ -869,7 +877,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName ){
 					Sys_FPrintf( SYS_WRN, "WARNING: Max deprecation depth of %i is reached on shader '%s'\n", MAX_SHADER_DEPRECATION_DEPTH, shader );
 				}
 				/* search again from beginning */
-				i = -1;
+				i = FirstNameIndexEntry( &shaderInfoIndex, shader );
 				continue;
 			}
 
@@ -882,11 +890,13 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName ){
 			/* return it */
 			return si;
 		}
+		i = NextNameIndexEntry( &shaderInfoIndex, i );
 	}
 
 	/* allocate a default shader */
 	si = AllocShaderInfo();
 	strcpy( si->shader, shader );
+	IndexShaderInfo();
 	LoadShaderImages( si );
 	FinishShader( si );
 
@@ -1012,6 +1022,7 @@ static void ParseShaderFile( const char *filename ){
 		if ( suffix != NULL ) {
 			*suffix = '\0';
 		}
+		IndexShaderInfo();
 
 		/* handle { } section */
 		if ( !GetTokenAppend( shaderText, qtrue ) ) {
@@ -49,16 +49,25 @@
 #define GROW_META_VERTS     1024
 #define GROW_META_TRIANGLES 1024
 
+#define META_VERT_HASHES        65536
+#define META_TRIANGLE_HASHES    65536
+
 static int numMetaSurfaces, numPatchMetaSurfaces;
 
 static int maxMetaVerts = 0;
 static int numMetaVerts = 0;
 static int firstSearchMetaVert = 0;
 static bspDrawVert_t        *metaVerts = NULL;
+static int                  *metaVertHashChain = NULL;          /* next vert + 1 in the same hash bucket, 0 ends the chain */
+static int metaVertHash[ META_VERT_HASHES ];                    /* newest vert + 1 per bucket */
 
 static int maxMetaTriangles = 0;
 static int numMetaTriangles = 0;
 static metaTriangle_t       *metaTriangles = NULL;
+#ifdef USE_EXHAUSTIVE_SEARCH
+static int                  *metaTriangleHashChain = NULL;
+static int metaTriangleHash[ META_TRIANGLE_HASHES ];
+#endif
 
 
 
@@ -70,6 +79,53 @@ static metaTriangle_t       *metaTriangles = NULL;
 void ClearMetaTriangles( void ){
 	numMetaVerts = 0;
 	numMetaTriangles = 0;
+	memset( metaVertHash, 0, sizeof( metaVertHash ) );
+	#ifdef USE_EXHAUSTIVE_SEARCH
+	memset( metaTriangleHash, 0, sizeof( metaTriangleHash ) );
+	#endif
+}
+
+
+
+/*
+   HashMetaData()
+   hashes the raw bytes of a vertex or triangle, so that exactly the
+   records that memcmp() would call equal land in the same bucket
+ */
+
+static unsigned int HashMetaData( const void *data, size_t size ){
+	const byte      *b = data;
+	unsigned int hash;
+	size_t i;
+
+
+	/* fnv-1a */
+	hash = 2166136261u;
+	for ( i = 0; i < size; i++ )
+	{
+		hash ^= b[ i ];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+
+/*
+   ResizeMetaArray()
+   reallocates one of the growable meta arrays, keeping its first num entries
+ */
+
+static void *ResizeMetaArray( void *data, int num, int max, size_t size ){
+	void    *temp;
+
+
+	temp = safe_malloc( max * size );
+	if ( data != NULL ) {
+		memcpy( temp, data, num * size );
+		free( data );
+	}
+	return temp;
 }
 
 
@@ -80,32 +136,30 @@ void ClearMetaTriangles( void ){
  */
 
 static int FindMetaVertex( bspDrawVert_t *src ){
-	int i;
-	bspDrawVert_t   *v, *temp;
+	int i, hash;
 
 
-	/* try to find an existing drawvert */
-	for ( i = firstSearchMetaVert, v = &metaVerts[ i ]; i < numMetaVerts; i++, v++ )
+	/* try to find an existing drawvert (chains run newest first, so stop at the first vert older than the search window) */
+	hash = HashMetaData( src, sizeof( *src ) ) & ( META_VERT_HASHES - 1 );
+	for ( i = metaVertHash[ hash ] - 1; i >= firstSearchMetaVert; i = metaVertHashChain[ i ] - 1 )
 	{
-		if ( memcmp( src, v, sizeof( bspDrawVert_t ) ) == 0 ) {
+		if ( memcmp( src, &metaVerts[ i ], sizeof( bspDrawVert_t ) ) == 0 ) {
 			return i;
 		}
 	}
 
 	/* enough space? */
 	if ( numMetaVerts >= maxMetaVerts ) {
-		/* reallocate more room */
-		maxMetaVerts += GROW_META_VERTS;
-		temp = safe_malloc( maxMetaVerts * sizeof( bspDrawVert_t ) );
-		if ( metaVerts != NULL ) {
-			memcpy( temp, metaVerts, numMetaVerts * sizeof( bspDrawVert_t ) );
-			free( metaVerts );
-		}
-		metaVerts = temp;
+		/* reallocate more room (doubling, so filling the list takes linear time) */
+		maxMetaVerts += ( maxMetaVerts > GROW_META_VERTS ? maxMetaVerts : GROW_META_VERTS );
+		metaVerts = ResizeMetaArray( metaVerts, numMetaVerts, maxMetaVerts, sizeof( *metaVerts ) );
+		metaVertHashChain = ResizeMetaArray( metaVertHashChain, numMetaVerts, maxMetaVerts, sizeof( *metaVertHashChain ) );
 	}
 
 	/* add the triangle */
 	memcpy( &metaVerts[ numMetaVerts ], src, sizeof( bspDrawVert_t ) );
+	metaVertHashChain[ numMetaVerts ] = metaVertHash[ hash ];
+	metaVertHash[ hash ] = numMetaVerts + 1;
 	numMetaVerts++;
 
 	/* return the count */
@@ -120,19 +174,14 @@ static int FindMetaVertex( bspDrawVert_t *src ){
  */
 
 static int AddMetaTriangle( void ){
-	metaTriangle_t  *temp;
-
-
 	/* enough space? */
 	if ( numMetaTriangles >= maxMetaTriangles ) {
-		/* reallocate more room */
-		maxMetaTriangles += GROW_META_TRIANGLES;
-		temp = safe_malloc( maxMetaTriangles * sizeof( metaTriangle_t ) );
-		if ( metaTriangles != NULL ) {
-			memcpy( temp, metaTriangles, numMetaTriangles * sizeof( metaTriangle_t ) );
-			free( metaTriangles );
-		}
-		metaTriangles = temp;
+		/* reallocate more room (doubling, so filling the list takes linear time) */
+		maxMetaTriangles += ( maxMetaTriangles > GROW_META_TRIANGLES ? maxMetaTriangles : GROW_META_TRIANGLES );
+		metaTriangles = ResizeMetaArray( metaTriangles, numMetaTriangles, maxMetaTriangles, sizeof( *metaTriangles ) );
+		#ifdef USE_EXHAUSTIVE_SEARCH
+		metaTriangleHashChain = ResizeMetaArray( metaTriangleHashChain, numMetaTriangles, maxMetaTriangles, sizeof( *metaTriangleHashChain ) );
+		#endif
 	}
 
 	/* increment and return */
@@ -151,6 +200,9 @@ static int AddMetaTriangle( void ){
 int FindMetaTriangle( metaTriangle_t *src, bspDrawVert_t *a, bspDrawVert_t *b, bspDrawVert_t *c, int planeNum ){
 	int triIndex;
 	vec3_t dir;
+	#ifdef USE_EXHAUSTIVE_SEARCH
+	int i, hash;
+	#endif
 
 
 
@@ -216,16 +268,11 @@ int FindMetaTriangle( metaTriangle_t *src, bspDrawVert_t *a, bspDrawVert_t *b, b
 
 	/* try to find an existing triangle */
 	#ifdef USE_EXHAUSTIVE_SEARCH
+	hash = HashMetaData( src, sizeof( *src ) ) & ( META_TRIANGLE_HASHES - 1 );
+	for ( i = metaTriangleHash[ hash ] - 1; i >= 0; i = metaTriangleHashChain[ i ] - 1 )
 	{
-		int i;
-		metaTriangle_t  *tri;
-
-
-		for ( i = 0, tri = metaTriangles; i < numMetaTriangles; i++, tri++ )
-		{
-			if ( memcmp( src, tri, sizeof( metaTriangle_t ) ) == 0 ) {
-				return i;
-			}
+		if ( memcmp( src, &metaTriangles[ i ], sizeof( metaTriangle_t ) ) == 0 ) {
+			return i;
 		}
 	}
 	#endif
@@ -235,6 +282,10 @@ int FindMetaTriangle( metaTriangle_t *src, bspDrawVert_t *a, bspDrawVert_t *b, b
 
 	/* add the triangle */
 	memcpy( &metaTriangles[ triIndex ], src, sizeof( metaTriangle_t ) );
+	#ifdef USE_EXHAUSTIVE_SEARCH
+	metaTriangleHashChain[ triIndex ] = metaTriangleHash[ hash ];
+	metaTriangleHash[ hash ] = triIndex + 1;
+	#endif
 
 	/* return the triangle index */
 	return triIndex;
@@ -1180,6 +1231,144 @@ void FixMetaTJunctions( void ){
 
 
 
+/*
+   coincident vertex hash
+   buckets the meta verts into small grid cells, so SmoothMetaTriangles() only has
+   to compare a vertex against the verts in the cells within EQUAL_EPSILON of it
+   instead of against every later vertex in the list
+ */
+
+#define SMOOTH_CELL_SIZE        1.0f
+#define SMOOTH_CELL_MARGIN      ( 2.0f * EQUAL_EPSILON )
+#define SMOOTH_MAX_COORD        1.0e9f
+
+static int smoothHashSize;
+static int                  *smoothHash;                        /* first vert + 1 per bucket */
+static int                  *smoothChain;                       /* next vert + 1 in the same bucket, in ascending order */
+static int ( *smoothCells )[ 3 ];
+static int numSmoothOddVerts;
+static int                  *smoothOddVerts;                    /* verts too far out (or not a number) to be bucketed */
+
+static qboolean SmoothVertInRange( const vec3_t xyz ){
+	/* written so that nans fail too */
+	return ( fabs( xyz[ 0 ] ) < SMOOTH_MAX_COORD && fabs( xyz[ 1 ] ) < SMOOTH_MAX_COORD && fabs( xyz[ 2 ] ) < SMOOTH_MAX_COORD );
+}
+
+static void SmoothVertCell( const vec3_t xyz, float offset, int cell[ 3 ] ){
+	cell[ 0 ] = (int) floor( ( xyz[ 0 ] + offset ) / SMOOTH_CELL_SIZE );
+	cell[ 1 ] = (int) floor( ( xyz[ 1 ] + offset ) / SMOOTH_CELL_SIZE );
+	cell[ 2 ] = (int) floor( ( xyz[ 2 ] + offset ) / SMOOTH_CELL_SIZE );
+}
+
+static int SmoothCellHash( const int cell[ 3 ] ){
+	return (int) ( ( (unsigned int) cell[ 0 ] * 73856093u ^ (unsigned int) cell[ 1 ] * 19349663u ^ (unsigned int) cell[ 2 ] * 83492791u ) & ( smoothHashSize - 1 ) );
+}
+
+static int CompareVertNums( const void *a, const void *b ){
+	return *( (const int*) a ) - *( (const int*) b );
+}
+
+static void BuildSmoothHash( void ){
+	int i, hash;
+
+
+	/* allocate */
+	smoothHashSize = 1;
+	while ( smoothHashSize < numMetaVerts )
+		smoothHashSize <<= 1;
+	smoothHash = safe_malloc0( smoothHashSize * sizeof( *smoothHash ) );
+	smoothChain = safe_malloc( ( numMetaVerts + 1 ) * sizeof( *smoothChain ) );
+	smoothCells = safe_malloc( ( numMetaVerts + 1 ) * sizeof( *smoothCells ) );
+	smoothOddVerts = safe_malloc( ( numMetaVerts + 1 ) * sizeof( *smoothOddVerts ) );
+	numSmoothOddVerts = 0;
+
+	/* walk the verts backwards so the chains come out in ascending order */
+	for ( i = numMetaVerts - 1; i >= 0; i-- )
+	{
+		if ( !SmoothVertInRange( metaVerts[ i ].xyz ) ) {
+			smoothChain[ i ] = 0;
+			continue;
+		}
+		SmoothVertCell( metaVerts[ i ].xyz, 0.0f, smoothCells[ i ] );
+		hash = SmoothCellHash( smoothCells[ i ] );
+		smoothChain[ i ] = smoothHash[ hash ];
+		smoothHash[ hash ] = i + 1;
+	}
+	for ( i = 0; i < numMetaVerts; i++ )
+	{
+		if ( !SmoothVertInRange( metaVerts[ i ].xyz ) ) {
+			smoothOddVerts[ numSmoothOddVerts++ ] = i;
+		}
+	}
+}
+
+static void FreeSmoothHash( void ){
+	free( smoothHash );
+	free( smoothChain );
+	free( smoothCells );
+	free( smoothOddVerts );
+}
+
+/*
+   FindCoincidentMetaVerts()
+   stores every vert numbered num or higher that may be coincident with vert num in
+   candidates, in ascending order; the caller still has to VectorCompare() them
+ */
+
+static int FindCoincidentMetaVerts( int num, int **candidates, int *maxCandidates ){
+	int i, j, hash, numCandidates, cell[ 3 ], mins[ 3 ], maxs[ 3 ];
+
+
+	/* make sure the worst case fits */
+	if ( *maxCandidates < numMetaVerts ) {
+		free( *candidates );
+		*maxCandidates = numMetaVerts;
+		*candidates = safe_malloc( ( *maxCandidates + 1 ) * sizeof( **candidates ) );
+	}
+
+	/* verts that can't be bucketed have to be checked against everything */
+	numCandidates = 0;
+	if ( !SmoothVertInRange( metaVerts[ num ].xyz ) ) {
+		for ( j = num; j < numMetaVerts; j++ )
+			( *candidates )[ numCandidates++ ] = j;
+		return numCandidates;
+	}
+
+	/* gather the cells that may hold coincident verts */
+	SmoothVertCell( metaVerts[ num ].xyz, -SMOOTH_CELL_MARGIN, mins );
+	SmoothVertCell( metaVerts[ num ].xyz, SMOOTH_CELL_MARGIN, maxs );
+	for ( cell[ 0 ] = mins[ 0 ]; cell[ 0 ] <= maxs[ 0 ]; cell[ 0 ]++ )
+	{
+		for ( cell[ 1 ] = mins[ 1 ]; cell[ 1 ] <= maxs[ 1 ]; cell[ 1 ]++ )
+		{
+			for ( cell[ 2 ] = mins[ 2 ]; cell[ 2 ] <= maxs[ 2 ]; cell[ 2 ]++ )
+			{
+				hash = SmoothCellHash( cell );
+				for ( j = smoothHash[ hash ] - 1; j >= 0; j = smoothChain[ j ] - 1 )
+				{
+					if ( j >= num && smoothCells[ j ][ 0 ] == cell[ 0 ] && smoothCells[ j ][ 1 ] == cell[ 1 ] && smoothCells[ j ][ 2 ] == cell[ 2 ] ) {
+						( *candidates )[ numCandidates++ ] = j;
+					}
+				}
+			}
+		}
+	}
+
+	/* add the odd verts */
+	for ( i = 0; i < numSmoothOddVerts; i++ )
+	{
+		if ( smoothOddVerts[ i ] >= num ) {
+			( *candidates )[ numCandidates++ ] = smoothOddVerts[ i ];
+		}
+	}
+
+	/* keep the order of a straight walk through the list */
+	qsort( *candidates, numCandidates, sizeof( **candidates ), CompareVertNums );
+	return numCandidates;
+}
+
+
+
 /*
    SmoothMetaTriangles()
    averages coincident vertex normals in the meta triangles
@@ -1190,11 +1379,13 @@ void FixMetaTJunctions( void ){
 #define EQUAL_NORMAL_EPSILON    0.01
 
 void SmoothMetaTriangles( void ){
-	int i, j, k, f, fOld, start, cs, numVerts, numVotes, numSmoothed;
+	int i, j, k, c, f, fOld, start, cs, numVerts, numVotes, numSmoothed;
+	int numCandidates, maxCandidates;
 	float shadeAngle, defaultShadeAngle, maxShadeAngle, dot, testAngle;
 	metaTriangle_t  *tri;
 	float           *shadeAngles;
 	byte            *smoothed;
+	int             *candidates;
 	vec3_t average, diff;
 	int indexes[ MAX_SAMPLES ];
 	vec3_t votes[ MAX_SAMPLES ];
@@ -1258,6 +1449,11 @@ void SmoothMetaTriangles( void ){
 	fOld = -1;
 	start = I_FloatTime();
 
+	/* bucket the verts */
+	BuildSmoothHash();
+	candidates = NULL;
+	maxCandidates = 0;
+
 	/* go through the list of vertexes */
 	numSmoothed = 0;
 	for ( i = 0; i < numMetaVerts; i++ )
@@ -1280,8 +1476,11 @@ void SmoothMetaTriangles( void ){
 		numVotes = 0;
 
 		/* build a table of coincident vertexes */
-		for ( j = i; j < numMetaVerts && numVerts < MAX_SAMPLES; j++ )
+		numCandidates = FindCoincidentMetaVerts( i, &candidates, &maxCandidates );
+		for ( c = 0; c < numCandidates && numVerts < MAX_SAMPLES; c++ )
 		{
+			j = candidates[ c ];
+
 			/* already smoothed? */
 			if ( smoothed[ j >> 3 ] & ( 1 << ( j & 7 ) ) ) {
 				continue;
@@ -1350,6 +1549,8 @@ void SmoothMetaTriangles( void ){
 	/* free the tables */
 	free( shadeAngles );
 	free( smoothed );
+	free( candidates );
+	FreeSmoothHash();
 
 	/* print time */
 	Sys_FPrintf( SYS_VRB, " (%d)\n", (int) ( I_FloatTime() - start ) );
@@ -57,8 +57,18 @@ typedef struct edgeLine_s {
 
 	// unused element of doubly linked list
 	edgePoint_t *chain;
+
+	// axis of an axial line, -1 otherwise
+	int axis;
+	// next axial line + 1 in the same hash bucket
+	int hashChain;
 } edgeLine_t;
 
+typedef struct {
+	int lineNum;
+	int next;
+} edgeCellLink_t;
+
 typedef struct {
 	float length;
 	bspDrawVert_t   *dv[2];
@@ -83,6 +93,21 @@ int c_natural, c_rotate, c_cant;
 #define LINE_POSITION_EPSILON   0.25
 #define POINT_ON_LINE_EPSILON   0.25
 
+// edge line lookup: axial lines are hashed by their axis and their (unit
+// quantised) position on the other two axes, every other line is linked into
+// the grid cells it passes within the bounds of the edges being added
+#define EDGE_LINE_HASHES        65536
+#define EDGE_CELL_HASHES        65536
+#define EDGE_CELL_SIZE          128.0f
+#define EDGE_SEARCH_MARGIN      1.0f
+
+static int edgeLineHash[ EDGE_LINE_HASHES ];
+static int edgeCellHash[ EDGE_CELL_HASHES ];
+static edgeCellLink_t *edgeCellLinks = NULL;
+static int numEdgeCellLinks;
+static int allocatedEdgeCellLinks = 0;
+static vec3_t edgeMins, edgeMaxs;
+
 /*
    ====================
    InsertPointOnEdge
@@ -132,6 +157,229 @@ void InsertPointOnEdge( vec3_t v, edgeLine_t *e ) {
 }
 
 
+/*
+   EdgeLineAxis()
+   returns the axis of a line whose side planes only measure one coordinate each, -1 otherwise
+ */
+
+static int EdgeLineAxis( const edgeLine_t *e ){
+	int i, j, k;
+
+
+	for ( k = 0; k < 3; k++ )
+	{
+		i = ( k + 1 ) % 3;
+		j = ( k + 2 ) % 3;
+		if ( e->dir[ i ] == 0.0f && e->dir[ j ] == 0.0f &&
+			 e->normal1[ k ] == 0.0f && e->normal2[ k ] == 0.0f &&
+			 ( e->normal1[ i ] == 0.0f ) != ( e->normal1[ j ] == 0.0f ) &&
+			 ( e->normal2[ i ] == 0.0f ) != ( e->normal2[ j ] == 0.0f ) ) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+
+
+/*
+   EdgeLineHash()
+   hashes an axial line by its axis and the unit cell it crosses the other two axes in
+ */
+
+static int EdgeLineHash( int axis, int a, int b ){
+	return (int) ( ( (unsigned int) axis * 83492791u ^ (unsigned int) a * 73856093u ^ (unsigned int) b * 19349663u ) & ( EDGE_LINE_HASHES - 1 ) );
+}
+
+
+
+/*
+   EdgeCellHash()
+   hashes a grid cell holding non-axial lines
+ */
+
+static int EdgeCellHash( int x, int y, int z ){
+	return (int) ( ( (unsigned int) x * 73856093u ^ (unsigned int) y * 19349663u ^ (unsigned int) z * 83492791u ) & ( EDGE_CELL_HASHES - 1 ) );
+}
+
+
+
+/*
+   LinkEdgeLine()
+   makes a new edge line findable by FindEdgeLine()
+ */
+
+static void LinkEdgeLine( int lineNum ){
+	int i, j, x, y, z, hash, mins[ 3 ], maxs[ 3 ];
+	edgeLine_t      *e;
+	float t, t0, t1, step, lo, hi;
+	vec3_t p0, p1;
+
+
+	e = &edgeLines[ lineNum ];
+	e->axis = EdgeLineAxis( e );
+
+	/* axial lines go into the line hash */
+	if ( e->axis >= 0 ) {
+		i = ( e->axis + 1 ) % 3;
+		j = ( e->axis + 2 ) % 3;
+		hash = EdgeLineHash( e->axis, (int) floor( e->origin[ i ] ), (int) floor( e->origin[ j ] ) );
+		e->hashChain = edgeLineHash[ hash ];
+		edgeLineHash[ hash ] = lineNum + 1;
+		return;
+	}
+
+	/* clip the line to the edge bounds */
+	t0 = -1.0e30f;
+	t1 = 1.0e30f;
+	for ( i = 0; i < 3; i++ )
+	{
+		lo = edgeMins[ i ] - EDGE_SEARCH_MARGIN - e->origin[ i ];
+		hi = edgeMaxs[ i ] + EDGE_SEARCH_MARGIN - e->origin[ i ];
+		if ( e->dir[ i ] == 0.0f ) {
+			if ( lo > 0.0f || hi < 0.0f ) {
+				return;
+			}
+			continue;
+		}
+		lo /= e->dir[ i ];
+		hi /= e->dir[ i ];
+		if ( lo > hi ) {
+			t = lo;
+			lo = hi;
+			hi = t;
+		}
+		if ( lo > t0 ) {
+			t0 = lo;
+		}
+		if ( hi < t1 ) {
+			t1 = hi;
+		}
+	}
+
+	/* link the line into every cell along the clipped piece */
+	step = EDGE_CELL_SIZE * 0.5f;
+	for ( t = t0; t <= t1; t += step )
+	{
+		VectorMA( e->origin, t, e->dir, p0 );
+		VectorMA( e->origin, ( t + step < t1 ? t + step : t1 ), e->dir, p1 );
+		for ( i = 0; i < 3; i++ )
+		{
+			mins[ i ] = (int) floor( ( ( p0[ i ] < p1[ i ] ? p0[ i ] : p1[ i ] ) - EDGE_SEARCH_MARGIN ) / EDGE_CELL_SIZE );
+			maxs[ i ] = (int) floor( ( ( p0[ i ] > p1[ i ] ? p0[ i ] : p1[ i ] ) + EDGE_SEARCH_MARGIN ) / EDGE_CELL_SIZE );
+		}
+		for ( z = mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+			for ( y = mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+				for ( x = mins[ 0 ]; x <= maxs[ 0 ]; x++ )
+				{
+					/* links of this line are added in a row, so a repeat shows up at the head */
+					hash = EdgeCellHash( x, y, z );
+					if ( edgeCellHash[ hash ] > 0 && edgeCellLinks[ edgeCellHash[ hash ] - 1 ].lineNum == lineNum ) {
+						continue;
+					}
+					AUTOEXPAND_BY_REALLOC( edgeCellLinks, numEdgeCellLinks, allocatedEdgeCellLinks, 1024 );
+					edgeCellLinks[ numEdgeCellLinks ].lineNum = lineNum;
+					edgeCellLinks[ numEdgeCellLinks ].next = edgeCellHash[ hash ];
+					numEdgeCellLinks++;
+					edgeCellHash[ hash ] = numEdgeCellLinks;
+				}
+	}
+}
+
+
+
+/*
+   EdgeOnLine()
+   determines if both points of an edge lie on an edge line
+ */
+
+static qboolean EdgeOnLine( vec3_t v1, vec3_t v2, edgeLine_t *e ){
+	float d;
+
+
+	d = DotProduct( v1, e->normal1 ) - e->dist1;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+	d = DotProduct( v1, e->normal2 ) - e->dist2;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+
+	d = DotProduct( v2, e->normal1 ) - e->dist1;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+	d = DotProduct( v2, e->normal2 ) - e->dist2;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+
+/*
+   FindEdgeLine()
+   returns the lowest numbered edge line both points lie on, -1 if there is none
+ */
+
+static int FindEdgeLine( vec3_t v1, vec3_t v2 ){
+	int i, j, k, a, b, hash, link, best;
+
+
+	/* points outside the indexed bounds need a full search */
+	for ( k = 0; k < 3; k++ )
+	{
+		if ( !( v1[ k ] >= edgeMins[ k ] && v1[ k ] <= edgeMaxs[ k ] ) ) {
+			break;
+		}
+	}
+	if ( k < 3 ) {
+		for ( i = 0; i < numEdgeLines; i++ )
+		{
+			if ( EdgeOnLine( v1, v2, &edgeLines[ i ] ) ) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	/* every line through v1 is in one of the nearby buckets, keep the first one of them */
+	best = -1;
+	for ( k = 0; k < 3; k++ )
+	{
+		i = ( k + 1 ) % 3;
+		j = ( k + 2 ) % 3;
+		for ( a = (int) floor( v1[ i ] - 2.0f * POINT_ON_LINE_EPSILON ); a <= (int) floor( v1[ i ] + 2.0f * POINT_ON_LINE_EPSILON ); a++ )
+		{
+			for ( b = (int) floor( v1[ j ] - 2.0f * POINT_ON_LINE_EPSILON ); b <= (int) floor( v1[ j ] + 2.0f * POINT_ON_LINE_EPSILON ); b++ )
+			{
+				hash = EdgeLineHash( k, a, b );
+				for ( link = edgeLineHash[ hash ] - 1; link >= 0; link = edgeLines[ link ].hashChain - 1 )
+				{
+					if ( edgeLines[ link ].axis == k && ( best < 0 || link < best ) && EdgeOnLine( v1, v2, &edgeLines[ link ] ) ) {
+						best = link;
+					}
+				}
+			}
+		}
+	}
+	hash = EdgeCellHash( (int) floor( v1[ 0 ] / EDGE_CELL_SIZE ), (int) floor( v1[ 1 ] / EDGE_CELL_SIZE ), (int) floor( v1[ 2 ] / EDGE_CELL_SIZE ) );
+	for ( link = edgeCellHash[ hash ] - 1; link >= 0; link = edgeCellLinks[ link ].next - 1 )
+	{
+		i = edgeCellLinks[ link ].lineNum;
+		if ( ( best < 0 || i < best ) && EdgeOnLine( v1, v2, &edgeLines[ i ] ) ) {
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+
+
 /*
    ====================
    AddEdge
@@ -162,28 +410,10 @@ int AddEdge( vec3_t v1, vec3_t v2, qboolean createNonAxial ) {
 		}
 	}
 
-	for ( i = 0 ; i < numEdgeLines ; i++ ) {
-		e = &edgeLines[i];
-
-		d = DotProduct( v1, e->normal1 ) - e->dist1;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-		d = DotProduct( v1, e->normal2 ) - e->dist2;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-
-		d = DotProduct( v2, e->normal1 ) - e->dist1;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-		d = DotProduct( v2, e->normal2 ) - e->dist2;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-
+	i = FindEdgeLine( v1, v2 );
+	if ( i >= 0 ) {
 		// this is the edge
+		e = &edgeLines[i];
 		InsertPointOnEdge( v1, e );
 		InsertPointOnEdge( v2, e );
 		return i;
@@ -205,6 +435,8 @@ int AddEdge( vec3_t v1, vec3_t v2, qboolean createNonAxial ) {
 	e->dist1 = DotProduct( e->origin, e->normal1 );
 	e->dist2 = DotProduct( e->origin, e->normal2 );
 
+	LinkEdgeLine( numEdgeLines - 1 );
+
 	InsertPointOnEdge( v1, e );
 	InsertPointOnEdge( v2, e );
 
@@ -619,7 +851,7 @@ int EdgeCompare( const void *elem1, const void *elem2 ) {
  */
 
 void FixTJunctions( entity_t *ent ){
-	int i;
+	int i, j;
 	mapDrawSurface_t    *ds;
 	shaderInfo_t        *si;
 	int axialEdgeLines;
@@ -634,6 +866,22 @@ void FixTJunctions( entity_t *ent ){
 	Sys_FPrintf( SYS_VRB, "--- FixTJunctions ---\n" );
 	numEdgeLines = 0;
 	numOriginalEdges = 0;
+	numEdgeCellLinks = 0;
+	memset( edgeLineHash, 0, sizeof( edgeLineHash ) );
+	memset( edgeCellHash, 0, sizeof( edgeCellHash ) );
+
+	// bound the verts the edges are made of, so the non-axial lines can be clipped to it
+	ClearBounds( edgeMins, edgeMaxs );
+	for ( i = ent->firstDrawSurf ; i < numMapDrawSurfs ; i++ )
+	{
+		ds = &mapDrawSurfs[ i ];
+		si = ds->shaderInfo;
+		if ( ( si->compileFlags & C_NODRAW ) || si->autosprite || si->notjunc || ds->numVerts == 0 ) {
+			continue;
+		}
+		for ( j = 0; j < ds->numVerts; j++ )
+			AddPointToBounds( ds->verts[ j ].xyz, edgeMins, edgeMaxs );
+	}
 
 	// add all the edges
 	// this actually creates axial edges, but it
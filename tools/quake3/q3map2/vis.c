@@ -98,14 +98,72 @@ void prl( leaf_t *l ){
    =============
  */
 int PComp( const void *a, const void *b ){
-	if ( ( *(const vportal_t *const *)a )->nummightsee == ( *(const vportal_t *const *)b )->nummightsee ) {
+	if ( ( *(const vportal_t *const *)a )->cost == ( *(const vportal_t *const *)b )->cost ) {
 		return 0;
 	}
-	if ( ( *(const vportal_t *const *)a )->nummightsee < ( *(const vportal_t *const *)b )->nummightsee ) {
+	if ( ( *(const vportal_t *const *)a )->cost < ( *(const vportal_t *const *)b )->cost ) {
 		return -1;
 	}
 	return 1;
 }
+
+/*
+   EstimatePortalCosts()
+   a portal costs the chains it took to flow last time (kept in the vis cache), or its
+   squared mightsee count scaled to the measured portals when it was not flowed before
+ */
+static void EstimatePortalCosts( void ){
+	int i;
+	double measured, estimated, scale;
+	vportal_t   *p;
+
+
+	measured = estimated = 0;
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		if ( p->chains > 0 ) {
+			measured += p->chains;
+			estimated += (double) p->nummightsee * p->nummightsee;
+		}
+	}
+	scale = ( measured > 0 && estimated > 0 ) ? measured / estimated : 1;
+
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+		p->cost = p->chains > 0 ? p->chains : scale * p->nummightsee * p->nummightsee;
+}
+
+/*
+   PrintFlowStats()
+   sums up what the flow cost, for tuning the scheduling
+ */
+static void PrintFlowStats( void ){
+	int i, maxDepth;
+	double chains, clips;
+	vportal_t   *p, *costliest;
+
+
+	chains = 0;
+	clips = 0;
+	maxDepth = 0;
+	costliest = NULL;
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		chains += p->chains;
+		clips += p->clips;
+		if ( p->maxDepth > maxDepth ) {
+			maxDepth = p->maxDepth;
+		}
+		if ( costliest == NULL || p->chains > costliest->chains ) {
+			costliest = p;
+		}
+	}
+	if ( costliest == NULL || chains <= 0 ) {
+		return;
+	}
+	Sys_Printf( "%9.0f chains flowed, %d deep at most\n", chains, maxDepth );
+	Sys_Printf( "%9.0f windings clipped, %.1f per chain\n", clips, clips / chains );
+	Sys_Printf( "%9d chains on portal %d, the costliest, with %d clips\n", costliest->chains, (int)( costliest - portals ), costliest->clips );
+}
 void SortPortals( void ){
 	int i;
 
@@ -169,7 +227,7 @@ void ClusterMerge( int leafnum ){
 	leaf_t      *leaf;
 	byte portalvector[MAX_PORTALS / 8];
 	byte uncompressed[MAX_MAP_LEAFS / 8];
-	int i, j;
+	int i;
 	int numvis, mergedleafnum;
 	vportal_t   *p;
 	int pnum;
@@ -192,8 +250,7 @@ void ClusterMerge( int leafnum ){
 		if ( p->status != stat_done ) {
 			Error( "portal not done" );
 		}
-		for ( j = 0 ; j < portallongs ; j++ )
-			( (long *)portalvector )[j] |= ( (long *)p->portalvis )[j];
+		PortalBitsOr( portalvector, p->portalvis );
 		pnum = p - portals;
 		portalvector[pnum >> 3] |= 1 << ( pnum & 7 );
 	}
@@ -226,10 +283,11 @@ void CalcPortalVis( void ){
 #ifdef MREDEBUG
 	Sys_Printf( "%6d portals out of %d", 0, numportals * 2 );
 	//get rid of the counter
-	RunThreadsOnIndividual( numportals * 2, qfalse, PortalFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qfalse, PortalFlow );
 #else
-	RunThreadsOnIndividual( numportals * 2, qtrue, PortalFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qtrue, PortalFlow );
 #endif
+	PrintFlowStats();
 
 }
 
@@ -246,15 +304,16 @@ void CalcPassageVis( void ){
 	RunThreadsOnIndividual( numportals * 2, qfalse, CreatePassages );
 	_printf( "\n" );
 	_printf( "%6d portals out of %d", 0, numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qfalse, PassageFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qfalse, PassageFlow );
 	_printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
 
 	Sys_Printf( "\n--- PassageFlow (%d) ---\n", numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qtrue, PassageFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qtrue, PassageFlow );
 #endif
+	PrintFlowStats();
 }
 
 /*
@@ -270,15 +329,16 @@ void CalcPassagePortalVis( void ){
 	RunThreadsOnIndividual( numportals * 2, qfalse, CreatePassages );
 	Sys_Printf( "\n" );
 	Sys_Printf( "%6d portals out of %d", 0, numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qfalse, PassagePortalFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qfalse, PassagePortalFlow );
 	Sys_Printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
 
 	Sys_Printf( "\n--- PassagePortalFlow (%d) ---\n", numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qtrue, PassagePortalFlow );
+	RunThreadsOnIndividual( SchedulePortalFlow(), qtrue, PassagePortalFlow );
 #endif
+	PrintFlowStats();
 }
 
 /*
@@ -297,6 +357,605 @@ void CalcFastVis( void ){
 	}
 }
 
+/*
+   ==================
+   vis checkpoints
+
+   with -checkpoint every portal whose flow is done is appended to <map>.vcp as it
+   finishes, so -resume can pick up a killed run where it left off; the file starts
+   with checksums of the .prt and of the options that change the result, and it is
+   only read back if they match
+   ==================
+ */
+
+#define VIS_CHECKPOINT_IDENT        ( ( 'P' << 24 ) + ( 'C' << 16 ) + ( 'V' << 8 ) + 'Q' )
+#define VIS_CHECKPOINT_VERSION      1
+#define VIS_CHECKPOINT_DENSE        -1
+
+typedef struct visCheckpointHeader_s
+{
+	int ident, version;
+	int prtChecksum, optionsChecksum;
+	int numPortals, portalBytes;
+}
+visCheckpointHeader_t;
+
+static FILE                 *checkpointFile;
+static char checkpointPath[ 1024 ];
+static visCheckpointHeader_t checkpointHeader;
+
+
+
+/*
+   SetupVisCheckpoint()
+   names the checkpoint of a portal file and checksums the portal file
+ */
+
+static void SetupVisCheckpoint( const char *portalFilePath ){
+	int size;
+	void        *buffer;
+
+
+	if ( !strcmp( portalFilePath, "-" ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Portal file read from stdin, no vis checkpoint\n" );
+		visCheckpoint = visResume = qfalse;
+		return;
+	}
+
+	strcpy( checkpointPath, portalFilePath );
+	StripExtension( checkpointPath );
+	strcat( checkpointPath, ".vcp" );
+
+	size = LoadFile( portalFilePath, &buffer );
+	checkpointHeader.ident = LittleLong( VIS_CHECKPOINT_IDENT );
+	checkpointHeader.version = LittleLong( VIS_CHECKPOINT_VERSION );
+	checkpointHeader.prtChecksum = LittleLong( Com_BlockChecksum( buffer, size ) );
+	free( buffer );
+}
+
+
+
+/*
+   VisOptionsChecksum()
+   checksums the options that change the portals or their vis
+ */
+
+static int VisOptionsChecksum( void ){
+	int options[ 8 ];
+
+
+	memset( options, 0, sizeof( options ) );
+	options[ 0 ] = fastvis;
+	options[ 1 ] = noPassageVis;
+	options[ 2 ] = passageVisOnly;
+	options[ 3 ] = mergevis;
+	options[ 4 ] = mergevisportals;
+	options[ 5 ] = hint;
+	memcpy( &options[ 6 ], &farPlaneDist, sizeof( farPlaneDist ) );
+	options[ 7 ] = farPlaneDistMode;
+	return Com_BlockChecksum( options, sizeof( options ) );
+}
+
+
+
+/*
+   EncodeVisRecord()
+   packs a portal number and a portal bitset into a record, listing the nonzero
+   64 bit words of the bitset when that is smaller; returns the record size
+ */
+
+static int EncodeVisRecord( int portalNum, const byte *bits, int numBytes, byte *record ){
+	int i, numWords, numSet, size;
+	uint64_t w;
+
+
+	/* count the words */
+	numWords = numBytes >> 3;
+	numSet = 0;
+	for ( i = 0; i < numWords; i++ )
+	{
+		memcpy( &w, bits + ( i << 3 ), 8 );
+		numSet += ( w != 0 );
+	}
+
+	( (int*) record )[ 0 ] = LittleLong( portalNum );
+	size = 8;
+	if ( numSet * 12 >= numBytes ) {
+		( (int*) record )[ 1 ] = LittleLong( VIS_CHECKPOINT_DENSE );
+		memcpy( record + size, bits, numBytes );
+		return size + numBytes;
+	}
+
+	( (int*) record )[ 1 ] = LittleLong( numSet );
+	for ( i = 0; i < numWords; i++ )
+	{
+		memcpy( &w, bits + ( i << 3 ), 8 );
+		if ( w != 0 ) {
+			*( (int*) ( record + size ) ) = LittleLong( i );
+			memcpy( record + size + 4, &w, 8 );
+			size += 12;
+		}
+	}
+	return size;
+}
+
+
+
+/*
+   DecodeVisRecord()
+   unpacks a record into its portal number and bitset, returns the record size or 0
+   if the record is cut off or broken
+ */
+
+static int DecodeVisRecord( const byte *record, int length, int numBytes, int *portalNum, byte *bits ){
+	int i, numSet, size, wordNum;
+
+
+	if ( length < 8 ) {
+		return 0;
+	}
+	*portalNum = LittleLong( ( (const int*) record )[ 0 ] );
+	numSet = LittleLong( ( (const int*) record )[ 1 ] );
+	if ( numSet < VIS_CHECKPOINT_DENSE || numSet > ( numBytes >> 3 ) ) {
+		return 0;
+	}
+	size = 8 + ( numSet == VIS_CHECKPOINT_DENSE ? numBytes : numSet * 12 );
+	if ( size > length ) {
+		return 0;
+	}
+
+	/* unpack */
+	if ( numSet == VIS_CHECKPOINT_DENSE ) {
+		memcpy( bits, record + 8, numBytes );
+		return size;
+	}
+	memset( bits, 0, numBytes );
+	for ( i = 0; i < numSet; i++ )
+	{
+		wordNum = LittleLong( *( (const int*) ( record + 8 + i * 12 ) ) );
+		if ( wordNum < 0 || wordNum >= ( numBytes >> 3 ) ) {
+			return 0;
+		}
+		memcpy( bits + ( wordNum << 3 ), record + 8 + i * 12 + 4, 8 );
+	}
+	return size;
+}
+
+
+
+/*
+   OpenVisCheckpoint()
+   starts the checkpoint file; with -resume the portals finished by an earlier run
+   with the same portal file and options are read back first and marked done
+ */
+
+static void OpenVisCheckpoint( void ){
+	int i, size, length, offset, portalNum, numResumed;
+	byte            *buffer, *record, *bits;
+	visCheckpointHeader_t   *header;
+	vportal_t       *p;
+
+
+	checkpointHeader.optionsChecksum = LittleLong( VisOptionsChecksum() );
+	checkpointHeader.numPortals = LittleLong( numportals * 2 );
+	checkpointHeader.portalBytes = LittleLong( portalbytes );
+
+	/* read back the last run */
+	numResumed = 0;
+	if ( visResume ) {
+		buffer = NULL;
+		length = 0;
+		if ( FileExists( checkpointPath ) ) {
+			length = LoadFile( checkpointPath, (void**) &buffer );
+		}
+		header = (visCheckpointHeader_t*) buffer;
+		if ( length < (int) sizeof( *header ) ) {
+			Sys_Printf( "No vis checkpoint in %s, starting over\n", checkpointPath );
+		}
+		else if ( memcmp( header, &checkpointHeader, sizeof( *header ) ) ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: %s does not match the portal file or vis options, starting over\n", checkpointPath );
+		}
+		else
+		{
+			/* a killed run can leave a partial record at the end */
+			bits = safe_malloc( portalbytes );
+			for ( offset = sizeof( *header ); offset < length; offset += size )
+			{
+				size = DecodeVisRecord( buffer + offset, length - offset, portalbytes, &portalNum, bits );
+				if ( size == 0 || portalNum < 0 || portalNum >= numportals * 2 ) {
+					break;
+				}
+				p = &portals[ portalNum ];
+				if ( !p->removed && p->status != stat_done ) {
+					memcpy( p->portalvis, bits, portalbytes );
+					p->status = stat_done;
+					numResumed++;
+				}
+			}
+			free( bits );
+			Sys_Printf( "Resuming %d of %d portals from %s\n", numResumed, numportals * 2, checkpointPath );
+		}
+		free( buffer );
+	}
+
+	/* rewrite the file with what was read back */
+	checkpointFile = fopen( checkpointPath, "wb" );
+	if ( checkpointFile == NULL ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Could not write %s, no vis checkpoint\n", checkpointPath );
+		return;
+	}
+	fwrite( &checkpointHeader, sizeof( checkpointHeader ), 1, checkpointFile );
+	record = safe_malloc( 8 + portalbytes );
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		if ( !portals[ i ].removed && portals[ i ].status == stat_done ) {
+			fwrite( record, EncodeVisRecord( i, portals[ i ].portalvis, portalbytes, record ), 1, checkpointFile );
+		}
+	}
+	free( record );
+	fflush( checkpointFile );
+}
+
+
+
+/*
+   CheckpointPortal()
+   appends a finished portal to the checkpoint file
+ */
+
+void CheckpointPortal( vportal_t *p ){
+	int size;
+	byte        *record;
+
+
+	if ( checkpointFile == NULL ) {
+		return;
+	}
+
+	record = safe_malloc( 8 + portalbytes );
+	size = EncodeVisRecord( p - portals, p->portalvis, portalbytes, record );
+	ThreadLock();
+	fwrite( record, size, 1, checkpointFile );
+	fflush( checkpointFile );
+	ThreadUnlock();
+	free( record );
+}
+
+
+
+/*
+   CloseVisCheckpoint()
+   stops appending to the checkpoint file
+ */
+
+static void CloseVisCheckpoint( void ){
+	if ( checkpointFile != NULL ) {
+		fclose( checkpointFile );
+		checkpointFile = NULL;
+	}
+}
+
+
+
+/*
+   ==================
+   incremental vis
+
+   with -incremental the portalvis of every portal is kept in <map>.viscache next to
+   the bsp, along with a key for each portal (its winding and plane) and a hash of
+   its neighbourhood (the keys of the portals it might see and the portals of the
+   leafs they lead into) and the chains it took to flow; the next run reuses the portalvis of every portal whose key
+   and neighbourhood are unchanged, and only flows the others
+   ==================
+ */
+
+#define VIS_CACHE_IDENT         ( ( 'C' << 24 ) + ( 'P' << 16 ) + ( 'V' << 8 ) + 'Q' )
+#define VIS_CACHE_VERSION       2
+
+typedef struct visCacheHeader_s
+{
+	int ident, version;
+	int optionsChecksum;
+	int numPortals, portalBytes;
+}
+visCacheHeader_t;
+
+static char visCachePath[ 1024 ];
+static uint64_t             *portalKeys;
+static uint64_t             *portalFloodHashes;
+
+
+
+/*
+   HashVisBytes() / MixVisHash()
+   fnv-1a, and a finalizer so hashes can be summed up in any order
+ */
+
+static uint64_t HashVisBytes( uint64_t hash, const void *data, int size ){
+	int i;
+
+
+	for ( i = 0; i < size; i++ )
+	{
+		hash ^= ( (const byte*) data )[ i ];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static uint64_t MixVisHash( uint64_t hash ){
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+
+
+/*
+   HashVisPortals()
+   keys the portals and hashes their neighbourhood, needs BasePortalVis
+ */
+
+static void HashVisPortals( void ){
+	int i, j, wordNum, numWords;
+	uint64_t hash, w, *leafHashes;
+	vportal_t   *p, *q;
+
+
+	/* key the portals */
+	portalKeys = safe_malloc0( numportals * 2 * sizeof( *portalKeys ) );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		if ( p->removed ) {
+			continue;
+		}
+		hash = HashVisBytes( 0xCBF29CE484222325ULL, &p->winding->numpoints, sizeof( p->winding->numpoints ) );
+		hash = HashVisBytes( hash, p->winding->points, p->winding->numpoints * sizeof( p->winding->points[ 0 ] ) );
+		hash = HashVisBytes( hash, &p->plane, sizeof( p->plane ) );
+		portalKeys[ i ] = hash ? hash : 1;
+	}
+
+	/* hash the portals leading out of each leaf */
+	leafHashes = safe_malloc0( portalclusters * sizeof( *leafHashes ) );
+	for ( i = 0; i < portalclusters; i++ )
+	{
+		for ( j = 0; j < leafs[ i ].numportals; j++ )
+		{
+			q = leafs[ i ].portals[ j ];
+			if ( !q->removed ) {
+				leafHashes[ i ] += MixVisHash( portalKeys[ q - portals ] );
+			}
+		}
+	}
+
+	/* hash the neighbourhood */
+	portalFloodHashes = safe_malloc0( numportals * 2 * sizeof( *portalFloodHashes ) );
+	numWords = portalbytes >> 3;
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		if ( p->removed ) {
+			continue;
+		}
+		hash = MixVisHash( portalKeys[ i ] ^ MixVisHash( leafHashes[ p->leaf ] ) );
+		for ( wordNum = 0; wordNum < numWords; wordNum++ )
+		{
+			memcpy( &w, p->portalflood + ( wordNum << 3 ), 8 );
+			for ( ; w != 0; w &= w - 1 )
+			{
+				q = &portals[ ( wordNum << 6 ) + __builtin_ctzll( w ) ];
+				hash += MixVisHash( portalKeys[ q - portals ] + MixVisHash( leafHashes[ q->leaf ] ) );
+			}
+		}
+		portalFloodHashes[ i ] = hash;
+	}
+	free( leafHashes );
+}
+
+
+
+/*
+   ReuseVisCache()
+   marks the portals whose portalvis can be taken from the vis cache done
+ */
+
+static void ReuseVisCache( void ){
+	int i, j, b, size, length, offset, numOld, oldBytes, numReused, hashSize, portalNum;
+	int             *table, *oldToNew, *newToOld;
+	byte            *buffer, *bits;
+	uint64_t        *oldKeys, *oldFloodHashes;
+	const int       *oldChains;
+	uint64_t w;
+	visCacheHeader_t    *header;
+	vportal_t       *p;
+
+
+	/* load it */
+	if ( !FileExists( visCachePath ) ) {
+		Sys_Printf( "No vis cache in %s, computing all portals\n", visCachePath );
+		return;
+	}
+	length = LoadFile( visCachePath, (void**) &buffer );
+	header = (visCacheHeader_t*) buffer;
+	numOld = length >= (int) sizeof( *header ) ? LittleLong( header->numPortals ) : 0;
+	oldBytes = length >= (int) sizeof( *header ) ? LittleLong( header->portalBytes ) : 0;
+	if ( length < (int) sizeof( *header ) ||
+		 LittleLong( header->ident ) != VIS_CACHE_IDENT ||
+		 LittleLong( header->version ) != VIS_CACHE_VERSION ||
+		 LittleLong( header->optionsChecksum ) != VisOptionsChecksum() ||
+		 numOld < 0 || numOld > MAX_PORTALS * 2 || oldBytes != ( ( numOld + 63 ) & ~63 ) >> 3 ||
+		 length < (int) sizeof( *header ) + numOld * 20 ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s is from other vis options or broken, computing all portals\n", visCachePath );
+		free( buffer );
+		return;
+	}
+	oldKeys = (uint64_t*) ( buffer + sizeof( *header ) );
+	oldFloodHashes = oldKeys + numOld;
+	oldChains = (const int*) ( oldFloodHashes + numOld );
+	for ( i = 0; i < numOld * 2; i++ )
+		oldKeys[ i ] = LittleLong64( oldKeys[ i ] );
+
+	/* hash the new keys, portals sharing a key are never matched */
+	newToOld = safe_malloc( numportals * 2 * sizeof( *newToOld ) );
+	for ( hashSize = 64; hashSize < numportals * 4; hashSize <<= 1 ) ;
+	table = safe_malloc( hashSize * sizeof( *table ) );
+	memset( table, -1, hashSize * sizeof( *table ) );
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		newToOld[ i ] = -1;
+		if ( portalKeys[ i ] == 0 ) {
+			continue;
+		}
+		for ( j = portalKeys[ i ] & ( hashSize - 1 ); table[ j ] >= 0; j = ( j + 1 ) & ( hashSize - 1 ) )
+		{
+			if ( portalKeys[ table[ j ] ] == portalKeys[ i ] ) {
+				newToOld[ table[ j ] ] = newToOld[ i ] = -2;
+				break;
+			}
+		}
+		if ( table[ j ] < 0 ) {
+			table[ j ] = i;
+		}
+	}
+
+	/* match the old portals */
+	oldToNew = safe_malloc( ( numOld + 1 ) * sizeof( *oldToNew ) );
+	for ( i = 0; i < numOld; i++ )
+	{
+		oldToNew[ i ] = -1;
+		if ( oldKeys[ i ] == 0 ) {
+			continue;
+		}
+		for ( j = oldKeys[ i ] & ( hashSize - 1 ); table[ j ] >= 0; j = ( j + 1 ) & ( hashSize - 1 ) )
+		{
+			if ( portalKeys[ table[ j ] ] == oldKeys[ i ] ) {
+				break;
+			}
+		}
+		if ( table[ j ] < 0 || newToOld[ table[ j ] ] == -2 ) {
+			continue;
+		}
+		oldToNew[ i ] = table[ j ];
+		newToOld[ table[ j ] ] = ( newToOld[ table[ j ] ] == -1 ? i : -2 );
+	}
+
+	/* the chains a portal took last time are the best guess for this time */
+	for ( i = 0; i < numOld; i++ )
+	{
+		if ( oldToNew[ i ] >= 0 && newToOld[ oldToNew[ i ] ] == i ) {
+			portals[ oldToNew[ i ] ].chains = LittleLong( oldChains[ i ] );
+		}
+	}
+
+	/* take the portalvis of the portals with an unchanged neighbourhood */
+	numReused = 0;
+	bits = safe_malloc( oldBytes + 8 );
+	for ( offset = sizeof( *header ) + numOld * 20; offset < length; offset += size )
+	{
+		size = DecodeVisRecord( buffer + offset, length - offset, oldBytes, &portalNum, bits );
+		if ( size == 0 || portalNum < 0 || portalNum >= numOld ) {
+			break;
+		}
+		i = oldToNew[ portalNum ];
+		if ( i < 0 || newToOld[ i ] != portalNum || portalFloodHashes[ i ] != oldFloodHashes[ portalNum ] ) {
+			continue;
+		}
+		p = &portals[ i ];
+		if ( p->removed || p->status == stat_done ) {
+			continue;
+		}
+
+		/* renumber the bits */
+		for ( j = 0; j < ( oldBytes >> 3 ); j++ )
+		{
+			memcpy( &w, bits + ( j << 3 ), 8 );
+			for ( ; w != 0; w &= w - 1 )
+			{
+				b = ( j << 6 ) + __builtin_ctzll( w );
+				if ( b >= numOld || oldToNew[ b ] < 0 || newToOld[ oldToNew[ b ] ] != b ) {
+					break;
+				}
+				p->portalvis[ oldToNew[ b ] >> 3 ] |= 1 << ( oldToNew[ b ] & 7 );
+			}
+			if ( w != 0 ) {
+				break;
+			}
+		}
+		if ( j < ( oldBytes >> 3 ) ) {
+			memset( p->portalvis, 0, portalbytes );
+			continue;
+		}
+		p->status = stat_done;
+		numReused++;
+	}
+	Sys_Printf( "Reusing %d of %d portals from %s\n", numReused, numportals * 2, visCachePath );
+
+	free( bits );
+	free( oldToNew );
+	free( table );
+	free( newToOld );
+	free( buffer );
+}
+
+
+
+/*
+   WriteVisCache()
+   saves the portalvis of all portals for the next -incremental run
+ */
+
+static void WriteVisCache( void ){
+	int i, chains;
+	uint64_t key;
+	byte                *record;
+	visCacheHeader_t header;
+	FILE                *f;
+
+
+	f = fopen( visCachePath, "wb" );
+	if ( f == NULL ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Could not write %s\n", visCachePath );
+		return;
+	}
+	Sys_Printf( "Writing %s\n", visCachePath );
+
+	header.ident = LittleLong( VIS_CACHE_IDENT );
+	header.version = LittleLong( VIS_CACHE_VERSION );
+	header.optionsChecksum = LittleLong( VisOptionsChecksum() );
+	header.numPortals = LittleLong( numportals * 2 );
+	header.portalBytes = LittleLong( portalbytes );
+	fwrite( &header, sizeof( header ), 1, f );
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		key = LittleLong64( portalKeys[ i ] );
+		fwrite( &key, sizeof( key ), 1, f );
+	}
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		key = LittleLong64( portalFloodHashes[ i ] );
+		fwrite( &key, sizeof( key ), 1, f );
+	}
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		chains = LittleLong( portals[ i ].chains );
+		fwrite( &chains, sizeof( chains ), 1, f );
+	}
+
+	record = safe_malloc( 8 + portalbytes );
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		if ( !portals[ i ].removed && portals[ i ].status == stat_done ) {
+			fwrite( record, EncodeVisRecord( i, portals[ i ].portalvis, portalbytes, record ), 1, f );
+		}
+	}
+	free( record );
+	fclose( f );
+}
+
+
+
 /*
    ==================
    CalcVis
@@ -341,10 +1000,26 @@ void CalcVis( void ){
 	Sys_Printf( "\n--- BasePortalVis (%d) ---\n", numportals * 2 );
 	RunThreadsOnIndividual( numportals * 2, qtrue, BasePortalVis );
 
+	/* time the portal bit kernels on this map instead */
+	if ( benchPortalBits ) {
+		BenchPortalBits();
+		return;
+	}
+
 //	RunThreadsOnIndividual (numportals*2, qtrue, BetterPortalVis);
 
+	if ( visIncremental && !fastvis ) {
+		HashVisPortals();
+		ReuseVisCache();
+	}
+
+	EstimatePortalCosts();
 	SortPortals();
 
+	if ( visCheckpoint && !fastvis ) {
+		OpenVisCheckpoint();
+	}
+
 	if ( fastvis ) {
 		CalcFastVis();
 	}
@@ -357,6 +1032,8 @@ void CalcVis( void ){
 	else {
 		CalcPassagePortalVis();
 	}
+
+	CloseVisCheckpoint();
 	//
 	// assemble the leaf vis lists by oring and compressing the portal lists
 	//
@@ -1169,6 +1846,29 @@ int VisMain( int argc, char **argv ){
 			argv[ i ] = NULL;
 			Sys_Printf( "Use %s as portal file\n", portalFilePath );
 		}
+		else if ( !strcmp( argv[ i ], "-bitkernels" ) ) {
+			portalBitKernels = argv[ i + 1 ];
+			argv[ i ] = NULL;
+			i++;
+			argv[ i ] = NULL;
+		}
+		else if ( !strcmp( argv[ i ], "-checkpoint" ) ) {
+			Sys_Printf( "checkpoint = true\n" );
+			visCheckpoint = qtrue;
+		}
+		else if ( !strcmp( argv[ i ], "-resume" ) ) {
+			Sys_Printf( "resume = true\n" );
+			visCheckpoint = qtrue;
+			visResume = qtrue;
+		}
+		else if ( !strcmp( argv[ i ], "-incremental" ) ) {
+			Sys_Printf( "incremental = true\n" );
+			visIncremental = qtrue;
+		}
+		else if ( !strcmp( argv[ i ], "-benchbits" ) ) {
+			Sys_Printf( "benchbits = true\n" );
+			benchPortalBits = qtrue;
+		}
 
 		else{
 			Sys_FPrintf( SYS_WRN, "WARNING: Unknown option \"%s\"\n", argv[ i ] );
@@ -1180,6 +1880,9 @@ int VisMain( int argc, char **argv ){
 	}
 
 
+	/* pick the portal bit kernels */
+	SetupPortalBits( portalBitKernels );
+
 	/* load the bsp */
 	sprintf( source, "%s%s", inbase, ExpandArg( argv[ i ] ) );
 	StripExtension( source );
@@ -1187,6 +1890,11 @@ int VisMain( int argc, char **argv ){
 	Sys_Printf( "Loading %s\n", source );
 	LoadBSPFile( source );
 
+	/* the vis cache lives next to the bsp */
+	strcpy( visCachePath, source );
+	StripExtension( visCachePath );
+	strcat( visCachePath, ".viscache" );
+
 	if ( game->texFile )
 	{
 		// smokinguns-like tex file
@@ -1205,6 +1913,9 @@ int VisMain( int argc, char **argv ){
 	}
 	Sys_Printf( "Loading %s\n", portalFilePath );
 	LoadPortals( portalFilePath );
+	if ( visCheckpoint ) {
+		SetupVisCheckpoint( portalFilePath );
+	}
 
 	/* ydnar: exit if no portals, hence no vis */
 	if ( numportals == 0 ) {
@@ -1233,6 +1944,9 @@ int VisMain( int argc, char **argv ){
 	Sys_Printf( "visdatasize:%i\n", numBSPVisBytes );
 
 	CalcVis();
+	if ( benchPortalBits ) {
+		return 0;
+	}
 
 	/* delete the prt file */
 	if ( !saveprt ) {
@@ -1251,5 +1965,15 @@ int VisMain( int argc, char **argv ){
 	Sys_Printf( "Writing %s\n", source );
 	WriteBSPFile( source );
 
+	/* the checkpoint is in the bsp now */
+	if ( visCheckpoint ) {
+		remove( checkpointPath );
+	}
+
+	/* keep the vis around for the next run */
+	if ( visIncremental && !fastvis ) {
+		WriteVisCache();
+	}
+
 	return 0;
 }
@@ -0,0 +1,749 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+
+/* marker */
+#define VISBITS_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+#include <time.h>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+	#include <immintrin.h>
+	#define PORTAL_BITS_X86     1
+#else
+	#define PORTAL_BITS_X86     0
+#endif
+
+
+
+/*
+   portal bit kernels
+   the portal bitsets are combined and counted through one of these sets of kernels,
+   picked at startup by what the cpu supports (or by -bitkernels); all of them take
+   any length and unaligned bitsets and produce the same bits
+ */
+
+typedef struct portalBits_s
+{
+	const char  *name;
+	qboolean ( *supported )( void );
+	qboolean ( *bitsAnd )( byte *out, const byte *a, const byte *b, const byte *seen, int numBytes );
+	qboolean ( *bitsAnd3 )( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen, int numBytes );
+	void ( *bitsOr )( byte *out, const byte *a, int numBytes );
+	int ( *bitsCount )( const byte *bits, int numBytes );
+}
+portalBits_t;
+
+
+
+/* -------------------------------------------------------------------------------
+
+   scalar
+
+   ------------------------------------------------------------------------------- */
+
+static qboolean PortalBitsSupportedScalar( void ){
+	return qtrue;
+}
+
+static qboolean PortalBitsAndScalar( byte *out, const byte *a, const byte *b, const byte *seen, int numBytes ){
+	int i;
+	uint64_t wa, wb, ws, more;
+
+
+	more = 0;
+	for ( i = 0; i + 8 <= numBytes; i += 8 )
+	{
+		memcpy( &wa, a + i, 8 );
+		memcpy( &wb, b + i, 8 );
+		memcpy( &ws, seen + i, 8 );
+		wa &= wb;
+		memcpy( out + i, &wa, 8 );
+		more |= wa & ~ws;
+	}
+	for ( ; i < numBytes; i++ )
+	{
+		out[ i ] = a[ i ] & b[ i ];
+		more |= out[ i ] & ~seen[ i ];
+	}
+	return more != 0;
+}
+
+static qboolean PortalBitsAnd3Scalar( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen, int numBytes ){
+	int i;
+	uint64_t wa, wb, wc, ws, more;
+
+
+	more = 0;
+	for ( i = 0; i + 8 <= numBytes; i += 8 )
+	{
+		memcpy( &wa, a + i, 8 );
+		memcpy( &wb, b + i, 8 );
+		memcpy( &wc, c + i, 8 );
+		memcpy( &ws, seen + i, 8 );
+		wa &= wb & wc;
+		memcpy( out + i, &wa, 8 );
+		more |= wa & ~ws;
+	}
+	for ( ; i < numBytes; i++ )
+	{
+		out[ i ] = a[ i ] & b[ i ] & c[ i ];
+		more |= out[ i ] & ~seen[ i ];
+	}
+	return more != 0;
+}
+
+static void PortalBitsOrScalar( byte *out, const byte *a, int numBytes ){
+	int i;
+	uint64_t wo, wa;
+
+
+	for ( i = 0; i + 8 <= numBytes; i += 8 )
+	{
+		memcpy( &wo, out + i, 8 );
+		memcpy( &wa, a + i, 8 );
+		wo |= wa;
+		memcpy( out + i, &wo, 8 );
+	}
+	for ( ; i < numBytes; i++ )
+		out[ i ] |= a[ i ];
+}
+
+static int PortalBitsCountScalar( const byte *bits, int numBytes ){
+	int i, c;
+	uint64_t w;
+
+
+	c = 0;
+	for ( i = 0; i + 8 <= numBytes; i += 8 )
+	{
+		memcpy( &w, bits + i, 8 );
+		w = w - ( ( w >> 1 ) & 0x5555555555555555ULL );
+		w = ( w & 0x3333333333333333ULL ) + ( ( w >> 2 ) & 0x3333333333333333ULL );
+		w = ( w + ( w >> 4 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+		c += (int) ( ( w * 0x0101010101010101ULL ) >> 56 );
+	}
+	for ( ; i < numBytes; i++ )
+	{
+		for ( w = bits[ i ]; w; w &= w - 1 )
+			c++;
+	}
+	return c;
+}
+
+static const portalBits_t portalBitsScalar =
+{
+	"scalar",
+	PortalBitsSupportedScalar,
+	PortalBitsAndScalar,
+	PortalBitsAnd3Scalar,
+	PortalBitsOrScalar,
+	PortalBitsCountScalar
+};
+
+
+
+#if PORTAL_BITS_X86
+
+/* -------------------------------------------------------------------------------
+
+   sse2
+
+   ------------------------------------------------------------------------------- */
+
+static qboolean PortalBitsSupportedSSE2( void ){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "sse2" ) ? qtrue : qfalse;
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static qboolean PortalBitsAndSSE2( byte *out, const byte *a, const byte *b, const byte *seen, int numBytes ){
+	int i;
+	__m128i m, more;
+
+
+	more = _mm_setzero_si128();
+	for ( i = 0; i + 16 <= numBytes; i += 16 )
+	{
+		m = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( a + i ) ), _mm_loadu_si128( (const __m128i*) ( b + i ) ) );
+		_mm_storeu_si128( (__m128i*) ( out + i ), m );
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i*) ( seen + i ) ), m ) );
+	}
+	return PortalBitsAndScalar( out + i, a + i, b + i, seen + i, numBytes - i )
+		   | ( _mm_movemask_epi8( _mm_cmpeq_epi8( more, _mm_setzero_si128() ) ) != 0xFFFF );
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static qboolean PortalBitsAnd3SSE2( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen, int numBytes ){
+	int i;
+	__m128i m, more;
+
+
+	more = _mm_setzero_si128();
+	for ( i = 0; i + 16 <= numBytes; i += 16 )
+	{
+		m = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( a + i ) ), _mm_loadu_si128( (const __m128i*) ( b + i ) ) );
+		m = _mm_and_si128( m, _mm_loadu_si128( (const __m128i*) ( c + i ) ) );
+		_mm_storeu_si128( (__m128i*) ( out + i ), m );
+		more = _mm_or_si128( more, _mm_andnot_si128( _mm_loadu_si128( (const __m128i*) ( seen + i ) ), m ) );
+	}
+	return PortalBitsAnd3Scalar( out + i, a + i, b + i, c + i, seen + i, numBytes - i )
+		   | ( _mm_movemask_epi8( _mm_cmpeq_epi8( more, _mm_setzero_si128() ) ) != 0xFFFF );
+}
+
+__attribute__( ( target( "sse2" ) ) )
+static void PortalBitsOrSSE2( byte *out, const byte *a, int numBytes ){
+	int i;
+
+
+	for ( i = 0; i + 16 <= numBytes; i += 16 )
+		_mm_storeu_si128( (__m128i*) ( out + i ), _mm_or_si128( _mm_loadu_si128( (const __m128i*) ( out + i ) ), _mm_loadu_si128( (const __m128i*) ( a + i ) ) ) );
+	PortalBitsOrScalar( out + i, a + i, numBytes - i );
+}
+
+/* sse2 has no popcnt and no byte shuffle, so the bits are summed up in registers and the bytes with psadbw */
+__attribute__( ( target( "sse2" ) ) )
+static int PortalBitsCountSSE2( const byte *bits, int numBytes ){
+	int i;
+	__m128i v, sum;
+	const __m128i m1 = _mm_set1_epi8( 0x55 ), m2 = _mm_set1_epi8( 0x33 ), m4 = _mm_set1_epi8( 0x0F );
+
+
+	sum = _mm_setzero_si128();
+	for ( i = 0; i + 16 <= numBytes; i += 16 )
+	{
+		v = _mm_loadu_si128( (const __m128i*) ( bits + i ) );
+		v = _mm_sub_epi8( v, _mm_and_si128( _mm_srli_epi64( v, 1 ), m1 ) );
+		v = _mm_add_epi8( _mm_and_si128( v, m2 ), _mm_and_si128( _mm_srli_epi64( v, 2 ), m2 ) );
+		v = _mm_and_si128( _mm_add_epi8( v, _mm_srli_epi64( v, 4 ) ), m4 );
+		sum = _mm_add_epi64( sum, _mm_sad_epu8( v, _mm_setzero_si128() ) );
+	}
+	return _mm_cvtsi128_si32( sum ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( sum, sum ) )
+		   + PortalBitsCountScalar( bits + i, numBytes - i );
+}
+
+static const portalBits_t portalBitsSSE2 =
+{
+	"sse2",
+	PortalBitsSupportedSSE2,
+	PortalBitsAndSSE2,
+	PortalBitsAnd3SSE2,
+	PortalBitsOrSSE2,
+	PortalBitsCountSSE2
+};
+
+
+
+/* -------------------------------------------------------------------------------
+
+   avx2
+
+   ------------------------------------------------------------------------------- */
+
+static qboolean PortalBitsSupportedAVX2( void ){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "avx2" ) ? qtrue : qfalse;
+}
+
+__attribute__( ( target( "avx2" ) ) )
+static qboolean PortalBitsAndAVX2( byte *out, const byte *a, const byte *b, const byte *seen, int numBytes ){
+	int i;
+	__m256i m, more;
+
+
+	more = _mm256_setzero_si256();
+	for ( i = 0; i + 32 <= numBytes; i += 32 )
+	{
+		m = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*) ( a + i ) ), _mm256_loadu_si256( (const __m256i*) ( b + i ) ) );
+		_mm256_storeu_si256( (__m256i*) ( out + i ), m );
+		more = _mm256_or_si256( more, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i*) ( seen + i ) ), m ) );
+	}
+	return PortalBitsAndScalar( out + i, a + i, b + i, seen + i, numBytes - i )
+		   | !_mm256_testz_si256( more, more );
+}
+
+__attribute__( ( target( "avx2" ) ) )
+static qboolean PortalBitsAnd3AVX2( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen, int numBytes ){
+	int i;
+	__m256i m, more;
+
+
+	more = _mm256_setzero_si256();
+	for ( i = 0; i + 32 <= numBytes; i += 32 )
+	{
+		m = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*) ( a + i ) ), _mm256_loadu_si256( (const __m256i*) ( b + i ) ) );
+		m = _mm256_and_si256( m, _mm256_loadu_si256( (const __m256i*) ( c + i ) ) );
+		_mm256_storeu_si256( (__m256i*) ( out + i ), m );
+		more = _mm256_or_si256( more, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i*) ( seen + i ) ), m ) );
+	}
+	return PortalBitsAnd3Scalar( out + i, a + i, b + i, c + i, seen + i, numBytes - i )
+		   | !_mm256_testz_si256( more, more );
+}
+
+__attribute__( ( target( "avx2" ) ) )
+static void PortalBitsOrAVX2( byte *out, const byte *a, int numBytes ){
+	int i;
+
+
+	for ( i = 0; i + 32 <= numBytes; i += 32 )
+		_mm256_storeu_si256( (__m256i*) ( out + i ), _mm256_or_si256( _mm256_loadu_si256( (const __m256i*) ( out + i ) ), _mm256_loadu_si256( (const __m256i*) ( a + i ) ) ) );
+	PortalBitsOrScalar( out + i, a + i, numBytes - i );
+}
+
+/* nibble lookup through vpshufb, bytes summed with vpsadbw */
+__attribute__( ( target( "avx2" ) ) )
+static int PortalBitsCountAVX2( const byte *bits, int numBytes ){
+	int i;
+	__m256i v, cnt, sum;
+	const __m256i nibbles = _mm256_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+	const __m256i low = _mm256_set1_epi8( 0x0F );
+	__m128i half;
+
+
+	sum = _mm256_setzero_si256();
+	for ( i = 0; i + 32 <= numBytes; i += 32 )
+	{
+		v = _mm256_loadu_si256( (const __m256i*) ( bits + i ) );
+		cnt = _mm256_add_epi8( _mm256_shuffle_epi8( nibbles, _mm256_and_si256( v, low ) ),
+							   _mm256_shuffle_epi8( nibbles, _mm256_and_si256( _mm256_srli_epi16( v, 4 ), low ) ) );
+		sum = _mm256_add_epi64( sum, _mm256_sad_epu8( cnt, _mm256_setzero_si256() ) );
+	}
+	half = _mm_add_epi64( _mm256_castsi256_si128( sum ), _mm256_extracti128_si256( sum, 1 ) );
+	return _mm_cvtsi128_si32( half ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( half, half ) )
+		   + PortalBitsCountScalar( bits + i, numBytes - i );
+}
+
+static const portalBits_t portalBitsAVX2 =
+{
+	"avx2",
+	PortalBitsSupportedAVX2,
+	PortalBitsAndAVX2,
+	PortalBitsAnd3AVX2,
+	PortalBitsOrAVX2,
+	PortalBitsCountAVX2
+};
+
+#endif
+
+
+
+/* fastest first */
+static const portalBits_t   *allPortalBits[] =
+{
+#if PORTAL_BITS_X86
+	&portalBitsAVX2,
+	&portalBitsSSE2,
+#endif
+	&portalBitsScalar
+};
+
+#define NUM_PORTAL_BITS     ( (int) ( sizeof( allPortalBits ) / sizeof( allPortalBits[ 0 ] ) ) )
+
+static const portalBits_t   *portalBits = &portalBitsScalar;
+
+
+
+/*
+   SetupPortalBits()
+   picks the portal bit kernels, the named ones or the fastest the cpu supports
+ */
+
+void SetupPortalBits( const char *name ){
+	int i;
+
+
+	for ( i = 0; i < NUM_PORTAL_BITS; i++ )
+	{
+		if ( name != NULL && Q_stricmp( name, allPortalBits[ i ]->name ) ) {
+			continue;
+		}
+		if ( !allPortalBits[ i ]->supported() ) {
+			if ( name != NULL ) {
+				Sys_FPrintf( SYS_WRN, "WARNING: %s portal bit kernels are not supported by this cpu\n", name );
+				name = NULL;
+				i = -1;
+			}
+			continue;
+		}
+		portalBits = allPortalBits[ i ];
+		Sys_Printf( "portal bit kernels: %s\n", portalBits->name );
+		return;
+	}
+
+	/* unknown name */
+	Sys_FPrintf( SYS_WRN, "WARNING: unknown portal bit kernels \"%s\"\n", name );
+	SetupPortalBits( NULL );
+}
+
+
+
+/*
+   PortalBitsAnd()
+   out = a & b, returns true if out has bits that are not in seen
+ */
+
+qboolean PortalBitsAnd( byte *out, const byte *a, const byte *b, const byte *seen ){
+	return portalBits->bitsAnd( out, a, b, seen, portalbytes );
+}
+
+
+
+/*
+   PortalBitsAnd3()
+   out = a & b & c, returns true if out has bits that are not in seen
+ */
+
+qboolean PortalBitsAnd3( byte *out, const byte *a, const byte *b, const byte *c, const byte *seen ){
+	return portalBits->bitsAnd3( out, a, b, c, seen, portalbytes );
+}
+
+
+
+/*
+   PortalBitsOr()
+   out |= a
+ */
+
+void PortalBitsOr( byte *out, const byte *a ){
+	portalBits->bitsOr( out, a, portalbytes );
+}
+
+
+
+/*
+   CountBits()
+   counts the set bits among the first numbits
+ */
+
+int CountBits( byte *bits, int numbits ){
+	int c;
+
+
+	c = portalBits->bitsCount( bits, numbits >> 3 );
+	if ( numbits & 7 ) {
+		c += portalBits->bitsCount( ( const byte[] ){ bits[ numbits >> 3 ] & ( ( 1 << ( numbits & 7 ) ) - 1 ) }, 1 );
+	}
+	return c;
+}
+
+
+
+/* -------------------------------------------------------------------------------
+
+   mightsee
+
+   ------------------------------------------------------------------------------- */
+
+#define MAX_MIGHTSEE_STACKS     1024
+
+/* the mightsee bitsets of one thread, one per recursion depth */
+typedef struct mightseeStack_s
+{
+	int numLevels;
+	mightsee_t          **levels;
+}
+mightseeStack_t;
+
+static mightseeStack_t mightseeStacks[ MAX_MIGHTSEE_STACKS ];
+
+
+
+/*
+   MightseeForDepth()
+   returns the mightsee bitset of the calling thread for a recursion depth; it keeps
+   whatever the last recursion at that depth left in it
+ */
+
+mightsee_t *MightseeForDepth( int depth ){
+	int threadNum, numLevels, numWords;
+	mightseeStack_t     *stack;
+	mightsee_t          *might;
+
+
+	threadNum = ThreadNum();
+	if ( threadNum >= MAX_MIGHTSEE_STACKS ) {
+		Error( "MAX_MIGHTSEE_STACKS (%d) exceeded", MAX_MIGHTSEE_STACKS );
+	}
+	stack = &mightseeStacks[ threadNum ];
+
+	/* grow the stack */
+	if ( depth >= stack->numLevels ) {
+		numLevels = stack->numLevels > 0 ? stack->numLevels : 16;
+		while ( numLevels <= depth )
+			numLevels *= 2;
+		stack->levels = realloc( stack->levels, numLevels * sizeof( *stack->levels ) );
+		if ( stack->levels == NULL ) {
+			Error( "MightseeForDepth: failed to allocate %d levels", numLevels );
+		}
+
+		numWords = portalbytes >> 3;
+		for ( ; stack->numLevels < numLevels; stack->numLevels++ )
+		{
+			might = safe_malloc( sizeof( *might ) );
+			might->bits = safe_malloc0( portalbytes );
+			might->words = safe_malloc( ( numWords / MIGHTSEE_LIST_FRACTION + 1 ) * sizeof( *might->words ) );
+			might->numWords = 0;
+			stack->levels[ stack->numLevels ] = might;
+		}
+	}
+
+	return stack->levels[ depth ];
+}
+
+
+
+/*
+   MightseeCopy()
+   sets a mightsee bitset to a whole bitset
+ */
+
+void MightseeCopy( mightsee_t *out, const byte *bits ){
+	memcpy( out->bits, bits, portalbytes );
+	out->numWords = MIGHTSEE_UNLISTED;
+}
+
+
+
+/*
+   ListMightsee()
+   lists the nonzero words of a mightsee bitset, unless there are too many of them
+ */
+
+static void ListMightsee( mightsee_t *might ){
+	int i, n, numWords, maxWords;
+	uint64_t w;
+
+
+	numWords = portalbytes >> 3;
+	maxWords = numWords / MIGHTSEE_LIST_FRACTION;
+	for ( i = 0, n = 0; i < numWords; i++ )
+	{
+		memcpy( &w, might->bits + ( i << 3 ), 8 );
+		if ( w == 0 ) {
+			continue;
+		}
+		if ( n >= maxWords ) {
+			might->numWords = MIGHTSEE_DENSE;
+			return;
+		}
+		might->words[ n++ ] = i;
+	}
+	might->numWords = n;
+}
+
+
+
+/*
+   MightseeAnd()
+   out = in & a (& b, if not NULL), returns true if out has bits that are not in seen;
+   a listed input is only and-ed over its nonzero words, which lists the output too
+ */
+
+qboolean MightseeAnd( mightsee_t *out, mightsee_t *in, const byte *a, const byte *b, const byte *seen ){
+	int i, n, o;
+	uint64_t w, wa, ws, more;
+
+
+	if ( in->numWords == MIGHTSEE_UNLISTED ) {
+		ListMightsee( in );
+	}
+
+	/* dense, and the whole bitset */
+	if ( in->numWords == MIGHTSEE_DENSE ) {
+		out->numWords = MIGHTSEE_UNLISTED;
+		if ( b != NULL ) {
+			return PortalBitsAnd3( out->bits, in->bits, a, b, seen );
+		}
+		return PortalBitsAnd( out->bits, in->bits, a, seen );
+	}
+
+	/* clear what is left in out from last time */
+	if ( out->numWords >= 0 ) {
+		for ( i = 0; i < out->numWords; i++ )
+			memset( out->bits + ( out->words[ i ] << 3 ), 0, 8 );
+	}
+	else{
+		memset( out->bits, 0, portalbytes );
+	}
+
+	/* and the listed words */
+	more = 0;
+	for ( i = 0, n = 0; i < in->numWords; i++ )
+	{
+		o = in->words[ i ] << 3;
+		memcpy( &w, in->bits + o, 8 );
+		memcpy( &wa, a + o, 8 );
+		w &= wa;
+		if ( b != NULL ) {
+			memcpy( &wa, b + o, 8 );
+			w &= wa;
+		}
+		if ( w == 0 ) {
+			continue;
+		}
+		memcpy( out->bits + o, &w, 8 );
+		memcpy( &ws, seen + o, 8 );
+		more |= w & ~ws;
+		out->words[ n++ ] = in->words[ i ];
+	}
+	out->numWords = n;
+
+	return more != 0;
+}
+
+
+
+/*
+   BenchPortalBits()
+   times each set of portal bit kernels the cpu supports on the portal bitsets of the
+   loaded map (needs BasePortalVis), and checks them against the scalar ones
+ */
+
+#define BENCH_PORTAL_BITS_SECONDS   0.5
+
+static unsigned int RunPortalBits( const portalBits_t *set, int kernel, const byte **bitsets, int n, byte *out, qboolean check ){
+	int i, j;
+	unsigned int result;
+	const byte  *a, *b, *c, *seen;
+
+
+	result = 0;
+	for ( i = 0; i < n; i++ )
+	{
+		a = bitsets[ i ];
+		b = bitsets[ ( i + 1 ) % n ];
+		c = bitsets[ ( i + 2 ) % n ];
+		seen = bitsets[ ( i + 3 ) % n ];
+		switch ( kernel )
+		{
+		case 0:
+			result = result * 3 + set->bitsAnd( out, a, b, seen, portalbytes );
+			break;
+		case 1:
+			result = result * 3 + set->bitsAnd3( out, a, b, c, seen, portalbytes );
+			break;
+		case 2:
+			memcpy( out, a, portalbytes );
+			set->bitsOr( out, b, portalbytes );
+			break;
+		default:
+			result = result * 3 + set->bitsCount( a, portalbytes );
+			break;
+		}
+
+		/* hash the whole output when checking, otherwise just keep the compiler honest */
+		if ( check ) {
+			for ( j = 0; j < portalbytes; j++ )
+				result = result * 31 + out[ j ];
+		}
+		else{
+			result += out[ i % portalbytes ];
+		}
+	}
+	return result;
+}
+
+static unsigned int BenchPortalBitsSet( const portalBits_t *set, int kernel, const byte **bitsets, int n, byte *out, double *seconds, int *ops ){
+	int rounds;
+	unsigned int result;
+	clock_t start;
+
+
+	/* check run */
+	memset( out, 0, portalbytes );
+	result = RunPortalBits( set, kernel, bitsets, n, out, qtrue );
+
+	/* timed runs */
+	rounds = 0;
+	start = clock();
+	do
+	{
+		RunPortalBits( set, kernel, bitsets, n, out, qfalse );
+		rounds++;
+		*seconds = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+	}
+	while ( *seconds < BENCH_PORTAL_BITS_SECONDS );
+
+	*ops = rounds * n;
+	return result;
+}
+
+void BenchPortalBits( void ){
+	int i, kernel, ops, numBitsets;
+	unsigned int check, scalarCheck[ 4 ];
+	double seconds, bytes;
+	byte        *out;
+	const byte  **bitsets;
+	const char  *kernelNames[ 4 ] = { "and", "and3", "or", "count" };
+	const int kernelInputs[ 4 ] = { 3, 4, 2, 1 };
+
+
+	/* the flood bitsets of the portals still around */
+	bitsets = safe_malloc( numportals * 2 * sizeof( *bitsets ) );
+	numBitsets = 0;
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		if ( !portals[ i ].removed ) {
+			bitsets[ numBitsets++ ] = portals[ i ].portalflood;
+		}
+	}
+	if ( numBitsets == 0 ) {
+		free( bitsets );
+		return;
+	}
+
+	Sys_Printf( "\n--- BenchPortalBits (%d portals, %d bytes) ---\n", numBitsets, portalbytes );
+	out = safe_malloc0( portalbytes );
+	for ( i = NUM_PORTAL_BITS - 1; i >= 0; i-- )
+	{
+		if ( !allPortalBits[ i ]->supported() ) {
+			Sys_Printf( "%-8s not supported\n", allPortalBits[ i ]->name );
+			continue;
+		}
+		for ( kernel = 0; kernel < 4; kernel++ )
+		{
+			/* the scalar kernels come last in the list, so they are run first */
+			check = BenchPortalBitsSet( allPortalBits[ i ], kernel, bitsets, numBitsets, out, &seconds, &ops );
+			if ( allPortalBits[ i ] == &portalBitsScalar ) {
+				scalarCheck[ kernel ] = check;
+			}
+			bytes = (double) ops * portalbytes * kernelInputs[ kernel ];
+			Sys_Printf( "%-8s %-6s %9.1f ns/op %7.2f GB/s%s\n", allPortalBits[ i ]->name, kernelNames[ kernel ],
+						seconds * 1e9 / ops, bytes / seconds / 1e9, check == scalarCheck[ kernel ] ? "" : "  MISMATCH" );
+		}
+	}
+	free( out );
+	free( bitsets );
+}
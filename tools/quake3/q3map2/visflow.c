@@ -36,6 +36,14 @@
 /* dependencies */
 #include "q3map2.h"
 
+/* the winding kernels have to round exactly like the plain c code, so they need sse float math, not x87 */
+#if defined( __SSE2__ ) && defined( __SSE_MATH__ )
+	#include <emmintrin.h>
+	#define VIS_WINDING_SIMD    1
+#else
+	#define VIS_WINDING_SIMD    0
+#endif
+
 
 
 
@@ -58,19 +66,6 @@
    void CalcMightSee (leaf_t *leaf,
  */
 
-int CountBits( byte *bits, int numbits ){
-	int i;
-	int c;
-
-	c = 0;
-	for ( i = 0 ; i < numbits ; i++ )
-		if ( bits[i >> 3] & ( 1 << ( i & 7 ) ) ) {
-			c++;
-		}
-
-	return c;
-}
-
 int c_fullskip;
 
 int c_chop, c_nochop;
@@ -128,24 +123,104 @@ void FreeStackWinding( fixedWinding_t *w, pstack_t *stack ){
 
 /*
    ==============
-   VisChopWinding
+   winding kernels
 
+   the innermost work of vis is measuring winding points against planes; with sse the
+   points of a winding are taken four at a time (turned from the point array into x, y
+   and z registers), as are candidate and cached seperators, all rounding exactly like
+   the plain c code so the vis data does not change
    ==============
  */
-fixedWinding_t  *VisChopWinding( fixedWinding_t *in, pstack_t *stack, visPlane_t *split ){
-	vec_t dists[128];
-	int sides[128];
-	int counts[3];
+
+#if VIS_WINDING_SIMD
+
+/* the float dists are compared against the double ON_EPSILON in c, so compare them
+   against the float next to it in the way that gives the same answers */
+#define VIS_EPSILON_F           ( (float) ON_EPSILON )
+#define VIS_EPSILON_ABOVE       ( (double) VIS_EPSILON_F > ON_EPSILON )
+#define VIS_EPSILON_BELOW       ( (double) VIS_EPSILON_F < ON_EPSILON )
+
+static inline __m128 VisFront( __m128 d ){      /* d > ON_EPSILON */
+	return VIS_EPSILON_ABOVE ? _mm_cmpge_ps( d, _mm_set1_ps( VIS_EPSILON_F ) ) : _mm_cmpgt_ps( d, _mm_set1_ps( VIS_EPSILON_F ) );
+}
+
+static inline __m128 VisBack( __m128 d ){       /* d < -ON_EPSILON */
+	return VIS_EPSILON_ABOVE ? _mm_cmple_ps( d, _mm_set1_ps( -VIS_EPSILON_F ) ) : _mm_cmplt_ps( d, _mm_set1_ps( -VIS_EPSILON_F ) );
+}
+
+static inline __m128 VisTiny( __m128 d ){       /* d < ON_EPSILON */
+	return VIS_EPSILON_BELOW ? _mm_cmple_ps( d, _mm_set1_ps( VIS_EPSILON_F ) ) : _mm_cmplt_ps( d, _mm_set1_ps( VIS_EPSILON_F ) );
+}
+
+/* loads four points as x, y and z */
+static inline void LoadVisPoints( const vec3_t *points, __m128 *x, __m128 *y, __m128 *z ){
+	const float *f = points[ 0 ];
+	__m128 a = _mm_loadu_ps( f ), b = _mm_loadu_ps( f + 4 ), c = _mm_loadu_ps( f + 8 );
+
+	*x = _mm_shuffle_ps( a, _mm_shuffle_ps( b, c, _MM_SHUFFLE( 1, 1, 2, 2 ) ), _MM_SHUFFLE( 2, 0, 3, 0 ) );
+	*y = _mm_shuffle_ps( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 0, 0, 1, 1 ) ), _mm_shuffle_ps( b, c, _MM_SHUFFLE( 2, 2, 3, 3 ) ), _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	*z = _mm_shuffle_ps( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 1, 1, 2, 2 ) ), _mm_shuffle_ps( c, c, _MM_SHUFFLE( 3, 3, 0, 0 ) ), _MM_SHUFFLE( 2, 0, 2, 0 ) );
+}
+
+/* loads up to four points starting at first, repeating the last one */
+static inline void LoadWindingPoints( const fixedWinding_t *w, int first, __m128 *x, __m128 *y, __m128 *z ){
+	int i;
+	vec3_t points[ 4 ];
+
+
+	if ( first + 4 <= w->numpoints ) {
+		LoadVisPoints( &w->points[ first ], x, y, z );
+		return;
+	}
+	for ( i = 0; i < 4; i++ )
+		VectorCopy( w->points[ first + i < w->numpoints ? first + i : w->numpoints - 1 ], points[ i ] );
+	LoadVisPoints( points, x, y, z );
+}
+
+/* point . normal - dist, for four points or four planes */
+static inline __m128 VisPlaneDists( __m128 x, __m128 y, __m128 z, __m128 nx, __m128 ny, __m128 nz, __m128 dist ){
+	return _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, nx ), _mm_mul_ps( y, ny ) ), _mm_mul_ps( z, nz ) ), dist );
+}
+
+#endif
+
+/*
+   WindingPlaneSides()
+   measures the points of a winding against a plane
+ */
+static inline void WindingPlaneSides( const fixedWinding_t *in, const visPlane_t *split, vec_t *dists, int *sides, int *counts ){
+	int i;
 	vec_t dot;
-	int i, j;
-	vec_t   *p1, *p2;
-	vec3_t mid;
-	fixedWinding_t  *neww;
+#if VIS_WINDING_SIMD
+	__m128 x, y, z, d, front, back;
+	__m128i frontInts, backInts;
+	const __m128 nx = _mm_set1_ps( split->normal[ 0 ] ), ny = _mm_set1_ps( split->normal[ 1 ] ), nz = _mm_set1_ps( split->normal[ 2 ] );
+	const __m128 dist = _mm_set1_ps( split->dist );
+#endif
 
-	counts[0] = counts[1] = counts[2] = 0;
 
-	// determine sides for each point
-	for ( i = 0 ; i < in->numpoints ; i++ )
+	counts[ SIDE_FRONT ] = counts[ SIDE_BACK ] = 0;
+	i = 0;
+
+#if VIS_WINDING_SIMD
+	for ( ; i + 4 <= in->numpoints; i += 4 )
+	{
+		LoadVisPoints( &in->points[ i ], &x, &y, &z );
+		d = VisPlaneDists( x, y, z, nx, ny, nz, dist );
+		front = VisFront( d );
+		back = VisBack( d );
+		_mm_storeu_ps( &dists[ i ], d );
+
+		/* SIDE_ON - 2 * front - back, with the masks being -1 */
+		frontInts = _mm_castps_si128( front );
+		backInts = _mm_castps_si128( back );
+		_mm_storeu_si128( (__m128i*) &sides[ i ], _mm_add_epi32( _mm_set1_epi32( SIDE_ON ), _mm_add_epi32( _mm_add_epi32( frontInts, frontInts ), backInts ) ) );
+		counts[ SIDE_FRONT ] += __builtin_popcount( _mm_movemask_ps( front ) );
+		counts[ SIDE_BACK ] += __builtin_popcount( _mm_movemask_ps( back ) );
+	}
+#endif
+
+	for ( ; i < in->numpoints; i++ )
 	{
 		dot = DotProduct( in->points[i], split->normal );
 		dot -= split->dist;
@@ -163,6 +238,31 @@ fixedWinding_t  *VisChopWinding( fixedWinding_t *in, pstack_t *stack, visPlane_t
 		counts[sides[i]]++;
 	}
 
+	counts[ SIDE_ON ] = in->numpoints - counts[ SIDE_FRONT ] - counts[ SIDE_BACK ];
+}
+
+/*
+   ==============
+   VisChopWinding
+
+   ==============
+ */
+fixedWinding_t  *VisChopWinding( fixedWinding_t *in, pstack_t *stack, visPlane_t *split ){
+	vec_t dists[128];
+	int sides[128];
+	int counts[3];
+	vec_t dot;
+	int i, j;
+	vec_t   *p1, *p2;
+	vec3_t mid;
+	fixedWinding_t  *neww;
+
+	( *stack->c_clips )++;
+
+	// determine sides for each point
+	WindingPlaneSides( in, split, dists, sides, counts );
+	i = in->numpoints;
+
 	if ( !counts[1] ) {
 		return in;      // completely on front side
 
@@ -237,175 +337,385 @@ fixedWinding_t  *VisChopWinding( fixedWinding_t *in, pstack_t *stack, visPlane_t
 
 /*
    ==============
-   ClipToSeperators
+   SeperatorForEdge
 
-   Source, pass, and target are an ordering of portals.
+   Finds the first seperating plane through edge i of source and a point of pass,
+   the way ClipToSeperators and AddSeperators look for them.
+   ==============
+ */
+#if VIS_WINDING_SIMD
+static qboolean SeperatorForEdge( const fixedWinding_t *source, const fixedWinding_t *pass, int i, qboolean flipclip, visPlane_t *plane ){
+	int j, k, l, bits;
+	vec3_t v1;
+	__m128 x, y, z, v2x, v2y, v2z, nx, ny, nz, dist, length, d, valid, decided, flip, neg, pos, skip, off, sign;
+	__m128d lo, hi;
+	__m128i lanes;
+	vec_t normals[ 3 ][ 4 ], dists[ 4 ];
+
+
+	l = ( i + 1 ) % source->numpoints;
+	VectorSubtract( source->points[l], source->points[i], v1 );
+
+	// try four vertexes of pass at a time, taking the first that
+	// makes a plane that puts all of the vertexes of pass on the
+	// front side and all of the vertexes of source on the back side
+	lanes = _mm_set_epi32( 3, 2, 1, 0 );
+	for ( j = 0 ; j < pass->numpoints ; j += 4 )
+	{
+		LoadWindingPoints( pass, j, &x, &y, &z );
+		valid = _mm_castsi128_ps( _mm_cmplt_epi32( lanes, _mm_set1_epi32( pass->numpoints - j ) ) );
 
-   Generates seperating planes canidates by taking two points from source and one
-   point from pass, and clips target by them.
+		v2x = _mm_sub_ps( x, _mm_set1_ps( source->points[i][0] ) );
+		v2y = _mm_sub_ps( y, _mm_set1_ps( source->points[i][1] ) );
+		v2z = _mm_sub_ps( z, _mm_set1_ps( source->points[i][2] ) );
 
-   If target is totally clipped away, that portal can not be seen through.
+		nx = _mm_sub_ps( _mm_mul_ps( _mm_set1_ps( v1[1] ), v2z ), _mm_mul_ps( _mm_set1_ps( v1[2] ), v2y ) );
+		ny = _mm_sub_ps( _mm_mul_ps( _mm_set1_ps( v1[2] ), v2x ), _mm_mul_ps( _mm_set1_ps( v1[0] ), v2z ) );
+		nz = _mm_sub_ps( _mm_mul_ps( _mm_set1_ps( v1[0] ), v2y ), _mm_mul_ps( _mm_set1_ps( v1[1] ), v2x ) );
 
-   Normal clip keeps target on the same side as pass, which is correct if the
-   order goes source, pass, target.  If the order goes pass, source, target then
-   flipclip should be set.
-   ==============
- */
-fixedWinding_t  *ClipToSeperators( fixedWinding_t *source, fixedWinding_t *pass, fixedWinding_t *target, qboolean flipclip, pstack_t *stack ){
-	int i, j, k, l;
-	visPlane_t plane;
+		// if points don't make a valid plane, skip it
+		length = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nx ), _mm_mul_ps( ny, ny ) ), _mm_mul_ps( nz, nz ) );
+		valid = _mm_andnot_ps( VisTiny( length ), valid );
+		if ( !_mm_movemask_ps( valid ) ) {
+			continue;
+		}
+
+		// 1 / sqrt in double, as the c code does
+		lo = _mm_div_pd( _mm_set1_pd( 1.0 ), _mm_sqrt_pd( _mm_cvtps_pd( length ) ) );
+		hi = _mm_div_pd( _mm_set1_pd( 1.0 ), _mm_sqrt_pd( _mm_cvtps_pd( _mm_movehl_ps( length, length ) ) ) );
+		length = _mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) );
+
+		nx = _mm_mul_ps( nx, length );
+		ny = _mm_mul_ps( ny, length );
+		nz = _mm_mul_ps( nz, length );
+		dist = VisPlaneDists( x, y, z, nx, ny, nz, _mm_setzero_ps() );
+
+		//
+		// find out which side of the generated seperating plane has the
+		// source portal, the first vertex off the plane tells
+		//
+		decided = flip = _mm_setzero_ps();
+		for ( k = 0 ; k < source->numpoints ; k++ )
+		{
+			if ( k == i || k == l ) {
+				continue;
+			}
+			d = VisPlaneDists( _mm_set1_ps( source->points[k][0] ), _mm_set1_ps( source->points[k][1] ), _mm_set1_ps( source->points[k][2] ), nx, ny, nz, dist );
+			off = _mm_andnot_ps( decided, _mm_or_ps( VisFront( d ), VisBack( d ) ) );
+			flip = _mm_or_ps( flip, _mm_and_ps( off, VisFront( d ) ) );
+			decided = _mm_or_ps( decided, off );
+			if ( ( _mm_movemask_ps( _mm_or_ps( decided, _mm_cmpeq_ps( valid, _mm_setzero_ps() ) ) ) ) == 15 ) {
+				break;
+			}
+		}
+		valid = _mm_and_ps( valid, decided );   // else planar with source portal
+
+		//
+		// flip the normal if the source portal is backwards
+		//
+		sign = _mm_and_ps( flip, _mm_set1_ps( -0.0f ) );
+		nx = _mm_or_ps( _mm_and_ps( flip, _mm_sub_ps( _mm_setzero_ps(), nx ) ), _mm_andnot_ps( flip, nx ) );
+		ny = _mm_or_ps( _mm_and_ps( flip, _mm_sub_ps( _mm_setzero_ps(), ny ) ), _mm_andnot_ps( flip, ny ) );
+		nz = _mm_or_ps( _mm_and_ps( flip, _mm_sub_ps( _mm_setzero_ps(), nz ) ), _mm_andnot_ps( flip, nz ) );
+		dist = _mm_xor_ps( dist, sign );
+
+		//
+		// if all of the pass portal points are now on the positive side,
+		// this is the seperating plane
+		//
+		neg = pos = _mm_setzero_ps();
+		for ( k = 0 ; k < pass->numpoints ; k++ )
+		{
+			d = VisPlaneDists( _mm_set1_ps( pass->points[k][0] ), _mm_set1_ps( pass->points[k][1] ), _mm_set1_ps( pass->points[k][2] ), nx, ny, nz, dist );
+			skip = _mm_castsi128_ps( _mm_cmpeq_epi32( lanes, _mm_set1_epi32( k - j ) ) );
+			neg = _mm_or_ps( neg, _mm_andnot_ps( skip, VisBack( d ) ) );
+			pos = _mm_or_ps( pos, _mm_andnot_ps( skip, VisFront( d ) ) );
+			if ( _mm_movemask_ps( _mm_andnot_ps( neg, valid ) ) == 0 ) {
+				break;  // points on negative side, not a seperating plane
+			}
+		}
+		valid = _mm_and_ps( _mm_andnot_ps( neg, valid ), pos );    // and not planar with it
+
+		bits = _mm_movemask_ps( valid );
+		if ( !bits ) {
+			continue;
+		}
+
+		// take the first one
+		_mm_storeu_ps( normals[ 0 ], nx );
+		_mm_storeu_ps( normals[ 1 ], ny );
+		_mm_storeu_ps( normals[ 2 ], nz );
+		_mm_storeu_ps( dists, dist );
+		k = __builtin_ctz( bits );
+		VectorSet( plane->normal, normals[ 0 ][ k ], normals[ 1 ][ k ], normals[ 2 ][ k ] );
+		plane->dist = dists[ k ];
+
+		//
+		// flip the normal if we want the back side
+		//
+		if ( flipclip ) {
+			VectorSubtract( vec3_origin, plane->normal, plane->normal );
+			plane->dist = -plane->dist;
+		}
+
+		return qtrue;
+	}
+
+	return qfalse;
+}
+#else
+static qboolean SeperatorForEdge( const fixedWinding_t *source, const fixedWinding_t *pass, int i, qboolean flipclip, visPlane_t *plane ){
+	int j, k, l;
 	vec3_t v1, v2;
 	float d;
 	vec_t length;
 	int counts[3];
 	qboolean fliptest;
 
-	// check all combinations
-	for ( i = 0 ; i < source->numpoints ; i++ )
-	{
-		l = ( i + 1 ) % source->numpoints;
-		VectorSubtract( source->points[l], source->points[i], v1 );
 
-		// find a vertex of pass that makes a plane that puts all of the
-		// vertexes of pass on the front side and all of the vertexes of
-		// source on the back side
-		for ( j = 0 ; j < pass->numpoints ; j++ )
-		{
-			VectorSubtract( pass->points[j], source->points[i], v2 );
+	l = ( i + 1 ) % source->numpoints;
+	VectorSubtract( source->points[l], source->points[i], v1 );
 
-			plane.normal[0] = v1[1] * v2[2] - v1[2] * v2[1];
-			plane.normal[1] = v1[2] * v2[0] - v1[0] * v2[2];
-			plane.normal[2] = v1[0] * v2[1] - v1[1] * v2[0];
+	// find a vertex of pass that makes a plane that puts all of the
+	// vertexes of pass on the front side and all of the vertexes of
+	// source on the back side
+	for ( j = 0 ; j < pass->numpoints ; j++ )
+	{
+		VectorSubtract( pass->points[j], source->points[i], v2 );
 
-			// if points don't make a valid plane, skip it
+		plane->normal[0] = v1[1] * v2[2] - v1[2] * v2[1];
+		plane->normal[1] = v1[2] * v2[0] - v1[0] * v2[2];
+		plane->normal[2] = v1[0] * v2[1] - v1[1] * v2[0];
 
-			length = plane.normal[0] * plane.normal[0]
-					 + plane.normal[1] * plane.normal[1]
-					 + plane.normal[2] * plane.normal[2];
+		// if points don't make a valid plane, skip it
 
-			if ( length < ON_EPSILON ) {
-				continue;
-			}
+		length = plane->normal[0] * plane->normal[0]
+				 + plane->normal[1] * plane->normal[1]
+				 + plane->normal[2] * plane->normal[2];
+
+		if ( length < ON_EPSILON ) {
+			continue;
+		}
 
-			length = 1 / sqrt( length );
+		length = 1 / sqrt( length );
 
-			plane.normal[0] *= length;
-			plane.normal[1] *= length;
-			plane.normal[2] *= length;
+		plane->normal[0] *= length;
+		plane->normal[1] *= length;
+		plane->normal[2] *= length;
 
-			plane.dist = DotProduct( pass->points[j], plane.normal );
+		plane->dist = DotProduct( pass->points[j], plane->normal );
 
-			//
-			// find out which side of the generated seperating plane has the
-			// source portal
-			//
+		//
+		// find out which side of the generated seperating plane has the
+		// source portal
+		//
 #if 1
-			fliptest = qfalse;
-			for ( k = 0 ; k < source->numpoints ; k++ )
-			{
-				if ( k == i || k == l ) {
-					continue;
-				}
-				d = DotProduct( source->points[k], plane.normal ) - plane.dist;
-				if ( d < -ON_EPSILON ) { // source is on the negative side, so we want all
-					                    // pass and target on the positive side
-					fliptest = qfalse;
-					break;
-				}
-				else if ( d > ON_EPSILON ) { // source is on the positive side, so we want all
-					                        // pass and target on the negative side
-					fliptest = qtrue;
-					break;
-				}
+		fliptest = qfalse;
+		for ( k = 0 ; k < source->numpoints ; k++ )
+		{
+			if ( k == i || k == l ) {
+				continue;
+			}
+			d = DotProduct( source->points[k], plane->normal ) - plane->dist;
+			if ( d < -ON_EPSILON ) { // source is on the negative side, so we want all
+				                    // pass and target on the positive side
+				fliptest = qfalse;
+				break;
 			}
-			if ( k == source->numpoints ) {
-				continue;       // planar with source portal
+			else if ( d > ON_EPSILON ) { // source is on the positive side, so we want all
+				                        // pass and target on the negative side
+				fliptest = qtrue;
+				break;
 			}
+		}
+		if ( k == source->numpoints ) {
+			continue;       // planar with source portal
+		}
 #else
-			fliptest = flipclip;
+		fliptest = flipclip;
 #endif
-			//
-			// flip the normal if the source portal is backwards
-			//
-			if ( fliptest ) {
-				VectorSubtract( vec3_origin, plane.normal, plane.normal );
-				plane.dist = -plane.dist;
-			}
+		//
+		// flip the normal if the source portal is backwards
+		//
+		if ( fliptest ) {
+			VectorSubtract( vec3_origin, plane->normal, plane->normal );
+			plane->dist = -plane->dist;
+		}
 #if 1
-			//
-			// if all of the pass portal points are now on the positive side,
-			// this is the seperating plane
-			//
-			counts[0] = counts[1] = counts[2] = 0;
-			for ( k = 0 ; k < pass->numpoints ; k++ )
-			{
-				if ( k == j ) {
-					continue;
-				}
-				d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-				if ( d < -ON_EPSILON ) {
-					break;
-				}
-				else if ( d > ON_EPSILON ) {
-					counts[0]++;
-				}
-				else{
-					counts[2]++;
-				}
-			}
-			if ( k != pass->numpoints ) {
-				continue;   // points on negative side, not a seperating plane
-
-			}
-			if ( !counts[0] ) {
-				continue;   // planar with seperating plane
-			}
-#else
-			k = ( j + 1 ) % pass->numpoints;
-			d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-			if ( d < -ON_EPSILON ) {
+		//
+		// if all of the pass portal points are now on the positive side,
+		// this is the seperating plane
+		//
+		counts[0] = counts[1] = counts[2] = 0;
+		for ( k = 0 ; k < pass->numpoints ; k++ )
+		{
+			if ( k == j ) {
 				continue;
 			}
-			k = ( j + pass->numpoints - 1 ) % pass->numpoints;
-			d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
+			d = DotProduct( pass->points[k], plane->normal ) - plane->dist;
 			if ( d < -ON_EPSILON ) {
-				continue;
+				break;
 			}
-#endif
-			//
-			// flip the normal if we want the back side
-			//
-			if ( flipclip ) {
-				VectorSubtract( vec3_origin, plane.normal, plane.normal );
-				plane.dist = -plane.dist;
+			else if ( d > ON_EPSILON ) {
+				counts[0]++;
+			}
+			else{
+				counts[2]++;
 			}
+		}
+		if ( k != pass->numpoints ) {
+			continue;   // points on negative side, not a seperating plane
 
+		}
+		if ( !counts[0] ) {
+			continue;   // planar with seperating plane
+		}
+#else
+		k = ( j + 1 ) % pass->numpoints;
+		d = DotProduct( pass->points[k], plane->normal ) - plane->dist;
+		if ( d < -ON_EPSILON ) {
+			continue;
+		}
+		k = ( j + pass->numpoints - 1 ) % pass->numpoints;
+		d = DotProduct( pass->points[k], plane->normal ) - plane->dist;
+		if ( d < -ON_EPSILON ) {
+			continue;
+		}
+#endif
+		//
+		// flip the normal if we want the back side
+		//
+		if ( flipclip ) {
+			VectorSubtract( vec3_origin, plane->normal, plane->normal );
+			plane->dist = -plane->dist;
+		}
+
+		return qtrue;
+	}
+
+	return qfalse;
+}
+#endif
+
+/*
+   ==============
+   seperator cache
+   ==============
+ */
 #ifdef SEPERATORCACHE
-			stack->seperators[flipclip][stack->numseperators[flipclip]] = plane;
-			if ( ++stack->numseperators[flipclip] >= MAX_SEPERATORS ) {
-				Error( "MAX_SEPERATORS" );
-			}
+static void AddSeperator( visSeperators_t *seperators, const visPlane_t *plane ){
+	int n = seperators->numSeperators;
+
+	seperators->normals[ 0 ][ n ] = plane->normal[ 0 ];
+	seperators->normals[ 1 ][ n ] = plane->normal[ 1 ];
+	seperators->normals[ 2 ][ n ] = plane->normal[ 2 ];
+	seperators->dists[ n ] = plane->dist;
+	if ( ++seperators->numSeperators >= MAX_SEPERATORS ) {
+		Error( "MAX_SEPERATORS" );
+	}
+}
+
+/*
+   ChopWindingBySeperators()
+   chops a winding by each cached seperator in turn, returns NULL if nothing is left
+ */
+static fixedWinding_t *ChopWindingBySeperators( fixedWinding_t *in, pstack_t *stack, const visSeperators_t *seperators ){
+	int n;
+	visPlane_t plane;
+#if VIS_WINDING_SIMD
+	int k, bits;
+	__m128 nx, ny, nz, dist, back;
 #endif
-			//MrE: fast check first
-			d = DotProduct( stack->portal->origin, plane.normal ) - plane.dist;
-			//if completely at the back of the seperator plane
-			if ( d < -stack->portal->radius ) {
-				return NULL;
-			}
-			//if completely on the front of the seperator plane
-			if ( d > stack->portal->radius ) {
+
+
+	for ( n = 0; n < seperators->numSeperators; n++ )
+	{
+#if VIS_WINDING_SIMD
+		// the winding is left alone by seperators it is completely in front of,
+		// so skip past those four at a time
+		nx = _mm_loadu_ps( &seperators->normals[ 0 ][ n ] );
+		ny = _mm_loadu_ps( &seperators->normals[ 1 ][ n ] );
+		nz = _mm_loadu_ps( &seperators->normals[ 2 ][ n ] );
+		dist = _mm_loadu_ps( &seperators->dists[ n ] );
+		back = _mm_setzero_ps();
+		for ( k = 0; k < in->numpoints; k++ )
+		{
+			back = _mm_or_ps( back, VisBack( VisPlaneDists( _mm_set1_ps( in->points[k][0] ), _mm_set1_ps( in->points[k][1] ), _mm_set1_ps( in->points[k][2] ), nx, ny, nz, dist ) ) );
+			if ( _mm_movemask_ps( back ) & 1 ) {
 				break;
 			}
+		}
+		bits = _mm_movemask_ps( back );
+		if ( seperators->numSeperators - n < 4 ) {
+			bits &= ( 1 << ( seperators->numSeperators - n ) ) - 1;
+		}
+		if ( !bits ) {
+			n += 3;
+			continue;
+		}
+		n += __builtin_ctz( bits );
+#endif
+		VectorSet( plane.normal, seperators->normals[ 0 ][ n ], seperators->normals[ 1 ][ n ], seperators->normals[ 2 ][ n ] );
+		plane.dist = seperators->dists[ n ];
+		in = VisChopWinding( in, stack, &plane );
+		if ( !in ) {
+			return NULL;        // target is not visible
+		}
+	}
 
-			//
-			// clip target by the seperating plane
-			//
-			target = VisChopWinding( target, stack, &plane );
-			if ( !target ) {
-				return NULL;        // target is not visible
+	return in;
+}
+#endif
+
+/*
+   ==============
+   ClipToSeperators
+
+   Source, pass, and target are an ordering of portals.
+
+   Generates seperating planes canidates by taking two points from source and one
+   point from pass, and clips target by them.
+
+   If target is totally clipped away, that portal can not be seen through.
+
+   Normal clip keeps target on the same side as pass, which is correct if the
+   order goes source, pass, target.  If the order goes pass, source, target then
+   flipclip should be set.
+   ==============
+ */
+fixedWinding_t  *ClipToSeperators( fixedWinding_t *source, fixedWinding_t *pass, fixedWinding_t *target, qboolean flipclip, pstack_t *stack ){
+	int i;
+	visPlane_t plane;
+	float d;
+
+	// check all combinations
+	for ( i = 0 ; i < source->numpoints ; i++ )
+	{
+		if ( !SeperatorForEdge( source, pass, i, flipclip, &plane ) ) {
+			continue;
+		}
+
+#ifdef SEPERATORCACHE
+		AddSeperator( &stack->seperators[flipclip], &plane );
+#endif
+		//MrE: fast check first
+		d = DotProduct( stack->portal->origin, plane.normal ) - plane.dist;
+		//if completely at the back of the seperator plane
+		if ( d < -stack->portal->radius ) {
+			return NULL;
+		}
+		//if completely on the front of the seperator plane
+		if ( d > stack->portal->radius ) {
+			continue;
+		}
+
+		//
+		// clip target by the seperating plane
+		//
+		target = VisChopWinding( target, stack, &plane );
+		if ( !target ) {
+			return NULL;        // target is not visible
 
-			}
-			break;      // optimization by Antony Suter
 		}
 	}
 
@@ -425,11 +735,15 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	vportal_t   *p;
 	visPlane_t backplane;
 	leaf_t      *leaf;
-	int i, j, n;
-	long        *test, *might, *prevmight, *vis, more;
+	int i;
+	byte        *test, *vis;
+	qboolean more;
 	int pnum;
 
 	thread->c_chains++;
+	if ( prevstack->depth + 1 > thread->maxDepth ) {
+		thread->maxDepth = prevstack->depth + 1;
+	}
 
 	leaf = &leafs[leafnum];
 //	CheckStack (leaf, thread);
@@ -440,14 +754,15 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	stack.leaf = leaf;
 	stack.portal = NULL;
 	stack.depth = prevstack->depth + 1;
+	stack.c_clips = prevstack->c_clips;
 
 #ifdef SEPERATORCACHE
-	stack.numseperators[0] = 0;
-	stack.numseperators[1] = 0;
+	stack.seperators[0].numSeperators = 0;
+	stack.seperators[1].numSeperators = 0;
 #endif
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
+	stack.mightsee = MightseeForDepth( stack.depth );
+	vis = thread->portalvis;
 
 	// check all portals for flowing into other leafs
 	for ( i = 0; i < leaf->numportals; i++ )
@@ -456,6 +771,9 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 		if ( p->removed ) {
 			continue;
 		}
+		if ( thread->branch >= 0 && prevstack->depth == 0 && i != thread->branch ) {
+			continue;   // another thread flows this one
+		}
 		pnum = p - portals;
 
 		/* MrE: portal trace debug code
@@ -477,29 +795,23 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 		   }
 		 */
 
-		if ( !( prevstack->mightsee[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
+		if ( !( prevstack->mightsee->bits[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
 			continue;   // can't possibly see it
 		}
 
 		// if the portal can't see anything we haven't already seen, skip it
 		if ( p->status == stat_done ) {
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		prevmight = (long *)prevstack->mightsee;
-		for ( j = 0 ; j < portallongs ; j++ )
-		{
-			might[j] = prevmight[j] & test[j];
-			more |= ( might[j] & ~vis[j] );
-		}
+		more = MightseeAnd( stack.mightsee, prevstack->mightsee, test, NULL, vis );
 
 		if ( !more &&
-			 ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
+			 ( thread->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
 			continue;
 		}
 
@@ -579,24 +891,15 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 		if ( !prevstack->pass ) { // the second leaf can only be blocked if coplanar
 
 			// mark the portal as visible
-			thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
+			thread->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
 			RecursiveLeafFlow( p->leaf, thread, &stack );
 			continue;
 		}
 
 #ifdef SEPERATORCACHE
-		if ( stack.numseperators[0] ) {
-			for ( n = 0; n < stack.numseperators[0]; n++ )
-			{
-				stack.pass = VisChopWinding( stack.pass, &stack, &stack.seperators[0][n] );
-				if ( !stack.pass ) {
-					break;      // target is not visible
-				}
-			}
-			if ( n < stack.numseperators[0] ) {
-				continue;
-			}
+		if ( stack.seperators[0].numSeperators ) {
+			stack.pass = ChopWindingBySeperators( stack.pass, &stack, &stack.seperators[0] );
 		}
 		else
 		{
@@ -610,14 +913,8 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 		}
 
 #ifdef SEPERATORCACHE
-		if ( stack.numseperators[1] ) {
-			for ( n = 0; n < stack.numseperators[1]; n++ )
-			{
-				stack.pass = VisChopWinding( stack.pass, &stack, &stack.seperators[1][n] );
-				if ( !stack.pass ) {
-					break;      // target is not visible
-				}
-			}
+		if ( stack.seperators[1].numSeperators ) {
+			stack.pass = ChopWindingBySeperators( stack.pass, &stack, &stack.seperators[1] );
 		}
 		else
 		{
@@ -631,7 +928,7 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 		}
 
 		// mark the portal as visible
-		thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
+		thread->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
 		// flow through it for real
 		RecursiveLeafFlow( p->leaf, thread, &stack );
@@ -642,6 +939,204 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	prevstack->next = NULL;
 }
 
+/*
+   ===============
+   flow tasks
+
+   every portal is flowed as one task, except for the costliest ones in a threaded
+   run: those are split into one task per top level portal of their leaf, so the end
+   of the run is not left to a single thread grinding through them
+   ===============
+ */
+
+#define FLOW_SPLIT_DIVISOR  8           /* split portals costing more than 1 / ( threads * this ) of the whole flow */
+
+typedef struct flowTask_s
+{
+	int portalNum;                      /* into sorted_portals */
+	int branch;                         /* top level portal to flow, -1 for all */
+}
+flowTask_t;
+
+static int numFlowTasks;
+static flowTask_t           *flowTasks;
+
+/*
+   FlowBranches()
+   returns the number of tasks a portal is split into, 0 for a single task
+ */
+static int FlowBranches( vportal_t *p, float splitCost ){
+	int i, numBranches;
+	leaf_t      *leaf;
+
+
+	if ( splitCost < 0 || p->cost <= splitCost || p->removed || p->status == stat_done ) {
+		return 0;
+	}
+
+	numBranches = 0;
+	leaf = &leafs[ p->leaf ];
+	for ( i = 0; i < leaf->numportals; i++ )
+		numBranches += !leaf->portals[ i ]->removed;
+	return numBranches >= 2 ? numBranches : 0;
+}
+
+/*
+   SchedulePortalFlow()
+   makes the flow tasks for the portals that are not done yet, in sorted order,
+   and returns their number
+ */
+int SchedulePortalFlow( void ){
+	int i, j, numBranches, numSplit;
+	float totalCost, splitCost;
+	vportal_t   *p;
+	leaf_t      *leaf;
+
+
+	/* the cost of what is left to do */
+	totalCost = 0;
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		p = sorted_portals[ i ];
+		if ( !p->removed && p->status != stat_done ) {
+			totalCost += p->cost;
+		}
+	}
+	splitCost = numthreads > 1 ? totalCost / ( numthreads * FLOW_SPLIT_DIVISOR ) : -1;
+
+	/* count the tasks */
+	numFlowTasks = 0;
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		numBranches = FlowBranches( sorted_portals[ i ], splitCost );
+		numFlowTasks += numBranches > 0 ? numBranches : 1;
+	}
+
+	/* make them */
+	free( flowTasks );
+	flowTasks = safe_malloc( ( numFlowTasks + 1 ) * sizeof( *flowTasks ) );
+	numFlowTasks = 0;
+	numSplit = 0;
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		p = sorted_portals[ i ];
+		if ( !p->removed && p->status != stat_done ) {
+			p->chains = 0;
+			p->clips = 0;
+			p->maxDepth = 0;
+		}
+
+		/* one task for the whole portal */
+		numBranches = FlowBranches( p, splitCost );
+		p->branchesLeft = numBranches > 0 ? numBranches : 1;
+		if ( numBranches == 0 ) {
+			flowTasks[ numFlowTasks ].portalNum = i;
+			flowTasks[ numFlowTasks ].branch = -1;
+			numFlowTasks++;
+			continue;
+		}
+
+		/* one task per top level portal */
+		leaf = &leafs[ p->leaf ];
+		for ( j = 0; j < leaf->numportals; j++ )
+		{
+			if ( !leaf->portals[ j ]->removed ) {
+				flowTasks[ numFlowTasks ].portalNum = i;
+				flowTasks[ numFlowTasks ].branch = j;
+				numFlowTasks++;
+			}
+		}
+		numSplit++;
+	}
+
+	if ( numSplit > 0 ) {
+		Sys_Printf( "%d costly portals split across threads, %d flow tasks\n", numSplit, numFlowTasks );
+	}
+	return numFlowTasks;
+}
+
+/*
+   BeginPortalFlow()
+   sets up the thread data for a flow task, returns false if there is nothing to flow
+ */
+static qboolean BeginPortalFlow( int tasknum, threaddata_t *data ){
+	int i;
+	vportal_t   *p;
+
+
+	p = sorted_portals[ flowTasks[ tasknum ].portalNum ];
+
+	if ( p->removed ) {
+		p->status = stat_done;
+		return qfalse;
+	}
+
+	/* done by an earlier run, see -resume and -incremental */
+	if ( p->status == stat_done ) {
+		return qfalse;
+	}
+
+	p->status = stat_working;
+
+	memset( data, 0, sizeof( *data ) );
+	data->base = p;
+	data->branch = flowTasks[ tasknum ].branch;
+
+	/* a branch gathers its own bits, starting from what the other branches found so far */
+	if ( data->branch < 0 ) {
+		data->portalvis = p->portalvis;
+	}
+	else
+	{
+		data->portalvis = safe_malloc( portalbytes );
+		for ( i = 0; i < portalbytes; i += 8 )
+			*( (uint64_t*) ( data->portalvis + i ) ) = __atomic_load_n( (uint64_t*) ( p->portalvis + i ), __ATOMIC_RELAXED );
+	}
+
+	data->pstack_head.portal = p;
+	data->pstack_head.source = p->winding;
+	data->pstack_head.portalplane = p->plane;
+	data->pstack_head.depth = 0;
+	data->pstack_head.c_clips = &data->c_clips;
+	data->pstack_head.mightsee = MightseeForDepth( 0 );
+	MightseeCopy( data->pstack_head.mightsee, p->portalflood );
+
+	return qtrue;
+}
+
+/*
+   EndPortalFlow()
+   records the flow statistics of a task and finishes its portal once all of its
+   branches are in, returns true if the portal is done
+ */
+static qboolean EndPortalFlow( threaddata_t *data ){
+	int i, depth;
+	vportal_t   *p;
+
+
+	p = data->base;
+
+	/* statistics for the cost model */
+	__atomic_add_fetch( &p->chains, data->c_chains, __ATOMIC_RELAXED );
+	__atomic_add_fetch( &p->clips, data->c_clips, __ATOMIC_RELAXED );
+	depth = __atomic_load_n( &p->maxDepth, __ATOMIC_RELAXED );
+	while ( data->maxDepth > depth && !__atomic_compare_exchange_n( &p->maxDepth, &depth, data->maxDepth, qfalse, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) ;
+
+	/* merge a branch */
+	if ( data->branch >= 0 ) {
+		for ( i = 0; i < portalbytes; i += 8 )
+			__atomic_or_fetch( (uint64_t*) ( p->portalvis + i ), *( (uint64_t*) ( data->portalvis + i ) ), __ATOMIC_RELAXED );
+		free( data->portalvis );
+		if ( __atomic_sub_fetch( &p->branchesLeft, 1, __ATOMIC_ACQ_REL ) > 0 ) {
+			return qfalse;
+		}
+	}
+
+	p->status = stat_done;
+	CheckpointPortal( p );
+	return qtrue;
+}
+
 /*
    ===============
    PortalFlow
@@ -649,45 +1144,32 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
    generates the portalvis bit vector
    ===============
  */
-void PortalFlow( int portalnum ){
+void PortalFlow( int tasknum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 	int c_might, c_can;
 
 #ifdef MREDEBUG
-	Sys_Printf( "\r%6d", portalnum );
+	Sys_Printf( "\r%6d", tasknum );
 #endif
 
-	p = sorted_portals[portalnum];
-
-	if ( p->removed ) {
-		p->status = stat_done;
+	if ( !BeginPortalFlow( tasknum, &data ) ) {
 		return;
 	}
-
-	p->status = stat_working;
+	p = data.base;
 
 	c_might = CountBits( p->portalflood, numportals * 2 );
 
-	memset( &data, 0, sizeof( data ) );
-	data.base = p;
-
-	data.pstack_head.portal = p;
-	data.pstack_head.source = p->winding;
-	data.pstack_head.portalplane = p->plane;
-	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
-
 	RecursiveLeafFlow( p->leaf, &data, &data.pstack_head );
 
-	p->status = stat_done;
+	if ( !EndPortalFlow( &data ) ) {
+		return;
+	}
 
 	c_can = CountBits( p->portalvis, numportals * 2 );
 
-	Sys_FPrintf( SYS_VRB,"portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n",
-				 (int)( p - portals ), c_might, c_can, data.c_chains );
+	Sys_FPrintf( SYS_VRB,"portal:%4i  mightsee:%4i  cansee:%4i (%i chains, %i clips)\n",
+				 (int)( p - portals ), c_might, c_can, p->chains, p->clips );
 }
 
 /*
@@ -700,18 +1182,26 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 	vportal_t   *p;
 	leaf_t      *leaf;
 	passage_t   *passage, *nextpassage;
-	int i, j;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i;
+	byte        *vis, *portalvis;
+	qboolean more;
 	int pnum;
 
+	thread->c_chains++;
+	if ( prevstack->depth + 1 > thread->maxDepth ) {
+		thread->maxDepth = prevstack->depth + 1;
+	}
+
 	leaf = &leafs[portal->leaf];
 
 	prevstack->next = &stack;
 
 	stack.next = NULL;
 	stack.depth = prevstack->depth + 1;
+	stack.c_clips = prevstack->c_clips;
+	stack.mightsee = MightseeForDepth( stack.depth );
 
-	vis = (long *)thread->base->portalvis;
+	vis = thread->portalvis;
 
 	passage = portal->passages;
 	nextpassage = passage;
@@ -723,39 +1213,25 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 			continue;
 		}
 		nextpassage = passage->next;
+		if ( thread->branch >= 0 && prevstack->depth == 0 && i != thread->branch ) {
+			continue;   // another thread flows this one
+		}
 		pnum = p - portals;
 
-		if ( !( prevstack->mightsee[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
+		if ( !( prevstack->mightsee->bits[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
 			continue;   // can't possibly see it
 		}
 
 		// mark the portal as visible
-		thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
+		thread->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
+		more = MightseeAnd( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, vis );
 
 		if ( !more ) {
 			// can't see anything new
@@ -776,40 +1252,25 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
    PassageFlow
    ===============
  */
-void PassageFlow( int portalnum ){
+void PassageFlow( int tasknum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
 #ifdef MREDEBUG
-	Sys_Printf( "\r%6d", portalnum );
+	Sys_Printf( "\r%6d", tasknum );
 #endif
 
-	p = sorted_portals[portalnum];
-
-	if ( p->removed ) {
-		p->status = stat_done;
+	if ( !BeginPortalFlow( tasknum, &data ) ) {
 		return;
 	}
-
-	p->status = stat_working;
+	p = data.base;
 
 //	c_might = CountBits (p->portalflood, numportals*2);
 
-	memset( &data, 0, sizeof( data ) );
-	data.base = p;
-
-	data.pstack_head.portal = p;
-	data.pstack_head.source = p->winding;
-	data.pstack_head.portalplane = p->plane;
-	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
-
 	RecursivePassageFlow( p, &data, &data.pstack_head );
 
-	p->status = stat_done;
+	EndPortalFlow( &data );
 
 	/*
 	   c_can = CountBits (p->portalvis, numportals*2);
@@ -830,11 +1291,15 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	leaf_t      *leaf;
 	visPlane_t backplane;
 	passage_t   *passage, *nextpassage;
-	int i, j, n;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i;
+	byte        *vis, *portalvis;
+	qboolean more;
 	int pnum;
 
-//	thread->c_chains++;
+	thread->c_chains++;
+	if ( prevstack->depth + 1 > thread->maxDepth ) {
+		thread->maxDepth = prevstack->depth + 1;
+	}
 
 	leaf = &leafs[portal->leaf];
 //	CheckStack (leaf, thread);
@@ -845,13 +1310,15 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	stack.leaf = leaf;
 	stack.portal = NULL;
 	stack.depth = prevstack->depth + 1;
+	stack.c_clips = prevstack->c_clips;
 
 #ifdef SEPERATORCACHE
-	stack.numseperators[0] = 0;
-	stack.numseperators[1] = 0;
+	stack.seperators[0].numSeperators = 0;
+	stack.seperators[1].numSeperators = 0;
 #endif
 
-	vis = (long *)thread->base->portalvis;
+	stack.mightsee = MightseeForDepth( stack.depth );
+	vis = thread->portalvis;
 
 	passage = portal->passages;
 	nextpassage = passage;
@@ -863,38 +1330,24 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 			continue;
 		}
 		nextpassage = passage->next;
+		if ( thread->branch >= 0 && prevstack->depth == 0 && i != thread->branch ) {
+			continue;   // another thread flows this one
+		}
 		pnum = p - portals;
 
-		if ( !( prevstack->mightsee[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
+		if ( !( prevstack->mightsee->bits[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {
 			continue;   // can't possibly see it
 
 		}
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
+		more = MightseeAnd( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, vis );
 
-		if ( !more && ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
+		if ( !more && ( thread->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
 			continue;
 		}
 
@@ -974,24 +1427,15 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 		if ( !prevstack->pass ) { // the second leaf can only be blocked if coplanar
 
 			// mark the portal as visible
-			thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
+			thread->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
 			RecursivePassagePortalFlow( p, thread, &stack );
 			continue;
 		}
 
 #ifdef SEPERATORCACHE
-		if ( stack.numseperators[0] ) {
-			for ( n = 0; n < stack.numseperators[0]; n++ )
-			{
-				stack.pass = VisChopWinding( stack.pass, &stack, &stack.seperators[0][n] );
-				if ( !stack.pass ) {
-					break;      // target is not visible
-				}
-			}
-			if ( n < stack.numseperators[0] ) {
-				continue;
-			}
+		if ( stack.seperators[0].numSeperators ) {
+			stack.pass = ChopWindingBySeperators( stack.pass, &stack, &stack.seperators[0] );
 		}
 		else
 		{
@@ -1005,14 +1449,8 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 		}
 
 #ifdef SEPERATORCACHE
-		if ( stack.numseperators[1] ) {
-			for ( n = 0; n < stack.numseperators[1]; n++ )
-			{
-				stack.pass = VisChopWinding( stack.pass, &stack, &stack.seperators[1][n] );
-				if ( !stack.pass ) {
-					break;      // target is not visible
-				}
-			}
+		if ( stack.seperators[1].numSeperators ) {
+			stack.pass = ChopWindingBySeperators( stack.pass, &stack, &stack.seperators[1] );
 		}
 		else
 		{
@@ -1026,7 +1464,7 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 		}
 
 		// mark the portal as visible
-		thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
+		thread->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
 		// flow through it for real
 		RecursivePassagePortalFlow( p, thread, &stack );
@@ -1042,40 +1480,25 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
    PassagePortalFlow
    ===============
  */
-void PassagePortalFlow( int portalnum ){
+void PassagePortalFlow( int tasknum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
 #ifdef MREDEBUG
-	Sys_Printf( "\r%6d", portalnum );
+	Sys_Printf( "\r%6d", tasknum );
 #endif
 
-	p = sorted_portals[portalnum];
-
-	if ( p->removed ) {
-		p->status = stat_done;
+	if ( !BeginPortalFlow( tasknum, &data ) ) {
 		return;
 	}
-
-	p->status = stat_working;
+	p = data.base;
 
 //	c_might = CountBits (p->portalflood, numportals*2);
 
-	memset( &data, 0, sizeof( data ) );
-	data.base = p;
-
-	data.pstack_head.portal = p;
-	data.pstack_head.source = p->winding;
-	data.pstack_head.portalplane = p->plane;
-	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
-
 	RecursivePassagePortalFlow( p, &data, &data.pstack_head );
 
-	p->status = stat_done;
+	EndPortalFlow( &data );
 
 	/*
 	   c_can = CountBits (p->portalvis, numportals*2);
@@ -1095,26 +1518,9 @@ fixedWinding_t *PassageChopWinding( fixedWinding_t *in, fixedWinding_t *out, vis
 	vec3_t mid;
 	fixedWinding_t  *neww;
 
-	counts[0] = counts[1] = counts[2] = 0;
-
 	// determine sides for each point
-	for ( i = 0 ; i < in->numpoints ; i++ )
-	{
-		dot = DotProduct( in->points[i], split->normal );
-		dot -= split->dist;
-		dists[i] = dot;
-		if ( dot > ON_EPSILON ) {
-			sides[i] = SIDE_FRONT;
-		}
-		else if ( dot < -ON_EPSILON ) {
-			sides[i] = SIDE_BACK;
-		}
-		else
-		{
-			sides[i] = SIDE_ON;
-		}
-		counts[sides[i]]++;
-	}
+	WindingPlaneSides( in, split, dists, sides, counts );
+	i = in->numpoints;
 
 	if ( !counts[1] ) {
 		return in;      // completely on front side
@@ -1188,142 +1594,22 @@ fixedWinding_t *PassageChopWinding( fixedWinding_t *in, fixedWinding_t *out, vis
    ===============
  */
 int AddSeperators( fixedWinding_t *source, fixedWinding_t *pass, qboolean flipclip, visPlane_t *seperators, int maxseperators ){
-	int i, j, k, l;
+	int i, numseperators;
 	visPlane_t plane;
-	vec3_t v1, v2;
-	float d;
-	vec_t length;
-	int counts[3], numseperators;
-	qboolean fliptest;
 
 	numseperators = 0;
 	// check all combinations
 	for ( i = 0 ; i < source->numpoints ; i++ )
 	{
-		l = ( i + 1 ) % source->numpoints;
-		VectorSubtract( source->points[l], source->points[i], v1 );
-
-		// find a vertex of pass that makes a plane that puts all of the
-		// vertexes of pass on the front side and all of the vertexes of
-		// source on the back side
-		for ( j = 0 ; j < pass->numpoints ; j++ )
-		{
-			VectorSubtract( pass->points[j], source->points[i], v2 );
-
-			plane.normal[0] = v1[1] * v2[2] - v1[2] * v2[1];
-			plane.normal[1] = v1[2] * v2[0] - v1[0] * v2[2];
-			plane.normal[2] = v1[0] * v2[1] - v1[1] * v2[0];
-
-			// if points don't make a valid plane, skip it
-
-			length = plane.normal[0] * plane.normal[0]
-					 + plane.normal[1] * plane.normal[1]
-					 + plane.normal[2] * plane.normal[2];
-
-			if ( length < ON_EPSILON ) {
-				continue;
-			}
-
-			length = 1 / sqrt( length );
-
-			plane.normal[0] *= length;
-			plane.normal[1] *= length;
-			plane.normal[2] *= length;
-
-			plane.dist = DotProduct( pass->points[j], plane.normal );
-
-			//
-			// find out which side of the generated seperating plane has the
-			// source portal
-			//
-#if 1
-			fliptest = qfalse;
-			for ( k = 0 ; k < source->numpoints ; k++ )
-			{
-				if ( k == i || k == l ) {
-					continue;
-				}
-				d = DotProduct( source->points[k], plane.normal ) - plane.dist;
-				if ( d < -ON_EPSILON ) { // source is on the negative side, so we want all
-					                    // pass and target on the positive side
-					fliptest = qfalse;
-					break;
-				}
-				else if ( d > ON_EPSILON ) { // source is on the positive side, so we want all
-					                        // pass and target on the negative side
-					fliptest = qtrue;
-					break;
-				}
-			}
-			if ( k == source->numpoints ) {
-				continue;       // planar with source portal
-			}
-#else
-			fliptest = flipclip;
-#endif
-			//
-			// flip the normal if the source portal is backwards
-			//
-			if ( fliptest ) {
-				VectorSubtract( vec3_origin, plane.normal, plane.normal );
-				plane.dist = -plane.dist;
-			}
-#if 1
-			//
-			// if all of the pass portal points are now on the positive side,
-			// this is the seperating plane
-			//
-			counts[0] = counts[1] = counts[2] = 0;
-			for ( k = 0 ; k < pass->numpoints ; k++ )
-			{
-				if ( k == j ) {
-					continue;
-				}
-				d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-				if ( d < -ON_EPSILON ) {
-					break;
-				}
-				else if ( d > ON_EPSILON ) {
-					counts[0]++;
-				}
-				else{
-					counts[2]++;
-				}
-			}
-			if ( k != pass->numpoints ) {
-				continue;   // points on negative side, not a seperating plane
-
-			}
-			if ( !counts[0] ) {
-				continue;   // planar with seperating plane
-			}
-#else
-			k = ( j + 1 ) % pass->numpoints;
-			d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-			if ( d < -ON_EPSILON ) {
-				continue;
-			}
-			k = ( j + pass->numpoints - 1 ) % pass->numpoints;
-			d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-			if ( d < -ON_EPSILON ) {
-				continue;
-			}
-#endif
-			//
-			// flip the normal if we want the back side
-			//
-			if ( flipclip ) {
-				VectorSubtract( vec3_origin, plane.normal, plane.normal );
-				plane.dist = -plane.dist;
-			}
+		if ( !SeperatorForEdge( source, pass, i, flipclip, &plane ) ) {
+			continue;
+		}
 
-			if ( numseperators >= maxseperators ) {
-				Error( "max seperators" );
-			}
-			seperators[numseperators] = plane;
-			numseperators++;
-			break;
+		if ( numseperators >= maxseperators ) {
+			Error( "max seperators" );
 		}
+		seperators[numseperators] = plane;
+		numseperators++;
 	}
 	return numseperators;
 }
@@ -1705,8 +1991,7 @@ void BasePortalVis( int portalnum ){
 void RecursiveLeafBitFlow( int leafnum, byte *mightsee, byte *cansee ){
 	vportal_t   *p;
 	leaf_t      *leaf;
-	int i, j;
-	long more;
+	int i;
 	int pnum;
 	byte newmight[MAX_PORTALS / 8];
 
@@ -1727,15 +2012,7 @@ void RecursiveLeafBitFlow( int leafnum, byte *mightsee, byte *cansee ){
 		}
 
 		// if this portal can see some portals we mightsee, recurse
-		more = 0;
-		for ( j = 0 ; j < portallongs ; j++ )
-		{
-			( (long *)newmight )[j] = ( (long *)mightsee )[j]
-									  & ( (long *)p->portalflood )[j];
-			more |= ( (long *)newmight )[j] & ~( (long *)cansee )[j];
-		}
-
-		if ( !more ) {
+		if ( !PortalBitsAnd( newmight, mightsee, p->portalflood, cansee ) ) {
 			continue;   // can't see anything new
 
 		}